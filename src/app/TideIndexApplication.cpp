@@ -10,15 +10,26 @@
 #include "TideIndexApplication.h"
 #include "TideMatchSet.h"
 #include "app/tide/modifications.h"
+#include "app/tide/peptide_table.h"
+#include "app/tide/fragment_index.h"
 #include "app/tide/records_to_vector-inl.h"
 
 #ifdef _MSC_VER
 #include <io.h>
 #endif
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+// Number of proteins read from the FASTA file and digested at a time.
+static const size_t DIGEST_BATCH_SIZE = 4096;
 
 extern void AddTheoreticalPeaks(const vector<const pb::Protein*>& proteins,
                                 const string& input_filename,
-                                const string& output_filename);
+                                const string& output_filename,
+                                const string& table_filename,
+                                const string& fragments_filename,
+                                size_t max_fragment_postings,
+                                const string& temp_dir);
 extern void AddMods(HeadedRecordReader* reader,
                     string out_file,
                     string tmpDir,                    
@@ -129,6 +140,8 @@ int TideIndexApplication::main(
   string out_proteins = FileUtils::Join(index, "protix");
   string out_peptides = FileUtils::Join(index, "pepix");
   string out_aux = FileUtils::Join(index, "auxlocs");
+  string out_table = Params::GetBool("peptide-table") ? PeptideTable::FileName(index) : "";
+  string out_fragments = Params::GetBool("fragment-index") ? FragmentIndex::FileName(index) : "";
   string modless_peptides = out_peptides + ".nomods.tmp";
   string peakless_peptides = out_peptides + ".nopeaks.tmp";
   ofstream* out_target_list = NULL;
@@ -155,6 +168,8 @@ int TideIndexApplication::main(
       FileUtils::Remove(out_proteins);
       FileUtils::Remove(out_peptides);
       FileUtils::Remove(out_aux);
+      FileUtils::Remove(PeptideTable::FileName(index));
+      FileUtils::Remove(FragmentIndex::FileName(index));
       FileUtils::Remove(modless_peptides);
       FileUtils::Remove(peakless_peptides);
     } else {
@@ -167,7 +182,11 @@ int TideIndexApplication::main(
   carp(CARP_INFO, "Reading %s and computing unmodified peptides...",
        fasta.c_str());
   pb::Header proteinPbHeader;
-  vector<TideIndexPeptide> peptideHeap;
+  PeptideHeap peptideHeap;
+  if (Params::GetInt("memory-limit") > 0) {
+    peptideHeap.setLimit(((size_t)Params::GetInt("memory-limit") << 20) /
+                         sizeof(TideIndexPeptide), Params::GetString("temp-dir"));
+  }
   vector<string*> proteinSequences;
   fastaToPb(cmd_line, enzyme_t, digestion, missed_cleavages, min_mass, max_mass,
             min_length, max_length, allowDups, mass_type, decoy_type, fasta, out_proteins,
@@ -231,6 +250,7 @@ int TideIndexApplication::main(
 
   string basic_peptides = need_mods ? modless_peptides : peakless_peptides;
 
+  peptideHeap.finish(proteinSequences);
   writePeptidesAndAuxLocs(peptideHeap, basic_peptides, out_aux, header_no_mods);
   // Do some clean up
   for (vector<string*>::iterator i = proteinSequences.begin();
@@ -238,7 +258,7 @@ int TideIndexApplication::main(
        ++i) {
     delete *i;
   }
-  vector<TideIndexPeptide>().swap(peptideHeap);
+  peptideHeap.clear();
   ProteinVec proteins;
   if (!ReadRecordsToVector<pb::Protein>(&proteins, out_proteins)) {
     carp(CARP_FATAL, "Error reading proteins file");
@@ -321,7 +341,12 @@ int TideIndexApplication::main(
   }
 
   carp(CARP_INFO, "Precomputing theoretical spectra...");
-  AddTheoreticalPeaks(proteins, peakless_peptides, out_peptides);
+  // The fragment index postings are held under the same memory limit as the
+  // peptides, spilling to temp-dir.
+  AddTheoreticalPeaks(proteins, peakless_peptides, out_peptides, out_table,
+                      out_fragments,
+                      ((size_t)Params::GetInt("memory-limit") << 20) / sizeof(int32_t),
+                      Params::GetString("temp-dir"));
 
   // Clean up
   for (vector<const pb::Protein*>::iterator i = proteins.begin();
@@ -389,12 +414,14 @@ vector<string> TideIndexApplication::getOptions() const {
     "decoy-prefix",
     "digestion",
     "enzyme",
+    "fragment-index",
     "isotopic-mass",
     "keep-terminal-aminos",
     "mass-precision",
     "max-length",
     "max-mass",
     "max-mods",
+    "memory-limit",
     "min-length",
     "min-mass",
     "min-mods",
@@ -404,10 +431,12 @@ vector<string> TideIndexApplication::getOptions() const {
     "nterm-peptide-mods-spec",
     "nterm-protein-mods-spec",
     "num-decoys-per-target",
+    "num-threads",
     "output-dir",
     "overwrite",
     "parameter-file",
     "peptide-list",
+    "peptide-table",
     "seed",
     "temp-dir",
     "verbosity"
@@ -453,7 +482,7 @@ void TideIndexApplication::fastaToPb(
   const string& fasta,
   const string& proteinPbFile,
   pb::Header& outProteinPbHeader,
-  vector<TideIndexPeptide>& outPeptideHeap,
+  PeptideHeap& outPeptideHeap,
   vector<string*>& outProteinSequences,
   ofstream* decoyFasta
 ) {
@@ -481,45 +510,69 @@ void TideIndexApplication::fastaToPb(
   set<string> setTargets, setDecoys;
   map<const string*, TargetInfo> targetInfo;
 
-  // Iterate over all proteins in FASTA file
+  int numThreads = Params::GetInt("num-threads");
+  if (numThreads < 1) {
+    numThreads = boost::thread::hardware_concurrency();
+  }
+  vector<const string*> batchSequences;
+  vector< vector<PeptideInfo> > batchPeptides;
+  vector< vector<FLOAT_T> > batchMasses;
+
+  // Iterate over all proteins in FASTA file. The proteins are read in
+  // batches, which are digested in parallel, and then added to the heap in
+  // the order in which they were read.
   unsigned int targetsGenerated = 0, decoysGenerated = 0;
-  while (GeneratePeptides::getNextProtein(fastaStream, &proteinName, proteinSequence)) {
-    outProteinSequences.push_back(proteinSequence);
-    cleavedPeptideInfo.push_back(make_pair(
-      ProteinInfo(proteinName, proteinSequence), vector<PeptideInfo>()));
-    const ProteinInfo& proteinInfo = cleavedPeptideInfo.back().first;
-    vector<PeptideInfo>& cleavedPeptides = cleavedPeptideInfo.back().second;
-    // Write pb::Protein
-    writePbProtein(proteinWriter, ++curProtein, proteinName, *proteinSequence);
-    cleavedPeptides = GeneratePeptides::cleaveProtein(
-      *proteinSequence, enzyme, digestion, missedCleavages, minLength, maxLength);
-    // Iterate over all generated peptides for this protein
-    for (vector<PeptideInfo>::iterator i = cleavedPeptides.begin();
-         i != cleavedPeptides.end(); ) {
-      FLOAT_T pepMass = calcPepMassTide(i->Sequence(), massType);
-      if (pepMass < 0.0) {
-        // Sequence contained some invalid character
-        carp(CARP_DEBUG, "Ignoring invalid sequence <%s>", i->Sequence().c_str());
-        ++invalidPepCnt;
-        i = cleavedPeptides.erase(i);
-        continue;
-      } else if (pepMass < minMass || pepMass > maxMass) {
-        // Skip to next peptide if not in mass range
+  bool moreProteins = true;
+  while (moreProteins) {
+    batchSequences.clear();
+    while (batchSequences.size() < DIGEST_BATCH_SIZE &&
+           (moreProteins = GeneratePeptides::getNextProtein(
+              fastaStream, &proteinName, proteinSequence))) {
+      outProteinSequences.push_back(proteinSequence);
+      cleavedPeptideInfo.push_back(make_pair(
+        ProteinInfo(proteinName, proteinSequence), vector<PeptideInfo>()));
+      // Write pb::Protein
+      writePbProtein(proteinWriter, ++curProtein, proteinName, *proteinSequence);
+      batchSequences.push_back(proteinSequence);
+      proteinSequence = new string;
+    }
+    digestProteins(batchSequences, enzyme, digestion, missedCleavages,
+                   minLength, maxLength, massType, numThreads,
+                   batchPeptides, batchMasses);
+    size_t batchStart = cleavedPeptideInfo.size() - batchSequences.size();
+    for (size_t p = 0; p < batchSequences.size(); ++p) {
+      int proteinId = batchStart + p;
+      const ProteinInfo& proteinInfo = cleavedPeptideInfo[proteinId].first;
+      vector<PeptideInfo>& cleavedPeptides = cleavedPeptideInfo[proteinId].second;
+      cleavedPeptides.swap(batchPeptides[p]);
+      vector<FLOAT_T>::const_iterator mass = batchMasses[p].begin();
+      // Iterate over all generated peptides for this protein
+      for (vector<PeptideInfo>::iterator i = cleavedPeptides.begin();
+           i != cleavedPeptides.end(); ++mass) {
+        FLOAT_T pepMass = *mass;
+        if (pepMass < 0.0) {
+          // Sequence contained some invalid character
+          carp(CARP_DEBUG, "Ignoring invalid sequence <%s>", i->Sequence().c_str());
+          ++invalidPepCnt;
+          i = cleavedPeptides.erase(i);
+          continue;
+        } else if (pepMass < minMass || pepMass > maxMass) {
+          // Skip to next peptide if not in mass range
+          ++i;
+          continue;
+        }
+        // Add target to heap
+        TideIndexPeptide pepTarget(pepMass, i->Length(), outProteinSequences[proteinId],
+                                   proteinId, i->Position());
+        outPeptideHeap.push(pepTarget);
+        if (!allowDups && decoyType != NO_DECOYS) {
+          const string* setTarget = &*(setTargets.insert(i->Sequence()).first);
+          targetInfo.insert(make_pair(setTarget, TargetInfo(proteinInfo, i->Position(), pepMass)));
+        }
+        ++targetsGenerated;
         ++i;
-        continue;
       }
-      // Add target to heap
-      TideIndexPeptide pepTarget(pepMass, i->Length(), proteinSequence, curProtein, i->Position());
-      outPeptideHeap.push_back(pepTarget);
-      push_heap(outPeptideHeap.begin(), outPeptideHeap.end(), greater<TideIndexPeptide>());
-      if (!allowDups && decoyType != NO_DECOYS) {
-        const string* setTarget = &*(setTargets.insert(i->Sequence()).first);
-        targetInfo.insert(make_pair(setTarget, TargetInfo(proteinInfo, i->Position(), pepMass)));
-      }
-      ++targetsGenerated;
-      ++i;
     }
-    proteinSequence = new string;
   }
   delete proteinSequence;
   if (targetsGenerated == 0) {
@@ -538,47 +591,61 @@ void TideIndexApplication::fastaToPb(
     if (decoyFasta) {
       carp(CARP_INFO, "Writing reverse-protein fasta and decoys...");
     }
-    for (vector< pair< ProteinInfo, vector<PeptideInfo> > >::const_iterator i =
-         cleavedPeptideInfo.begin(); i != cleavedPeptideInfo.end(); ++i) {
-      string decoyProtein = *(i->first.sequence);
-      reverse(decoyProtein.begin(), decoyProtein.end());
-      if (decoyFasta) {
-        (*decoyFasta) << ">"<< decoyPrefix << i->first.name << endl
-                      << decoyProtein << endl;
+    // Reversed proteins are digested in parallel batches, like the targets.
+    size_t numTargetProteins = cleavedPeptideInfo.size();
+    for (size_t batchStart = 0; batchStart < numTargetProteins;
+         batchStart += DIGEST_BATCH_SIZE) {
+      size_t batchEnd = min(batchStart + DIGEST_BATCH_SIZE, numTargetProteins);
+      vector<string> decoyProteins(batchEnd - batchStart);
+      batchSequences.clear();
+      for (size_t p = batchStart; p < batchEnd; ++p) {
+        string& decoyProtein = decoyProteins[p - batchStart];
+        decoyProtein = *(cleavedPeptideInfo[p].first.sequence);
+        reverse(decoyProtein.begin(), decoyProtein.end());
+        batchSequences.push_back(&decoyProtein);
       }
-      vector<PeptideInfo> cleavedReverse = GeneratePeptides::cleaveProtein(
-        decoyProtein, enzyme, digestion, missedCleavages, minLength, maxLength);
-      // Iterate over all generated peptides for this protein
-      for (vector<PeptideInfo>::iterator j = cleavedReverse.begin();
-           j != cleavedReverse.end();
-           ++j) {
-        FLOAT_T pepMass = calcPepMassTide(j->Sequence(), massType);
-        if (pepMass < 0.0) {
-          // Sequence contained some invalid character
-          carp(CARP_DEBUG, "Ignoring invalid sequence in decoy fasta <%s>",
-               j->Sequence().c_str());
-          ++invalidPepCnt;
-          continue;
-        } else if (pepMass < minMass || pepMass > maxMass) {
-          // Skip to next peptide if not in mass range
-          continue;
-        } else if (!allowDups && setTargets.find(j->Sequence()) != setTargets.end()) {
-          // Sequence already exists as a target
-          continue;
+      digestProteins(batchSequences, enzyme, digestion, missedCleavages,
+                     minLength, maxLength, massType, numThreads,
+                     batchPeptides, batchMasses);
+      for (size_t p = batchStart; p < batchEnd; ++p) {
+        const pair< ProteinInfo, vector<PeptideInfo> >* i = &cleavedPeptideInfo[p];
+        const string& decoyProtein = decoyProteins[p - batchStart];
+        if (decoyFasta) {
+          (*decoyFasta) << ">"<< decoyPrefix << i->first.name << endl
+                        << decoyProtein << endl;
+        }
+        const vector<PeptideInfo>& cleavedReverse = batchPeptides[p - batchStart];
+        vector<FLOAT_T>::const_iterator mass = batchMasses[p - batchStart].begin();
+        // Iterate over all generated peptides for this protein
+        for (vector<PeptideInfo>::const_iterator j = cleavedReverse.begin();
+             j != cleavedReverse.end();
+             ++j, ++mass) {
+          FLOAT_T pepMass = *mass;
+          if (pepMass < 0.0) {
+            // Sequence contained some invalid character
+            carp(CARP_DEBUG, "Ignoring invalid sequence in decoy fasta <%s>",
+                 j->Sequence().c_str());
+            ++invalidPepCnt;
+            continue;
+          } else if (pepMass < minMass || pepMass > maxMass) {
+            // Skip to next peptide if not in mass range
+            continue;
+          } else if (!allowDups && setTargets.find(j->Sequence()) != setTargets.end()) {
+            // Sequence already exists as a target
+            continue;
+          }
+          string* decoySequence = new string(j->Sequence());
+          outProteinSequences.push_back(decoySequence);
+
+          // Write pb::Protein
+          writeDecoyPbProtein(++curProtein, ProteinInfo(i->first.name, &decoyProtein),
+                              *decoySequence, j->Position(), proteinWriter);
+          // Add decoy to heap
+          TideIndexPeptide pepDecoy(pepMass, j->Length(), decoySequence,
+            curProtein, (j->Position() > 0) ? 1 : 0, 0);
+          outPeptideHeap.push(pepDecoy);
+          ++decoysGenerated;
         }
-        string* decoySequence = new string(j->Sequence());
-        outProteinSequences.push_back(decoySequence);
-
-        // Write pb::Protein
-        writeDecoyPbProtein(++curProtein, ProteinInfo(i->first.name, &decoyProtein),
-                            *decoySequence, j->Position(), proteinWriter);
-        // Add decoy to heap
-        TideIndexPeptide pepDecoy(pepMass, j->Length(), decoySequence,
-          curProtein, (j->Position() > 0) ? 1 : 0, 0);
-        outPeptideHeap.push_back(pepDecoy);
-        push_heap(outPeptideHeap.begin(), outPeptideHeap.end(),
-          greater<TideIndexPeptide>());
-        ++decoysGenerated;
       }
     }
   } else if (!allowDups) {
@@ -642,8 +709,62 @@ void TideIndexApplication::fastaToPb(
   }
 }
 
+void TideIndexApplication::digestProteins(
+  const vector<const string*>& sequences,
+  ENZYME_T enzyme,
+  DIGEST_T digestion,
+  int missedCleavages,
+  int minLength,
+  int maxLength,
+  MASS_TYPE_T massType,
+  int numThreads,
+  vector< vector<GeneratePeptides::CleavedPeptide> >& outPeptides,
+  vector< vector<FLOAT_T> >& outMasses
+) {
+  outPeptides.clear();
+  outPeptides.resize(sequences.size());
+  outMasses.clear();
+  outMasses.resize(sequences.size());
+  DigestJob job;
+  job.sequences = &sequences;
+  job.enzyme = enzyme;
+  job.digestion = digestion;
+  job.missedCleavages = missedCleavages;
+  job.minLength = minLength;
+  job.maxLength = maxLength;
+  job.massType = massType;
+  job.numShards = max(1, min(numThreads, (int)sequences.size()));
+  job.peptides = &outPeptides;
+  job.masses = &outMasses;
+
+  // Each thread writes only the results of its own sequences.
+  boost::thread_group threadgroup;
+  for (int t = 1; t < job.numShards; t++) {
+    threadgroup.add_thread(new boost::thread(boost::bind(
+      &TideIndexApplication::digestProteinShard, &job, t)));
+  }
+  digestProteinShard(&job, 0);
+  threadgroup.join_all();
+}
+
+void TideIndexApplication::digestProteinShard(DigestJob* job, int shard) {
+  const vector<const string*>& sequences = *job->sequences;
+  for (size_t i = shard; i < sequences.size(); i += job->numShards) {
+    vector<GeneratePeptides::CleavedPeptide>& peptides = (*job->peptides)[i];
+    peptides = GeneratePeptides::cleaveProtein(*sequences[i], job->enzyme,
+      job->digestion, job->missedCleavages, job->minLength, job->maxLength);
+    vector<FLOAT_T>& masses = (*job->masses)[i];
+    masses.reserve(peptides.size());
+    for (vector<GeneratePeptides::CleavedPeptide>::const_iterator j = peptides.begin();
+         j != peptides.end();
+         ++j) {
+      masses.push_back(calcPepMassTide(j->Sequence(), job->massType));
+    }
+  }
+}
+
 void TideIndexApplication::writePeptidesAndAuxLocs(
-  vector<TideIndexPeptide>& peptideHeap,
+  PeptideHeap& peptideHeap,
   const string& peptidePbFile,
   const string& auxLocsPbFile,
   pb::Header& pbHeader
@@ -711,23 +832,21 @@ void TideIndexApplication::writePeptidesAndAuxLocs(
   int numDecoys = 0;
   int numDuplicateTargets = 0;
   int numDuplicateDecoys = 0;
-  sort_heap(peptideHeap.begin(), peptideHeap.end(),
-            greater<TideIndexPeptide>());
   while (!peptideHeap.empty()) {
-    TideIndexPeptide curPeptide(peptideHeap.back());
-    peptideHeap.pop_back();
+    TideIndexPeptide curPeptide(peptideHeap.top());
+    peptideHeap.pop();
     // For duplicate peptides we only record the location
-    while (!peptideHeap.empty() && peptideHeap.back() == curPeptide) {
-      if (peptideHeap.back().isDecoy()) {
+    while (!peptideHeap.empty() && peptideHeap.top() == curPeptide) {
+      if (peptideHeap.top().isDecoy()) {
         numDuplicateDecoys++;
       } else {
         numDuplicateTargets++;
       }        
       carp(CARP_DEBUG, "Skipping duplicate %s.", curPeptide.getSequence().c_str());
       pb::Location* location = pbAuxLoc.add_location();
-      location->set_protein_id(peptideHeap.back().getProteinId());
-      location->set_pos(peptideHeap.back().getProteinPos());
-      peptideHeap.pop_back();
+      location->set_protein_id(peptideHeap.top().getProteinId());
+      location->set_pos(peptideHeap.top().getProteinPos());
+      peptideHeap.pop();
     }
     getPbPeptide(count, curPeptide, pbPeptide);
     // Not all peptides have aux locations associated with them. Check to see
@@ -871,6 +990,159 @@ void TideIndexApplication::getPbPeptide(
   }
 }
 
+TideIndexApplication::PeptideHeap::PeptideHeap()
+  : size_(0), maxPeptides_(0), proteinSequences_(NULL) {
+}
+
+TideIndexApplication::PeptideHeap::~PeptideHeap() {
+  clear();
+}
+
+void TideIndexApplication::PeptideHeap::setLimit(
+  size_t maxPeptides,
+  const string& tempDir
+) {
+  maxPeptides_ = max(maxPeptides, (size_t)1);
+  tempDir_ = tempDir;
+  if (tempDir_.empty()) {
+#ifdef _MSC_VER
+    char buf[261];
+    GetTempPath(261, buf);
+    tempDir_ = buf;
+#else
+    tempDir_ = "/tmp/";
+#endif
+  }
+}
+
+void TideIndexApplication::PeptideHeap::push(const TideIndexPeptide& peptide) {
+  heap_.push_back(peptide);
+  push_heap(heap_.begin(), heap_.end(), greater<TideIndexPeptide>());
+  ++size_;
+  if (maxPeptides_ > 0 && heap_.size() >= maxPeptides_) {
+    spill();
+  }
+}
+
+void TideIndexApplication::PeptideHeap::spill() {
+  // Sorting with greater leaves the smallest peptide at the back, so the run
+  // is written from the back.
+  sort_heap(heap_.begin(), heap_.end(), greater<TideIndexPeptide>());
+  // Unique names, so that tide-index runs sharing temp-dir keep their runs
+  // apart
+  string runFile = FileUtils::UniquePath(FileUtils::Join(tempDir_,
+    "tide_index_run_" + StringUtils::ToString(runFiles_.size()) + "_%%%%%%%%%%%%%%%%"));
+  FILE* out = fopen(runFile.c_str(), "wb");
+  if (out == NULL) {
+    fail("Couldn't open file " + runFile + " for write.");
+  }
+  runFiles_.push_back(runFile);
+  for (vector<TideIndexPeptide>::const_reverse_iterator i = heap_.rbegin();
+       i != heap_.rend();
+       ++i) {
+    RunRecord record;
+    record.mass = i->getMass();
+    record.length = i->getLength();
+    record.proteinId = i->getProteinId();
+    record.proteinPos = i->getProteinPos();
+    record.decoyIdx = i->decoyIdx();
+    if (fwrite(&record, sizeof(record), 1, out) != 1) {
+      fclose(out);
+      fail("Error writing " + runFile + ".");
+    }
+  }
+  if (fclose(out) != 0) {
+    fail("Error writing " + runFile + ".");
+  }
+  carp(CARP_DEBUG, "Wrote %d peptides to %s", (int)heap_.size(), runFile.c_str());
+  vector<TideIndexPeptide>().swap(heap_);
+}
+
+void TideIndexApplication::PeptideHeap::fail(const string& message) {
+  // Remove the runs before exiting, since the destructor will not run.
+  clear();
+  carp(CARP_FATAL, "%s", message.c_str());
+}
+
+bool TideIndexApplication::PeptideHeap::readRun(
+  size_t run,
+  TideIndexPeptide* peptide
+) {
+  RunRecord record;
+  if (fread(&record, sizeof(record), 1, runs_[run]) != 1) {
+    if (ferror(runs_[run])) {
+      fail("Error reading " + runFiles_[run] + ".");
+    }
+    return false;
+  }
+  *peptide = TideIndexPeptide(record.mass, record.length,
+                              (*proteinSequences_)[record.proteinId],
+                              record.proteinId, record.proteinPos, record.decoyIdx);
+  return true;
+}
+
+void TideIndexApplication::PeptideHeap::finish(const vector<string*>& proteinSequences) {
+  if (runFiles_.empty()) {
+    sort_heap(heap_.begin(), heap_.end(), greater<TideIndexPeptide>());
+    return;
+  }
+  // Merge the runs, starting with the first peptide of each.
+  if (!heap_.empty()) {
+    spill();
+  }
+  carp(CARP_INFO, "Merging %d sorted runs of peptides", (int)runFiles_.size());
+  proteinSequences_ = &proteinSequences;
+  for (size_t i = 0; i < runFiles_.size(); ++i) {
+    FILE* in = fopen(runFiles_[i].c_str(), "rb");
+    if (in == NULL) {
+      fail("Couldn't open file " + runFiles_[i] + " for read.");
+    }
+    runs_.push_back(in);
+    TideIndexPeptide peptide;
+    if (readRun(i, &peptide)) {
+      merge_.push(make_pair(peptide, i));
+    }
+  }
+}
+
+bool TideIndexApplication::PeptideHeap::empty() const {
+  return runs_.empty() ? heap_.empty() : merge_.empty();
+}
+
+const TideIndexApplication::TideIndexPeptide&
+TideIndexApplication::PeptideHeap::top() const {
+  return runs_.empty() ? heap_.back() : merge_.top().first;
+}
+
+void TideIndexApplication::PeptideHeap::pop() {
+  if (runs_.empty()) {
+    heap_.pop_back();
+    return;
+  }
+  size_t run = merge_.top().second;
+  merge_.pop();
+  TideIndexPeptide peptide;
+  if (readRun(run, &peptide)) {
+    merge_.push(make_pair(peptide, run));
+  }
+}
+
+void TideIndexApplication::PeptideHeap::clear() {
+  vector<TideIndexPeptide>().swap(heap_);
+  while (!merge_.empty()) {
+    merge_.pop();
+  }
+  for (size_t i = 0; i < runs_.size(); ++i) {
+    fclose(runs_[i]);
+  }
+  runs_.clear();
+  for (size_t i = 0; i < runFiles_.size(); ++i) {
+    FileUtils::Remove(runFiles_[i]);
+  }
+  runFiles_.clear();
+  size_ = 0;
+}
+
 void TideIndexApplication::addAuxLoc(
   int proteinId,
   int proteinPos,
@@ -950,7 +1222,7 @@ void TideIndexApplication::generateDecoys(
   const int startLoc,
   HeadedRecordWriter& proteinWriter,
   FLOAT_T pepMass,
-  vector<TideIndexPeptide>& outPeptideHeap,
+  PeptideHeap& outPeptideHeap,
   vector<string*>& outProteinSequences
 ) {
   vector<string*> decoySequences;
@@ -1017,8 +1289,7 @@ void TideIndexApplication::generateDecoys(
     writeDecoyPbProtein(++curProtein, proteinInfo, *seq, startLoc, proteinWriter);
     // Add decoy to heap
     TideIndexPeptide pepDecoy(pepMass, setTarget.length(), seq, curProtein, (startLoc > 0) ? 1 : 0, i);
-    outPeptideHeap.push_back(pepDecoy);
-    push_heap(outPeptideHeap.begin(), outPeptideHeap.end(), greater<TideIndexPeptide>());
+    outPeptideHeap.push(pepDecoy);
   }
   decoysGenerated += decoySequences.size();
  }
@@ -9,6 +9,8 @@
 #include <unistd.h>
 #endif
 #include <errno.h>
+#include <cstdio>
+#include <queue>
 #include <gflags/gflags.h>
 #include "header.pb.h"
 #include "tide/records.h"
@@ -16,6 +18,7 @@
 #include "tide/theoretical_peak_set.h"
 #include "tide/abspath.h"
 #include "TideSearchApplication.h"
+#include "GeneratePeptides.h"
 #include "util/crux-utils.h"
 
 using namespace std;
@@ -135,7 +138,12 @@ class TideIndexApplication : public CruxApplication {
       if (lhs.decoyIdx_ != rhs.decoyIdx_) {
         return lhs.decoyIdx_ > rhs.decoyIdx_;
       }
-      return false;
+      // Duplicates come out in protein order, so that the first location
+      // does not depend on how the peptides were heaped or merged.
+      if (lhs.proteinId_ != rhs.proteinId_) {
+        return lhs.proteinId_ > rhs.proteinId_;
+      }
+      return lhs.proteinPos_ > rhs.proteinPos_;
     }
     friend bool operator ==(
       const TideIndexPeptide& lhs, const TideIndexPeptide& rhs) {
@@ -145,6 +153,62 @@ class TideIndexApplication : public CruxApplication {
     }
   };
 
+  /**
+   * Holds the peptides generated by fastaToPb until writePeptidesAndAuxLocs
+   * takes them back out, smallest first (by TideIndexPeptide::operator>).
+   * By default the peptides are kept in a single in-memory heap. With a limit
+   * set, every time the heap reaches the limit it is sorted and written to a
+   * run file in a temporary directory, and the runs are merged on the way out.
+   */
+  class PeptideHeap {
+   public:
+    PeptideHeap();
+    ~PeptideHeap();
+
+    void setLimit(size_t maxPeptides, const std::string& tempDir);
+    void push(const TideIndexPeptide& peptide);
+    size_t size() const { return size_; }
+
+    /**
+     * Called once all peptides have been pushed, before the first top().
+     * Peptides read back from runs point into proteinSequences.
+     */
+    void finish(const std::vector<string*>& proteinSequences);
+    bool empty() const;
+    const TideIndexPeptide& top() const;
+    void pop();
+    void clear();
+
+   private:
+    struct RunRecord {
+      double mass;
+      int length;
+      int proteinId;
+      int proteinPos;
+      int decoyIdx;
+    };
+    typedef std::pair<TideIndexPeptide, size_t> MergeEntry;
+    struct MergeGreater {
+      bool operator()(const MergeEntry& lhs, const MergeEntry& rhs) const {
+        return lhs.first > rhs.first;
+      }
+    };
+
+    void spill();
+    bool readRun(size_t run, TideIndexPeptide* peptide);
+    // Removes the run files, then exits with message.
+    void fail(const std::string& message);
+
+    std::vector<TideIndexPeptide> heap_;
+    size_t size_;
+    size_t maxPeptides_;
+    std::string tempDir_;
+    std::vector<std::string> runFiles_;
+    std::vector<FILE*> runs_;
+    const std::vector<string*>* proteinSequences_;
+    std::priority_queue<MergeEntry, std::vector<MergeEntry>, MergeGreater> merge_;
+  };
+
   struct ProteinInfo {
     string name;
     const string* sequence;
@@ -175,13 +239,53 @@ class TideIndexApplication : public CruxApplication {
     const std::string& fasta,
     const std::string& proteinPbFile,
     pb::Header& outProteinPbHeader,
-    std::vector<TideIndexPeptide>& outPeptideHeap,
+    PeptideHeap& outPeptideHeap,
     std::vector<string*>& outProteinSequences,
     std::ofstream* decoyFasta
   );
 
+  /**
+   * Work shared by the threads of digestProteins.
+   */
+  struct DigestJob {
+    const std::vector<const std::string*>* sequences;
+    ENZYME_T enzyme;
+    DIGEST_T digestion;
+    int missedCleavages;
+    int minLength;
+    int maxLength;
+    MASS_TYPE_T massType;
+    int numShards;
+    std::vector< std::vector<GeneratePeptides::CleavedPeptide> >* peptides;
+    std::vector< std::vector<FLOAT_T> >* masses;
+  };
+
+  /**
+   * Cleaves each of sequences and computes the mass of every resulting
+   * peptide (negative if it contains an invalid character), spreading the
+   * sequences over numThreads threads. The results for sequences[i] are in
+   * outPeptides[i] and outMasses[i].
+   */
+  static void digestProteins(
+    const std::vector<const std::string*>& sequences,
+    ENZYME_T enzyme,
+    DIGEST_T digestion,
+    int missedCleavages,
+    int minLength,
+    int maxLength,
+    MASS_TYPE_T massType,
+    int numThreads,
+    std::vector< std::vector<GeneratePeptides::CleavedPeptide> >& outPeptides,
+    std::vector< std::vector<FLOAT_T> >& outMasses
+  );
+
+  /**
+   * Digests every numShards-th sequence of job, starting with sequence shard.
+   */
+  static void digestProteinShard(DigestJob* job, int shard);
+
   static void writePeptidesAndAuxLocs(
-    std::vector<TideIndexPeptide>& peptideHeap, // will be destroyed.
+    PeptideHeap& peptideHeap, // will be emptied.
     const std::string& peptidePbFile,
     const std::string& auxLocsPbFile,
     pb::Header& pbHeader
@@ -239,7 +343,7 @@ class TideIndexApplication : public CruxApplication {
     const int startLoc,
     HeadedRecordWriter& proteinWriter,
     FLOAT_T pepMass,
-    vector<TideIndexPeptide>& outPeptideHeap,
+    PeptideHeap& outPeptideHeap,
     vector<string*>& outProteinSequences
   );
 
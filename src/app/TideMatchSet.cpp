@@ -20,12 +20,14 @@ string TideMatchSet::CleavageType;
 char TideMatchSet::match_collection_loc_[] = {0};
 char TideMatchSet::decoy_match_collection_loc_[] = {0};
 
-TideMatchSet::TideMatchSet(Arr* matches, double max_mz)
-  : matches_(matches), max_mz_(max_mz), exact_pval_search_(false), elution_window_(0) {
+TideMatchSet::TideMatchSet(Arr* matches, double max_mz, const SearchConfig* config)
+  : exact_pval_search_(false), elution_window_(0), sp_scorer_(NULL), stats_(NULL),
+    matches_(matches), max_mz_(max_mz), config_(config) {
 }
 
-TideMatchSet::TideMatchSet(Peptide* peptide, double max_mz)
-  : peptide_(peptide), max_mz_(max_mz), exact_pval_search_(false), elution_window_(0) {
+TideMatchSet::TideMatchSet(Peptide* peptide, double max_mz, const SearchConfig* config)
+  : exact_pval_search_(false), elution_window_(0), sp_scorer_(NULL), stats_(NULL),
+    peptide_(peptide), max_mz_(max_mz), config_(config) {
 }
 
 TideMatchSet::~TideMatchSet() {
@@ -125,15 +127,19 @@ void TideMatchSet::report(
   }
   peptide_->spectrum_matches_array.resize(top_matches);
   if (compute_sp) {
+    SearchStats::Scope sp(stats_, SearchStats::SP);
     vector<pair<double, int> > spScoreRank;
     spScoreRank.reserve(top_matches);
+    SpScorer* sp_scorer = sp_scorer_ ? sp_scorer_ : new SpScorer(proteins, max_mz_);
     for (int cnt = 0; cnt < top_matches; ++cnt) {
-      SpScorer sp_scorer(proteins, *peptide_->spectrum_matches_array[cnt].spectrum_,
-                         peptide_->spectrum_matches_array[cnt].charge_, max_mz_);
-      pb::Peptide* pb_peptide = getPbPeptide(*peptide_);
-      sp_scorer.Score(*pb_peptide, peptide_->spectrum_matches_array[cnt].spData_);
+      sp_scorer->SetSpectrum(*peptide_->spectrum_matches_array[cnt].spectrum_,
+                             peptide_->spectrum_matches_array[cnt].charge_);
+      sp_scorer->Score(*peptide_, peptide_->spectrum_matches_array[cnt].spData_);
       spScoreRank.push_back(make_pair(-1*peptide_->spectrum_matches_array[cnt].spData_.sp_score, cnt));
     }
+    if (sp_scorer != sp_scorer_) {
+      delete sp_scorer;
+    }
     sort(spScoreRank.begin(), spScoreRank.end());
     for (size_t i = 0; i < spScoreRank.size(); ++i) {
       peptide_->spectrum_matches_array[spScoreRank[i].second].spData_.sp_rank = i;
@@ -141,7 +147,7 @@ void TideMatchSet::report(
   }
   // target peptide or concat search
   ofstream* file =
-    (Params::GetBool("concat") || !peptide_->IsDecoy()) ? target_file : decoy_file;
+    (config_->concat || !peptide_->IsDecoy()) ? target_file : decoy_file;
   writeToFile(file, peptides, proteins, locations, compute_sp);
 }
 
@@ -169,7 +175,7 @@ void TideMatchSet::writeToFile(
   getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
   flankingAAs = n_term + c_term;
 
-  int precision = Params::GetInt("precision");
+  int precision = config_->precision;
 
   // look for other locations
   if (peptide->HasAuxLocationsIndex()) {
@@ -223,7 +229,7 @@ void TideMatchSet::writeToFile(
     }
     *file << i->score3_ << '\t';
 
-    if (Params::GetBool("concat")) {
+    if (config_->concat) {
       *file << peptides->ActiveTargets() + peptides->ActiveDecoys() << '\t';
     } else {
       *file << (!peptide->IsDecoy() ? peptides->ActiveTargets() : peptides->ActiveDecoys()) << '\t';
@@ -239,7 +245,7 @@ void TideMatchSet::writeToFile(
       const string& residues = protein->residues();
       *file << '\t'
             << residues.substr(residues.length() - peptide->Len());
-    } else if (Params::GetBool("concat") && !TideSearchApplication::proteinLevelDecoys()) {
+    } else if (config_->concat && !TideSearchApplication::proteinLevelDecoys()) {
       *file << '\t'
             << cruxPep.getUnshuffledSequence();
     }
@@ -252,8 +258,7 @@ void TideMatchSet::writeToFile(
  * This is for writing tab-delimited only
  */
 void TideMatchSet::report(
-  ofstream* target_file,  ///< target file to write to
-  ofstream* decoy_file, ///< decoy file to write to
+  TideResultWriter* writer, ///< writer for the calling thread
   int top_n,  ///< number of matches to report
   int decoys_per_target,
   const string& spectrum_filename, ///< name of spectrum file
@@ -263,8 +268,7 @@ void TideMatchSet::report(
   const ProteinVec& proteins,  ///< proteins corresponding with peptides
   const vector<const pb::AuxLocation*>& locations,  ///< auxiliary locations
   bool compute_sp, ///< whether to compute sp or not
-  bool highScoreBest, //< indicates semantics of score magnitude
-  boost::mutex * rwlock
+  bool highScoreBest //< indicates semantics of score magnitude
 ) {
   if (matches_->empty()) {
     return;
@@ -283,23 +287,31 @@ void TideMatchSet::report(
 
   map<Arr::iterator, pair<const SpScorer::SpScoreData, int> > sp_map;
   if (compute_sp) {
-    SpScorer sp_scorer(proteins, *spectrum, charge, max_mz_);
-    computeSpData(targets, &sp_map, &sp_scorer, peptides);
-    computeSpData(decoys, &sp_map, &sp_scorer, peptides);
+    SearchStats::Scope sp(stats_, SearchStats::SP);
+    if (sp_scorer_ != NULL) {
+      sp_scorer_->SetSpectrum(*spectrum, charge);
+      computeSpData(targets, &sp_map, sp_scorer_, peptides);
+      computeSpData(decoys, &sp_map, sp_scorer_, peptides);
+    } else {
+      SpScorer sp_scorer(proteins, *spectrum, charge, max_mz_);
+      computeSpData(targets, &sp_map, &sp_scorer, peptides);
+      computeSpData(decoys, &sp_map, &sp_scorer, peptides);
+    }
   }
-  writeToFile(target_file, top_n, decoys_per_target, targets, spectrum_filename, spectrum, charge,
-              peptides, proteins, locations, delta_cn_map, delta_lcn_map,
-              compute_sp ? &sp_map : NULL, rwlock);
-  writeToFile(decoy_file, top_n, decoys_per_target, decoys, spectrum_filename, spectrum, charge,
-              peptides, proteins, locations, delta_cn_map, delta_lcn_map,
-              compute_sp ? &sp_map : NULL, rwlock);
+  writeToFile(writer->Target(), writer, top_n, decoys_per_target, targets, spectrum_filename,
+              spectrum, charge, peptides, proteins, locations, delta_cn_map, delta_lcn_map,
+              compute_sp ? &sp_map : NULL);
+  writeToFile(writer->Decoy(), writer, top_n, decoys_per_target, decoys, spectrum_filename,
+              spectrum, charge, peptides, proteins, locations, delta_cn_map, delta_lcn_map,
+              compute_sp ? &sp_map : NULL);
 }
 
 /**
  * Helper function for tab delimited report function
  */
 void TideMatchSet::writeToFile(
-  ofstream* file,
+  ostream* file,
+  TideResultWriter* writer,
   int top_n,
   int decoys_per_target,
   const vector<Arr::iterator>& vec,
@@ -311,17 +323,16 @@ void TideMatchSet::writeToFile(
   const vector<const pb::AuxLocation*>& locations,
   const map<Arr::iterator, FLOAT_T>& delta_cn_map,
   const map<Arr::iterator, FLOAT_T>& delta_lcn_map,
-  const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map,
-  boost::mutex * rwlock
+  const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map
 ) {
   if (!file || vec.empty()) {
     return;
   }
 
-  int massPrecision = Params::GetInt("mass-precision");
-  int precision = Params::GetInt("precision");
+  int massPrecision = config_->mass_precision;
+  int precision = config_->precision;
 
-  const bool concat = Params::GetBool("concat");
+  const bool concat = config_->concat;
   const int concatDistinctMatches = peptides->ActiveTargets() + peptides->ActiveDecoys();
   map<int, int> decoyWriteCount;
 
@@ -347,40 +358,21 @@ void TideMatchSet::writeToFile(
       }
       rank = ++(j->second);
     }
-    const pb::Protein* protein = proteins[peptide->FirstLocProteinId()];
-    int pos = peptide->FirstLocPos();
-    string proteinNames = getProteinName(*protein,
-      (!protein->has_target_pos()) ? pos : protein->target_pos());
-    string flankingAAs, n_term, c_term;
-    getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
-    flankingAAs = n_term + c_term;
-
-    // look for other locations
-    if (peptide->HasAuxLocationsIndex()) {
-      const pb::AuxLocation* aux = locations[peptide->AuxLocationsIndex()];
-      for (int j = 0; j < aux->location_size(); j++) {
-        const pb::Location& location = aux->location(j);
-        protein = proteins[location.protein_id()];
-        pos = location.pos();
-        proteinNames += "," + getProteinName(*protein,
-          (!protein->has_target_pos()) ? pos : protein->target_pos());
-        getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
-        flankingAAs += "," + n_term + c_term;
-      }
+    bool cached;
+    TideResultWriter::PeptideColumns* columns = writer->CachedPeptide(peptide->Id(), &cached);
+    if (!cached) {
+      getPeptideColumns(peptide, proteins, locations, massPrecision, columns);
     }
-
-    Crux::Peptide cruxPep = getCruxPeptide(peptide);
     const SpScorer::SpScoreData* sp_data = sp_map ? &(sp_map->at(i).first) : NULL;
 
-    rwlock->lock();
-    if (Params::GetBool("file-column")) {
+    if (config_->file_column) {
       *file << spectrum_filename << '\t';
     }
     *file << spectrum->SpectrumNumber() << '\t'
           << charge << '\t'
           << StringUtils::ToString(spectrum->PrecursorMZ(), massPrecision) << '\t'
           << StringUtils::ToString((spectrum->PrecursorMZ() - MASS_PROTON) * charge, massPrecision) << '\t'
-          << StringUtils::ToString(cruxPep.calcModifiedMass(), massPrecision) << '\t'
+          << columns->mass << '\t'
           << delta_cn_map.at(i) << '\t'
           << delta_lcn_map.at(i) << '\t';
     if (sp_map) {
@@ -422,31 +414,23 @@ void TideMatchSet::writeToFile(
             << sp_data->total_ions << '\t';
     }
 
-    if (Params::GetBool("concat")) {
+    if (concat) {
       *file << concatDistinctMatches << '\t';
     } else {
       *file << (!peptide->IsDecoy() ? peptides->ActiveTargets() : peptides->ActiveDecoys()) << '\t';
     }
 
-    *file << cruxPep.getModifiedSequenceWithMasses() << '\t'
-          << cruxPep.getModsString() << '\t'
+    *file << columns->sequence << '\t'
+          << columns->mods << '\t'
           << CleavageType << '\t'
-          << proteinNames << '\t'
-          << flankingAAs;
+          << columns->proteins << '\t'
+          << columns->flanks;
     if (peptide->IsDecoy()) {
       *file << "\tdecoy";
     } else {
       *file << "\ttarget";
     }
-    if (peptide->IsDecoy() && !TideSearchApplication::proteinLevelDecoys()) {
-      // write target sequence
-      const string& residues = protein->residues();
-      *file << '\t'
-            << residues.substr(residues.length() - peptide->Len());
-    } else if (Params::GetBool("concat") && !TideSearchApplication::proteinLevelDecoys()) {
-      *file << '\t'
-            << cruxPep.getUnshuffledSequence();
-    }
+    *file << columns->unshuffled;
     if (decoys_per_target > 1) {
       if (peptide->IsDecoy()) {
         *file << '\t'
@@ -455,8 +439,55 @@ void TideMatchSet::writeToFile(
         *file << '\t';
       }
     }
-    *file << endl;
-    rwlock->unlock();
+    *file << '\n';
+  }
+}
+
+/**
+ * Fill in the columns that depend only on the peptide
+ */
+void TideMatchSet::getPeptideColumns(
+  const Peptide* peptide,
+  const ProteinVec& proteins,
+  const vector<const pb::AuxLocation*>& locations,
+  int massPrecision,
+  TideResultWriter::PeptideColumns* columns
+) {
+  const pb::Protein* protein = proteins[peptide->FirstLocProteinId()];
+  int pos = peptide->FirstLocPos();
+  string proteinNames = getProteinName(*protein,
+    (!protein->has_target_pos()) ? pos : protein->target_pos());
+  string flankingAAs, n_term, c_term;
+  getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+  flankingAAs = n_term + c_term;
+
+  // look for other locations
+  if (peptide->HasAuxLocationsIndex()) {
+    const pb::AuxLocation* aux = locations[peptide->AuxLocationsIndex()];
+    for (int j = 0; j < aux->location_size(); j++) {
+      const pb::Location& location = aux->location(j);
+      protein = proteins[location.protein_id()];
+      pos = location.pos();
+      proteinNames += "," + getProteinName(*protein,
+        (!protein->has_target_pos()) ? pos : protein->target_pos());
+      getFlankingAAs(peptide, protein, pos, &n_term, &c_term);
+      flankingAAs += "," + n_term + c_term;
+    }
+  }
+
+  Crux::Peptide cruxPep = getCruxPeptide(peptide);
+  columns->mass = StringUtils::ToString(cruxPep.calcModifiedMass(), massPrecision);
+  columns->sequence = cruxPep.getModifiedSequenceWithMasses();
+  columns->mods = cruxPep.getModsString();
+  columns->proteins = proteinNames;
+  columns->flanks = flankingAAs;
+  columns->unshuffled.clear();
+  if (peptide->IsDecoy() && !TideSearchApplication::proteinLevelDecoys()) {
+    // write target sequence
+    const string& residues = protein->residues();
+    columns->unshuffled = '\t' + residues.substr(residues.length() - peptide->Len());
+  } else if (config_->concat && !TideSearchApplication::proteinLevelDecoys()) {
+    columns->unshuffled = '\t' + cruxPep.getUnshuffledSequence();
   }
 }
 
@@ -617,7 +648,7 @@ void TideMatchSet::gatherTargetsAndDecoys(
   }
 
   map<int, int> decoyWriteCount;
-  const bool concat = Params::GetBool("concat");
+  const bool concat = config_->concat;
   const int gatherSize = top_n + 1;
 
   // decoys but not concat, populate targets and decoys
@@ -660,33 +691,6 @@ void TideMatchSet::gatherTargetsAndDecoys(
   }
 }
 
-/**
- * Create a pb peptide from Tide peptide
- */
-pb::Peptide* TideMatchSet::getPbPeptide(const Peptide& peptide) {
-  pb::Peptide* pb_peptide = new pb::Peptide();
-  pb_peptide->set_id(peptide.Id());
-  pb_peptide->set_mass(peptide.Mass());
-  pb_peptide->set_length(peptide.Len());
-  if (peptide.HasAuxLocationsIndex()) {
-    pb_peptide->set_aux_locations_index(peptide.AuxLocationsIndex());
-  }
-
-  // Copy over all the modifications for this Peptide
-  const ModCoder::Mod* mods;
-  int pep_mods = peptide.Mods(&mods);
-  for (int i = 0; i < pep_mods; ++i) {
-    pb_peptide->add_modifications(mods[i]);
-  }
-
-  // Copy over the Peptide's first location within the first protein
-  pb::Location* first_location = pb_peptide->mutable_first_location();
-  first_location->set_protein_id(peptide.FirstLocProteinId());
-  first_location->set_pos(peptide.FirstLocPos());
-
-  return pb_peptide;
-}
-
 /**
  * Gets the protein name with the index appended.
  */
@@ -721,14 +725,14 @@ void TideMatchSet::computeDeltaCns(
 ) {
   vector<FLOAT_T> scores;
   for (vector<Arr::iterator>::const_iterator i = vec.begin(); i != vec.end(); i++) {
-    if (Params::GetBool("exact-p-value")) {
+    if (config_->exact_p_value) {
       scores.push_back((*i)->xcorr_pval);
     } else {
       scores.push_back((*i)->xcorr_score);
     }
   }
   vector< pair<FLOAT_T, FLOAT_T> > deltaCns = MatchCollection::calculateDeltaCns(
-    scores, !Params::GetBool("exact-p-value") ? XCORR : TIDE_SEARCH_EXACT_PVAL);
+    scores, !config_->exact_p_value ? XCORR : TIDE_SEARCH_EXACT_PVAL);
   for (int i = 0; i < vec.size(); i++) {
     delta_cn_map->insert(make_pair(vec[i], deltaCns[i].first));
     delta_lcn_map->insert(make_pair(vec[i], deltaCns[i].second));
@@ -746,9 +750,7 @@ void TideMatchSet::computeSpData(
   for (vector<Arr::iterator>::const_iterator i = vec.begin(); i != vec.end(); ++i) {
     spData.push_back(make_pair(*i, SpScorer::SpScoreData()));
     const Peptide& peptide = *(peptides->GetPeptide((*i)->rank));
-    pb::Peptide* pb_peptide = getPbPeptide(peptide);
-    sp_scorer->Score(*pb_peptide, spData.back().second);
-    delete pb_peptide;
+    sp_scorer->Score(peptide, spData.back().second);
   }
   sort(spData.begin(), spData.end(), spGreater());
   for (size_t i = 0; i < spData.size(); ++i) {
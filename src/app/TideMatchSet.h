@@ -8,8 +8,11 @@
 #include "tide/active_peptide_queue.h"  // no include guard
 #include "tide/fixed_cap_array.h"
 #include "tide/peptide.h"
+#include "tide/search_config.h"
+#include "tide/search_stats.h"
 #include "tide/sp_scorer.h"
 #include "tide/spectrum_collection.h"
+#include "TideResultWriter.h"
 
 #include "model/Modification.h"
 #include "model/PostProcessProtein.h"
@@ -23,6 +26,11 @@ class TideMatchSet {
  public:
   bool exact_pval_search_;
   int elution_window_;
+  // If set, used by report() to compute Sp, instead of a scorer of its own.
+  // The caller keeps ownership, and may reuse it for any number of match sets.
+  SpScorer* sp_scorer_;
+  // If set, Sp scoring in report() is timed as SearchStats::SP.
+  SearchStats* stats_;
   SCORE_FUNCTION_T cur_score_function_;
 
   typedef pair<int, int> Pair2;
@@ -45,13 +53,16 @@ class TideMatchSet {
   // to the index within the ActivePeptideQueue, counting from the back.  This
   // slight complication is due to the way the generated machine code fills the
   // counter in the matches buffer by decrementing the counter.
+  // config holds the output parameters, and must outlive the TideMatchSet.
   TideMatchSet(
     Arr* matches,
-    double max_mz
+    double max_mz,
+    const SearchConfig* config
   );
   TideMatchSet(
     Peptide* peptide,
-    double max_mz
+    double max_mz,
+    const SearchConfig* config
   );
 
   ~TideMatchSet();
@@ -73,8 +84,7 @@ class TideMatchSet {
    * Write spectrum centric to output files
    */
   void report(
-    ofstream* target_file,  ///< target file to write to
-    ofstream* decoy_file, ///< decoy file to write to
+    TideResultWriter* writer, ///< writer for the calling thread
     int top_n,  ///< number of matches to report
     int decoys_per_target,
     const string& spectrum_filename, ///< name of spectrum file
@@ -84,8 +94,7 @@ class TideMatchSet {
     const ProteinVec& proteins, ///< proteins corresponding with peptides
     const vector<const pb::AuxLocation*>& locations,  ///< auxiliary locations
     bool compute_sp, ///< whether to compute sp or not
-    bool highScoreBest, //< indicates semantics of score magnitude
-    boost::mutex * rwlock
+    bool highScoreBest //< indicates semantics of score magnitude
   );
 
   static void writeHeaders(
@@ -105,6 +114,7 @@ class TideMatchSet {
   Arr2* matches2_;
   Peptide* peptide_;
   double max_mz_;
+  const SearchConfig* config_;
 
   // For allocation
   static char match_collection_loc_[sizeof(MatchCollection)];
@@ -165,7 +175,8 @@ class TideMatchSet {
    * Helper function for tab delimited report function
    */
   void writeToFile(
-    ofstream* file,
+    ostream* file,
+    TideResultWriter* writer,
     int top_n,
     int decoys_per_target,
     const vector<Arr::iterator>& vec,
@@ -177,8 +188,18 @@ class TideMatchSet {
     const vector<const pb::AuxLocation*>& locations,
     const map<Arr::iterator, FLOAT_T>& delta_cn_map,
     const map<Arr::iterator, FLOAT_T>& delta_lcn_map,
-    const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map,
-    boost::mutex * rwlock
+    const map<Arr::iterator, pair<const SpScorer::SpScoreData, int> >* sp_map
+  );
+
+  /**
+   * Fill in the columns that depend only on the peptide
+   */
+  void getPeptideColumns(
+    const Peptide* peptide,
+    const ProteinVec& proteins,
+    const vector<const pb::AuxLocation*>& locations,
+    int massPrecision,
+    TideResultWriter::PeptideColumns* columns
   );
 
   Crux::Peptide getCruxPeptide(const Peptide* peptide);
@@ -193,13 +214,6 @@ class TideMatchSet {
     bool highScoreBest // indicates semantics of score magnitude
   );
 
-  /**
-   * Create a pb peptide from Tide peptide
-   */
-  static pb::Peptide* getPbPeptide(
-    const Peptide& peptide
-  );
-
   /**
    * Gets the protein name with the index appended.
    */
@@ -219,7 +233,7 @@ class TideMatchSet {
     string* out_c ///< out parameter for c flank
   );
 
-  static void computeDeltaCns(
+  void computeDeltaCns(
     const vector<Arr::iterator>& vec, // xcorr*100000000.0, high to low
     map<Arr::iterator, FLOAT_T>* delta_cn_map, // map to add delta cn scores to
     map<Arr::iterator, FLOAT_T>* delta_lcn_map
@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include "TideResultWriter.h"
+#include "tide/search_stats.h"
+#include "io/carp.h"
+#include "util/FileUtils.h"
+
+// Buffered output is handed to the output files once it reaches this size.
+static const size_t BLOCK_SIZE = 1 << 20;
+
+// Entries in the peptide cache before it is cleared. Spectra are searched in
+// order of mass, so by then most cached peptides will not be reported again.
+static const size_t MAX_CACHED_PEPTIDES = 1 << 15;
+
+// Each spectrum-charge in a temporary file is stored as this header, followed
+// by its target and then its decoy PSMs.
+struct SpoolRecord {
+  uint64_t index;
+  uint32_t target_size;
+  uint32_t decoy_size;
+};
+
+TideResultWriter::TideResultWriter(
+  ofstream* target_file,
+  ofstream* decoy_file,
+  boost::mutex* lock,
+  const string& spool_file
+) : target_file_(target_file), decoy_file_(decoy_file), lock_(lock),
+    spool_file_(spool_file), spool_(NULL), stats_(NULL),
+    stats_lock_type_(0) {
+  if (!spool_file_.empty() && (spool_ = fopen(spool_file_.c_str(), "wb")) == NULL) {
+    carp(CARP_FATAL, "Couldn't open file %s for write.", spool_file_.c_str());
+  }
+}
+
+TideResultWriter::~TideResultWriter() {
+  Flush();
+  FileUtils::Remove(spool_file_);
+}
+
+void TideResultWriter::EndSpectrum(size_t index) {
+  if (spool_file_.empty()) {
+    if ((size_t)target_.tellp() + (size_t)decoy_.tellp() >= BLOCK_SIZE) {
+      writeBlock();
+    }
+    return;
+  }
+  string target = target_.str();
+  string decoy = decoy_.str();
+  if (target.empty() && decoy.empty()) {
+    return;
+  }
+  SpoolRecord record;
+  record.index = index;
+  record.target_size = target.size();
+  record.decoy_size = decoy.size();
+  if (fwrite(&record, sizeof(record), 1, spool_) != 1 ||
+      fwrite(target.data(), 1, target.size(), spool_) != target.size() ||
+      fwrite(decoy.data(), 1, decoy.size(), spool_) != decoy.size()) {
+    carp(CARP_FATAL, "Error writing %s.", spool_file_.c_str());
+  }
+  target_.str("");
+  decoy_.str("");
+}
+
+void TideResultWriter::Flush() {
+  if (spool_file_.empty()) {
+    writeBlock();
+  } else if (spool_ != NULL) {
+    if (fclose(spool_) != 0) {
+      carp(CARP_FATAL, "Error writing %s.", spool_file_.c_str());
+    }
+    spool_ = NULL;
+  }
+}
+
+void TideResultWriter::writeBlock() {
+  if (target_.tellp() <= 0 && decoy_.tellp() <= 0) {
+    return;
+  }
+  if (stats_ != NULL) {
+    stats_->Lock(lock_, stats_lock_type_);
+  } else {
+    lock_->lock();
+  }
+  if (target_file_) {
+    *target_file_ << target_.str();
+  }
+  if (decoy_file_) {
+    *decoy_file_ << decoy_.str();
+  }
+  lock_->unlock();
+  target_.str("");
+  decoy_.str("");
+}
+
+TideResultWriter::PeptideColumns* TideResultWriter::CachedPeptide(int id, bool* found) {
+  map<int, PeptideColumns>::iterator i = peptide_cache_.find(id);
+  *found = i != peptide_cache_.end();
+  if (!*found) {
+    if (peptide_cache_.size() >= MAX_CACHED_PEPTIDES) {
+      peptide_cache_.clear();
+    }
+    i = peptide_cache_.insert(make_pair(id, PeptideColumns())).first;
+  }
+  return &i->second;
+}
+
+/**
+ * Reads the next record of a temporary file into record and the two strings.
+ * Returns false at the end of the file.
+ */
+static bool readRecord(
+  FILE* spool,
+  const string& filename,
+  SpoolRecord* record,
+  string* target,
+  string* decoy
+) {
+  if (fread(record, sizeof(*record), 1, spool) != 1) {
+    return false;
+  }
+  target->resize(record->target_size);
+  decoy->resize(record->decoy_size);
+  if ((!target->empty() && fread(&(*target)[0], 1, target->size(), spool) != target->size()) ||
+      (!decoy->empty() && fread(&(*decoy)[0], 1, decoy->size(), spool) != decoy->size())) {
+    carp(CARP_FATAL, "Error reading %s.", filename.c_str());
+  }
+  return true;
+}
+
+void TideResultWriter::Merge(
+  const vector<TideResultWriter*>& writers,
+  ofstream* target_file,
+  ofstream* decoy_file
+) {
+  size_t n = writers.size();
+  vector<FILE*> spools(n, (FILE*)NULL);
+  vector<SpoolRecord> records(n);
+  vector<string> targets(n), decoys(n);
+  vector<bool> more(n, false);
+  for (size_t i = 0; i < n; i++) {
+    const string& filename = writers[i]->spool_file_;
+    if ((spools[i] = fopen(filename.c_str(), "rb")) == NULL) {
+      carp(CARP_FATAL, "Couldn't open file %s for read.", filename.c_str());
+    }
+    more[i] = readRecord(spools[i], filename, &records[i], &targets[i], &decoys[i]);
+  }
+  // Each file is in order of index, and the indices of different threads are
+  // distinct, so repeatedly taking the lowest head gives the overall order.
+  while (true) {
+    int next = -1;
+    for (size_t i = 0; i < n; i++) {
+      if (more[i] && (next < 0 || records[i].index < records[next].index)) {
+        next = i;
+      }
+    }
+    if (next < 0) {
+      break;
+    }
+    if (target_file) {
+      *target_file << targets[next];
+    }
+    if (decoy_file) {
+      *decoy_file << decoys[next];
+    }
+    more[next] = readRecord(spools[next], writers[next]->spool_file_,
+                            &records[next], &targets[next], &decoys[next]);
+  }
+  for (size_t i = 0; i < n; i++) {
+    fclose(spools[i]);
+    FileUtils::Remove(writers[i]->spool_file_);
+  }
+}
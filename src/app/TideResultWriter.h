@@ -0,0 +1,102 @@
+#ifndef TIDE_RESULT_WRITER_H
+#define TIDE_RESULT_WRITER_H
+
+/*
+ * A TideResultWriter collects the tab-delimited PSMs written by one
+ * tide-search thread and passes them to the shared output files in large
+ * blocks, so that the threads seldom contend for the results lock.
+ *
+ * In ordered mode nothing is written to the output files during the search.
+ * Instead, the PSMs of each spectrum-charge are appended to a temporary file
+ * for the thread, tagged with the spectrum-charge's index, and Merge() writes
+ * the PSMs of all threads in order of that index once the search is done. The
+ * output is then the same regardless of the number of threads.
+ *
+ * The writer also keeps a cache of the columns that depend only on the peptide
+ * (sequence, modifications, proteins, flanking residues), since a peptide is
+ * usually reported for several neighboring spectra.
+ */
+
+#include <stdio.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+class SearchStats;
+
+using namespace std;
+
+class TideResultWriter {
+ public:
+  // Formatted columns of a peptide, which are the same for every PSM that it
+  // appears in.
+  struct PeptideColumns {
+    string mass;
+    string sequence;
+    string mods;
+    string proteins;
+    string flanks;
+    string unshuffled; // with its leading tab, or empty if not reported
+  };
+
+  // spool_file is the temporary file used in ordered mode, or empty for
+  // unordered mode, in which blocks are written to the files under lock.
+  TideResultWriter(
+    ofstream* target_file,
+    ofstream* decoy_file,
+    boost::mutex* lock,
+    const string& spool_file
+  );
+  ~TideResultWriter();
+
+  // Record waits for the results lock in stats, as lock type lock_type.
+  void SetStats(SearchStats* stats, int lock_type) {
+    stats_ = stats;
+    stats_lock_type_ = lock_type;
+  }
+
+  // Streams to format PSMs into, or NULL if there is no such output file.
+  ostream* Target() { return target_file_ ? &target_ : NULL; }
+  ostream* Decoy() { return decoy_file_ ? &decoy_ : NULL; }
+
+  // Called once all PSMs for the spectrum-charge at index have been written.
+  // Indices passed to successive calls must be increasing.
+  void EndSpectrum(size_t index);
+
+  // Write out anything still buffered. In ordered mode this closes the
+  // temporary file, after which Merge() may be called.
+  void Flush();
+
+  // Write the PSMs of all writers, which must be flushed, to the output files
+  // in order of spectrum-charge index, and remove the temporary files.
+  static void Merge(
+    const vector<TideResultWriter*>& writers,
+    ofstream* target_file,
+    ofstream* decoy_file
+  );
+
+  // Cached columns for the peptide with the given id. *found is false if the
+  // entry was just created, in which case the caller must fill it in.
+  PeptideColumns* CachedPeptide(int id, bool* found);
+
+ private:
+  void writeBlock();
+
+  ofstream* target_file_;
+  ofstream* decoy_file_;
+  boost::mutex* lock_;
+  string spool_file_;
+  FILE* spool_;
+  SearchStats* stats_;
+  int stats_lock_type_;
+
+  ostringstream target_;
+  ostringstream decoy_;
+
+  map<int, PeptideColumns> peptide_cache_;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "app/tide/abspath.h"
 #include "app/tide/records_to_vector-inl.h"
 
+#include "crux_version.h"
 #include "io/carp.h"
 #include "parameter.h"
 #include "io/SpectrumRecordWriter.h"
@@ -11,6 +12,13 @@
 #include "PSMConvertApplication.h"
 #include "tide/mass_constants.h"
 #include "TideMatchSet.h"
+#include "tide/compiler.h"
+#include "tide/fifo_alloc.h"
+#include "tide/peptide_table.h"
+#include "tide/fragment_index.h"
+#include "tide/score_count_matrix.h"
+#include "tide/search_stats.h"
+#include "tide/spectrum_batch.h"
 #include "util/Params.h"
 #include "util/FileUtils.h"
 #include "util/StringUtils.h"
@@ -35,8 +43,23 @@ const double TideSearchApplication::XCORR_SCALING = 100000000.0;
  * tide/spectrum_preprocess2.cc). */
 const double TideSearchApplication::RESCALE_FACTOR = 20.0;
 
+/* Page size of the arena that holds the temporary arrays of a search thread
+ * for one spectrum-charge.
+ */
+static const size_t SPECTRUM_ARENA_PAGE_SIZE = 1 << 20;
+
+/* Allocates an uninitialized array of n elements from arena. Sizes are
+ * rounded up to a multiple of 8 bytes, which keeps the doubles and pointers
+ * in the arena aligned.
+ */
+template<class T>
+static T* arenaArray(FifoAllocator* arena, int n) {
+  return (T*)arena->New((n * sizeof(T) + 7) & ~(size_t)7);
+}
+
 TideSearchApplication::TideSearchApplication():
-  exact_pval_search_(false), remove_index_(""), spectrum_flag_(NULL) {
+  spectrum_flag_(NULL), fragment_index_(NULL), stats_file_(NULL), stats_entries_(0),
+  remove_index_(""), exact_pval_search_(false) {
 }
 
 TideSearchApplication::~TideSearchApplication() {
@@ -125,6 +148,19 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
                      "is not allowed in this version of Crux.");
   }
 
+  if (Params::GetInt("spectrum-batch-size") > 1 &&
+      Params::GetString("xcorr-scoring") != "portable") {
+    carp(CARP_FATAL, "spectrum-batch-size greater than 1 requires xcorr-scoring=portable.");
+  }
+  if (Params::GetInt("fragment-index-top-n") > 0) {
+    if (Params::GetString("xcorr-scoring") == "compiled") {
+      carp(CARP_FATAL, "fragment-index-top-n requires xcorr-scoring other than compiled.");
+    } else if (Params::GetInt("spectrum-batch-size") > 1) {
+      carp(CARP_FATAL, "fragment-index-top-n cannot be used with spectrum-batch-size "
+                       "greater than 1.");
+    }
+  }
+
   // Check that combined p-value is with exact-p-value=T
   SCORE_FUNCTION_T curScoreFunction = string_to_score_function_type(Params::GetString("score-function"));
   if (curScoreFunction == BOTH_SCORE && !exact_pval_search_) {
@@ -241,10 +277,7 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   // Read peptides index file
   pb::Header peptides_header;
 
-  vector<HeadedRecordReader*> peptide_reader;
-  for (int i = 0; i < NUM_THREADS; i++) {
-    peptide_reader.push_back(new HeadedRecordReader(peptides_file, &peptides_header));
-  }
+  HeadedRecordReader* peptide_reader = new HeadedRecordReader(peptides_file, &peptides_header);
 
   if ((peptides_header.file_type() != pb::Header::PEPTIDES) ||
       !peptides_header.has_peptides_header()) {
@@ -293,33 +326,114 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
     TideMatchSet::writeHeaders(target_file, false, decoysPerTarget > 1, compute_sp);
     TideMatchSet::writeHeaders(decoy_file, true, decoysPerTarget > 1, compute_sp);
   }
+  if (Params::GetBool("search-stats")) {
+    string stats_file_name = make_file_path("tide-search.stats.json");
+    stats_file_ = create_stream_in_path(stats_file_name.c_str(), NULL, overwrite);
+    stats_entries_ = 0;
+    *stats_file_ << "[";
+  }
+
+  // If tide-index also wrote the peptides as a table, map it and read the
+  // peptides from there instead, unless it was written with another pepix.
+  PeptideTable* peptide_table = NULL;
+  string table_file = PeptideTable::FileName(index);
+  if (FileUtils::Exists(table_file)) {
+    peptide_table = new PeptideTable(table_file);
+    if (!peptide_table->OK() || !peptide_table->Matches(peptides_file, peptides_header)) {
+      carp(CARP_WARNING, "Ignoring %s, which does not match %s; reading peptides "
+                         "from %s instead.", table_file.c_str(), peptides_file.c_str(),
+                         peptides_file.c_str());
+      delete peptide_table;
+      peptide_table = NULL;
+    } else {
+      carp(CARP_DEBUG, "Read %ld peptides from %s.", peptide_table->Size(), table_file.c_str());
+    }
+  }
 
-  vector<InputFile> sr = getInputFiles(input_files);
+  // Candidate preselection needs the fragment index written by tide-index.
+  FragmentIndex* fragment_index = NULL;
+  if (Params::GetInt("fragment-index-top-n") > 0) {
+    string fragments_file = FragmentIndex::FileName(index);
+    if (!FileUtils::Exists(fragments_file)) {
+      carp(CARP_FATAL, "fragment-index-top-n requires an index built with "
+                       "--fragment-index T (%s not found).", fragments_file.c_str());
+    }
+    fragment_index = new FragmentIndex(fragments_file);
+    if (!fragment_index->OK()) {
+      carp(CARP_FATAL, "Error reading index (%s)", fragments_file.c_str());
+    }
+    fragment_index_ = fragment_index;
+  }
+
+  // With pipeline-spectra, each spectrum file is converted and loaded on a
+  // background thread while the one before it is searched. Otherwise all
+  // files are converted up front and each is loaded just before its search.
+  bool pipeline = Params::GetBool("pipeline-spectra") && input_files.size() > 1;
+  vector<InputFile> sr;
+  PreparedSpectra next;
+  boost::thread* prefetch = NULL;
+  if (pipeline) {
+    prefetch = new boost::thread(boost::bind(&TideSearchApplication::prepareSpectra, this,
+                                             input_files[0], true, &next));
+  } else {
+    sr = getInputFiles(input_files);
+  }
 
   // Loop through spectrum files
-  for (vector<InputFile>::const_iterator f = sr.begin(); f != sr.end(); f++) {
-    if (!peptide_reader[0]) {
-      for (int i = 0; i < NUM_THREADS; i++) {
-        peptide_reader[i] = new HeadedRecordReader(peptides_file, &peptides_header);
-      }
+  for (size_t file_index = 0; file_index < input_files.size(); file_index++) {
+    if (!peptide_reader && !peptide_table) {
+      peptide_reader = new HeadedRecordReader(peptides_file, &peptides_header);
     }
 
+    // With multiple threads, all queues draw from a single reader so that
+    // each peptide is read and compiled only once.
+    SharedPeptideSource* shared_peptides = NULL;
+    bool compile = curScoreFunction == XCORR_SCORE && !exact_pval_search_;
+    if (NUM_THREADS > 1 && peptide_table) {
+      shared_peptides = new SharedPeptideSource(peptide_table, proteins, NUM_THREADS, compile);
+    } else if (NUM_THREADS > 1) {
+      shared_peptides = new SharedPeptideSource(peptide_reader->Reader(), proteins, NUM_THREADS,
+        compile);
+    }
     vector<ActivePeptideQueue*> active_peptide_queue;
     for (int i = 0; i < NUM_THREADS; i++) {
-      active_peptide_queue.push_back(new ActivePeptideQueue(peptide_reader[i]->Reader(), proteins));
+      if (shared_peptides) {
+        active_peptide_queue.push_back(new ActivePeptideQueue(shared_peptides, i, proteins));
+      } else if (peptide_table) {
+        active_peptide_queue.push_back(new ActivePeptideQueue(peptide_table, proteins));
+      } else {
+        active_peptide_queue.push_back(new ActivePeptideQueue(peptide_reader->Reader(), proteins));
+      }
       active_peptide_queue[i]->SetBinSize(bin_width_, bin_offset_);
     }
 
-    string spectra_file = f->SpectrumRecords;
+    const InputFile* f;
     SpectrumCollection* spectra = NULL;
-    map<string, SpectrumCollection*>::iterator spectraIter = spectra_.find(spectra_file);
-    if (spectraIter == spectra_.end()) {
-      carp(CARP_INFO, "Reading spectrum file %s.", spectra_file.c_str());
-      spectra = loadSpectra(spectra_file);
-      carp(CARP_INFO, "Read %d spectra.", spectra->Size());
+    bool ownSpectra = true;
+    if (pipeline) {
+      prefetch->join();
+      delete prefetch;
+      prefetch = NULL;
+      f = next.File;
+      spectra = next.Spectra;
+      ownSpectra = next.OwnSpectra;
+      if (file_index + 1 < input_files.size()) {
+        prefetch = new boost::thread(boost::bind(&TideSearchApplication::prepareSpectra, this,
+                                                 input_files[file_index + 1], true, &next));
+      }
     } else {
-      spectra = spectraIter->second;
+      f = &sr[file_index];
+      map<string, SpectrumCollection*>::iterator spectraIter = spectra_.find(f->SpectrumRecords);
+      if (spectraIter == spectra_.end()) {
+        carp(CARP_INFO, "Reading spectrum file %s.", f->SpectrumRecords.c_str());
+        spectra = loadSpectra(f->SpectrumRecords);
+        carp(CARP_INFO, "Read %d spectra.", spectra->Size());
+      } else {
+        spectra = spectraIter->second;
+        ownSpectra = false;
+      }
     }
+    string spectra_file = f->SpectrumRecords;
 
     double highest_mz = spectra->FindHighestMZ();
     unsigned int spectrum_num = spectra->SpecCharges()->size();
@@ -346,7 +460,7 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
            pepHeader.mods(), pepHeader.nterm_mods(), pepHeader.cterm_mods(),
            decoysPerTarget, &negative_isotope_errors);
 
-    if (spectraIter == spectra_.end()) {
+    if (ownSpectra) {
       delete spectra;
     }
     // convert tab delimited to other file formats.
@@ -361,11 +475,23 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
     // Clean up
     for (int i = 0; i < NUM_THREADS; i++) {
       delete active_peptide_queue[i];
-      delete peptide_reader[i];
-      peptide_reader[i] = NULL;
+    }
+    delete shared_peptides;
+    delete peptide_reader;
+    peptide_reader = NULL;
+    if (pipeline) {
+      delete f;
     }
 
   } // End of spectrum file loop
+  delete peptide_table;
+  delete fragment_index;
+  fragment_index_ = NULL;
+  if (stats_file_) {
+    *stats_file_ << "]\n";
+    delete stats_file_;
+    stats_file_ = NULL;
+  }
 
   for (ProteinVec::iterator i = proteins.begin(); i != proteins.end(); ++i) {
     delete *i;
@@ -419,37 +545,164 @@ vector<TideSearchApplication::InputFile> TideSearchApplication::getInputFiles(
   // Try to read all spectrum files as spectrumrecords, convert those that fail
   vector<InputFile> input_sr;
   for (vector<string>::const_iterator f = filepaths.begin(); f != filepaths.end(); f++) {
-    SpectrumCollection spectra;
-    pb::Header spectrum_header;
-    string spectrumrecords = *f;
-    bool keepSpectrumrecords = true;
+    input_sr.push_back(getInputFile(*f, filepaths.size() > 1));
+  }
+  return input_sr;
+}
+
+/**
+ * Returns the spectrumrecords to search for a single spectrum file, converting
+ * the file if it is not spectrumrecords already. multipleInputs is true if the
+ * file is one of several being searched.
+ */
+TideSearchApplication::InputFile TideSearchApplication::getInputFile(
+  const string& filepath,
+  bool multipleInputs
+) const {
+  string cacheDir = Params::GetString("spectrum-cache-dir");
+  if (!cacheDir.empty() && !FileUtils::IsDir(cacheDir) && !FileUtils::Mkdir(cacheDir) &&
+      !FileUtils::IsDir(cacheDir)) {
+    carp(CARP_FATAL, "Could not create spectrum cache directory %s", cacheDir.c_str());
+  }
+  SpectrumCollection spectra;
+  pb::Header spectrum_header;
+  string spectrumrecords = filepath;
+  bool keepSpectrumrecords = true;
+  if (spectra.ReadSpectrumRecords(filepath, &spectrum_header)) {
+    // Already spectrumrecords
+  } else if (!cacheDir.empty()) {
+    // Reuse an earlier conversion of the same content, or convert into the
+    // cache so that later runs can
+    spectrumrecords = spectrumCacheFile(filepath, cacheDir);
+    if (spectra.ReadSpectrumRecords(spectrumrecords, &spectrum_header)) {
+      carp(CARP_INFO, "Using cached spectrumrecords %s for %s",
+           spectrumrecords.c_str(), filepath.c_str());
+    } else if (!convertToCache(filepath, spectrumrecords)) {
+      carp(CARP_FATAL, "Error converting %s to spectrumrecords format", filepath.c_str());
+    }
+  } else {
+    // Failed, try converting to spectrumrecords file
+    carp(CARP_INFO, "Converting %s to spectrumrecords format", filepath.c_str());
+    carp(CARP_INFO, "Elapsed time starting conversion: %.3g s", wall_clock() / 1e6);
+    spectrumrecords = Params::GetString("store-spectra");
+    keepSpectrumrecords = !spectrumrecords.empty();
+    if (!keepSpectrumrecords) {
+      spectrumrecords = make_file_path(FileUtils::BaseName(filepath) + ".spectrumrecords.tmp");
+    } else if (multipleInputs) {
+      carp(CARP_FATAL, "Cannot use store-spectra option with multiple input "
+                       "spectrum files");
+    }
+    carp(CARP_DEBUG, "New spectrumrecords filename: %s", spectrumrecords.c_str());
+    if (!SpectrumRecordWriter::convert(filepath, spectrumrecords)) {
+      carp(CARP_FATAL, "Error converting %s to spectrumrecords format", filepath.c_str());
+    }
+    carp(CARP_DEBUG, "Reading converted spectrum file %s", spectrumrecords.c_str());
+    // Re-read converted file as spectrumrecords file
     if (!spectra.ReadSpectrumRecords(spectrumrecords, &spectrum_header)) {
-      // Failed, try converting to spectrumrecords file
-      carp(CARP_INFO, "Converting %s to spectrumrecords format", f->c_str());
-      carp(CARP_INFO, "Elapsed time starting conversion: %.3g s", wall_clock() / 1e6);
-      spectrumrecords = Params::GetString("store-spectra");
-      keepSpectrumrecords = !spectrumrecords.empty();
-      if (!keepSpectrumrecords) {
-        spectrumrecords = make_file_path(FileUtils::BaseName(*f) + ".spectrumrecords.tmp");
-      } else if (filepaths.size() > 1) {
-        carp(CARP_FATAL, "Cannot use store-spectra option with multiple input "
-                         "spectrum files");
-      }
-      carp(CARP_DEBUG, "New spectrumrecords filename: %s", spectrumrecords.c_str());
-      if (!SpectrumRecordWriter::convert(*f, spectrumrecords)) {
-        carp(CARP_FATAL, "Error converting %s to spectrumrecords format", f->c_str());
-      }
-      carp(CARP_DEBUG, "Reading converted spectrum file %s", spectrumrecords.c_str());
-      // Re-read converted file as spectrumrecords file
-      if (!spectra.ReadSpectrumRecords(spectrumrecords, &spectrum_header)) {
-        carp(CARP_DEBUG, "Deleting %s", spectrumrecords.c_str());
-        FileUtils::Remove(spectrumrecords);
-        carp(CARP_FATAL, "Error reading spectra file %s", spectrumrecords.c_str());
-      }
+      carp(CARP_DEBUG, "Deleting %s", spectrumrecords.c_str());
+      FileUtils::Remove(spectrumrecords);
+      carp(CARP_FATAL, "Error reading spectra file %s", spectrumrecords.c_str());
     }
-    input_sr.push_back(InputFile(*f, spectrumrecords, keepSpectrumrecords));
   }
-  return input_sr;
+  return InputFile(filepath, spectrumrecords, keepSpectrumrecords);
+}
+
+/**
+ * Converts (if necessary) and loads the spectrum file filepath, unless its
+ * spectra are already held in spectra_. This is run on
+ * a background thread while the previous spectrum file is being searched, so
+ * that parsing and sorting the spectra overlaps with the search.
+ */
+void TideSearchApplication::prepareSpectra(
+  const string& filepath,
+  bool multipleInputs,
+  PreparedSpectra* prepared
+) const {
+  prepared->File = new InputFile(getInputFile(filepath, multipleInputs));
+  map<string, SpectrumCollection*>::const_iterator spectraIter =
+    spectra_.find(prepared->File->SpectrumRecords);
+  if (spectraIter != spectra_.end()) {
+    prepared->Spectra = spectraIter->second;
+    prepared->OwnSpectra = false;
+    return;
+  }
+  carp(CARP_INFO, "Reading spectrum file %s.", prepared->File->SpectrumRecords.c_str());
+  prepared->Spectra = loadSpectra(prepared->File->SpectrumRecords);
+  prepared->OwnSpectra = true;
+  carp(CARP_INFO, "Read %d spectra.", prepared->Spectra->Size());
+}
+
+/**
+ * Version of the spectrumrecords written into the spectrum cache. Increase it
+ * whenever conversion changes, so that entries written before are not reused.
+ */
+static const int SPECTRUM_CACHE_VERSION = 1;
+
+/**
+ * Returns the path in cacheDir of the spectrumrecords converted from file.
+ * The name includes a hash of the file's contents, of the parameters that
+ * affect conversion, and of the Crux and cache versions, so a file that
+ * changes, or is converted differently, gets a new entry rather than a stale
+ * one.
+ */
+string TideSearchApplication::spectrumCacheFile(
+  const string& file,
+  const string& cacheDir
+) const {
+  // 64-bit FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  const uint64_t prime = 1099511628211ULL;
+  ifstream in(file.c_str(), ios::binary);
+  if (!in.good()) {
+    carp(CARP_FATAL, "Could not open spectrum file %s", file.c_str());
+  }
+  char buf[1 << 16];
+  while (in.read(buf, sizeof(buf)) || in.gcount() > 0) {
+    for (streamsize i = 0; i < in.gcount(); i++) {
+      hash = (hash ^ (unsigned char)buf[i]) * prime;
+    }
+  }
+  string conversion =
+    "\n" + string(CRUX_VERSION) +
+    "\n" + StringUtils::ToString(SPECTRUM_CACHE_VERSION) +
+    "\n" + Params::GetString("spectrum-parser") +
+    "\n" + Params::GetString("scan-number") +
+    "\n" + StringUtils::ToString(Params::GetBool("use-z-line")) +
+    "\n" + StringUtils::ToString(Params::GetBool("pm-ignore-no-charge"));
+  for (string::const_iterator i = conversion.begin(); i != conversion.end(); i++) {
+    hash = (hash ^ (unsigned char)*i) * prime;
+  }
+  char hex[17];
+  sprintf(hex, "%08x%08x", (unsigned int)(hash >> 32), (unsigned int)hash);
+  return FileUtils::Join(cacheDir, FileUtils::BaseName(file) + "." + hex + ".spectrumrecords");
+}
+
+/**
+ * Converts file into the cache entry cached. The conversion is written to a
+ * uniquely named file and renamed into place, so that concurrent processes
+ * converting the same file never see a partial entry. Returns true if cached
+ * can be read afterwards.
+ */
+bool TideSearchApplication::convertToCache(
+  const string& file,
+  const string& cached
+) const {
+  carp(CARP_INFO, "Converting %s to spectrumrecords format in cache", file.c_str());
+  carp(CARP_INFO, "Elapsed time starting conversion: %.3g s", wall_clock() / 1e6);
+  string tmp = FileUtils::UniquePath(cached + ".%%%%%%%%.tmp");
+  if (!SpectrumRecordWriter::convert(file, tmp)) {
+    FileUtils::Remove(tmp);
+    return false;
+  }
+  try {
+    FileUtils::Rename(tmp, cached);
+  } catch (...) {
+    // Another process may have put its own conversion in place first
+    FileUtils::Remove(tmp);
+  }
+  SpectrumCollection spectra;
+  pb::Header header;
+  return spectra.ReadSpectrumRecords(cached, &header);
 }
 
 SpectrumCollection* TideSearchApplication::loadSpectra(const string& file) {
@@ -488,7 +741,6 @@ void TideSearchApplication::search(void* threadarg) {
   ofstream* decoy_file = my_data->decoy_file;
   bool compute_sp = my_data->compute_sp;
   int64_t thread_num = my_data->thread_num;
-  int64_t num_threads = my_data->num_threads;
   int nAA = my_data->nAA;
   double* aaFreqN = my_data->aaFreqN;
   double* aaFreqI = my_data->aaFreqI;
@@ -514,20 +766,51 @@ void TideSearchApplication::search(void* threadarg) {
 
   int* sc_index = my_data->sc_index;
   int* total_candidate_peptides = my_data->total_candidate_peptides;
+  const SearchConfig* config = my_data->config;
+  SearchStats* stats = my_data->stats;
 
   // params
-  bool peptide_centric = Params::GetBool("peptide-centric-search");
-  bool use_neutral_loss_peaks = Params::GetBool("use-neutral-loss-peaks");
-  bool use_flanking_peaks = Params::GetBool("use-flanking-peaks");
+  bool peptide_centric = config->peptide_centric_search;
+  bool use_neutral_loss_peaks = config->use_neutral_loss_peaks;
+  bool use_flanking_peaks = config->use_flanking_peaks;
   int max_charge = Params::GetInt("max-precursor-charge");
+  int batch_size = Params::GetInt("spectrum-batch-size");
   // Added by Andy Lin on 2/9/2016
   // Determines which score function to use for scoring PSMs and store in SCORE_FUNCTION enum
-  SCORE_FUNCTION_T curScoreFunction = string_to_score_function_type(Params::GetString("score-function"));
+  SCORE_FUNCTION_T curScoreFunction = config->score_function;
 
   // This is the main search loop.
   ObservedPeakSet observed(bin_width, bin_offset,
                            use_neutral_loss_peaks,
-                           use_flanking_peaks);
+                           use_flanking_peaks, config);
+  // Peptide-centric search reports hits as peptides leave the queue, so the
+  // queue cannot be loaded ahead for a batch.
+  SpectrumBatch* batch = NULL;
+  if (batch_size > 1 && !peptide_centric) {
+    batch = new SpectrumBatch(batch_size, bin_width, bin_offset,
+                              use_neutral_loss_peaks, use_flanking_peaks, config);
+  }
+
+  // Exact p-value workspace, reused for every spectrum
+  ScoreCountMatrix scoreCountMatrix;
+
+  // Sp workspace, reused for every match reported by this thread
+  SpScorer* sp_scorer = compute_sp ? new SpScorer(proteins, highest_mz) : NULL;
+
+  // Temporaries for one spectrum-charge. The arena is released and the
+  // vectors are emptied at the start of each spectrum-charge, keeping their
+  // memory, so once they have grown to the largest size needed the loop
+  // below seldom allocates.
+  FifoAllocator arena(SPECTRUM_ARENA_PAGE_SIZE);
+  vector<double> min_mass_buffer;
+  vector<double> max_mass_buffer;
+  vector<bool> candidate_status_buffer;
+  vector<vector<int> > evidenceObs;
+  vector<vector<vector<double> > > residueEvidenceMatrix;
+  vector<vector<double> > spectrumResidueEvidenceMatrix;
+  vector<int> preselect_bins;
+  vector<int> preselect_counts;
+  vector<pair<int, int> > preselect_selected;
 
   // Keep track of observed peaks that get filtered out in various ways.
   long int num_range_skipped = 0;
@@ -539,16 +822,20 @@ void TideSearchApplication::search(void* threadarg) {
   FLOAT_T sc_total = (FLOAT_T)spec_charges->size();
   int print_interval = Params::GetInt("print-search-progress");
 
-  for (vector<SpectrumCollection::SpecCharge>::const_iterator sc = spec_charges->begin()+thread_num;
-       sc < spec_charges->begin() + (spec_charges->size());
-       sc = sc + num_threads) {
-    locks_array[LOCK_REPORTING]->lock();
+  // Spectrum-charges are taken in contiguous blocks from the scheduler
+  size_t block_pos = 0;
+  size_t block_end = 0;
+  while (block_pos < block_end || my_data->scheduler->NextBlock(&block_pos, &block_end)) {
+    vector<SpectrumCollection::SpecCharge>::const_iterator sc = spec_charges->begin() + block_pos++;
+    stats->Switch(SearchStats::OTHER);
+    stats->Lock(locks_array[LOCK_REPORTING], LOCK_REPORTING);
     ++(*sc_index);
     if (print_interval > 0 && *sc_index > 0 && *sc_index % print_interval == 0) {
       carp(CARP_INFO, "%d spectrum-charge combinations searched, %.0f%% complete",
            *sc_index, *sc_index / sc_total * 100);
     }
     locks_array[LOCK_REPORTING]->unlock();
+    arena.ReleaseAll();
 
     Spectrum* spectrum = sc->spectrum;
     double precursor_mz = spectrum->PrecursorMZ();
@@ -556,7 +843,7 @@ void TideSearchApplication::search(void* threadarg) {
     int charge = sc->charge;
     int scan_num = spectrum->SpectrumNumber();
     if (spectrum_flag != NULL) {
-      locks_array[LOCK_CASCADE]->lock();
+      stats->Lock(locks_array[LOCK_CASCADE], LOCK_CASCADE);
       map<pair<string, unsigned int>, bool>::iterator spectrum_id;
       spectrum_id = spectrum_flag->find(pair<string, unsigned int>(
         spectrum_filename, scan_num * 10 + charge));
@@ -567,17 +854,17 @@ void TideSearchApplication::search(void* threadarg) {
       locks_array[LOCK_CASCADE]->unlock();
     }
 
-    if (precursor_mz < spectrum_min_mz || precursor_mz > spectrum_max_mz ||
-        scan_num < min_scan || scan_num > max_scan ||
-        spectrum->Size() < min_peaks ||
-        (search_charge != 0 && charge != search_charge) || charge > max_charge) {
+    if (skipSpecCharge(*my_data, *sc, max_charge)) {
       continue;
     }
     // The active peptide queue holds the candidate peptides for spectrum.
     // Calculate and set the window, depending on the window type.
-    vector<double>* min_mass = new vector<double>();
-    vector<double>* max_mass = new vector<double>();
-    vector<bool>* candidatePeptideStatus = new vector<bool>();
+    vector<double>* min_mass = &min_mass_buffer;
+    vector<double>* max_mass = &max_mass_buffer;
+    vector<bool>* candidatePeptideStatus = &candidate_status_buffer;
+    min_mass->clear();
+    max_mass->clear();
+    candidatePeptideStatus->clear();
     double min_range, max_range;
     computeWindow(*sc, window_type, precursor_window, max_charge,
                   negative_isotope_errors, min_mass, max_mass, &min_range, &max_range);
@@ -587,32 +874,64 @@ void TideSearchApplication::search(void* threadarg) {
     if (curScoreFunction == XCORR_SCORE && !exact_pval_search_) {  //execute original tide-search program
       // Normalize the observed spectrum and compute the cache of
       // frequently-needed values for taking dot products with theoretical
-      // spectra.
-      observed.PreprocessSpectrum(*spectrum, charge, &num_range_skipped,
-                                  &num_precursors_skipped,
-                                  &num_isotopes_skipped, &num_retained);
+      // spectra. In batch mode this spectrum and the next few are scored
+      // together when the first of them is reached.
+      stats->Switch(SearchStats::PREPROCESS);
+      if (batch == NULL) {
+        observed.PreprocessSpectrum(*spectrum, charge, &num_range_skipped,
+                                    &num_precursors_skipped,
+                                    &num_isotopes_skipped, &num_retained);
+      } else if (batch->Member(&*sc) < 0) {
+        fillBatch(batch, *my_data, block_pos - 1, block_end, max_charge,
+                  &num_range_skipped, &num_precursors_skipped,
+                  &num_isotopes_skipped, &num_retained);
+      }
+      stats->Switch(SearchStats::WINDOW);
       int nCandPeptide = active_peptide_queue->SetActiveRange(
         min_mass, max_mass, min_range, max_range, candidatePeptideStatus);
+      stats->CountWindow(candidatePeptideStatus->size(), nCandPeptide);
       if (nCandPeptide == 0) {
         continue;
       }
-      locks_array[LOCK_CANDIDATES]->lock();
+      stats->Lock(locks_array[LOCK_CANDIDATES], LOCK_CANDIDATES);
       *total_candidate_peptides += nCandPeptide;
       locks_array[LOCK_CANDIDATES]->unlock();
 
       int candidatePeptideStatusSize = candidatePeptideStatus->size();
-      TideMatchSet::Arr2 match_arr2(candidatePeptideStatusSize); // Scored peptides will go here.
+      TideMatchSet::Arr2 match_arr2; // Scored peptides will go here.
+      match_arr2.Init(&arena, candidatePeptideStatusSize);
 
       // Programs for taking the dot-product with the observed spectrum are laid
       // out in memory managed by the active_peptide_queue, one program for each
       // candidate peptide. The programs will store the results directly into
       // match_arr. We now pass control to those programs.
-      collectScoresCompiled(active_peptide_queue, spectrum, observed, &match_arr2,
+      stats->Switch(SearchStats::SCORE);
+      if (batch != NULL) {
+        collectScoresBatch(active_peptide_queue, *batch, batch->Member(&*sc),
+                           &match_arr2, candidatePeptideStatusSize, charge);
+      } else if (fragment_index_ != NULL && !peptide_centric &&
+                 nCandPeptide > config->fragment_index_top_n) {
+        collectScoresPreselected(active_peptide_queue, spectrum, observed,
+                                 *candidatePeptideStatus,
+                                 config->fragment_index_top_n, &match_arr2,
+                                 candidatePeptideStatusSize, charge,
+                                 &preselect_bins, &preselect_counts,
+                                 &preselect_selected);
+      } else if (config->xcorr_scoring == SearchConfig::XCORR_SPARSE) {
+        collectScoresSparse(active_peptide_queue, observed, &match_arr2,
                             candidatePeptideStatusSize, charge);
+      } else if (config->xcorr_scoring == SearchConfig::XCORR_PORTABLE) {
+        collectScoresPortable(active_peptide_queue, observed, &match_arr2,
+                              candidatePeptideStatusSize, charge);
+      } else {
+        collectScoresCompiled(active_peptide_queue, spectrum, observed, &match_arr2,
+                              candidatePeptideStatusSize, charge);
+      }
 
       // matches will arrange the results in a heap by score, return the top
       // few, and recover the association between counter and peptide. We output
       // the top matches.
+      stats->Switch(SearchStats::REPORT);
       if (peptide_centric) {
         deque<Peptide*>::const_iterator iter_ = active_peptide_queue->iter_;
         TideMatchSet::Arr2::iterator it = match_arr2.begin();
@@ -623,7 +942,8 @@ void TideSearchApplication::search(void* threadarg) {
           }
         }
       } else {  //spectrum centric match report.
-        TideMatchSet::Arr match_arr(nCandPeptide);
+        TideMatchSet::Arr match_arr;
+        match_arr.Init(&arena, nCandPeptide);
         for (TideMatchSet::Arr2::iterator it = match_arr2.begin();
              it != match_arr2.end();
              ++it) {
@@ -636,25 +956,30 @@ void TideSearchApplication::search(void* threadarg) {
           }
         }
 
-        TideMatchSet matches(&match_arr, highest_mz);
+        TideMatchSet matches(&match_arr, highest_mz, config);
         matches.exact_pval_search_ = exact_pval_search;
         matches.cur_score_function_ = curScoreFunction;
+        matches.sp_scorer_ = sp_scorer;
 
-        matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
+        matches.report(my_data->result_writer, top_matches, numDecoys, spectrum_filename,
                        spectrum, charge, active_peptide_queue, proteins,
-                       locations, compute_sp, true, locks_array[LOCK_RESULTS]);
+                       locations, compute_sp, true);
+        my_data->result_writer->EndSpectrum(block_pos - 1);
       }  //end peptide_centric == false
     } else { //This runs curScoreFunction=BOTH_SCORE, curScoreFunction=RESIUDUE_EVIDENCE_MATRIX, and xcorr p-val
 
+      stats->Switch(SearchStats::WINDOW);
       int nCandPeptide = active_peptide_queue->SetActiveRangeBIons(min_mass, max_mass, min_range, max_range, candidatePeptideStatus);
       int candidatePeptideStatusSize = candidatePeptideStatus->size();
+      stats->CountWindow(candidatePeptideStatusSize, nCandPeptide);
       if (nCandPeptide == 0) {
         continue;
       }
 
-      locks_array[LOCK_CANDIDATES]->lock();
+      stats->Lock(locks_array[LOCK_CANDIDATES], LOCK_CANDIDATES);
       *total_candidate_peptides += nCandPeptide;
       locks_array[LOCK_CANDIDATES]->unlock();
+      stats->Switch(SearchStats::PREPROCESS);
 
       //TODO so this includes ALL amino acids seen (including modified, NTerm mod, CTerm Mod)
       //as a result -- we will look for NTerm mod amino acids throughout spectrum instead of
@@ -667,8 +992,8 @@ void TideSearchApplication::search(void* threadarg) {
         }
       }
       int maxPrecurMassBin = floor(MaxBin::Global().CacheBinEnd() + 50.0);
-      double fragTol = Params::GetDouble("fragment-tolerance");
-      int granularityScale = Params::GetInt("evidence-granularity");
+      double fragTol = config->fragment_tolerance;
+      int granularityScale = config->evidence_granularity;
 
       //TODO look at this
       int minDeltaMass;
@@ -681,7 +1006,8 @@ void TideSearchApplication::search(void* threadarg) {
         maxDeltaMass = aaMassInt[nAARes - 1];
       }
 
-      TideMatchSet::Arr match_arr(nCandPeptide); // scored peptides will go here.
+      TideMatchSet::Arr match_arr; // scored peptides will go here.
+      match_arr.Init(&arena, nCandPeptide);
 
       // iterators needed at multiple places in following code
       deque<Peptide*>::const_iterator iter_ = active_peptide_queue->iter_;
@@ -715,10 +1041,10 @@ void TideSearchApplication::search(void* threadarg) {
       int nPepMassIntUniq = (int)pepMassIntUnique.size();
 
       //XCORR
-      vector< vector<int> > evidenceObs(nPepMassIntUniq, vector<int>(maxPrecurMassBin, 0));
-      int* scoreOffsetObs = new int[nPepMassIntUniq];
-      double** pValueScoreObs = new double*[nPepMassIntUniq];
-      int* intensArrayTheor = new int [maxPrecurMassBin]; // initialized later in loop
+      evidenceObs.resize(nPepMassIntUniq);
+      int* scoreOffsetObs = arenaArray<int>(&arena, nPepMassIntUniq);
+      double** pValueScoreObs = arenaArray<double*>(&arena, nPepMassIntUniq);
+      int* intensArrayTheor = arenaArray<int>(&arena, maxPrecurMassBin); // initialized later in loop
       //END XCORR
 
       //RES-EV
@@ -726,8 +1052,7 @@ void TideSearchApplication::search(void* threadarg) {
       //nPepMassIntUniq: number of mass bins candidate are in
       //nAARes: number of amino acids
       //maxPrecurMassBin: max number of mass bins
-      vector<vector<vector<double> > > residueEvidenceMatrix(nPepMassIntUniq,
-	      vector<vector<double> >(nAARes, vector<double>(maxPrecurMassBin, 0)));
+      residueEvidenceMatrix.resize(nPepMassIntUniq);
 
       //Stores the score offset needed calculating res-ev p-values
       vector<int> scoreResidueOffsetObs(maxPrecurMassBin, -1);
@@ -760,6 +1085,24 @@ void TideSearchApplication::search(void* threadarg) {
       }
 
       map<int, bool> calcDPMatrix; //for each precursor mass bin, bool determines whether to calc DP matrix
+
+      //The residue evidence matrix depends only on the spectrum, so it is
+      //computed once and truncated for each mass bin
+      if (curScoreFunction != XCORR_SCORE && nPepMassIntUniq > 0) {
+        // note: aaMassDouble differs from aaMass
+        // aaMassDouble contains amino acids masses in float form
+        // aaMass contains amino acid asses in integer form
+        // precursorMass is the neutral mass
+        spectrumResidueEvidenceMatrix.resize(nAARes);
+        for (int i = 0; i < nAARes; i++) {
+          spectrumResidueEvidenceMatrix[i].assign(maxPrecurMassBin, 0);
+        }
+        observed.CreateResidueEvidenceMatrix(*spectrum, charge, maxPrecurMassBin, precursorMass,
+                                             nAARes, aaMassDouble, fragTol, granularityScale,
+                                             nTermMass, cTermMass,&num_range_skipped, 
+                                             &num_precursors_skipped, &num_isotopes_skipped, &num_retained,
+                                             spectrumResidueEvidenceMatrix);
+      }
       //END RES-EV
 
       //Create a residue evidence matrix and evidence vector
@@ -774,34 +1117,26 @@ void TideSearchApplication::search(void* threadarg) {
           double pepMassMonoMean = (pepMaInt - 0.5 + bin_offset_) * bin_width_;
           evidenceObs[pe] = spectrum->CreateEvidenceVectorDiscretized(
             bin_width, bin_offset, charge, pepMassMonoMean, maxPrecurMassBin,
-            &num_range_skipped, &num_precursors_skipped, &num_isotopes_skipped, &num_retained);
+            &num_range_skipped, &num_precursors_skipped, &num_isotopes_skipped, &num_retained,
+            config);
         }
         //END XCORR
 
         //RES-EV
         if (curScoreFunction != XCORR_SCORE) {
-          // note: aaMassDouble differs from aaMass
-          // aaMassDouble contains amino acids masses in float form
-          // aaMass contains amino acid asses in integer form
-          // precursorMass is the neutral mass
-          observed.CreateResidueEvidenceMatrix(*spectrum, charge, maxPrecurMassBin, precursorMass,
-                                               nAARes, aaMassDouble, fragTol, granularityScale,
-                                               nTermMass, cTermMass,&num_range_skipped, 
-                                               &num_precursors_skipped, &num_isotopes_skipped, &num_retained,
-                                               residueEvidenceMatrix[pe]);
-          vector<vector<double> > curResidueEvidenceMatrix = residueEvidenceMatrix[pe];
-
           //Get rid of values larger than curPepMassInt
           int curPepMassInt = pepMassIntUnique[pe];
-          for (int i = 0; i < curResidueEvidenceMatrix.size(); i++) {
-            curResidueEvidenceMatrix[i].resize(curPepMassInt);
+          residueEvidenceMatrix[pe].resize(nAARes);
+          for (int i = 0; i < nAARes; i++) {
+            residueEvidenceMatrix[pe][i].assign(spectrumResidueEvidenceMatrix[i].begin(),
+                                                spectrumResidueEvidenceMatrix[i].begin() + curPepMassInt);
           }
-          residueEvidenceMatrix[pe] = curResidueEvidenceMatrix;
           calcDPMatrix[curPepMassInt] = false;
         }
         //END RES-Ev
       }
 
+      stats->Switch(SearchStats::SCORE);
       //Calculates a residue evidence score and a xcorr score
       //between a spectrum and all possible peptide candidates
       //based upon the residue evidence matrix and the theoretical spectrum
@@ -845,17 +1180,10 @@ void TideSearchApplication::search(void* threadarg) {
 
           //RES-EV
           if (curScoreFunction != XCORR_SCORE) {
-            vector<vector<double> > curResidueEvidenceMatrix = residueEvidenceMatrix[pepMassIntIdx];
+            const vector<vector<double> >& curResidueEvidenceMatrix = residueEvidenceMatrix[pepMassIntIdx];
             Peptide* curPeptide = (*iter_);
 
-            vector<unsigned int> intensArrayTheorResEv;
-            for (vector<unsigned int>::const_iterator iter_uint = iter1_->unordered_peak_list_.begin();
-                 iter_uint != iter1_->unordered_peak_list_.end();
-                 iter_uint++) {
-              intensArrayTheorResEv.push_back(*iter_uint);
-            }
-
-            scoreResidueEvidence = calcResEvScore(curResidueEvidenceMatrix,intensArrayTheorResEv,aaMassDouble,curPeptide);
+            scoreResidueEvidence = calcResEvScore(curResidueEvidenceMatrix,iter1_->unordered_peak_list_,aaMassDouble,curPeptide);
             resEvScores.push_back(scoreResidueEvidence);
 
             if (scoreResidueEvidence > 0) { // if > 0, set bool to true to create DP matrix
@@ -876,6 +1204,7 @@ void TideSearchApplication::search(void* threadarg) {
         assert(xcorrScores.size() == nCandPeptide);
       }
 
+      stats->Switch(SearchStats::PVALUE);
       //XCORR
       //Create a dynamic programming vector is there is a xcorr
       //and if user specified as a score function either 'xcorr' or 'both'
@@ -905,12 +1234,12 @@ void TideSearchApplication::search(void* threadarg) {
           int bottomRowBuffer = maxEvidence + 1;
           int topRowBuffer = -minEvidence;
           int nRowDynProg = bottomRowBuffer - minScore + 1 + maxScore + topRowBuffer;
-          pValueScoreObs[pe] = new double[nRowDynProg];
+          pValueScoreObs[pe] = arenaArray<double>(&arena, nRowDynProg);
 
           scoreOffsetObs[pe] = calcScoreCount(maxPrecurMassBin, &evidenceObs[pe][0], pepMaInt,
                                maxEvidence, minEvidence, maxScore, minScore,
                                nAA, aaFreqN, aaFreqI, aaFreqC, aaMass,
-                               pValueScoreObs[pe]);
+                               pValueScoreObs[pe], &scoreCountMatrix);
         }
       }
       //END XCORR
@@ -919,13 +1248,19 @@ void TideSearchApplication::search(void* threadarg) {
       //Create dyanamic programming matrix if there is a res-ev score greater than 0
       //and if user specified as a score function either 'residue-evidence matrix' or 'both'
       if (curScoreFunction != XCORR_SCORE) {
+        //One dynamic programming matrix, up to the heaviest of these bins,
+        //gives the score counts for all of them
+        vector<int> dpPepMassInt;
+        vector<int> dpMaxEvidence;
+        vector<int> dpMaxScore;
+        int dpLast = -1;
         for (pe=0 ; pe<nPepMassIntUniq ; pe++) {
           int curPepMassInt = pepMassIntUnique[pe];
           if (calcDPMatrix[curPepMassInt] == false) {
             continue;
           }
 
-          vector<vector<double> > curResidueEvidenceMatrix = residueEvidenceMatrix[pe];
+          const vector<vector<double> >& curResidueEvidenceMatrix = residueEvidenceMatrix[pe];
           vector<int> maxColEvidence(curPepMassInt,0);
 
           //maxColEvidence is edited by reference
@@ -938,13 +1273,25 @@ void TideSearchApplication::search(void* threadarg) {
             maxScore += maxColEvidence[i];
           }
 
-          int scoreOffset;
-          vector<double> scoreResidueCount;
+          dpPepMassInt.push_back(curPepMassInt);
+          dpMaxEvidence.push_back(maxEvidence);
+          dpMaxScore.push_back(maxScore);
+          dpLast = pe;
+        }
 
-          calcResidueScoreCount(nAARes,curPepMassInt,curResidueEvidenceMatrix,aaMassInt,
+        vector<int> dpScoreOffset;
+        vector<vector<double> > dpScoreCount;
+        if (dpLast >= 0) {
+          calcResidueScoreCount(nAARes,dpPepMassInt,residueEvidenceMatrix[dpLast],aaMassInt,
                                 dAAFreqN, dAAFreqI, dAAFreqC,nTermMassBin,cTermMassBin,
-                                minDeltaMass,maxDeltaMass,maxEvidence,maxScore,
-                                scoreResidueCount,scoreOffset);
+                                minDeltaMass,maxDeltaMass,dpMaxEvidence,dpMaxScore,
+                                dpScoreCount,dpScoreOffset,&scoreCountMatrix);
+        }
+
+        for (int bin = 0; bin < dpPepMassInt.size(); bin++) {
+          int curPepMassInt = dpPepMassInt[bin];
+          int scoreOffset = dpScoreOffset[bin];
+          vector<double>& scoreResidueCount = dpScoreCount[bin];
           scoreResidueOffsetObs[curPepMassInt] = scoreOffset;
 
           double totalCount = 0;
@@ -958,7 +1305,7 @@ void TideSearchApplication::search(void* threadarg) {
             //Avoid potential underflow
             scoreResidueCount[i] = exp(log(scoreResidueCount[i]) - log(totalCount));
           }
-          pValuesResidueObs[curPepMassInt] = scoreResidueCount;
+          pValuesResidueObs[curPepMassInt].swap(scoreResidueCount);
         }
       }
       //END RES-EV
@@ -1040,43 +1387,40 @@ void TideSearchApplication::search(void* threadarg) {
         ++iter1_;
       }
 
-      //clean up
-      if (curScoreFunction != RESIDUE_EVIDENCE_MATRIX) {
-        for (pe = 0; pe < nPepMassIntUniq; pe++) {
-          delete [] pValueScoreObs[pe];
-        }
-      }
-      delete [] scoreOffsetObs;
-      delete [] pValueScoreObs;
-      delete [] intensArrayTheor;
-
+      stats->Switch(SearchStats::REPORT);
       if (!peptide_centric) {
         // below text is copied from text above in the exact-p-value XCORR case
         // matches will arrange the results in a heap by score, return the top
         // few, and recover the association between counter and peptide. We output
         // the top matches.
-        TideMatchSet matches(&match_arr, highest_mz);
+        TideMatchSet matches(&match_arr, highest_mz, config);
         matches.exact_pval_search_ = exact_pval_search_;
         matches.cur_score_function_ = curScoreFunction;
+        matches.sp_scorer_ = sp_scorer;
 
         if (curScoreFunction == RESIDUE_EVIDENCE_MATRIX && exact_pval_search_ == false) {
-          matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
+          matches.report(my_data->result_writer, top_matches, numDecoys, spectrum_filename,
                          spectrum, charge, active_peptide_queue, proteins,
-                         locations, compute_sp, true, locks_array[LOCK_RESULTS]);
+                         locations, compute_sp, true);
         } else {
-          matches.report(target_file, decoy_file, top_matches, numDecoys, spectrum_filename,
+          matches.report(my_data->result_writer, top_matches, numDecoys, spectrum_filename,
                          spectrum, charge, active_peptide_queue, proteins,
-                         locations, compute_sp, false, locks_array[LOCK_RESULTS]);
+                         locations, compute_sp, false);
         }
+        my_data->result_writer->EndSpectrum(block_pos - 1);
       } //end peptide_centric == false
     }
-    delete min_mass;
-    delete max_mass;
-    delete candidatePeptideStatus;
   }
 
-  if (!Params::GetBool("skip-preprocessing")) {
-    locks_array[LOCK_REPORTING]->lock();
+  stats->Switch(SearchStats::OTHER);
+  active_peptide_queue->Finish();
+  active_peptide_queue->CountFifoPages(stats);
+  stats->CountFifoPages(arena.PagesMapped(), arena.PageSwitches());
+  delete batch;
+  delete sp_scorer;
+
+  if (!config->skip_preprocessing) {
+    stats->Lock(locks_array[LOCK_REPORTING], LOCK_REPORTING);
     if (curScoreFunction == BOTH_SCORE) {
       num_precursors_skipped = num_precursors_skipped / 2;
       num_isotopes_skipped = num_isotopes_skipped / 2;
@@ -1100,6 +1444,7 @@ void TideSearchApplication::search(void* threadarg) {
     }
     locks_array[LOCK_REPORTING]->unlock();
   }
+  stats->Finish();
 }
 
 void TideSearchApplication::search(
@@ -1143,13 +1488,16 @@ void TideSearchApplication::search(
     locks_array.push_back(new boost::mutex());
   }
 
-  int elution_window = Params::GetInt("elution-window-size");
-  bool peptide_centric = Params::GetBool("peptide-centric-search");
+  // Parameters used for every spectrum or match, looked up once
+  SearchConfig config;
+  int elution_window = config.elution_window_size;
+  bool peptide_centric = config.peptide_centric_search;
 
   // initialize fields required for output
   int* sc_index = new int(-1);
   int* total_candidate_peptides = new int(0);
   FLOAT_T sc_total = (FLOAT_T)spec_charges->size();
+  SpecChargeScheduler scheduler(spec_charges->size(), NUM_THREADS);
 
   if (peptide_centric == false) {
     elution_window = 0;
@@ -1174,8 +1522,30 @@ void TideSearchApplication::search(
 
   for (int i = 0; i < NUM_THREADS; i++) {
     active_peptide_queue[i]->SetOutputs(
-      NULL, &locations, top_matches, compute_sp, target_file, decoy_file, highest_mz);
+      NULL, &locations, top_matches, compute_sp, target_file, decoy_file, highest_mz,
+      &config);
+  }
+
+  // Each thread buffers its own spectrum-centric results. With
+  // deterministic-output they are kept apart until the search is done, and
+  // then written in the order of the spectrum-charges.
+  bool deterministic = Params::GetBool("deterministic-output") && NUM_THREADS > 1;
+  vector<TideResultWriter*> result_writers;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    string spool_file = deterministic
+      ? make_file_path("tide-search.results." + StringUtils::ToString(i) + ".tmp") : "";
+    result_writers.push_back(new TideResultWriter(target_file, decoy_file,
+                                                  locks_array[LOCK_RESULTS], spool_file));
+  }
+
+  // Per-thread stats, collected only if search-stats is set
+  vector<SearchStats*> thread_stats;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    thread_stats.push_back(new SearchStats(stats_file_ != NULL));
+    active_peptide_queue[i]->SetStats(thread_stats[i]);
+    result_writers[i]->SetStats(thread_stats[i], LOCK_RESULTS);
   }
+  double search_start = wall_clock();
 
   // Creating structs to hold information required for each thread to search through
   // a spec charge
@@ -1189,7 +1559,8 @@ void TideSearchApplication::search(
       i, NUM_THREADS, nAA, aaFreqN, aaFreqI, aaFreqC, aaMass,
       nAARes, &dAAFreqN, &dAAFreqI, &dAAFreqC, &dAAMass,
       &mod_table, &nterm_mod_table, &cterm_mod_table, numDecoys, locks_array, //TODO do I need to delete pointer somewhere?
-      bin_width_, bin_offset_, exact_pval_search_, spectrum_flag_, sc_index, total_candidate_peptides, negative_isotope_errors));
+      bin_width_, bin_offset_, exact_pval_search_, spectrum_flag_, sc_index, total_candidate_peptides, negative_isotope_errors,
+      &scheduler, result_writers[i], &config, thread_stats[i]));
   }
 
   boost::thread_group threadgroup;
@@ -1206,6 +1577,43 @@ void TideSearchApplication::search(
   // Join threads
   threadgroup.join_all();
 
+  for (int i = 0; i < NUM_THREADS; i++) {
+    result_writers[i]->Flush();
+  }
+  if (deterministic) {
+    TideResultWriter::Merge(result_writers, target_file, decoy_file);
+  }
+  for (int i = 0; i < NUM_THREADS; i++) {
+    delete result_writers[i];
+  }
+  if (stats_file_) {
+    static const char* const kLockNames[NUMBER_LOCK_TYPES] = {
+      "results", "cascade", "candidates", "reporting"
+    };
+    // Peptides drawn from a shared source are allocated by the source
+    SearchStats shared_stats(false);
+    if (active_peptide_queue[0]->SharedSource() != NULL) {
+      active_peptide_queue[0]->SharedSource()->CountFifoPages(&shared_stats);
+    }
+    *stats_file_ << (stats_entries_++ > 0 ? ",\n" : "\n");
+    SearchStats::WriteJson(stats_file_, spectrum_filename,
+                           (wall_clock() - search_start) / 1e6, thread_stats,
+                           shared_stats,
+                           vector<string>(kLockNames, kLockNames + NUMBER_LOCK_TYPES));
+    stats_file_->flush();
+  }
+  for (int i = 0; i < NUM_THREADS; i++) {
+    active_peptide_queue[i]->SetStats(NULL);
+    delete thread_stats[i];
+  }
+  // The results may be converted to other formats as soon as this returns
+  if (target_file) {
+    target_file->flush();
+  }
+  if (decoy_file) {
+    decoy_file->flush();
+  }
+
   carp(CARP_INFO, "Time per spectrum-charge combination: %lf s.", wall_clock() / (1e6*sc_total));
   carp(CARP_INFO, "Average number of candidates per spectrum-charge combination: %lf ",
                   (*total_candidate_peptides) / sc_total);
@@ -1217,6 +1625,36 @@ void TideSearchApplication::search(
 
 }
 
+TideSearchApplication::SpecChargeScheduler::SpecChargeScheduler(
+  size_t num_spec_charges,
+  int num_threads
+) : next_(0), size_(num_spec_charges), num_threads_(num_threads) {
+}
+
+bool TideSearchApplication::SpecChargeScheduler::NextBlock(
+  size_t* begin,
+  size_t* end
+) {
+  // Largest block handed out at once; keeps the threads close enough in mass
+  // that a shared peptide window stays small.
+  const size_t MAX_BLOCK_SIZE = 64;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  if (next_ >= size_) {
+    return false;
+  }
+  size_t block_size = (size_ - next_) / (2 * num_threads_);
+  if (block_size < 1) {
+    block_size = 1;
+  } else if (block_size > MAX_BLOCK_SIZE) {
+    block_size = MAX_BLOCK_SIZE;
+  }
+  *begin = next_;
+  next_ = min(size_, next_ + block_size);
+  *end = next_;
+  return true;
+}
+
 void TideSearchApplication::collectScoresCompiled(
   ActivePeptideQueue* active_peptide_queue,
   const Spectrum* spectrum,
@@ -1301,6 +1739,9 @@ void TideSearchApplication::collectScoresCompiled(
     pop ecx
   }
 #endif
+#elif !defined(__i386__) && !defined(__x86_64__)
+  carp(CARP_FATAL, "Compiled XCorr scoring requires an x86 processor. "
+                   "Use --xcorr-scoring portable instead.");
 #else
   __asm__ __volatile__("cld\n" // stos operations increment edi
 #ifdef __x86_64__
@@ -1329,6 +1770,197 @@ void TideSearchApplication::collectScoresCompiled(
   match_arr->set_size(queue_size);
 }
 
+void TideSearchApplication::collectScoresPortable(
+  ActivePeptideQueue* active_peptide_queue,
+  const ObservedPeakSet& observed,
+  TideMatchSet::Arr2* match_arr,
+  int queue_size,
+  int charge
+) {
+  // Produces the same (score, counter) pairs as collectScoresCompiled, but
+  // runs each peptide's portable program in turn (see compiler.h).
+  const int* cache = observed.GetCache();
+  pair<int, int>* results = match_arr->data();
+  deque<Peptide*>::const_iterator iter = active_peptide_queue->iter_;
+  for (int counter = queue_size; counter > 0; --counter, ++iter, ++results) {
+    results->first = TheoreticalPeakCompiler::RunPortable((*iter)->Prog(charge), cache);
+    results->second = counter;
+  }
+  match_arr->set_size(queue_size);
+}
+
+void TideSearchApplication::collectScoresSparse(
+  ActivePeptideQueue* active_peptide_queue,
+  const ObservedPeakSet& observed,
+  TideMatchSet::Arr2* match_arr,
+  int queue_size,
+  int charge
+) {
+  const int* codes = observed.SparseCodes();
+  const int* values = observed.SparseValues();
+  int size = observed.SparseSize();
+  pair<int, int>* results = match_arr->data();
+  deque<Peptide*>::const_iterator iter = active_peptide_queue->iter_;
+  for (int counter = queue_size; counter > 0; --counter, ++iter, ++results) {
+    results->first = TheoreticalPeakCompiler::RunSparse((*iter)->Prog(charge), codes, values, size);
+    results->second = counter;
+  }
+  match_arr->set_size(queue_size);
+}
+
+void TideSearchApplication::collectScoresPreselected(
+  ActivePeptideQueue* active_peptide_queue,
+  const Spectrum* spectrum,
+  const ObservedPeakSet& observed,
+  const vector<bool>& candidatePeptideStatus,
+  int top_n,
+  TideMatchSet::Arr2* match_arr,
+  int queue_size,
+  int charge,
+  vector<int>* bins,
+  vector<int>* counts,
+  vector<pair<int, int> >* selected
+) {
+  // Fragment bins of the observed peaks, which are in order of m/z.
+  bins->clear();
+  for (int i = 0; i < spectrum->Size(); ++i) {
+    int bin = FragmentIndex::Bin(spectrum->M_Z(i));
+    if (bins->empty() || bins->back() != bin) {
+      bins->push_back(bin);
+    }
+  }
+  long begin = active_peptide_queue->Position(active_peptide_queue->iter_);
+  fragment_index_->CountShared(*bins, begin, begin + queue_size, counts);
+
+  // Candidates by decreasing count, then by position, so that ties are broken
+  // the same way on every run.
+  selected->clear();
+  for (int i = 0; i < queue_size; ++i) {
+    if (candidatePeptideStatus[i]) {
+      selected->push_back(make_pair(-(*counts)[i], i));
+    }
+  }
+  if ((int)selected->size() > top_n) {
+    nth_element(selected->begin(), selected->begin() + top_n, selected->end());
+    selected->resize(top_n);
+  }
+
+  // Same (score, counter) pairs as collectScoresPortable, for the selected
+  // candidates only.
+  pair<int, int>* results = match_arr->data();
+  for (vector<pair<int, int> >::const_iterator i = selected->begin();
+       i != selected->end(); ++i, ++results) {
+    const void* prog = active_peptide_queue->PeptideAt(begin + i->second)->Prog(charge);
+    results->first = observed.Sparse() ?
+      TheoreticalPeakCompiler::RunSparse(prog, observed.SparseCodes(),
+                                         observed.SparseValues(), observed.SparseSize()) :
+      TheoreticalPeakCompiler::RunPortable(prog, observed.GetCache());
+    results->second = queue_size - i->second;
+  }
+  match_arr->set_size(selected->size());
+}
+
+bool TideSearchApplication::skipSpecCharge(
+  const thread_data& data,
+  const SpectrumCollection::SpecCharge& sc,
+  int max_charge
+) const {
+  const Spectrum* spectrum = sc.spectrum;
+  double precursor_mz = spectrum->PrecursorMZ();
+  int scan_num = spectrum->SpectrumNumber();
+  return precursor_mz < data.spectrum_min_mz || precursor_mz > data.spectrum_max_mz ||
+         scan_num < data.min_scan || scan_num > data.max_scan ||
+         spectrum->Size() < data.min_peaks ||
+         (data.search_charge != 0 && sc.charge != data.search_charge) ||
+         sc.charge > max_charge;
+}
+
+void TideSearchApplication::fillBatch(
+  SpectrumBatch* batch,
+  const thread_data& data,
+  size_t first,
+  size_t end,
+  int max_charge,
+  long int* num_range_skipped,
+  long int* num_precursors_skipped,
+  long int* num_isotopes_skipped,
+  long int* num_retained
+) {
+  // The batch starts with spectrum-charge first and takes the following ones
+  // in [first, end) that will be searched and that use the same programs
+  // (see Peptide::Prog()).
+  const vector<SpectrumCollection::SpecCharge>& spec_charges = *data.spec_charges;
+  bool high_charge = spec_charges[first].charge > 2;
+  double batch_min_mass = 0, batch_max_mass = 0;
+  double batch_min_range = 0, batch_max_range = 0;
+  batch->Clear();
+  for (size_t i = first; i < end && !batch->Full(); ++i) {
+    const SpectrumCollection::SpecCharge& sc = spec_charges[i];
+    if ((sc.charge > 2) != high_charge ||
+        (i > first && skipSpecCharge(data, sc, max_charge))) {
+      continue;
+    }
+    vector<double> min_mass, max_mass;
+    double min_range, max_range;
+    computeWindow(sc, data.window_type, data.precursor_window, max_charge,
+                  data.negative_isotope_errors, &min_mass, &max_mass,
+                  &min_range, &max_range);
+    if (batch->Size() == 0) {
+      batch_min_mass = min_mass.front();
+      batch_max_mass = max_mass.back();
+      batch_min_range = min_range;
+      batch_max_range = max_range;
+    } else {
+      batch_min_mass = min(batch_min_mass, min_mass.front());
+      batch_max_mass = max(batch_max_mass, max_mass.back());
+      batch_min_range = min(batch_min_range, min_range);
+      batch_max_range = max(batch_max_range, max_range);
+    }
+    batch->Add(&sc, *sc.spectrum, sc.charge, num_range_skipped,
+               num_precursors_skipped, num_isotopes_skipped, num_retained);
+  }
+
+  // Load every peptide that any member may need and score them all at once.
+  ActivePeptideQueue* active_peptide_queue = data.active_peptide_queue;
+  vector<double> min_mass(1, batch_min_mass);
+  vector<double> max_mass(1, batch_max_mass);
+  vector<bool> candidatePeptideStatus;
+  data.stats->Switch(SearchStats::WINDOW);
+  active_peptide_queue->SetActiveRange(&min_mass, &max_mass, batch_min_range,
+                                       batch_max_range, &candidatePeptideStatus);
+  if (!active_peptide_queue->HasNext()) {
+    return;
+  }
+  data.stats->Switch(SearchStats::SCORE);
+  batch->Score(active_peptide_queue, spec_charges[first].charge,
+               active_peptide_queue->Position(active_peptide_queue->iter_),
+               active_peptide_queue->Position(active_peptide_queue->end_));
+}
+
+void TideSearchApplication::collectScoresBatch(
+  ActivePeptideQueue* active_peptide_queue,
+  const SpectrumBatch& batch,
+  int member,
+  TideMatchSet::Arr2* match_arr,
+  int queue_size,
+  int charge
+) {
+  // Same (score, counter) pairs as collectScoresCompiled. Peptides outside
+  // the range scored for the batch are scored individually.
+  pair<int, int>* results = match_arr->data();
+  long position = active_peptide_queue->Position(active_peptide_queue->iter_);
+  for (int counter = queue_size; counter > 0; --counter, ++position, ++results) {
+    if (batch.Covers(position)) {
+      results->first = batch.GetScore(member, position);
+    } else {
+      results->first = TheoreticalPeakCompiler::RunPortable(
+        active_peptide_queue->PeptideAt(position)->Prog(charge), batch.GetCache(member));
+    }
+    results->second = counter;
+  }
+  match_arr->set_size(queue_size);
+}
+
 void TideSearchApplication::convertResults() const {
   PSMConvertApplication converter;
   if (!Params::GetBool("concat")) {
@@ -1484,10 +2116,12 @@ vector<string> TideSearchApplication::getOptions() const {
     "compute-sp",
     "concat",
     "deisotope",
+    "deterministic-output",
     "elution-window-size",
     "exact-p-value",
     "file-column",
     "fileroot",
+    "fragment-index-top-n",
     "isotope-error",
     "mass-precision",
     "max-precursor-charge",
@@ -1506,6 +2140,7 @@ vector<string> TideSearchApplication::getOptions() const {
     "evidence-granularity",
     "pepxml-output",
     "pin-output",
+    "pipeline-spectra",
     "pm-charge",
     "pm-max-frag-mz",
     "pm-max-precursor-delta-ppm",
@@ -1525,7 +2160,10 @@ vector<string> TideSearchApplication::getOptions() const {
     "remove-precursor-peak",
     "remove-precursor-tolerance",
     "scan-number",
+    "search-stats",
     "skip-preprocessing",
+    "spectrum-batch-size",
+    "spectrum-cache-dir",
     "spectrum-charge",
     "spectrum-max-mz",
     "spectrum-min-mz",
@@ -1538,7 +2176,8 @@ vector<string> TideSearchApplication::getOptions() const {
     "use-flanking-peaks",
     "use-neutral-loss-peaks",
     "use-z-line",
-    "verbosity"
+    "verbosity",
+    "xcorr-scoring"
   };
   return vector<string>(arr, arr + sizeof(arr) / sizeof(string));
 }
@@ -1559,6 +2198,10 @@ vector< pair<string, string> > TideSearchApplication::getOutputs() const {
   outputs.push_back(make_pair("tide-search.log.txt",
     "a log file containing a copy of all messages that were printed to the "
     "screen during execution."));
+  outputs.push_back(make_pair("tide-search.stats.json",
+    "a JSON file giving, for each spectrum file searched, the time spent in each "
+    "stage of the search by each thread, along with window sizes and lock waits. "
+    "This file will only be created if search-stats is set."));
   return outputs;
 }
 bool TideSearchApplication::needsOutputDirectory() const {
@@ -1587,7 +2230,8 @@ int TideSearchApplication::calcScoreCount(
   double* aaFreqI,
   double* aaFreqC,
   int* aaMass,
-  double* pValueScoreObs
+  double* pValueScoreObs,
+  ScoreCountMatrix* dynProg
 ) {
   const int nDeltaMass = nAA;
   int minDeltaMass = aaMass[0];
@@ -1599,8 +2243,6 @@ int TideSearchApplication::calcScoreCount(
   int ma;
   int evidence;
   int de;
-  int evidenceRow;
-  double sumScore;
 
   int bottomRowBuffer = maxEvidence + 1;
   int topRowBuffer = -minEvidence;
@@ -1618,91 +2260,52 @@ int TideSearchApplication::calcScoreCount(
   int initCountRow = bottomRowBuffer - minScore;
   int initCountCol = maxDeltaMass + colStart;
 
-  double** dynProgArray = new double*[nRow];
-  for (row = 0; row < nRow; row++) {
-    dynProgArray[row] = new double[nCol];
-    for (col = 0; col < nCol; col++) {
-      dynProgArray[row][col] = 0.0;
-    }
-  }
-  double* scoreCountBinAdjust = 0;
-  scoreCountBinAdjust = new double[nRow];
-  for (row = 0; row < nRow; row++) {
-    scoreCountBinAdjust[row] = 0.0;
-  }
-
-  dynProgArray[initCountRow][initCountCol] = 1.0; // initial count of peptides with mass = 1
-  vector<int> deltaMassCol(nDeltaMass);
+  dynProg->Reset(nRow, nCol);
+  dynProg->Set(initCountRow, initCountCol, 1.0); // initial count of peptides with mass = 1
   // populate matrix with scores for first (i.e. N-terminal) amino acid in sequence
   for (de = 0; de < nDeltaMass; de++) {
     ma = aaMass[de];
     row = initCountRow + evidenceObs[ma + colStart];
     col = initCountCol + ma;
     if (col <= maxDeltaMass + colLast) {
-      dynProgArray[row][col] += dynProgArray[initCountRow][initCountCol] * aaFreqN[de];
+      dynProg->Add(row, col, dynProg->Get(initCountRow, initCountCol) * aaFreqN[de]);
     }
   }
   // set to zero now that score counts for first amino acid are in matrix
-  dynProgArray[initCountRow][initCountCol] = 0.0;
+  dynProg->Set(initCountRow, initCountCol, 0.0);
   // populate matrix with score counts for non-terminal amino acids in sequence
   for (ma = colFirst; ma < colLast; ma++) {
     col = maxDeltaMass + ma;
     evidence = evidenceObs[ma];
-    for (de = 0; de < nDeltaMass; de++) {
-      deltaMassCol[de] = col - aaMass[de];
-    }
-    for (row = rowFirst; row <= rowLast; row++) {
-      evidenceRow = row - evidence;
-      sumScore = dynProgArray[row][col];
-      for (de = 0; de < nDeltaMass; de++) {
-        sumScore += dynProgArray[evidenceRow][deltaMassCol[de]] * aaFreqI[de];
-      }
-      dynProgArray[row][col] = sumScore;
-    }
+    dynProg->Accumulate(col, rowFirst, rowLast, true, nDeltaMass, aaMass, evidence, aaFreqI);
   }
   // populate matrix with score counts for last (i.e. C-terminal) amino acid in sequence
   ma = colLast;
   col = maxDeltaMass + ma;
   evidence = 0; // no evidence should be added for last amino acid in sequence
-  for (de = 0; de < nDeltaMass; de++) {
-    deltaMassCol[de] = col - aaMass[de];
-  }
-  for (row = rowFirst; row <= rowLast; row++) {
-    evidenceRow = row - evidence;
-    sumScore = 0.0;
-    for (de = 0; de < nDeltaMass; de++) {
-      sumScore += dynProgArray[evidenceRow][deltaMassCol[de]] * aaFreqC[de];  // C-terminal residue
-    }
-    dynProgArray[row][col] = sumScore;
-  }
+  dynProg->Accumulate(col, rowFirst, rowLast, false, nDeltaMass, aaMass, evidence, aaFreqC);
 
   int colScoreCount = maxDeltaMass + colLast;
   double totalCount = 0.0;
   for (row = 0; row < nRow; row++) {
     // at this point pValueScoreObs just holds counts from last column of dynamic programming array
-    pValueScoreObs[row] = dynProgArray[row][colScoreCount];
+    pValueScoreObs[row] = dynProg->Get(row, colScoreCount);
     totalCount += pValueScoreObs[row];
-    scoreCountBinAdjust[row] = pValueScoreObs[row] / 2.0;
   }
-  // convert from counts to cumulative sum of counts
-  for (row = nRow - 2; row >= 0; row--) {
-    pValueScoreObs[row] += pValueScoreObs[row + 1];
+  // convert from counts to cumulative sum of counts, adjusted to reflect the
+  // center of each bin rather than its edge
+  double cumulative = 0.0;
+  for (row = nRow - 1; row >= 0; row--) {
+    double count = pValueScoreObs[row];
+    cumulative += count;
+    pValueScoreObs[row] = cumulative - count / 2.0;
   }
   double logTotalCount = log(totalCount);
   for (row = 0; row < nRow; row++) {
-    // adjust counts to reflect center of bin, not edge
-    pValueScoreObs[row] -= scoreCountBinAdjust[row];
     // normalize distribution; use exp( log ) to avoid potential underflow
     pValueScoreObs[row] = exp(log(pValueScoreObs[row]) - logTotalCount);
   }
 
-  // clean up
-  for (row = 0; row < nRow; row++) {
-    delete [] dynProgArray[row];
-  }
-  delete [] dynProgArray;
-  delete [] scoreCountBinAdjust;
-
   return scoreOffsetObs;
 }
 
@@ -1723,11 +2326,19 @@ int TideSearchApplication::calcScoreCount(
  *
  * Added by Andy Lin, March 2-16
  * Edited to work within Crux code instead of with original MATLAB code
+ *
+ * Counts are computed for every mass bin in pepMassInt (in increasing order)
+ * from a single matrix, built up to the heaviest bin. The score of a prefix
+ * depends only on its own mass, and residue evidence is never negative, so
+ * the columns below a lighter bin's C-terminal column are the same as if its
+ * matrix had been computed separately; only its C-terminal column differs,
+ * and that is summed on its own. Each scoreCount[i] has the layout it would
+ * have had for its own matrix, with scoreOffset[i] = maxEvidence[i].
  */
 void TideSearchApplication::calcResidueScoreCount (
   int nAa,
-  int pepMassInt,
-  vector<vector<double> >& residueEvidenceMatrix,
+  const vector<int>& pepMassInt,
+  const vector<vector<double> >& residueEvidenceMatrix,
   vector<int>& aaMass,
   const vector<double>& aaFreqN,
   const vector<double>& aaFreqI,
@@ -1736,33 +2347,36 @@ void TideSearchApplication::calcResidueScoreCount (
   int cTermMass, //this is cTermMassBin
   int minAaMass,
   int maxAaMass,
-  int maxEvidence,
-  int maxScore,
-  vector<double>& scoreCount, //this is returned for later use
-  int& scoreOffset //this is returned for later use
+  const vector<int>& maxEvidence,
+  const vector<int>& maxScore,
+  vector<vector<double> >& scoreCount, //this is returned for later use
+  vector<int>& scoreOffset, //this is returned for later use
+  ScoreCountMatrix* dynProg
 ) {
-  int minEvidence  = 0;
-  int minScore     = 0;
+  int nBin = pepMassInt.size();
+  scoreCount.resize(nBin);
+  scoreOffset.resize(nBin);
+  if (nBin == 0) {
+    return;
+  }
 
   int row;
   int col;
   int ma;
-  int evid;
   int de;
-  int evidRow;
-  double sumScore;
 
-  int bottomRowBuffer = maxEvidence;
-  int topRowBuffer = -minEvidence;
+  // Rows are scores, starting from 0, so that they are shared by all bins.
+  // The heaviest bin has the largest maximum score.
+  int maxScoreAll = *max_element(maxScore.begin(), maxScore.end());
   int colBuffer = maxAaMass;
   int colStart = nTermMass;
-  int nRow = bottomRowBuffer - minScore + 1 + maxScore + topRowBuffer;
-  int nCol = colBuffer + pepMassInt;
-  int rowFirst = bottomRowBuffer + 1;
-  int rowLast = rowFirst - minScore + maxScore;
+  int nRow = maxScoreAll + 1;
+  int nCol = colBuffer + pepMassInt.back();
+  int rowFirst = 1;
+  int rowLast = rowFirst + maxScoreAll;
   int colFirst = colStart + 1;
-  int colLast = pepMassInt - cTermMass;
-  int initCountRow = bottomRowBuffer - minScore + 1;
+  int colLast = pepMassInt.back() - cTermMass;
+  int initCountRow = 1;
   int initCountCol = maxAaMass + colStart;
 
   // convert to zero-based indexing
@@ -1773,19 +2387,11 @@ void TideSearchApplication::calcResidueScoreCount (
   initCountRow = initCountRow - 1;
   initCountCol = initCountCol - 1;
 
-  double** dynProgArray = 0;
-  dynProgArray = new double*[nRow];
-  for (row = 0; row < nRow; row++) {
-    dynProgArray[row] = new double[nCol];
-    for (col = 0; col < nCol; col++) {
-      dynProgArray[row][col] = 0.0;
-    }
-  }
+  dynProg->Reset(nRow, nCol);
 
   // initial count of peptides with mass = nTermMass
-  dynProgArray[initCountRow][initCountCol] = 1.0;
+  dynProg->Set(initCountRow, initCountCol, 1.0);
 
-  int* aaMassCol = new int[nAa];
   // populate matrix with scores for first (i.e. N-terminal) amino acid in sequence
   for (de = 0; de < nAa; de++) {
     ma = aaMass[de];
@@ -1803,64 +2409,39 @@ void TideSearchApplication::calcResidueScoreCount (
 
 //    if ( col <= maxAaMass + colLast ) { //original
     if (col <= maxAaMass + colLast && col >= initCountCol) { //TODO not sure if below or above is correct
-      //dynProgArray[ row ][ col ] += dynProgArray[ initCountRow ][ initCountCol ];
-      dynProgArray[row][col] += dynProgArray[initCountRow][initCountCol] * aaFreqN[de];
+      dynProg->Add(row, col, dynProg->Get(initCountRow, initCountCol) * aaFreqN[de]);
     }
   }
 
   //set to zero now that score counts for first amino acid are in matrix
-  dynProgArray[initCountRow][initCountCol] = 0.0;
+  dynProg->Set(initCountRow, initCountCol, 0.0);
 
   // populate matrix with score counts for non-terminal amino acids in sequence
+  vector<int> evidCol(nAa);
   for (ma = colFirst; ma < colLast; ma++) {
     col = maxAaMass + ma;
-
     for (de = 0; de < nAa; de++) {
-      aaMassCol[de] = col - aaMass[de];
-    }
-    for (row = rowFirst; row <= rowLast; row++) {
-      sumScore = dynProgArray[row][col];
-      for (de = 0; de < nAa; de++) {
-        evidRow = row - residueEvidenceMatrix[de][ma];
-        //sumScore += dynProgArray[ evidRow ][ aaMassCol[ de ] ];
-        sumScore += dynProgArray[evidRow][aaMassCol[de]] * aaFreqI[de];
-      }
-      dynProgArray[row][col] = sumScore;
+      evidCol[de] = (int)residueEvidenceMatrix[de][ma];
     }
+    dynProg->Accumulate(col, rowFirst, rowLast, true, nAa, &aaMass[0], &evidCol[0],
+                        &aaFreqI[0]);
   }
 
-  // populate matrix with score counts for last (i.e. C-terminal) amino acid in sequence
-  ma = colLast;
-  col = maxAaMass + ma;
+  // score counts for last (i.e. C-terminal) amino acid in sequence, for each bin;
+  // no evidence should be added for last amino acid in sequence
+  vector<double> lastCol;
+  for (int bin = 0; bin < nBin; bin++) {
+    ma = pepMassInt[bin] - cTermMass - 1;
+    col = maxAaMass + ma;
+    dynProg->Sum(col, rowFirst, rowFirst + maxScore[bin], nAa, &aaMass[0], &aaFreqC[0],
+                 &lastCol);
 
-  //no evidence should be added for last amino acid in sequence
-  evid = 0;
-  for (de = 0; de < nAa; de++) {
-    aaMassCol[de] = col - aaMass[de];
-  }
-  for (row = rowFirst; row <= rowLast; row++) {
-    evidRow = row - evid;
-    sumScore = 0.0;
-    for (de = 0; de < nAa; de++) {
-      //sumScore += dynProgArray[ evidRow ][ aaMassCol[ de ] ];
-      sumScore += dynProgArray[evidRow][aaMassCol[de]] * aaFreqC[de];
+    scoreCount[bin].assign(maxEvidence[bin] + 1 + maxScore[bin], 0.0);
+    for (row = 0; row <= maxScore[bin]; row++) {
+      scoreCount[bin][maxEvidence[bin] + row] = lastCol[row];
     }
-    dynProgArray[row][col] = sumScore;
-  }
-
-  int colScoreCount = maxAaMass + colLast;
-  scoreCount.resize(nRow);
-  for (int row = 0; row < nRow; row++) {
-    scoreCount[row] = dynProgArray[row][colScoreCount];
-  }
-  scoreOffset = initCountRow;
-
-  // clean up
-  for (int row = 0; row < nRow; row++) {
-    delete [] dynProgArray[row];
+    scoreOffset[bin] = maxEvidence[bin];
   }
-  delete [] dynProgArray;
-  delete [] aaMassCol;
 }
 
 void TideSearchApplication::processParams() {
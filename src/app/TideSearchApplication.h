@@ -15,6 +15,10 @@
 
 using namespace std;
 
+class SpectrumBatch;
+class FragmentIndex;
+class ScoreCountMatrix;
+
 /**
  * Locks for multi-threading in Tide.
  */
@@ -74,6 +78,14 @@ private:
       OriginalName(name), SpectrumRecords(spectrumrecords), Keep(keep) {}
   };
 
+  // A spectrum file converted and loaded ahead of its search
+  struct PreparedSpectra {
+    InputFile* File;
+    SpectrumCollection* Spectra;
+    bool OwnSpectra; // false if Spectra was found in spectra_
+    PreparedSpectra(): File(NULL), Spectra(NULL), OwnSpectra(true) {}
+  };
+
   /**
   brief This variable is used with Cascade Search.
   This map contains a flag for each spectrum whether
@@ -91,6 +103,11 @@ private:
 
   vector<int> getNegativeIsotopeErrors() const;
   vector<InputFile> getInputFiles(const vector<string>& filepaths) const;
+  InputFile getInputFile(const string& filepath, bool multipleInputs) const;
+  void prepareSpectra(const string& filepath, bool multipleInputs,
+                      PreparedSpectra* prepared) const;
+  string spectrumCacheFile(const string& file, const string& cacheDir) const;
+  bool convertToCache(const string& file, const string& cached) const;
   static SpectrumCollection* loadSpectra(const std::string& file);
 
   /**
@@ -155,6 +172,50 @@ private:
     int charge
   );
 
+  /**
+   * Scores the active peptides like collectScoresCompiled, using programs
+   * generated in portable mode (see tide/compiler.h).
+   */
+  void collectScoresPortable(
+    ActivePeptideQueue* active_peptide_queue,
+    const ObservedPeakSet& observed,
+    TideMatchSet::Arr2* match_arr,
+    int queue_size,
+    int charge
+  );
+
+  /**
+   * Scores only the top_n candidate active peptides that share the most
+   * fragment bins (see tide/fragment_index.h) with spectrum, like
+   * collectScoresPortable or collectScoresSparse. The remaining candidates
+   * are left out of match_arr. bins, counts and selected are workspace.
+   */
+  void collectScoresPreselected(
+    ActivePeptideQueue* active_peptide_queue,
+    const Spectrum* spectrum,
+    const ObservedPeakSet& observed,
+    const vector<bool>& candidatePeptideStatus,
+    int top_n,
+    TideMatchSet::Arr2* match_arr,
+    int queue_size,
+    int charge,
+    vector<int>* bins,
+    vector<int>* counts,
+    vector<pair<int, int> >* selected
+  );
+
+  /**
+   * Scores the active peptides like collectScoresPortable, against an
+   * observed peak set that keeps only its nonzero cache entries.
+   */
+  void collectScoresSparse(
+    ActivePeptideQueue* active_peptide_queue,
+    const ObservedPeakSet& observed,
+    TideMatchSet::Arr2* match_arr,
+    int queue_size,
+    int charge
+  );
+
   void convertResults() const;
 
   void computeWindow(
@@ -181,6 +242,15 @@ private:
   double bin_width_;
   double bin_offset_;
 
+  // Mapped fragment index of the peptide index if fragment-index-top-n is
+  // set, otherwise NULL.
+  const FragmentIndex* fragment_index_;
+
+  // tide-search.stats.json if search-stats is set, otherwise NULL. Each
+  // spectrum file searched adds an entry to the JSON array it holds.
+  ofstream* stats_file_;
+  int stats_entries_;
+
   std::string remove_index_;
 
   // this map can be used to preload spectra
@@ -251,6 +321,26 @@ private:
 
   virtual COMMAND_T getCommand() const;
 
+  /**
+   * Hands out contiguous blocks of the mass-sorted spectrum-charge list to
+   * the search threads, lightest first, so that each thread's active peptide
+   * window only moves forward. Blocks shrink toward the end of the list so
+   * that the threads finish at about the same time.
+   */
+  class SpecChargeScheduler {
+   public:
+    SpecChargeScheduler(size_t num_spec_charges, int num_threads);
+    /**
+     * Claims the next block [*begin, *end). Returns false when none remain.
+     */
+    bool NextBlock(size_t* begin, size_t* end);
+   private:
+    boost::mutex mutex_;
+    size_t next_;
+    size_t size_;
+    int num_threads_;
+  };
+
   /**
    * Struct holding necessary information for each thread to run.
    */
@@ -298,6 +388,10 @@ private:
     int* sc_index;
     int* total_candidate_peptides;
     vector<int>* negative_isotope_errors;
+    SpecChargeScheduler* scheduler;
+    TideResultWriter* result_writer;
+    const SearchConfig* config;
+    SearchStats* stats;
 
     thread_data (const string& spectrum_filename_, const vector<SpectrumCollection::SpecCharge>* spec_charges_,
             ActivePeptideQueue* active_peptide_queue_, ProteinVec proteins_,
@@ -312,7 +406,9 @@ private:
             const pb::ModTable* mod_table_, const pb::ModTable* nterm_mod_table_, const pb::ModTable* cterm_mod_table_, const int decoysPerTarget_,
             vector<boost::mutex*> locks_array_, double bin_width_, double bin_offset_, bool exact_pval_search_,
             map<pair<string, unsigned int>, bool>* spectrum_flag_, int* sc_index_, int* total_candidate_peptides_,
-            vector<int>* negative_isotope_errors_) :
+            vector<int>* negative_isotope_errors_, SpecChargeScheduler* scheduler_,
+            TideResultWriter* result_writer_, const SearchConfig* config_,
+            SearchStats* stats_) :
             spectrum_filename(spectrum_filename_), spec_charges(spec_charges_), active_peptide_queue(active_peptide_queue_),
             proteins(proteins_), locations(locations_), precursor_window(precursor_window_), window_type(window_type_),
             spectrum_min_mz(spectrum_min_mz_), spectrum_max_mz(spectrum_max_mz_), min_scan(min_scan_), max_scan(max_scan_),
@@ -322,9 +418,51 @@ private:
             aaMass(aaMass_), nAARes(nAARes_), dAAFreqN(dAAFreqN_), dAAFreqI(dAAFreqI_), dAAFreqC(dAAFreqC_), dAAMass(dAAMass_),
             mod_table(mod_table_), nterm_mod_table(nterm_mod_table_), cterm_mod_table(cterm_mod_table_), decoysPerTarget(decoysPerTarget_),
             locks_array(locks_array_), bin_width(bin_width_), bin_offset(bin_offset_), exact_pval_search(exact_pval_search_),
-            spectrum_flag(spectrum_flag_), sc_index(sc_index_), total_candidate_peptides(total_candidate_peptides_), negative_isotope_errors(negative_isotope_errors_) {}
+            spectrum_flag(spectrum_flag_), sc_index(sc_index_), total_candidate_peptides(total_candidate_peptides_), negative_isotope_errors(negative_isotope_errors_),
+            scheduler(scheduler_), result_writer(result_writer_), config(config_),
+            stats(stats_) {}
   };
 
+  /**
+   * Whether the spectrum selection parameters exclude a spectrum-charge from
+   * the search.
+   */
+  bool skipSpecCharge(
+    const thread_data& data,
+    const SpectrumCollection::SpecCharge& sc,
+    int max_charge
+  ) const;
+
+  /**
+   * Preprocesses spectrum-charge first, and up to batch capacity following
+   * ones from [first, end), into batch, and scores them together against
+   * all of their candidate peptides.
+   */
+  void fillBatch(
+    SpectrumBatch* batch,
+    const thread_data& data,
+    size_t first,
+    size_t end,
+    int max_charge,
+    long int* num_range_skipped,
+    long int* num_precursors_skipped,
+    long int* num_isotopes_skipped,
+    long int* num_retained
+  );
+
+  /**
+   * Like collectScoresCompiled, taking the scores of one member of a batch
+   * filled by fillBatch.
+   */
+  void collectScoresBatch(
+    ActivePeptideQueue* active_peptide_queue,
+    const SpectrumBatch& batch,
+    int member,
+    TideMatchSet::Arr2* match_arr,
+    int queue_size,
+    int charge
+  );
+
   int calcScoreCount(
     int numelEvidenceObs,
     int* evidenceObs,
@@ -338,13 +476,14 @@ private:
     double* aaFreqI,
     double* aaFreqC,
     int* aaMass,
-    double* pValueScoreObs
+    double* pValueScoreObs,
+    ScoreCountMatrix* dynProg
   );
 
   void calcResidueScoreCount (
     int nAa,
-    int pepMassInt,
-    vector<vector<double> >& residueEvidenceMatrix,
+    const vector<int>& pepMassInt,
+    const vector<vector<double> >& residueEvidenceMatrix,
     vector<int>& aaMass,
     const vector<double>& aaFreqN,
     const vector<double>& aaFreqI,
@@ -353,10 +492,11 @@ private:
     int CTermMass,
     int minAaMass,
     int maxAaMass,
-    int maxEvidence,
-    int maxScore,
-    vector<double>& scoreCount, //this is returned for later use
-    int& scoreOffSet //this is returned for later use
+    const vector<int>& maxEvidence,
+    const vector<int>& maxScore,
+    vector<vector<double> >& scoreCount, //this is returned for later use
+    vector<int>& scoreOffSet, //this is returned for later use
+    ScoreCountMatrix* dynProg
   );
 
   double calcCombinedPval( //calculates combined p-value
@@ -9,16 +9,156 @@
 #include "records_to_vector-inl.h"
 #include "theoretical_peak_set.h"
 #include "compiler.h"
+#include "peptide_table.h"
+#include "search_stats.h"
 #include "app/TideMatchSet.h"
+#include "util/Params.h"
 #include <map> //Added by Andy Lin
+#include <algorithm>
+#include <limits>
 #define CHECK(x) GOOGLE_CHECK((x))
 
 DEFINE_int32(fifo_page_size, 1, "Page size for FIFO allocator, in megs");
 
+// Whether to generate portable programs rather than x86 code (see compiler.h).
+static bool PortablePrograms() {
+  return SearchConfig::GetXcorrScoring() != SearchConfig::XCORR_COMPILED;
+}
+
+SharedPeptideSource::SharedPeptideSource(RecordReader* reader,
+                                         const vector<const pb::Protein*>&
+                                         proteins,
+                                         int num_consumers, bool compile)
+  : reader_(reader),
+    table_(NULL),
+    proteins_(proteins),
+    compile_(compile),
+    theoretical_peak_set_(2000),
+    first_index_(0),
+    first_needed_(num_consumers, 0),
+    fifo_alloc_peptides_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog1_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog2_(FLAGS_fifo_page_size << 20) {
+  CHECK(reader_->OK());
+  compiler_prog1_ = new TheoreticalPeakCompiler(&fifo_alloc_prog1_, PortablePrograms());
+  compiler_prog2_ = new TheoreticalPeakCompiler(&fifo_alloc_prog2_, PortablePrograms());
+}
+
+SharedPeptideSource::SharedPeptideSource(const PeptideTable* table,
+                                         const vector<const pb::Protein*>&
+                                         proteins,
+                                         int num_consumers, bool compile)
+  : reader_(NULL),
+    table_(table),
+    proteins_(proteins),
+    compile_(compile),
+    theoretical_peak_set_(2000),
+    first_index_(0),
+    first_needed_(num_consumers, 0),
+    fifo_alloc_peptides_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog1_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog2_(FLAGS_fifo_page_size << 20) {
+  CHECK(table_->OK());
+  compiler_prog1_ = new TheoreticalPeakCompiler(&fifo_alloc_prog1_, PortablePrograms());
+  compiler_prog2_ = new TheoreticalPeakCompiler(&fifo_alloc_prog2_, PortablePrograms());
+}
+
+SharedPeptideSource::~SharedPeptideSource() {
+  fifo_alloc_peptides_.ReleaseAll();
+  fifo_alloc_prog1_.ReleaseAll();
+  fifo_alloc_prog2_.ReleaseAll();
+
+  delete compiler_prog1_;
+  delete compiler_prog2_;
+}
+
+// Whether every peptide has been read onto the window. Caller must hold
+// mutex_.
+bool SharedPeptideSource::Done() {
+  if (table_ != NULL) {
+    return first_index_ + (long)window_.size() >= table_->Size();
+  }
+  return reader_->Done();
+}
+
+// Read the next peptide from disk onto the back of the window, compiling its
+// programs if required. Caller must hold mutex_.
+void SharedPeptideSource::ReadBack() {
+  if (table_ != NULL) {
+    table_->Read(first_index_ + window_.size(), &current_pb_peptide_);
+  } else {
+    reader_->Read(&current_pb_peptide_);
+  }
+  Peptide* peptide = new(&fifo_alloc_peptides_)
+    Peptide(current_pb_peptide_, proteins_, &fifo_alloc_peptides_);
+  if (compile_) {
+    theoretical_peak_set_.Clear();
+    peptide->ComputeTheoreticalPeaks(&theoretical_peak_set_, current_pb_peptide_,
+                                     compiler_prog1_, compiler_prog2_);
+  }
+  window_.push_back(peptide);
+}
+
+bool SharedPeptideSource::Fill(long* next_index, double min_range,
+                               double max_range, deque<Peptide*>* queue) {
+  boost::mutex::scoped_lock lock(mutex_);
+  assert(*next_index >= first_index_);
+  while (true) {
+    if (*next_index - first_index_ == (long)window_.size()) {
+      if (Done()) {
+        return true;
+      }
+      ReadBack();
+    }
+    Peptide* peptide = window_[*next_index - first_index_];
+    ++(*next_index);
+    if (peptide->Mass() < min_range) {
+      continue; // skip peptides that fall below min_range
+    }
+    queue->push_back(peptide);
+    if (peptide->Mass() > max_range) {
+      return false;
+    }
+  }
+}
+
+void SharedPeptideSource::Retire(int consumer, long first_needed) {
+  boost::mutex::scoped_lock lock(mutex_);
+  first_needed_[consumer] = first_needed;
+  long retire_to = *min_element(first_needed_.begin(), first_needed_.end());
+  if (retire_to <= first_index_) {
+    return;
+  }
+  while (!window_.empty() && first_index_ < retire_to) {
+    window_.pop_front();
+    ++first_index_;
+  }
+  if (window_.empty()) {
+    fifo_alloc_peptides_.ReleaseAll();
+    fifo_alloc_prog1_.ReleaseAll();
+    fifo_alloc_prog2_.ReleaseAll();
+  } else {
+    // Free all peptides up to, but not including, the new front.
+    Peptide* peptide = window_.front();
+    fifo_alloc_peptides_.Release(peptide);
+    peptide->ReleaseFifo(&fifo_alloc_prog1_, &fifo_alloc_prog2_);
+  }
+}
+
+void SharedPeptideSource::CountFifoPages(SearchStats* stats) const {
+  stats->CountFifoPages(fifo_alloc_peptides_.PagesMapped(),
+                        fifo_alloc_peptides_.PageSwitches());
+  stats->CountFifoPages(fifo_alloc_prog1_.PagesMapped(),
+                        fifo_alloc_prog1_.PageSwitches());
+  stats->CountFifoPages(fifo_alloc_prog2_.PagesMapped(),
+                        fifo_alloc_prog2_.PageSwitches());
+}
+
 ActivePeptideQueue::ActivePeptideQueue(RecordReader* reader,
                                        const vector<const pb::Protein*>&
                                        proteins)
-  : reader_(reader),
+  : reader_(reader), table_(NULL),
+    shared_source_(NULL), consumer_(0), next_index_(0),
     proteins_(proteins),
     theoretical_peak_set_(2000),   // probably overkill, but no harm
     theoretical_b_peak_set_(200),  // probably overkill, but no harm
@@ -27,10 +167,95 @@ ActivePeptideQueue::ActivePeptideQueue(RecordReader* reader,
     fifo_alloc_prog1_(FLAGS_fifo_page_size << 20),
     fifo_alloc_prog2_(FLAGS_fifo_page_size << 20) {
   CHECK(reader_->OK());
-  compiler_prog1_ = new TheoreticalPeakCompiler(&fifo_alloc_prog1_);
-  compiler_prog2_ = new TheoreticalPeakCompiler(&fifo_alloc_prog2_);
+  compiler_prog1_ = new TheoreticalPeakCompiler(&fifo_alloc_prog1_, PortablePrograms());
+  compiler_prog2_ = new TheoreticalPeakCompiler(&fifo_alloc_prog2_, PortablePrograms());
   peptide_centric_ = false;
   elution_window_ = 0;
+  sp_scorer_ = NULL;
+  stats_ = NULL;
+}
+
+ActivePeptideQueue::ActivePeptideQueue(SharedPeptideSource* source,
+                                       int consumer,
+                                       const vector<const pb::Protein*>&
+                                       proteins)
+  : reader_(NULL), table_(NULL),
+    shared_source_(source), consumer_(consumer), next_index_(0),
+    proteins_(proteins),
+    theoretical_peak_set_(2000),   // probably overkill, but no harm
+    theoretical_b_peak_set_(200),  // probably overkill, but no harm
+    active_targets_(0), active_decoys_(0),
+    fifo_alloc_peptides_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog1_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog2_(FLAGS_fifo_page_size << 20) {
+  compiler_prog1_ = new TheoreticalPeakCompiler(&fifo_alloc_prog1_, PortablePrograms());
+  compiler_prog2_ = new TheoreticalPeakCompiler(&fifo_alloc_prog2_, PortablePrograms());
+  peptide_centric_ = false;
+  elution_window_ = 0;
+  sp_scorer_ = NULL;
+  stats_ = NULL;
+}
+
+ActivePeptideQueue::ActivePeptideQueue(const PeptideTable* table,
+                                       const vector<const pb::Protein*>&
+                                       proteins)
+  : reader_(NULL), table_(table),
+    shared_source_(NULL), consumer_(0), next_index_(0),
+    proteins_(proteins),
+    theoretical_peak_set_(2000),   // probably overkill, but no harm
+    theoretical_b_peak_set_(200),  // probably overkill, but no harm
+    active_targets_(0), active_decoys_(0),
+    fifo_alloc_peptides_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog1_(FLAGS_fifo_page_size << 20),
+    fifo_alloc_prog2_(FLAGS_fifo_page_size << 20) {
+  CHECK(table_->OK());
+  compiler_prog1_ = new TheoreticalPeakCompiler(&fifo_alloc_prog1_, PortablePrograms());
+  compiler_prog2_ = new TheoreticalPeakCompiler(&fifo_alloc_prog2_, PortablePrograms());
+  peptide_centric_ = false;
+  elution_window_ = 0;
+  sp_scorer_ = NULL;
+  stats_ = NULL;
+}
+
+void ActivePeptideQueue::Finish() {
+  if (shared_source_ != NULL) {
+    shared_source_->Retire(consumer_, numeric_limits<long>::max());
+  }
+}
+
+void ActivePeptideQueue::CountFifoPages(SearchStats* stats) const {
+  stats->CountFifoPages(fifo_alloc_peptides_.PagesMapped(),
+                        fifo_alloc_peptides_.PageSwitches());
+  stats->CountFifoPages(fifo_alloc_prog1_.PagesMapped(),
+                        fifo_alloc_prog1_.PageSwitches());
+  stats->CountFifoPages(fifo_alloc_prog2_.PagesMapped(),
+                        fifo_alloc_prog2_.PageSwitches());
+}
+
+// Whether every peptide has been read from reader_ or table_.
+bool ActivePeptideQueue::ReadDone() {
+  if (table_ != NULL) {
+    return next_index_ >= table_->Size();
+  }
+  return reader_->Done();
+}
+
+// Read the peptide at next_index_ into current_pb_peptide_.
+void ActivePeptideQueue::ReadNext() {
+  if (table_ != NULL) {
+    table_->Read(next_index_, &current_pb_peptide_);
+  } else {
+    reader_->Read(&current_pb_peptide_);
+  }
+  ++next_index_;
+}
+
+// With a table, go straight to the first peptide of at least min_range when
+// nothing lighter is queued, rather than reading past the lighter ones.
+void ActivePeptideQueue::SkipTo(double min_range) {
+  if (table_ != NULL && queue_.empty()) {
+    next_index_ = max(next_index_, table_->LowerBound(min_range));
+  }
 }
 
 ActivePeptideQueue::~ActivePeptideQueue() {
@@ -43,6 +268,13 @@ ActivePeptideQueue::~ActivePeptideQueue() {
 
   delete compiler_prog1_;
   delete compiler_prog2_;
+  delete sp_scorer_;
+}
+
+// Drop the Sp workspace, which was made for the previous highest_mz_.
+void ActivePeptideQueue::ResetSpScorer() {
+  delete sp_scorer_;
+  sp_scorer_ = NULL;
 }
 
 // Compute the theoretical peaks of the peptide in the "back" of the queue
@@ -79,13 +311,20 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
     Peptide* peptide = queue_.front();
     //print hits in peptide-centric search
     ReportPeptideHits(peptide);
-    peptide->spectrum_matches_array.clear();
-    vector<Peptide::spectrum_matches>().swap(peptide->spectrum_matches_array);
+    if (peptide_centric_) {
+      // Peptides may be shared with other queues, so only touch the hits
+      // when they were recorded (peptide-centric search is single-threaded).
+      peptide->spectrum_matches_array.clear();
+      vector<Peptide::spectrum_matches>().swap(peptide->spectrum_matches_array);
+    }
     // would delete peptide's underlying pb::Peptide;
     queue_.pop_front();
 //    delete peptide;
   }
-  if (queue_.empty()) {
+  if (shared_source_ != NULL) {
+    // Peptides are owned by the source; tell it which ones we still need.
+    shared_source_->Retire(consumer_, next_index_ - (long)queue_.size());
+  } else if (queue_.empty()) {
     //cerr << "Releasing All\n";
     fifo_alloc_peptides_.ReleaseAll();
     fifo_alloc_prog1_.ReleaseAll();
@@ -106,13 +345,21 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
   // theoretical peaks. Data associated with each peptide is allocated by
   // fifo_alloc_peptides_.
   bool done = false;
-  if (queue_.empty() || queue_.back()->Mass() <= max_range) {
+  if (shared_source_ != NULL) {
+    // The source compiles every peptide as it is read.
+    if (queue_.empty() || queue_.back()->Mass() <= max_range) {
+      SearchStats::Scope compile(stats_, SearchStats::COMPILE);
+      done = shared_source_->Fill(&next_index_, min_range, max_range, &queue_);
+    }
+  } else if (queue_.empty() || queue_.back()->Mass() <= max_range) {
+    SearchStats::Scope compile(stats_, SearchStats::COMPILE);
     if (!queue_.empty()) {
       ComputeTheoreticalPeaksBack();
     }
-    while (!(done = reader_->Done())) {
+    SkipTo(min_range);
+    while (!(done = ReadDone())) {
       // read all peptides lighter than max_range
-      reader_->Read(&current_pb_peptide_);
+      ReadNext();
       if (current_pb_peptide_.mass() < min_range) {
         // we would delete current_pb_peptide_;
         continue; // skip peptides that fall below min_range
@@ -133,6 +380,7 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
   // Set up iterator for use with HasNext(),
   // GetPeptide(), and NextPeptide(). Return the number of enqueued peptides.
   if (queue_.empty()) {
+    iter_ = end_ = queue_.end();
     return 0;
   }
 
@@ -141,12 +389,12 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
     ++iter_;
   }
 
-  int* isotope_idx = new int(0);
+  int isotope_idx = 0;
   end_ = iter_;
   int active = 0;
   active_targets_ = active_decoys_ = 0;
   while (end_ != queue_.end() && (*end_)->Mass() < max_mass->back() ){
-    if (isWithinIsotope(min_mass, max_mass, (*end_)->Mass(), isotope_idx)) {
+    if (isWithinIsotope(min_mass, max_mass, (*end_)->Mass(), &isotope_idx)) {
       ++active;
       candidatePeptideStatus->push_back(true);
       if (!(*end_)->IsDecoy()) {
@@ -159,7 +407,6 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
     }
     ++end_;
   }
-  delete isotope_idx;
   if (active == 0) {
     return 0;
   }
@@ -186,13 +433,19 @@ int ActivePeptideQueue::SetActiveRangeBIons(vector<double>* min_mass, vector<dou
     Peptide* peptide = queue_.front();
     // would delete peptide's underlying pb::Peptide;
     ReportPeptideHits(peptide);
-    peptide->spectrum_matches_array.clear();
-    vector<Peptide::spectrum_matches>().swap(peptide->spectrum_matches_array);
+    if (peptide_centric_) {
+      // Peptides may be shared with other queues, so only touch the hits
+      // when they were recorded (peptide-centric search is single-threaded).
+      peptide->spectrum_matches_array.clear();
+      vector<Peptide::spectrum_matches>().swap(peptide->spectrum_matches_array);
+    }
     queue_.pop_front();
     b_ion_queue_.pop_front();
 //    delete peptide;
   }
-  if (queue_.empty()) {
+  if (shared_source_ != NULL) {
+    shared_source_->Retire(consumer_, next_index_ - (long)queue_.size());
+  } else if (queue_.empty()) {
     fifo_alloc_peptides_.ReleaseAll();
   } else {
     Peptide* peptide = queue_.front();
@@ -205,10 +458,23 @@ int ActivePeptideQueue::SetActiveRangeBIons(vector<double>* min_mass, vector<dou
   // theoretical peaks. Data associated with each peptide is allocated by
   // fifo_alloc_peptides_.
   bool done;
-  if (queue_.empty() || queue_.back()->Mass() <= max_range) {
-    while (!(done = reader_->Done())) {
+  if (shared_source_ != NULL) {
+    if (queue_.empty() || queue_.back()->Mass() <= max_range) {
+      SearchStats::Scope compile(stats_, SearchStats::COMPILE);
+      size_t first_new = queue_.size();
+      done = shared_source_->Fill(&next_index_, min_range, max_range, &queue_);
+      for (size_t i = first_new; i < queue_.size(); ++i) {
+        theoretical_b_peak_set_.Clear();
+        queue_[i]->ComputeBTheoreticalPeaks(&theoretical_b_peak_set_);
+        b_ion_queue_.push_back(theoretical_b_peak_set_);
+      }
+    }
+  } else if (queue_.empty() || queue_.back()->Mass() <= max_range) {
+    SearchStats::Scope compile(stats_, SearchStats::COMPILE);
+    SkipTo(min_range);
+    while (!(done = ReadDone())) {
       // read all peptides lighter than max_range
-      reader_->Read(&current_pb_peptide_);
+      ReadNext();
       if (current_pb_peptide_.mass() < min_range) {
         // we would delete current_pb_peptide_;
         continue; // skip peptides that fall below min_range
@@ -233,13 +499,13 @@ int ActivePeptideQueue::SetActiveRangeBIons(vector<double>* min_mass, vector<dou
     ++iter1_;
   }
 
-  int* isotope_idx = new int(0);
+  int isotope_idx = 0;
   end_ = iter_;
   end1_ = iter1_;
   int active = 0;
   active_targets_ = active_decoys_ = 0;
   while (end_ != queue_.end() && (*end_)->Mass() < max_mass->back() ){
-    if (isWithinIsotope(min_mass, max_mass, (*end_)->Mass(), isotope_idx)) {
+    if (isWithinIsotope(min_mass, max_mass, (*end_)->Mass(), &isotope_idx)) {
       ++active;
       candidatePeptideStatus->push_back(true);
       if (!(*end_)->IsDecoy()) {
@@ -253,7 +519,6 @@ int ActivePeptideQueue::SetActiveRangeBIons(vector<double>* min_mass, vector<dou
     ++end_;
     ++end1_;
   }
-  delete isotope_idx;
   if (active == 0) {
     return 0;
   }
@@ -412,10 +677,18 @@ void ActivePeptideQueue::ReportPeptideHits(Peptide* peptide) {
       return;
     }
 
+    SearchStats::Scope report(stats_, SearchStats::REPORT);
     current_peptide_ = peptide;
-    TideMatchSet matches(peptide, highest_mz_);
+    TideMatchSet matches(peptide, highest_mz_, config_);
     matches.exact_pval_search_ = exact_pval_search_;
     matches.elution_window_ = elution_window_;
+    if (compute_sp_) {
+      if (sp_scorer_ == NULL) {
+        sp_scorer_ = new SpScorer(proteins_, highest_mz_);
+      }
+      matches.sp_scorer_ = sp_scorer_;
+    }
+    matches.stats_ = stats_;
 
     if (!output_files_) { //only tab-delimited output is supported
         matches.report(target_file_, decoy_file_, top_matches_,
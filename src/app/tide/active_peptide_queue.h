@@ -13,8 +13,15 @@
 // SetActiveRange() the client may use the iterator interface HasNext() and
 // NextPeptide() to iterate over the window. The client may also use
 // GetPeptide() to get a specific peptide in the window.
+//
+// When several search threads each keep their own ActivePeptideQueue, the
+// queues may be constructed on top of a single SharedPeptideSource (below)
+// instead of a private RecordReader. The peptides and their compiled programs
+// are then read and generated only once, and each queue merely holds pointers
+// into the shared window.
 
 #include <deque>
+#include <boost/thread/mutex.hpp>
 #include "peptides.pb.h"
 #include "peptide.h"
 #include "theoretical_peak_set.h"
@@ -27,12 +34,86 @@
 #define ACTIVE_PEPTIDE_QUEUE_H
 
 class TheoreticalPeakCompiler;
+class PeptideTable;
+class SpScorer;
+class SearchStats;
+
+// A SharedPeptideSource reads a file of peptides of non-decreasing neutral
+// mass on behalf of a fixed number of consumers (one ActivePeptideQueue per
+// search thread). Each peptide is identified by its position in the file. A
+// consumer calls Fill() to obtain the peptides from a given position onward,
+// and Retire() to announce the position of the lightest peptide it still
+// needs. A peptide, together with its compiled programs, is freed only after
+// every consumer has retired it. All public methods are thread safe.
+class SharedPeptideSource {
+ public:
+  // If compile is false no dot-product programs are generated; this is the
+  // case for searches that only use the b ion peaks.
+  SharedPeptideSource(RecordReader* reader,
+                      const vector<const pb::Protein*>& proteins,
+                      int num_consumers, bool compile);
+
+  // Read the peptides from a table (see peptide_table.h) rather than pepix.
+  SharedPeptideSource(const PeptideTable* table,
+                      const vector<const pb::Protein*>& proteins,
+                      int num_consumers, bool compile);
+
+  ~SharedPeptideSource();
+
+  // Append to queue the peptides from position *next_index onward, skipping
+  // any lighter than min_range, and stopping after the first one that is
+  // heavier than max_range. *next_index is advanced past the peptides
+  // consumed. Returns true if the end of the file was reached.
+  bool Fill(long* next_index, double min_range, double max_range,
+            deque<Peptide*>* queue);
+
+  // Consumer no longer needs any peptide before position first_needed.
+  void Retire(int consumer, long first_needed);
+
+  // Add the page counts of the source's allocators to stats. Call only when
+  // no consumer is filling.
+  void CountFifoPages(SearchStats* stats) const;
+
+ private:
+  bool Done();
+  void ReadBack();
+
+  boost::mutex mutex_;
+  RecordReader* reader_;
+  const PeptideTable* table_;
+  pb::Peptide current_pb_peptide_;
+  const vector<const pb::Protein*>& proteins_;
+  bool compile_;
+  ST_TheoreticalPeakSet theoretical_peak_set_;
+
+  // Peptides read but not yet retired by every consumer. window_.front() is
+  // at position first_index_ in the file.
+  deque<Peptide*> window_;
+  long first_index_;
+  vector<long> first_needed_;
+
+  FifoAllocator fifo_alloc_peptides_;
+  FifoAllocator fifo_alloc_prog1_;
+  FifoAllocator fifo_alloc_prog2_;
+  TheoreticalPeakCompiler* compiler_prog1_;
+  TheoreticalPeakCompiler* compiler_prog2_;
+};
 
 class ActivePeptideQueue {
  public:
   ActivePeptideQueue(RecordReader* reader,
             const vector<const pb::Protein*>& proteins);
 
+  // Draw peptides from a source shared with other queues; consumer is the
+  // index of this queue among the source's consumers.
+  ActivePeptideQueue(SharedPeptideSource* source, int consumer,
+            const vector<const pb::Protein*>& proteins);
+
+  // Read peptides from a table (see peptide_table.h) rather than pepix. The
+  // table lets SetActiveRange() skip directly to min_range.
+  ActivePeptideQueue(const PeptideTable* table,
+            const vector<const pb::Protein*>& proteins);
+
   ~ActivePeptideQueue();
 
   bool isWithinIsotope(vector<double>* min_mass, vector<double>* max_mass, double mass, int* isotope_idx);
@@ -41,11 +122,33 @@ class ActivePeptideQueue {
   int SetActiveRange(vector<double>* min_mass, vector<double>* max_mass, double min_range, double max_range, vector<bool>* candidatePeptideStatus);
   int SetActiveRangeBIons(vector<double>* min_mass, vector<double>* max_mass, double min_range, double max_range, vector<bool>* candidatePeptideStatus);
 
+  // Called once the client will make no further calls to SetActiveRange(), so
+  // that a shared source need not keep this queue's peptides any longer.
+  void Finish();
+
+  // Time spent reading and compiling peptides, and reporting peptide-centric
+  // hits, is recorded in stats, which may be NULL (the default).
+  void SetStats(SearchStats* stats) { stats_ = stats; }
+
+  // Add the page counts of this queue's own allocators to stats. Peptides
+  // drawn from a shared source are counted by the source.
+  void CountFifoPages(SearchStats* stats) const;
+  SharedPeptideSource* SharedSource() const { return shared_source_; }
+
   bool HasNext() const { return iter_ != end_; }
   Peptide* NextPeptide() { return *iter_; }
   const Peptide* GetPeptide(int back_index) const {
     return peptide_centric_ ? current_peptide_ : *(end_ - back_index);
   }
+  // Position in the peptide file of the peptide at it, which must point into
+  // the queue. Positions of queued peptides stay fixed as the window moves.
+  long Position(deque<Peptide*>::const_iterator it) const {
+    return next_index_ - (long)(queue_.end() - it);
+  }
+  // The queued peptide at the given position in the peptide file.
+  const Peptide* PeptideAt(long position) const {
+    return queue_[position - (next_index_ - (long)queue_.size())];
+  }
   void SetBinSize(double binWidth, double binOffset) {
     theoretical_b_peak_set_.binWidth_ = binWidth;
     theoretical_b_peak_set_.binOffset_ = binOffset;
@@ -65,7 +168,8 @@ class ActivePeptideQueue {
 
   void ReportPeptideHits(Peptide* peptide);
   void SetOutputs(OutputFiles* output_files, const vector<const pb::AuxLocation*>* locations, int top_matches,
-                  bool compute_sp, ofstream* target_file, ofstream* decoy_file, double highest_mz) {
+                  bool compute_sp, ofstream* target_file, ofstream* decoy_file, double highest_mz,
+                  const SearchConfig* config) {
       locations_ = locations;
       output_files_ = output_files;
       top_matches_ = top_matches;
@@ -73,6 +177,8 @@ class ActivePeptideQueue {
       target_file_ = target_file;
       decoy_file_ = decoy_file;
       highest_mz_ = highest_mz;
+      config_ = config;
+      ResetSpScorer();
   }
   void setPeptideCentric(bool peptide_centric) {
     peptide_centric_ = peptide_centric;
@@ -95,7 +201,11 @@ class ActivePeptideQueue {
   ofstream* target_file_;
   ofstream* decoy_file_;
   double highest_mz_;
+  const SearchConfig* config_;
   Peptide* current_peptide_;
+  // Sp workspace for ReportPeptideHits, made on first use for highest_mz_
+  SpScorer* sp_scorer_;
+  SearchStats* stats_;
   bool exact_pval_search_;
   bool peptide_centric_;
   int elution_window_;
@@ -107,10 +217,22 @@ class ActivePeptideQueue {
   // See .cc file.
   void ComputeTheoreticalPeaksBack();
   void ComputeBTheoreticalPeaksBack();
+  bool ReadDone();
+  void ReadNext();
+  void SkipTo(double min_range);
+  void ResetSpScorer();
 
   RecordReader* reader_;
+  const PeptideTable* table_;
   pb::Peptide current_pb_peptide_;
 
+  // Non-NULL if peptides are drawn from a SharedPeptideSource rather than
+  // from reader_ or table_. next_index_ is the file position of the next
+  // peptide this queue will read, from whichever of them is in use.
+  SharedPeptideSource* shared_source_;
+  int consumer_;
+  long next_index_;
+
   // All amino acid sequences from which the peptides are drawn.
   const vector<const pb::Protein*>& proteins_; 
 
@@ -152,7 +274,7 @@ CONSIDER:
 Make 3 subclasses:
   Read-as-you-go (below)
   Preread into memory (as current operation)
-  Threaded reads (!!)
+  Threaded reads (!!) (partly addressed by SharedPeptideSource)
 
 pb::Peptide* pb_peptide = new pb::Peptide;
 CHECK(reader_->Read(pb_peptide));
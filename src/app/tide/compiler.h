@@ -75,16 +75,30 @@
 //    loop +1 // equivalent to dec %ecx; if (ecx != 0) skip one instruction
 //    ret
 //    ... (next program here)
+//
+// Alternatively, a compiler constructed in portable mode emits no machine
+// code. Each "program" is then just the list of cache offsets to add and to
+// subtract, laid out as
+//
+//    [num_pos, num_neg, pos_1, ..., pos_num_pos, neg_1, ..., neg_num_neg]
+//
+// and the dot product is taken by RunPortable(). Portable programs don't
+// chain into one another, so the caller visits each candidate peptide in turn.
+// This path works on any architecture. Both lists are sorted, so that
+// RunSparse() can also take the dot product with an observed peak set that
+// keeps only its nonzero cache entries (see spectrum_preprocess.h).
 
 #ifndef COMPILER_H
 #define COMPILER_H
 
 #include <stdint.h>
+#include <algorithm>
 
 class TheoreticalPeakCompiler {
  public:
-  explicit TheoreticalPeakCompiler(FifoAllocator* fifo_alloc) 
-    : fifo_alloc_(fifo_alloc), last_alloc_end_(NULL) {
+  explicit TheoreticalPeakCompiler(FifoAllocator* fifo_alloc,
+                                   bool portable = false)
+    : fifo_alloc_(fifo_alloc), last_alloc_end_(NULL), portable_(portable) {
       // fifo_alloc_ will make room for generated programs.
   }
 
@@ -92,6 +106,14 @@ class TheoreticalPeakCompiler {
     // Init() gets called once per candidate peptide.
     // pos_size is the number of cache entries to be added together, neg_size
     // is the number to be subtracted.
+    if (portable_) {
+      // Negative offsets are written after room for pos_size positive ones,
+      // and moved down by Done().
+      list_ = (int*) fifo_alloc_->New(sizeof(int) * (2 + pos_size + neg_size));
+      list_[0] = list_[1] = 0;
+      neg_list_ = list_ + 2 + pos_size;
+      return list_;
+    }
     // add or sub instructions take six bytes. The coda (containing the
     // storage of results etc.) takes seven bytes.
     int total_size = 6*(pos_size + neg_size) + 7;
@@ -152,6 +174,15 @@ class TheoreticalPeakCompiler {
   }
 
   void Done() {
+    if (portable_) {
+      int* end = list_ + 2 + list_[0];
+      for (int i = 0; i < list_[1]; ++i)
+        end[i] = neg_list_[i];
+      std::sort(list_ + 2, end);
+      std::sort(end, end + list_[1]);
+      fifo_alloc_->Unalloc(end + list_[1]);
+      return;
+    }
     // Write the coda instructions which will store results and update
     // counter. See comments above.
     // Poke machine code into the next 7 bytes at pos_.
@@ -164,6 +195,59 @@ class TheoreticalPeakCompiler {
     fifo_alloc_->Unalloc(last_alloc_end_);
   }
 
+  // Take the dot product of a portable program with the cache of an observed
+  // peak set. Four partial sums are kept so that successive loads don't wait
+  // on one another.
+  static int RunPortable(const void* prog, const int* cache) {
+    const int* list = (const int*) prog;
+    int num_pos = list[0];
+    int num_neg = list[1];
+    const int* code = list + 2;
+    int sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+    int i = 0;
+    for (; i + 4 <= num_pos; i += 4) {
+      sum0 += cache[code[i]];
+      sum1 += cache[code[i + 1]];
+      sum2 += cache[code[i + 2]];
+      sum3 += cache[code[i + 3]];
+    }
+    for (; i < num_pos; ++i)
+      sum0 += cache[code[i]];
+    code += num_pos;
+    for (i = 0; i < num_neg; ++i)
+      sum1 -= cache[code[i]];
+    return (sum0 + sum1) + (sum2 + sum3);
+  }
+
+  // Take the dot product of a portable program with the nonzero cache entries
+  // of an observed peak set, given as size codes in increasing order and
+  // their values. Entries missing from codes are zero.
+  static int RunSparse(const void* prog, const int* codes, const int* values,
+                       int size) {
+    const int* list = (const int*) prog;
+    const int* code = list + 2;
+    const int* codes_end = codes + size;
+    int sum = 0;
+    const int* pos = codes;
+    for (int i = 0; i < list[0]; ++i) {
+      pos = std::lower_bound(pos, codes_end, code[i]);
+      if (pos == codes_end)
+        break;
+      if (*pos == code[i])
+        sum += values[pos - codes];
+    }
+    code += list[0];
+    pos = codes;
+    for (int i = 0; i < list[1]; ++i) {
+      pos = std::lower_bound(pos, codes_end, code[i]);
+      if (pos == codes_end)
+        break;
+      if (*pos == code[i])
+        sum -= values[pos - codes];
+    }
+    return sum;
+  }
+
  private:
   // Various x86 instructions we need.
   static const uint16_t add_to_eax_at_edx_plus = 33283;
@@ -175,6 +259,10 @@ class TheoreticalPeakCompiler {
   static const int jmp_size = 5;
 
   void AddPositive(int peak) {
+    if (portable_) {
+      list_[2 + list_[0]++] = peak;
+      return;
+    }
     if (first_) { // First theoretical peak uses a 'mov' rather than an 'add'
       *((uint16_t*) pos_) = mov_to_eax_at_edx_plus;
     } else {
@@ -187,6 +275,10 @@ class TheoreticalPeakCompiler {
   }
 
   void AddNegative(int peak) {
+    if (portable_) {
+      neg_list_[list_[1]++] = peak;
+      return;
+    }
     *((uint16_t*) pos_) = sub_from_eax_at_edx_plus;
     pos_ += 2;
     *((int*) pos_) = peak << 2; // Store 4 * the peak position.
@@ -203,6 +295,10 @@ class TheoreticalPeakCompiler {
   unsigned char* last_alloc_end_;
   unsigned char* pos_; // "cursor position" as we write out instructions.
   bool first_;
+
+  bool portable_;
+  int* list_; // portable program being written
+  int* neg_list_; // where its negative offsets go until Done()
 };
 
 #endif // COMPILER_H
@@ -10,13 +10,29 @@ SpSpectrum::SpSpectrum(const Spectrum& spectrum, int charge, double max_mz)
   : beta_(0.075), max_intensity_(0.0), last_idx_(0) {
   max_mz_ = MassConstants::mass2bin(max_mz);  
   intensity_array_ = new double[IntensityArraySize()];
-  memset(intensity_array_, 0, sizeof(double)*IntensityArraySize());
+  scratch_array_ = new double[IntensityArraySize()];
 
-  PreprocessSpectrum(spectrum, charge);
+  Preprocess(spectrum, charge);
+}
+
+SpSpectrum::SpSpectrum(double max_mz)
+  : beta_(0.075), max_intensity_(0.0), last_idx_(0) {
+  max_mz_ = MassConstants::mass2bin(max_mz);
+  intensity_array_ = new double[IntensityArraySize()];
+  scratch_array_ = new double[IntensityArraySize()];
+  memset(intensity_array_, 0, sizeof(double)*IntensityArraySize());
 }
 
 SpSpectrum::~SpSpectrum() {
   delete [] intensity_array_;
+  delete [] scratch_array_;
+}
+
+void SpSpectrum::Preprocess(const Spectrum& spectrum, int charge) {
+  memset(intensity_array_, 0, sizeof(double)*IntensityArraySize());
+  max_intensity_ = 0.0;
+  last_idx_ = 0;
+  PreprocessSpectrum(spectrum, charge);
 }
 
 void SpSpectrum::PreprocessSpectrum(const Spectrum& spectrum, int charge) {
@@ -102,7 +118,7 @@ void SpSpectrum::NormalizeIntensityArray(double threshold) {
 
 void SpSpectrum::SmoothPeaks() {
   // create a new array, which will replace the original intensity array
-  double* new_array = new double[IntensityArraySize()];
+  double* new_array = scratch_array_;
   memset(new_array, 0, sizeof(double)*IntensityArraySize());
 
   // iterate over all peaks
@@ -119,13 +135,13 @@ void SpSpectrum::SmoothPeaks() {
     }
   }
 
-  delete [] intensity_array_;
+  scratch_array_ = intensity_array_;
   intensity_array_ = new_array;
 }
 
 void SpSpectrum::ZeroPeaks() {
   // create a new array, which will replace the original intensity array
-  double* new_array = new double[IntensityArraySize()];
+  double* new_array = scratch_array_;
   memset(new_array, 0, sizeof(double)*IntensityArraySize());
   
   // step 1,
@@ -134,13 +150,13 @@ void SpSpectrum::ZeroPeaks() {
   // step 2,
   ZeroPeakMeanStdev(2, new_array);
 
-  delete[] intensity_array_;
+  scratch_array_ = intensity_array_;
   intensity_array_ = new_array;
 }
 
 void SpSpectrum::ExtractPeaks(int top_rank) {
   // copy all peaks to temp_array
-  double* temp_array = new double[IntensityArraySize()];
+  double* temp_array = scratch_array_;
   memset(temp_array, 0, sizeof(double)*IntensityArraySize());
   int temp_idx = 0;
   for(int idx = 0; idx < IntensityArraySize(); ++idx){
@@ -171,8 +187,6 @@ void SpSpectrum::ExtractPeaks(int top_rank) {
       }
     }
   }
-  
-  delete [] temp_array;
 }
 
 void SpSpectrum::EqualizePeaks()
@@ -50,8 +50,14 @@
 class SpSpectrum {
  public:
   SpSpectrum(const Spectrum& spectrum, int charge, double max_mz);
+  // Allocates the arrays only; call Preprocess() before use.
+  explicit SpSpectrum(double max_mz);
   ~SpSpectrum();
 
+  // Replace the contents with the given spectrum, reusing the arrays, which
+  // are sized by the max_mz passed to the constructor.
+  void Preprocess(const Spectrum& spectrum, int charge);
+
   double Intensity(int index) const { return index < IntensityArraySize() ? intensity_array_[index] : 0; }
   double Beta() const { return beta_; }
   double TotalIonIntensity() {
@@ -139,6 +145,10 @@ class SpSpectrum {
   // Intensity array that can be indexed using the m/z bin
   double* intensity_array_; 
 
+  // Workspace of the same size, swapped with intensity_array_ by the steps
+  // that build a new array from the old one.
+  double* scratch_array_;
+
   // the max intensity in the intensity array
   double max_intensity_; 
 
@@ -27,6 +27,7 @@
 #endif
 #include<stdlib.h>
 #include<assert.h>
+#include<algorithm>
 #include<iostream>
 #include "fifo_alloc.h"
 
@@ -95,8 +96,11 @@ void FifoPage::DeletePage(void* page, size_t size) {
 void* FifoAllocator::FallbackNew(size_t amount) {    
   // Check if a free page is already in our linked list.
   FifoPage* free_page = current_page_->Next(); 
-  if (free_page == first_page_) {  // No free page in linked list
-    FifoPage* new_page = new FifoPage(page_size_);
+  ++page_switches_;
+  if (free_page == first_page_ || free_page->Size() < amount) {
+    // No free page in linked list, or it is too small for this block.
+    FifoPage* new_page = new FifoPage(max(page_size_, amount));
+    ++pages_mapped_;
     current_page_->InsertPage(new_page);
     current_page_ = new_page;
   } else {
@@ -104,13 +108,6 @@ void* FifoAllocator::FallbackNew(size_t amount) {
   }
   assert(current_page_->Empty());
 
-  if (amount > page_size_) { // CONSIDER: eliminate this restriction.
-    cerr << "Requested " << amount << " bytes from FifoAllocator, "
-	 << "but page size is " << page_size_ << ". Aborting\n";
-    abort();
-    return NULL;
-  }
-
   void* result = current_page_->New(amount);
   assert(result != NULL);
   return result;
@@ -8,7 +8,8 @@
 // for FIFO usage patterns, e.g. data assocatied with a queue.
 // 
 // A page size, S, is supplied to the FifoAllocator constructor.
-// At most 2 * S extra memory will be allocated.
+// At most 2 * S extra memory will be allocated. A block larger than S gets a
+// page of its own size, which is kept for reuse like any other page.
 //
 // Not thread safe! (TODO 254)
 //
@@ -46,6 +47,7 @@ class FifoPage {
 
   ~FifoPage() { DeletePage(page_, size_); }
 
+  size_t Size() const { return size_; }
   void Clear() { end_used_ = page_; }
   bool Empty() const { return end_used_ == page_; }
 
@@ -105,7 +107,8 @@ class FifoPage {
 
 class FifoAllocator {
  public:
-  explicit FifoAllocator(size_t page_size) : page_size_(page_size) {
+  explicit FifoAllocator(size_t page_size)
+    : page_size_(page_size), pages_mapped_(1), page_switches_(0) {
     current_page_ = new FifoPage(page_size_);
     first_page_ = current_page_;
   }
@@ -132,6 +135,11 @@ class FifoAllocator {
 
   void Show();
 
+  // Number of pages obtained from the system, and number of times allocation
+  // moved on to another page, since construction.
+  long PagesMapped() const { return pages_mapped_; }
+  long PageSwitches() const { return page_switches_; }
+
 #ifdef MEM_STATS
   static size_t Total() { return total_; }
 #endif
@@ -143,6 +151,8 @@ class FifoAllocator {
   size_t page_size_;
   FifoPage* first_page_;
   FifoPage* current_page_;
+  long pages_mapped_;
+  long page_switches_;
 
 #ifdef MEM_STATS
   static size_t total_;
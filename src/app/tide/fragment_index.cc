@@ -0,0 +1,254 @@
+// See fragment_index.h.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#ifdef _MSC_VER
+#include <io.h>
+#include "mman.h"
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "fragment_index.h"
+#include "io/carp.h"
+#include "util/FileUtils.h"
+#include "util/StringUtils.h"
+
+// The default mz-bin-width and mz-bin-offset.
+static const double BIN_WIDTH = 1.0005079;
+static const double BIN_OFFSET = 0.40;
+
+string FragmentIndex::FileName(const string& index_dir) {
+  return FileUtils::Join(index_dir, "pepix.fragments");
+}
+
+int FragmentIndex::Bin(double mz) {
+  return (int)(mz / BIN_WIDTH + 1.0 - BIN_OFFSET);
+}
+
+FragmentIndex::FragmentIndex(const string& filename)
+  : map_(NULL), map_size_(0), header_(NULL), offsets_(NULL), postings_(NULL) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+    close(fd);
+    return;
+  }
+  map_size_ = st.st_size;
+  void* map = mmap(0, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid
+  if (map == MAP_FAILED) {
+    return;
+  }
+  const char* base = (const char*) map;
+  const Header* header = (const Header*) base;
+  if (header->magic != kMagic || header->version != kVersion ||
+      header->postings_offset + header->postings_size * (int64_t)sizeof(int32_t) >
+        (int64_t)map_size_) {
+    munmap(map, map_size_);
+    return;
+  }
+  map_ = map;
+  header_ = header;
+  offsets_ = (const int64_t*)(base + header->offsets_offset);
+  postings_ = (const int32_t*)(base + header->postings_offset);
+}
+
+FragmentIndex::~FragmentIndex() {
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+  }
+}
+
+const int32_t* FragmentIndex::Postings(int bin, int* size) const {
+  if (bin < 0 || bin >= NumBins()) {
+    *size = 0;
+    return postings_;
+  }
+  *size = (int)(offsets_[bin + 1] - offsets_[bin]);
+  return postings_ + offsets_[bin];
+}
+
+void FragmentIndex::CountShared(const vector<int>& bins, long begin, long end,
+                                vector<int>* counts) const {
+  counts->assign(end - begin, 0);
+  for (vector<int>::const_iterator i = bins.begin(); i != bins.end(); ++i) {
+    int size;
+    const int32_t* list = Postings(*i, &size);
+    const int32_t* p = lower_bound(list, list + size, (int32_t)begin);
+    for (const int32_t* last = list + size; p != last && *p < end; ++p) {
+      ++(*counts)[*p - begin];
+    }
+  }
+}
+
+FragmentIndexWriter::FragmentIndexWriter(const string& filename,
+                                         size_t max_postings,
+                                         const string& temp_dir)
+  : filename_(filename), num_peptides_(0), max_postings_(max_postings),
+    num_postings_(0), temp_dir_(temp_dir) {
+  if (temp_dir_.empty()) {
+    temp_dir_ = boost::filesystem::temp_directory_path().string();
+  }
+}
+
+FragmentIndexWriter::~FragmentIndexWriter() {
+  if (!block_files_.empty() && num_postings_ > 0) {
+    Spill();
+  }
+  if (block_files_.empty()) {
+    bin_sizes_.clear();
+    for (size_t i = 0; i < postings_.size(); ++i) {
+      bin_sizes_.push_back(postings_[i].size());
+    }
+  }
+
+  FragmentIndex::Header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = FragmentIndex::kMagic;
+  header.version = FragmentIndex::kVersion;
+  header.num_peptides = num_peptides_;
+  header.num_bins = bin_sizes_.size();
+  header.offsets_offset = sizeof(header);
+  header.postings_offset = header.offsets_offset +
+    (header.num_bins + 1) * (int64_t)sizeof(int64_t);
+
+  vector<int64_t> offsets(1, 0);
+  for (size_t i = 0; i < bin_sizes_.size(); ++i) {
+    offsets.push_back(offsets.back() + bin_sizes_[i]);
+  }
+  header.postings_size = offsets.back();
+
+  FILE* file = fopen(filename_.c_str(), "wb");
+  if (file == NULL) {
+    Fail("Couldn't open file " + filename_ + " for write.");
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(&offsets[0], sizeof(int64_t), offsets.size(), file) == offsets.size();
+  if (block_files_.empty()) {
+    for (size_t i = 0; ok && i < postings_.size(); ++i) {
+      ok = postings_[i].empty() ||
+        fwrite(&postings_[i][0], sizeof(int32_t), postings_[i].size(), file) ==
+          postings_[i].size();
+    }
+  } else {
+    // Each block holds its number of bins, then for each bin the size and the
+    // postings of its list, so the blocks are read in step, one bin at a time.
+    carp(CARP_INFO, "Merging %d blocks of fragment postings",
+         (int)block_files_.size());
+    vector<FILE*> blocks;
+    vector<int64_t> block_bins;
+    for (size_t i = 0; i < block_files_.size(); ++i) {
+      FILE* block = fopen(block_files_[i].c_str(), "rb");
+      int64_t num_bins;
+      if (block == NULL || fread(&num_bins, sizeof(num_bins), 1, block) != 1) {
+        Fail("Error reading " + block_files_[i] + ".");
+      }
+      blocks.push_back(block);
+      block_bins.push_back(num_bins);
+    }
+    vector<int32_t> list;
+    for (int64_t bin = 0; ok && bin < header.num_bins; ++bin) {
+      for (size_t i = 0; ok && i < blocks.size(); ++i) {
+        if (bin >= block_bins[i]) {
+          continue;
+        }
+        int64_t size;
+        if (fread(&size, sizeof(size), 1, blocks[i]) != 1) {
+          Fail("Error reading " + block_files_[i] + ".");
+        }
+        list.resize(size);
+        if (size > 0 &&
+            fread(&list[0], sizeof(int32_t), size, blocks[i]) != (size_t)size) {
+          Fail("Error reading " + block_files_[i] + ".");
+        }
+        ok = size == 0 ||
+          fwrite(&list[0], sizeof(int32_t), size, file) == (size_t)size;
+      }
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      fclose(blocks[i]);
+      FileUtils::Remove(block_files_[i]);
+    }
+    block_files_.clear();
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    carp(CARP_FATAL, "Error writing %s.", filename_.c_str());
+  }
+}
+
+void FragmentIndexWriter::Write(const double* fragment_mz, int num_fragments) {
+  int32_t position = num_peptides_++;
+  for (int i = 0; i < num_fragments; ++i) {
+    int bin = FragmentIndex::Bin(fragment_mz[i]);
+    if (bin < 0) {
+      continue;
+    }
+    if (bin >= (int)postings_.size()) {
+      postings_.resize(bin + 1);
+    }
+    // A peptide is listed once per bin, however many fragments fall in it.
+    vector<int32_t>& list = postings_[bin];
+    if (list.empty() || list.back() != position) {
+      list.push_back(position);
+      ++num_postings_;
+    }
+  }
+  // Blocks only end between peptides.
+  if (max_postings_ > 0 && num_postings_ >= max_postings_) {
+    Spill();
+  }
+}
+
+void FragmentIndexWriter::Spill() {
+  // Unique names, so that tide-index runs sharing temp-dir keep their blocks
+  // apart
+  string block_file = FileUtils::UniquePath(FileUtils::Join(temp_dir_,
+    "tide_index_fragments_" + StringUtils::ToString(block_files_.size()) +
+    "_%%%%%%%%%%%%%%%%"));
+  FILE* out = fopen(block_file.c_str(), "wb");
+  if (out == NULL) {
+    Fail("Couldn't open file " + block_file + " for write.");
+  }
+  block_files_.push_back(block_file);
+  if (bin_sizes_.size() < postings_.size()) {
+    bin_sizes_.resize(postings_.size(), 0);
+  }
+  int64_t num_bins = postings_.size();
+  bool ok = fwrite(&num_bins, sizeof(num_bins), 1, out) == 1;
+  for (size_t i = 0; ok && i < postings_.size(); ++i) {
+    int64_t size = postings_[i].size();
+    bin_sizes_[i] += size;
+    ok = fwrite(&size, sizeof(size), 1, out) == 1 &&
+      (size == 0 ||
+       fwrite(&postings_[i][0], sizeof(int32_t), size, out) == (size_t)size);
+  }
+  ok = (fclose(out) == 0) && ok;
+  if (!ok) {
+    Fail("Error writing " + block_file + ".");
+  }
+  carp(CARP_DEBUG, "Wrote %d fragment postings to %s", (int)num_postings_,
+       block_file.c_str());
+  // Keep the bins, which the next block is likely to need again.
+  for (size_t i = 0; i < postings_.size(); ++i) {
+    postings_[i].clear();
+  }
+  num_postings_ = 0;
+}
+
+void FragmentIndexWriter::Fail(const string& message) {
+  // Remove the blocks before exiting, since the destructor will not run.
+  for (size_t i = 0; i < block_files_.size(); ++i) {
+    FileUtils::Remove(block_files_[i]);
+  }
+  block_files_.clear();
+  carp(CARP_FATAL, "%s", message.c_str());
+}
@@ -0,0 +1,123 @@
+// A FragmentIndex is an inverted index from fragment ion m/z to peptides,
+// optionally written by tide-index next to pepix. For each fragment bin it
+// lists, in increasing order, the positions (ids) of the peptides that have a
+// singly charged b or y ion in that bin.
+//
+// tide-search uses it to preselect candidates when the precursor window is
+// wide, as in open modification searches: the number of observed peaks that
+// a peptide shares with a spectrum is counted from the lists of the
+// spectrum's peak bins, and only the peptides with the highest counts are
+// scored with XCorr (see the fragment-index-top-n parameter).
+//
+// Bins are unit-resolution, independent of mz-bin-width, so that one index
+// serves searches at any bin width.
+//
+// The file consists of three regions:
+//
+//   header     FragmentIndex::Header, giving the size and offset of the others.
+//   offsets    num_bins + 1 offsets into postings; the list of bin b is
+//              postings[offsets[b]] up to postings[offsets[b + 1]].
+//   postings   Peptide positions, as int32.
+//
+// As with PeptideTable (see peptide_table.h) the file is written with the
+// byte order and layout of the machine that runs tide-index, and is memory
+// mapped at search time.
+//
+// Example usage:
+//   FragmentIndex index(FragmentIndex::FileName(index_dir));
+//   CHECK(index.OK());
+//   int size;
+//   const int32_t* list = index.Postings(FragmentIndex::Bin(mz), &size);
+
+#ifndef FRAGMENT_INDEX_H
+#define FRAGMENT_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class FragmentIndex {
+ public:
+  static const uint32_t kMagic = 0xf7a9e1d3;
+  static const uint32_t kVersion = 1;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t num_peptides;
+    int64_t num_bins;
+    int64_t offsets_offset;
+    int64_t postings_offset;
+    int64_t postings_size; // number of postings
+  };
+
+  // File name of the fragment index within an index directory.
+  static string FileName(const string& index_dir);
+
+  // Fragment bin of a singly charged ion of the given m/z.
+  static int Bin(double mz);
+
+  explicit FragmentIndex(const string& filename);
+  ~FragmentIndex();
+
+  // client should check once after construction
+  bool OK() const { return map_ != NULL; }
+
+  long NumPeptides() const { return (long)header_->num_peptides; }
+  int NumBins() const { return (int)header_->num_bins; }
+
+  // Positions of the peptides with a fragment in bin, in increasing order.
+  // *size gets their number; it is 0 for bins outside the index.
+  const int32_t* Postings(int bin, int* size) const;
+
+  // For each position from begin to end - 1, set (*counts)[position - begin]
+  // to the number of the given bins in which the peptide at that position
+  // has a fragment. bins must not hold duplicates.
+  void CountShared(const vector<int>& bins, long begin, long end,
+                   vector<int>* counts) const;
+
+ private:
+  void* map_;
+  size_t map_size_;
+  const Header* header_;
+  const int64_t* offsets_;
+  const int32_t* postings_;
+};
+
+// Writes a FragmentIndex. Peptides must be written in order of position, which
+// is how tide-index writes pepix. By default the postings are kept in memory
+// until the writer is destroyed. With max_postings set, whenever max_postings
+// postings are held they are written as a block to a temporary file in
+// temp_dir, and the blocks are joined into the index when the writer
+// is destroyed. Since positions only increase, each bin's list is the
+// concatenation of its lists in the blocks, in block order.
+class FragmentIndexWriter {
+ public:
+  explicit FragmentIndexWriter(const string& filename, size_t max_postings = 0,
+                               const string& temp_dir = "");
+  ~FragmentIndexWriter();
+
+  // Add the peptide at the next position, whose singly charged fragments
+  // have the num_fragments given m/z values.
+  void Write(const double* fragment_mz, int num_fragments);
+
+ private:
+  // Writes the postings held in memory as a block and clears them.
+  void Spill();
+  // Removes the blocks, then exits with message.
+  void Fail(const string& message);
+
+  string filename_;
+  long num_peptides_;
+  size_t max_postings_;
+  size_t num_postings_; // held in memory
+  string temp_dir_;
+  vector<vector<int32_t> > postings_;
+  vector<int64_t> bin_sizes_; // over all blocks, used once there are blocks
+  vector<string> block_files_;
+};
+
+#endif // FRAGMENT_INDEX_H
@@ -156,6 +156,7 @@ class Peptide {
   }
 
   string Seq() const { return string(residues_, Len()); } // For display
+  const char* Residues() const { return residues_; } // Len() residues
 
   string SeqWithMods() const;
 
@@ -25,6 +25,9 @@
 #include "peptide.h"
 #include "theoretical_peak_set.h"
 #include "abspath.h"
+#include "peptide_table.h"
+#include "fragment_index.h"
+#include "util/mass.h"
 
 using namespace std;
 
@@ -56,7 +59,11 @@ static void AddPeaksToPB(pb::Peptide* peptide, const TheoreticalPeakArr* peaks,
 
 void AddTheoreticalPeaks(const vector<const pb::Protein*>& proteins,
 			 const string& input_filename,
-			 const string& output_filename) {
+			 const string& output_filename,
+			 const string& table_filename,
+			 const string& fragments_filename,
+			 size_t max_fragment_postings,
+			 const string& temp_dir) {
   pb::Header orig_header, new_header;
   HeadedRecordReader reader(input_filename, &orig_header);
   CHECK(orig_header.file_type() == pb::Header::PEPTIDES);
@@ -69,9 +76,19 @@ void AddTheoreticalPeaks(const vector<const pb::Protein*>& proteins,
   pb::Header_Source* source = new_header.add_source();
   source->mutable_header()->CopyFrom(orig_header);
   source->set_filename(AbsPath(input_filename));
-  HeadedRecordWriter writer(output_filename, new_header);
+  HeadedRecordWriter* writer = new HeadedRecordWriter(output_filename, new_header);
   CHECK(reader.OK());
-  CHECK(writer.OK());
+  CHECK(writer->OK());
+  PeptideTableWriter* table_writer = NULL;
+  if (!table_filename.empty()) {
+    table_writer = new PeptideTableWriter(table_filename, output_filename, new_header);
+  }
+  FragmentIndexWriter* fragment_writer = NULL;
+  if (!fragments_filename.empty()) {
+    fragment_writer = new FragmentIndexWriter(fragments_filename, max_fragment_postings,
+                                              temp_dir);
+  }
+  vector<double> fragments;
 
   pb::Peptide pb_peptide;
 //  const int workspace_size = 2000; // More than sufficient for theor. peaks.
@@ -91,7 +108,33 @@ void AddTheoreticalPeaks(const vector<const pb::Protein*>& proteins,
     AddPeaksToPB(&pb_peptide, &peaks_charge_2, 2, false);
     AddPeaksToPB(&pb_peptide, &negs_charge_1, 1, true);
     AddPeaksToPB(&pb_peptide, &negs_charge_2, 2, true);
-*/    CHECK(writer.Write(&pb_peptide));
+*/    CHECK(writer->Write(&pb_peptide));
+    if (table_writer) {
+      CHECK(table_writer->Write(pb_peptide));
+    }
+    if (fragment_writer) {
+      // Singly charged b and y ions
+      Peptide peptide(pb_peptide, proteins);
+      double* masses = peptide.getAAMasses();
+      int len = peptide.Len();
+      double total = 0;
+      for (int i = 0; i < len; ++i) {
+        total += masses[i];
+      }
+      fragments.clear();
+      double b = 0;
+      for (int i = 0; i < len - 1; ++i) {
+        b += masses[i];
+        fragments.push_back(b + MASS_PROTON);
+        fragments.push_back(total - b + MASS_H2O_MONO + MASS_PROTON);
+      }
+      delete[] masses;
+      fragment_writer->Write(fragments.empty() ? NULL : &fragments[0],
+                             fragments.size());
+    }
   }
   CHECK(reader.OK());
+  delete writer; // the table records the size of the finished pepix
+  delete table_writer;
+  delete fragment_writer;
 }
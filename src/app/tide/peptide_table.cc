@@ -0,0 +1,249 @@
+// See peptide_table.h.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <algorithm>
+#ifdef _MSC_VER
+#include <io.h>
+#include "mman.h"
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "peptide_table.h"
+#include "io/carp.h"
+#include "util/FileUtils.h"
+
+typedef google::protobuf::RepeatedField<google::protobuf::int32> Int32Array;
+
+// Each array is stored as the differences between successive values (the
+// first against 0), zigzag encoded so that small negative differences stay
+// small, and written as varints.
+static void EncodeArray(const Int32Array& values, vector<unsigned char>* buf) {
+  int32_t last = 0;
+  for (int i = 0; i < values.size(); ++i) {
+    int32_t delta = values.Get(i) - last;
+    last = values.Get(i);
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    while (zigzag >= 0x80) {
+      buf->push_back((unsigned char)(zigzag | 0x80));
+      zigzag >>= 7;
+    }
+    buf->push_back((unsigned char)zigzag);
+  }
+}
+
+static const unsigned char* DecodeArray(const unsigned char* p, int size,
+                                        Int32Array* values) {
+  values->Reserve(size);
+  int32_t last = 0;
+  for (int i = 0; i < size; ++i) {
+    uint32_t zigzag = 0;
+    int shift = 0;
+    do {
+      zigzag |= (uint32_t)(*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p++ & 0x80);
+    last += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    values->Add(last);
+  }
+  return p;
+}
+
+string PeptideTable::FileName(const string& index_dir) {
+  return FileUtils::Join(index_dir, "pepix.table");
+}
+
+// Size of a file in bytes, or -1 if it cannot be read.
+static int64_t FileSize(const string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {
+    return -1;
+  }
+  return (int64_t)st.st_size;
+}
+
+uint64_t PeptideTable::HeaderHash(const pb::Header& header) {
+  // 64-bit FNV-1a
+  string bytes = header.SerializeAsString();
+  uint64_t hash = 14695981039346656037ULL;
+  for (string::const_iterator i = bytes.begin(); i != bytes.end(); ++i) {
+    hash = (hash ^ (unsigned char)*i) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+PeptideTable::PeptideTable(const string& filename)
+  : map_(NULL), map_size_(0), header_(NULL), entries_(NULL),
+    directory_(NULL), arrays_(NULL) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+    close(fd);
+    return;
+  }
+  map_size_ = st.st_size;
+  void* map = mmap(0, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid
+  if (map == MAP_FAILED) {
+    return;
+  }
+  const char* base = (const char*) map;
+  const Header* header = (const Header*) base;
+  if (header->magic != kMagic || header->version != kVersion ||
+      header->arrays_offset + header->arrays_size > (int64_t)map_size_) {
+    munmap(map, map_size_);
+    return;
+  }
+  map_ = map;
+  header_ = header;
+  entries_ = (const Entry*)(base + header->entries_offset);
+  directory_ = (const double*)(base + header->directory_offset);
+  arrays_ = (const unsigned char*)(base + header->arrays_offset);
+}
+
+PeptideTable::~PeptideTable() {
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+  }
+}
+
+bool PeptideTable::Matches(const string& pepix_filename,
+                           const pb::Header& pepix_header) const {
+  return header_->pepix_size == FileSize(pepix_filename) &&
+         header_->pepix_header_hash == HeaderHash(pepix_header);
+}
+
+long PeptideTable::LowerBound(double mass) const {
+  // The first block that starts at or above mass; the answer is either in the
+  // block before it or is its first entry.
+  long block = lower_bound(directory_, directory_ + header_->num_blocks, mass)
+               - directory_;
+  long end = min(block * kBlockSize, Size());
+  if (block == 0) {
+    return end;
+  }
+  const Entry* first = entries_ + (block - 1) * kBlockSize;
+  const Entry* last = entries_ + end;
+  while (first != last && first->mass < mass) {
+    ++first;
+  }
+  return first - entries_;
+}
+
+void PeptideTable::Read(long position, pb::Peptide* peptide) const {
+  const Entry& entry = entries_[position];
+  peptide->Clear();
+  peptide->set_id(position);
+  peptide->set_mass(entry.mass);
+  peptide->set_length(entry.length);
+  peptide->mutable_first_location()->set_protein_id(entry.protein_id);
+  peptide->mutable_first_location()->set_pos(entry.pos);
+  if (entry.aux_locations_index >= 0) {
+    peptide->set_aux_locations_index(entry.aux_locations_index);
+  }
+  if (entry.decoy_index >= 0) {
+    peptide->set_decoy_index(entry.decoy_index);
+  }
+  const unsigned char* p = arrays_ + entry.arrays;
+  p = DecodeArray(p, entry.array_sizes[0], peptide->mutable_peak1());
+  p = DecodeArray(p, entry.array_sizes[1], peptide->mutable_peak2());
+  p = DecodeArray(p, entry.array_sizes[2], peptide->mutable_neg_peak1());
+  p = DecodeArray(p, entry.array_sizes[3], peptide->mutable_neg_peak2());
+  DecodeArray(p, entry.array_sizes[4], peptide->mutable_modifications());
+}
+
+PeptideTableWriter::PeptideTableWriter(const string& filename,
+                                       const string& pepix_filename,
+                                       const pb::Header& pepix_header)
+  : filename_(filename), pepix_filename_(pepix_filename),
+    arrays_filename_(filename + ".arrays.tmp"), file_(NULL), arrays_file_(NULL) {
+  memset(&header_, 0, sizeof(header_));
+  header_.magic = PeptideTable::kMagic;
+  header_.version = PeptideTable::kVersion;
+  header_.entries_offset = sizeof(PeptideTable::Header);
+  header_.pepix_header_hash = PeptideTable::HeaderHash(pepix_header);
+  // The header is rewritten with the final sizes once all peptides are in.
+  if ((file_ = fopen(filename_.c_str(), "wb")) == NULL ||
+      (arrays_file_ = fopen(arrays_filename_.c_str(), "w+b")) == NULL ||
+      fwrite(&header_, sizeof(header_), 1, file_) != 1) {
+    carp(CARP_FATAL, "Couldn't open file %s for write.", filename_.c_str());
+  }
+}
+
+PeptideTableWriter::~PeptideTableWriter() {
+  if (file_ == NULL) {
+    return;
+  }
+  // Entries are followed by the directory, then the arrays, which were
+  // spooled to a temporary file so that the entries could be streamed.
+  header_.num_blocks = directory_.size();
+  header_.directory_offset = header_.entries_offset +
+    header_.num_peptides * (int64_t)sizeof(PeptideTable::Entry);
+  header_.arrays_offset = header_.directory_offset +
+    header_.num_blocks * (int64_t)sizeof(double);
+  header_.pepix_size = FileSize(pepix_filename_);
+  bool ok = directory_.empty() ||
+    fwrite(&directory_[0], sizeof(double), directory_.size(), file_) == directory_.size();
+  rewind(arrays_file_);
+  char buf[1 << 16];
+  size_t n;
+  while (ok && (n = fread(buf, 1, sizeof(buf), arrays_file_)) > 0) {
+    ok = fwrite(buf, 1, n, file_) == n;
+  }
+  ok = ok && fseek(file_, 0, SEEK_SET) == 0 &&
+       fwrite(&header_, sizeof(header_), 1, file_) == 1;
+  ok = (fclose(file_) == 0) && ok;
+  fclose(arrays_file_);
+  FileUtils::Remove(arrays_filename_);
+  if (!ok) {
+    carp(CARP_FATAL, "Error writing %s.", filename_.c_str());
+  }
+}
+
+bool PeptideTableWriter::Write(const pb::Peptide& peptide) {
+  if (peptide.id() != header_.num_peptides) {
+    carp(CARP_ERROR, "Peptide id %d written to %s at position %d.",
+         (int)peptide.id(), filename_.c_str(), (int)header_.num_peptides);
+    return false;
+  }
+  PeptideTable::Entry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.mass = peptide.mass();
+  entry.length = peptide.length();
+  entry.protein_id = peptide.first_location().protein_id();
+  entry.pos = peptide.first_location().pos();
+  entry.aux_locations_index =
+    peptide.has_aux_locations_index() ? peptide.aux_locations_index() : -1;
+  entry.decoy_index = peptide.has_decoy_index() ? peptide.decoy_index() : -1;
+  const Int32Array* arrays[PeptideTable::kNumArrays] = {
+    &peptide.peak1(), &peptide.peak2(), &peptide.neg_peak1(),
+    &peptide.neg_peak2(), &peptide.modifications()
+  };
+  buf_.clear();
+  for (int i = 0; i < PeptideTable::kNumArrays; ++i) {
+    if (arrays[i]->size() > 0xffff) {
+      return false;
+    }
+    entry.array_sizes[i] = arrays[i]->size();
+    EncodeArray(*arrays[i], &buf_);
+  }
+  entry.arrays = header_.arrays_size;
+
+  if (header_.num_peptides % PeptideTable::kBlockSize == 0) {
+    directory_.push_back(entry.mass);
+  }
+  if (fwrite(&entry, sizeof(entry), 1, file_) != 1 ||
+      (!buf_.empty() &&
+       fwrite(&buf_[0], 1, buf_.size(), arrays_file_) != buf_.size())) {
+    return false;
+  }
+  header_.arrays_size += buf_.size();
+  ++header_.num_peptides;
+  return true;
+}
@@ -0,0 +1,139 @@
+// A PeptideTable is a fixed-layout alternative to the file of peptide records
+// (pepix, see records.h) written by tide-index. The records can only be read
+// in order, parsing every pb::Peptide on the way. The table instead is mapped
+// into memory at search time, so that a reader can go straight to any
+// position, or to the first peptide of a given mass, without reading the
+// peptides in between.
+//
+// The file consists of four regions:
+//
+//   header     PeptideTable::Header, giving the size and offset of the others.
+//   entries    One PeptideTable::Entry per peptide, in the same (mass) order
+//              as pepix. The position of an entry is the peptide's id.
+//   directory  The mass of the first peptide of each block of kBlockSize
+//              entries, so that a mass lookup only touches a few entries.
+//   arrays     The repeated fields of each peptide (theoretical peak diffs and
+//              modifications), delta and varint encoded back to back.
+//
+// The table is written with the byte order and layout of the machine that runs
+// tide-index, and is only read back by the same build. It records the size and
+// a hash of the header of the pepix it was written with, so that a table left
+// behind when pepix is rebuilt without it is not used (see Matches()).
+//
+// Example usage:
+//   PeptideTable table(filename);
+//   CHECK(table.OK());
+//   pb::Peptide pb_peptide;
+//   for (long i = table.LowerBound(min_mass); i < table.Size(); ++i) {
+//     table.Read(i, &pb_peptide);
+//     ...
+//   }
+
+#ifndef PEPTIDE_TABLE_H
+#define PEPTIDE_TABLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "header.pb.h"
+#include "peptides.pb.h"
+
+using namespace std;
+
+class PeptideTable {
+ public:
+  static const uint32_t kMagic = 0x7e9ab1e5;
+  static const uint32_t kVersion = 2;
+  static const int kBlockSize = 64;
+
+  // Number of repeated fields stored in the arrays region for each peptide:
+  // peak1, peak2, neg_peak1, neg_peak2, modifications.
+  static const int kNumArrays = 5;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t num_peptides;
+    int64_t num_blocks;
+    int64_t entries_offset;
+    int64_t directory_offset;
+    int64_t arrays_offset;
+    int64_t arrays_size;
+    int64_t pepix_size; // bytes
+    uint64_t pepix_header_hash; // see HeaderHash()
+  };
+
+  struct Entry {
+    double mass;
+    int32_t length;
+    int32_t protein_id;
+    int32_t pos;
+    int32_t aux_locations_index; // -1 if none
+    int32_t decoy_index; // -1 if none
+    uint16_t array_sizes[kNumArrays];
+    int64_t arrays; // byte offset within the arrays region
+  };
+
+  // File name of the table within an index directory.
+  static string FileName(const string& index_dir);
+
+  // Hash of a pepix header, as recorded in the table.
+  static uint64_t HeaderHash(const pb::Header& header);
+
+  explicit PeptideTable(const string& filename);
+  ~PeptideTable();
+
+  // client should check once after construction
+  bool OK() const { return map_ != NULL; }
+
+  long Size() const { return (long)header_->num_peptides; }
+  double Mass(long position) const { return entries_[position].mass; }
+
+  // Whether the table was written with the pepix file pepix_filename, whose
+  // header is pepix_header.
+  bool Matches(const string& pepix_filename, const pb::Header& pepix_header) const;
+
+  // Position of the first peptide with mass at least mass, or Size() if there
+  // is none.
+  long LowerBound(double mass) const;
+
+  // Fill peptide with the peptide at the given position, exactly as it would
+  // have been read from pepix.
+  void Read(long position, pb::Peptide* peptide) const;
+
+ private:
+  void* map_;
+  size_t map_size_;
+  const Header* header_;
+  const Entry* entries_;
+  const double* directory_;
+  const unsigned char* arrays_;
+};
+
+// Writes a PeptideTable. Peptides must be written in order of non-decreasing
+// mass, with ids numbered sequentially from 0, which is how tide-index writes
+// pepix. pepix_filename is the pepix being written alongside, with header
+// pepix_header; it must be complete and closed before the writer is destroyed.
+class PeptideTableWriter {
+ public:
+  PeptideTableWriter(const string& filename, const string& pepix_filename,
+                     const pb::Header& pepix_header);
+  ~PeptideTableWriter();
+
+  bool OK() const { return file_ != NULL; }
+
+  bool Write(const pb::Peptide& peptide);
+
+ private:
+  string filename_;
+  string pepix_filename_;
+  string arrays_filename_;
+  FILE* file_;
+  FILE* arrays_file_;
+  PeptideTable::Header header_;
+  vector<double> directory_;
+  vector<unsigned char> buf_;
+};
+
+#endif // PEPTIDE_TABLE_H
@@ -0,0 +1,90 @@
+// See score_count_matrix.h.
+
+#include <assert.h>
+#include <algorithm>
+#include "score_count_matrix.h"
+
+void ScoreCountMatrix::Reset(int num_rows, int num_cols) {
+  num_rows_ = num_rows;
+  size_t size = (size_t)num_rows * num_cols;
+  if (cells_.size() < size) {
+    cells_.resize(size);
+  }
+  lo_.assign(num_cols, 0);
+  hi_.assign(num_cols, -1);
+}
+
+void ScoreCountMatrix::Extend(int col, int lo, int hi) {
+  double* cells = &cells_[Index(0, col)];
+  if (hi_[col] < lo_[col]) {
+    fill(cells + lo, cells + hi + 1, 0.0);
+    lo_[col] = lo;
+    hi_[col] = hi;
+    return;
+  }
+  if (lo < lo_[col]) {
+    fill(cells + lo, cells + lo_[col], 0.0);
+    lo_[col] = lo;
+  }
+  if (hi > hi_[col]) {
+    fill(cells + hi_[col] + 1, cells + hi + 1, 0.0);
+    hi_[col] = hi;
+  }
+}
+
+void ScoreCountMatrix::Accumulate(int col, int first_row, int last_row,
+                                  bool keep, int n, const int* masses,
+                                  const int* evidence, int evidence_stride,
+                                  const double* weights) {
+  if (!keep) {
+    int lo = max(lo_[col], first_row);
+    int hi = min(hi_[col], last_row);
+    if (lo <= hi) {
+      fill(&cells_[Index(lo, col)], &cells_[Index(hi, col)] + 1, 0.0);
+    }
+  }
+  // The rows of col that the nonzero cells of each source column reach.
+  for (int i = 0; i < n; ++i) {
+    int src = col - masses[i];
+    int e = evidence[i * evidence_stride];
+    int lo = max(lo_[src] + e, first_row);
+    int hi = min(hi_[src] + e, last_row);
+    if (lo <= hi) {
+      Extend(col, lo, hi);
+    }
+  }
+  // Sources are added one at a time, so that the inner loop runs over
+  // contiguous rows and can be vectorized. Each cell still receives its terms
+  // in order of i, as if they had been summed one cell at a time.
+  double* dst = &cells_[Index(0, col)];
+  for (int i = 0; i < n; ++i) {
+    assert(masses[i] > 0);
+    int src = col - masses[i];
+    int e = evidence[i * evidence_stride];
+    int lo = max(lo_[src] + e, first_row);
+    int hi = min(hi_[src] + e, last_row);
+    const double* src_cells = &cells_[Index(0, src)];
+    const double weight = weights[i];
+    for (int row = lo; row <= hi; ++row) {
+      dst[row] += src_cells[row - e] * weight;
+    }
+  }
+}
+
+void ScoreCountMatrix::Sum(int col, int first_row, int last_row, int n,
+                           const int* masses, const double* weights,
+                           vector<double>* out) const {
+  out->assign(last_row + 1, 0.0);
+  double* dst = &(*out)[0];
+  for (int i = 0; i < n; ++i) {
+    assert(masses[i] > 0);
+    int src = col - masses[i];
+    int lo = max(lo_[src], first_row);
+    int hi = min(hi_[src], last_row);
+    const double* src_cells = &cells_[Index(0, src)];
+    const double weight = weights[i];
+    for (int row = lo; row <= hi; ++row) {
+      dst[row] += src_cells[row] * weight;
+    }
+  }
+}
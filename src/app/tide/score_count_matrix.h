@@ -0,0 +1,97 @@
+// A ScoreCountMatrix is the dynamic programming matrix used to count the
+// peptides of a given mass by score, from which exact p-values are computed
+// (see TideSearchApplication::calcScoreCount and calcResidueScoreCount).
+// Rows are scores and columns are masses: cell (row, col) holds the weighted
+// number of residue sequences of mass col whose score corresponds to row.
+//
+// The matrix is stored column by column in a single buffer that is kept
+// between uses, so that a search thread that keeps one ScoreCountMatrix
+// allocates only until the buffer has grown to the largest size needed.
+//
+// Most cells are never reached: a column can only hold counts for the scores
+// reachable by a sequence of that mass. For each column the matrix tracks the
+// range of rows that may be nonzero; cells outside it read as zero, and are
+// neither cleared nor visited when a column is computed. This also means that
+// Reset() need not clear the buffer.
+//
+// Example usage:
+//   matrix.Reset(num_rows, num_cols);
+//   matrix.Set(init_row, init_col, 1.0);
+//   for (int col = first_col; col <= last_col; ++col) {
+//     matrix.Accumulate(col, first_row, last_row, true,
+//                       num_aa, aa_masses, evidence[col], aa_freqs);
+//   }
+//   double count = matrix.Get(row, last_col);
+
+#ifndef SCORE_COUNT_MATRIX_H
+#define SCORE_COUNT_MATRIX_H
+
+#include <vector>
+
+using namespace std;
+
+class ScoreCountMatrix {
+ public:
+  ScoreCountMatrix() : num_rows_(0) {}
+
+  // Make the matrix num_rows by num_cols, with every cell zero.
+  void Reset(int num_rows, int num_cols);
+
+  double Get(int row, int col) const {
+    return (row < lo_[col] || row > hi_[col]) ? 0.0 : cells_[Index(row, col)];
+  }
+
+  void Set(int row, int col, double value) {
+    Extend(col, row, row);
+    cells_[Index(row, col)] = value;
+  }
+
+  void Add(int row, int col, double value) {
+    Set(row, col, Get(row, col) + value);
+  }
+
+  // For each row from first_row to last_row, set cell (row, col) to its
+  // current value (or to zero, if keep is false) plus the sum over i < n of
+  //   Get(row - evidence[i], col - masses[i]) * weights[i],
+  // adding the terms in order of i. masses must be positive.
+  void Accumulate(int col, int first_row, int last_row, bool keep, int n,
+                  const int* masses, const int* evidence,
+                  const double* weights) {
+    Accumulate(col, first_row, last_row, keep, n, masses, evidence, 1, weights);
+  }
+
+  // As above, with the same evidence for every i.
+  void Accumulate(int col, int first_row, int last_row, bool keep, int n,
+                  const int* masses, int evidence, const double* weights) {
+    Accumulate(col, first_row, last_row, keep, n, masses, &evidence, 0, weights);
+  }
+
+  // Set out to last_row + 1 values, where out[row] for each row from
+  // first_row to last_row is the value that Accumulate(col, first_row,
+  // last_row, false, n, masses, 0, weights) would give cell (row, col), and
+  // the rest are zero. The matrix itself is not changed, so that col can
+  // still be computed as an inner column of a longer sequence.
+  void Sum(int col, int first_row, int last_row, int n, const int* masses,
+           const double* weights, vector<double>* out) const;
+
+ private:
+  size_t Index(int row, int col) const {
+    return (size_t)col * num_rows_ + row;
+  }
+
+  // Widen the range of rows held by col to include lo through hi, clearing
+  // the newly included cells.
+  void Extend(int col, int lo, int hi);
+
+  void Accumulate(int col, int first_row, int last_row, bool keep, int n,
+                  const int* masses, const int* evidence, int evidence_stride,
+                  const double* weights);
+
+  int num_rows_;
+  vector<double> cells_;
+  // Rows that may be nonzero in each column; empty if hi_ < lo_.
+  vector<int> lo_;
+  vector<int> hi_;
+};
+
+#endif // SCORE_COUNT_MATRIX_H
@@ -0,0 +1,47 @@
+// See search_config.h.
+
+#include "search_config.h"
+#include "util/crux-utils.h"
+#include "util/Params.h"
+
+// With bins this narrow, most of the m/z range of a spectrum holds no peaks,
+// and xcorr-scoring=auto keeps only the nonzero entries of the cache.
+static const double SPARSE_MAX_BIN_WIDTH = 0.1;
+
+SearchConfig::SearchConfig()
+  : skip_preprocessing(Params::GetBool("skip-preprocessing")),
+    remove_precursor_peak(Params::GetBool("remove-precursor-peak")),
+    remove_precursor_tolerance(Params::GetDouble("remove-precursor-tolerance")),
+    deisotope(Params::GetDouble("deisotope")),
+    use_flanking_peaks(Params::GetBool("use-flanking-peaks")),
+    use_neutral_loss_peaks(Params::GetBool("use-neutral-loss-peaks")),
+    score_function(string_to_score_function_type(Params::GetString("score-function"))),
+    exact_p_value(Params::GetBool("exact-p-value")),
+    fragment_tolerance(Params::GetDouble("fragment-tolerance")),
+    evidence_granularity(Params::GetInt("evidence-granularity")),
+    xcorr_scoring(GetXcorrScoring()),
+    fragment_index_top_n(Params::GetInt("fragment-index-top-n")),
+    concat(Params::GetBool("concat")),
+    file_column(Params::GetBool("file-column")),
+    peptide_centric_search(Params::GetBool("peptide-centric-search")),
+    elution_window_size(Params::GetInt("elution-window-size")),
+    precision(Params::GetInt("precision")),
+    mass_precision(Params::GetInt("mass-precision")) {
+}
+
+SearchConfig::XcorrScoring SearchConfig::GetXcorrScoring() {
+  std::string scoring = Params::GetString("xcorr-scoring");
+  if (scoring == "auto") {
+    if (Params::GetDouble("mz-bin-width") <= SPARSE_MAX_BIN_WIDTH) {
+      return XCORR_SPARSE;
+    }
+    // Preselected candidates are scored one at a time, which compiled
+    // programs can't do.
+    return Params::GetInt("fragment-index-top-n") > 0 ? XCORR_PORTABLE : XCORR_COMPILED;
+  } else if (scoring == "portable") {
+    return XCORR_PORTABLE;
+  } else if (scoring == "sparse") {
+    return XCORR_SPARSE;
+  }
+  return XCORR_COMPILED;
+}
@@ -0,0 +1,60 @@
+// A SearchConfig is a snapshot of the search parameters that are consulted
+// for every spectrum or match. Looking a parameter up in Params means a
+// string-keyed map lookup, which is too slow for the inner loops of a search,
+// so the values are read once when the SearchConfig is constructed and the
+// search code reads them from here instead.
+//
+// A SearchConfig is not changed after construction; code that uses one takes
+// it as a const pointer. Parameters must not be changed during a search.
+//
+// Example usage:
+//   SearchConfig config;  // after parameters have been set
+//   ObservedPeakSet observed(bin_width, bin_offset, NL, FP, &config);
+//   if (config.concat) { ... }
+
+#ifndef SEARCH_CONFIG_H
+#define SEARCH_CONFIG_H
+
+#include "model/objects.h"
+
+struct SearchConfig {
+  // How XCorr scores are taken when exact-p-value=F.
+  enum XcorrScoring {
+    XCORR_COMPILED, // x86 programs over the dense cache (see compiler.h)
+    XCORR_PORTABLE, // portable programs over the dense cache
+    XCORR_SPARSE    // portable programs over the nonzero cache entries
+  };
+
+  // Reads the current values from Params.
+  SearchConfig();
+
+  // The xcorr-scoring parameter, with "auto" resolved according to
+  // mz-bin-width.
+  static XcorrScoring GetXcorrScoring();
+
+  // Peak preprocessing
+  bool skip_preprocessing;
+  bool remove_precursor_peak;
+  double remove_precursor_tolerance;
+  double deisotope;
+  bool use_flanking_peaks;
+  bool use_neutral_loss_peaks;
+
+  // Scoring
+  SCORE_FUNCTION_T score_function;
+  bool exact_p_value;
+  double fragment_tolerance;
+  int evidence_granularity;
+  XcorrScoring xcorr_scoring;
+  int fragment_index_top_n;
+
+  // Output
+  bool concat;
+  bool file_column;
+  bool peptide_centric_search;
+  int elution_window_size;
+  int precision;
+  int mass_precision;
+};
+
+#endif // SEARCH_CONFIG_H
@@ -0,0 +1,142 @@
+// See search_stats.h.
+
+#include <iomanip>
+#include <boost/chrono.hpp>
+#include "search_stats.h"
+
+static const char* const kStageNames[SearchStats::NUM_STAGES] = {
+  "other", "preprocess", "window", "compile", "score", "pvalue", "sp", "report"
+};
+
+SearchStats::SearchStats(bool enabled)
+  : enabled_(enabled), current_(OTHER), last_(0),
+    spectrum_charges_(0), queue_sum_(0), queue_max_(0),
+    candidates_sum_(0), candidates_max_(0),
+    pages_mapped_(0), page_switches_(0) {
+  fill(seconds_, seconds_ + NUM_STAGES, 0.0);
+  if (Enabled()) {
+    last_ = Now();
+  }
+}
+
+double SearchStats::Now() {
+  return boost::chrono::duration<double>(
+    boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SearchStats::Charge() {
+  double now = Now();
+  seconds_[current_] += now - last_;
+  last_ = now;
+}
+
+void SearchStats::TimedLock(boost::mutex* mutex, int lock_type) {
+  if (lock_type >= (int)locks_.size()) {
+    locks_.resize(lock_type + 1);
+  }
+  LockStats& lock = locks_[lock_type];
+  ++lock.acquired;
+  if (mutex->try_lock()) {
+    return;
+  }
+  // Only a contended lock reads the clock. The wait is not charged to the
+  // current stage.
+  ++lock.contended;
+  Charge();
+  mutex->lock();
+  double now = Now();
+  lock.wait_seconds += now - last_;
+  last_ = now;
+}
+
+void SearchStats::Merge(const SearchStats& other) {
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    seconds_[i] += other.seconds_[i];
+  }
+  spectrum_charges_ += other.spectrum_charges_;
+  queue_sum_ += other.queue_sum_;
+  queue_max_ = max(queue_max_, other.queue_max_);
+  candidates_sum_ += other.candidates_sum_;
+  candidates_max_ = max(candidates_max_, other.candidates_max_);
+  pages_mapped_ += other.pages_mapped_;
+  page_switches_ += other.page_switches_;
+  if (locks_.size() < other.locks_.size()) {
+    locks_.resize(other.locks_.size());
+  }
+  for (size_t i = 0; i < other.locks_.size(); ++i) {
+    locks_[i].acquired += other.locks_[i].acquired;
+    locks_[i].contended += other.locks_[i].contended;
+    locks_[i].wait_seconds += other.locks_[i].wait_seconds;
+  }
+}
+
+static string JsonString(const string& s) {
+  string quoted = "\"";
+  for (string::const_iterator i = s.begin(); i != s.end(); ++i) {
+    if (*i == '"' || *i == '\\') {
+      quoted += '\\';
+    }
+    quoted += *i;
+  }
+  return quoted + "\"";
+}
+
+void SearchStats::WriteFields(ostream* out, const vector<string>& lock_names,
+                              const string& indent) const {
+  double n = max(spectrum_charges_, 1L);
+  *out << indent << "\"spectrum_charges\": " << spectrum_charges_ << ",\n"
+       << indent << "\"stage_seconds\": {";
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    *out << (i > 0 ? ", " : "") << '"' << kStageNames[i] << "\": "
+         << seconds_[i];
+  }
+  *out << "},\n"
+       << indent << "\"window\": {\"mean_peptides\": " << queue_sum_ / n
+       << ", \"max_peptides\": " << queue_max_
+       << ", \"mean_candidates\": " << candidates_sum_ / n
+       << ", \"max_candidates\": " << candidates_max_ << "},\n"
+       << indent << "\"fifo\": {\"pages_mapped\": " << pages_mapped_
+       << ", \"page_switches\": " << page_switches_ << "},\n"
+       << indent << "\"locks\": {";
+  for (size_t i = 0; i < lock_names.size(); ++i) {
+    LockStats lock = i < locks_.size() ? locks_[i] : LockStats();
+    *out << (i > 0 ? "," : "") << '\n' << indent << "  "
+         << JsonString(lock_names[i]) << ": {\"acquired\": " << lock.acquired
+         << ", \"contended\": " << lock.contended
+         << ", \"wait_seconds\": " << lock.wait_seconds << '}';
+  }
+  *out << '\n' << indent << "}\n";
+}
+
+void SearchStats::WriteJson(
+  ostream* out,
+  const string& spectrum_filename,
+  double wall_seconds,
+  const vector<SearchStats*>& threads,
+  const SearchStats& shared,
+  const vector<string>& lock_names
+) {
+  SearchStats total(false);
+  total.CountFifoPages(shared.pages_mapped_, shared.page_switches_);
+  for (size_t i = 0; i < threads.size(); ++i) {
+    total.Merge(*threads[i]);
+  }
+  *out << setprecision(6)
+       << "{\n"
+       << "  \"spectrum_file\": " << JsonString(spectrum_filename) << ",\n"
+       << "  \"threads\": " << threads.size() << ",\n"
+       << "  \"wall_seconds\": " << wall_seconds << ",\n"
+       << "  \"shared_fifo\": {\"pages_mapped\": " << shared.pages_mapped_
+       << ", \"page_switches\": " << shared.page_switches_ << "},\n"
+       << "  \"total\": {\n";
+  total.WriteFields(out, lock_names, "    ");
+  *out << "  },\n"
+       << "  \"per_thread\": [";
+  for (size_t i = 0; i < threads.size(); ++i) {
+    *out << (i > 0 ? ", {\n" : "{\n");
+    threads[i]->WriteFields(out, lock_names, "    ");
+    *out << "  }";
+  }
+  *out << "]\n"
+       << "}";
+}
@@ -0,0 +1,168 @@
+// SearchStats records where one tide-search thread spends its time: the
+// cumulative time of each search stage, the sizes of the active peptide
+// window, the page churn of the FIFO allocators, and the time spent waiting
+// for each of the search locks. Once the threads are done their stats are
+// written together as a JSON summary (see WriteJson()).
+//
+// Stage times are exclusive. At any moment exactly one stage is current, and
+// the clock is charged to it; Switch() changes the current stage, and a Scope
+// switches to a stage for its lifetime and back to the previous one after.
+// For example the peptides decoded and compiled while the window is updated
+// count as COMPILE, not WINDOW, and time spent waiting for a lock counts
+// towards that lock only.
+//
+// A disabled SearchStats does nothing but take locks. Defining
+// NO_SEARCH_STATS compiles the instrumentation out altogether.
+//
+// Example usage:
+//   SearchStats stats(enabled);
+//   stats.Switch(SearchStats::PREPROCESS);
+//   ... preprocess ...
+//   {
+//     SearchStats::Scope scope(&stats, SearchStats::SCORE);
+//     ... score ...
+//   }
+//   stats.Lock(mutex, lock_type);
+//   ... critical section ...
+//   mutex->unlock();
+//   stats.Finish();
+
+#ifndef SEARCH_STATS_H
+#define SEARCH_STATS_H
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+using namespace std;
+
+class SearchStats {
+ public:
+  enum Stage {
+    OTHER,       // scheduling, spectrum-charges skipped, loop overhead
+    PREPROCESS,  // observed spectrum preprocessing and evidence vectors
+    WINDOW,      // updating the active peptide window
+    COMPILE,     // decoding and compiling peptides entering the window
+    SCORE,       // XCorr and residue evidence scoring
+    PVALUE,      // exact p-value score counts
+    SP,          // Sp scoring
+    REPORT,      // ranking and formatting matches
+    NUM_STAGES
+  };
+
+  // Switches to a stage until it goes out of scope. stats may be NULL.
+  class Scope {
+   public:
+    Scope(SearchStats* stats, Stage stage)
+      : stats_(stats), previous_(stats ? stats->Switch(stage) : OTHER) {
+    }
+    ~Scope() {
+      if (stats_ != NULL) {
+        stats_->Switch(previous_);
+      }
+    }
+   private:
+    SearchStats* stats_;
+    Stage previous_;
+  };
+
+  explicit SearchStats(bool enabled);
+
+#ifdef NO_SEARCH_STATS
+  bool Enabled() const { return false; }
+#else
+  bool Enabled() const { return enabled_; }
+#endif
+
+  // Charge the time since the last switch to the current stage and make
+  // stage current. Returns the stage that was current.
+  Stage Switch(Stage stage) {
+    Stage previous = current_;
+    if (Enabled()) {
+      Charge();
+    }
+    current_ = stage;
+    return previous;
+  }
+
+  // Charge the time since the last switch, ending the stage timing.
+  void Finish() {
+    if (Enabled()) {
+      Charge();
+    }
+  }
+
+  // Record the window for one spectrum-charge: queue_size peptides in the
+  // active range, of which candidates are within the precursor window.
+  void CountWindow(long queue_size, long candidates) {
+    if (Enabled()) {
+      ++spectrum_charges_;
+      queue_sum_ += queue_size;
+      queue_max_ = max(queue_max_, queue_size);
+      candidates_sum_ += candidates;
+      candidates_max_ = max(candidates_max_, candidates);
+    }
+  }
+
+  // Record the page counts of a FifoAllocator (see fifo_alloc.h).
+  void CountFifoPages(long pages_mapped, long page_switches) {
+    pages_mapped_ += pages_mapped;
+    page_switches_ += page_switches;
+  }
+
+  // Lock mutex, recording whether it was held by another thread and, if so,
+  // how long it took to get. lock_type indexes the lock in the summary.
+  void Lock(boost::mutex* mutex, int lock_type) {
+    if (!Enabled()) {
+      mutex->lock();
+    } else {
+      TimedLock(mutex, lock_type);
+    }
+  }
+
+  // Add the counts and times of other to these.
+  void Merge(const SearchStats& other);
+
+  // Write the stats of each thread and their totals as a JSON object. The
+  // FIFO pages of shared, which holds the counts not owned by any one thread,
+  // are added to the totals. lock_names gives the names of the lock types
+  // passed to Lock().
+  static void WriteJson(
+    ostream* out,
+    const string& spectrum_filename,
+    double wall_seconds,
+    const vector<SearchStats*>& threads,
+    const SearchStats& shared,
+    const vector<string>& lock_names
+  );
+
+ private:
+  struct LockStats {
+    long acquired;
+    long contended;
+    double wait_seconds;
+    LockStats() : acquired(0), contended(0), wait_seconds(0) {}
+  };
+
+  static double Now();
+  void Charge();
+  void TimedLock(boost::mutex* mutex, int lock_type);
+  void WriteFields(ostream* out, const vector<string>& lock_names,
+                   const string& indent) const;
+
+  bool enabled_;
+  Stage current_;
+  double last_;  // time of the last switch
+  double seconds_[NUM_STAGES];
+
+  long spectrum_charges_;
+  long queue_sum_, queue_max_;
+  long candidates_sum_, candidates_max_;
+  long pages_mapped_, page_switches_;
+
+  vector<LockStats> locks_;
+};
+
+#endif // SEARCH_STATS_H
@@ -9,8 +9,17 @@
 
 SpScorer::SpScorer(const ProteinVec& proteins, const Spectrum& spectrum,
                    int charge, double max_mz)
-  : proteins_(proteins), spectrum_(spectrum), charge_(charge), max_mz_(max_mz),
-  sp_spectrum_(spectrum, charge, max_mz) {
+  : proteins_(proteins), max_mz_(max_mz),
+  sp_spectrum_(spectrum, charge, max_mz), charge_(charge) {
+}
+
+SpScorer::SpScorer(const ProteinVec& proteins, double max_mz)
+  : proteins_(proteins), max_mz_(max_mz), sp_spectrum_(max_mz), charge_(0) {
+}
+
+void SpScorer::SetSpectrum(const Spectrum& spectrum, int charge) {
+  sp_spectrum_.Preprocess(spectrum, charge);
+  charge_ = charge;
 }
 
 bool SpScorer::IonLookup(double mass, int charge, bool previous_ion_matched,
@@ -37,11 +46,19 @@ bool SpScorer::IonLookup(double mass, int charge, bool previous_ion_matched,
 
 void SpScorer::Score(const pb::Peptide& pb_peptide, SpScoreData& sp_score_data) {
   Peptide peptide(pb_peptide, proteins_);
-  vector<double> m_z(peptide.Len());
-  string sequence = peptide.Seq();
+  Score(peptide, sp_score_data);
+}
+
+void SpScorer::Score(const Peptide& peptide, SpScoreData& sp_score_data) {
+  int length = peptide.Len();
+  const char* sequence = peptide.Residues();
+  if ((int)m_z_.size() < length) {
+    m_z_.resize(length);
+  }
+  double* m_z = &m_z_[0];
 
   // Collect m/z values for each residue
-  for (int i = 0; i < sequence.length(); i++)
+  for (int i = 0; i < length; i++)
     m_z[i] = MassConstants::mono_table[sequence[i]];
 
   // Account for modifications
@@ -63,9 +80,9 @@ void SpScorer::Score(const pb::Peptide& pb_peptide, SpScoreData& sp_score_data)
     double b_ion = MASS_PROTON;
     double y_ion = peptide.Mass() + MASS_PROTON;
 
-    for (int i = 0; i < sequence.length(); i++) {
+    for (int i = 0; i < length; i++) {
       // Calculate and look up b-ions
-      if (i < sequence.length()-1) {
+      if (i < length-1) {
         b_ion += m_z[i];
         previous_b_ion_matched = IonLookup(b_ion, ion_charge,
                                            previous_b_ion_matched,
@@ -38,6 +38,8 @@
 #include "raw_proteins.pb.h"
 #include "peptides.pb.h"
 
+class Peptide;
+
 typedef vector<const pb::Protein*> ProteinVec;
 typedef vector<const pb::AuxLocation*> AuxLocVec;
 
@@ -73,7 +75,15 @@ class SpScorer {
   SpScorer(const ProteinVec& proteins, const Spectrum& spectrum, 
            int charge, double max_mz);
 
+  // A scorer that can be kept for a whole search and pointed at each spectrum
+  // in turn with SetSpectrum(), so that its arrays are allocated only once.
+  // Spectra must not exceed max_mz.
+  SpScorer(const ProteinVec& proteins, double max_mz);
+  void SetSpectrum(const Spectrum& spectrum, int charge);
+
   void Score(const pb::Peptide& pb_peptide, SpScoreData& sp_score_data);
+  // Same, for a peptide that is already in memory.
+  void Score(const Peptide& peptide, SpScoreData& sp_score_data);
   void RankSpScores(vector<SpScoreData>& scores, 
                     double* smallest_score = NULL);
   double TotalIonIntensity() {return sp_spectrum_.TotalIonIntensity();}
@@ -98,10 +108,12 @@ class SpScorer {
 
   
   const ProteinVec& proteins_;
-  const Spectrum& spectrum_;
+  double max_mz_;
   SpSpectrum sp_spectrum_;
   int charge_;
-  double max_mz_;
+
+  // Residue masses of the peptide being scored
+  vector<double> m_z_;
 };
 
 #endif // SP_SCORER_H
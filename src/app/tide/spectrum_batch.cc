@@ -0,0 +1,92 @@
+// See spectrum_batch.h.
+
+#include <assert.h>
+#include "records.h"
+#include "peptides.pb.h"
+#include "peptide.h"
+#include "active_peptide_queue.h"
+#include "spectrum_batch.h"
+
+SpectrumBatch::SpectrumBatch(int capacity, double bin_width, double bin_offset,
+                             bool NL, bool FP, const SearchConfig* config)
+  : capacity_(capacity),
+    cache_size_(MaxBin::Global().CacheBinEnd() * NUM_PEAK_TYPES),
+    begin_(0), end_(0) {
+  interleaved_ = new int[cache_size_ * capacity_];
+  for (int i = 0; i < capacity_; ++i) {
+    observed_.push_back(new ObservedPeakSet(bin_width, bin_offset, NL, FP, config));
+  }
+}
+
+SpectrumBatch::~SpectrumBatch() {
+  for (int i = 0; i < capacity_; ++i) {
+    delete observed_[i];
+  }
+  delete[] interleaved_;
+}
+
+void SpectrumBatch::Clear() {
+  keys_.clear();
+  scores_.clear();
+  begin_ = end_ = 0;
+}
+
+void SpectrumBatch::Add(const SpectrumCollection::SpecCharge* key,
+                        const Spectrum& spectrum, int charge,
+                        long int* num_range_skipped,
+                        long int* num_precursors_skipped,
+                        long int* num_isotopes_skipped,
+                        long int* num_retained) {
+  assert(!Full());
+  observed_[Size()]->PreprocessSpectrum(spectrum, charge, num_range_skipped,
+                                        num_precursors_skipped,
+                                        num_isotopes_skipped, num_retained);
+  keys_.push_back(key);
+}
+
+int SpectrumBatch::Member(const SpectrumCollection::SpecCharge* key) const {
+  for (int i = 0; i < Size(); ++i) {
+    if (keys_[i] == key) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void SpectrumBatch::Score(const ActivePeptideQueue* queue, int charge,
+                          long begin, long end) {
+  int size = Size();
+  for (int k = 0; k < size; ++k) {
+    const int* cache = observed_[k]->GetCache();
+    int* dst = interleaved_ + k;
+    for (int i = 0; i < cache_size_; ++i, dst += size) {
+      *dst = cache[i];
+    }
+  }
+
+  begin_ = begin;
+  end_ = end;
+  scores_.assign((end - begin) * size, 0);
+  if (scores_.empty()) {
+    return;
+  }
+  int* row = &scores_[0];
+  for (long position = begin; position < end; ++position, row += size) {
+    // Portable program layout: [num_pos, num_neg, pos..., neg...]
+    const int* list = (const int*) queue->PeptideAt(position)->Prog(charge);
+    const int* code = list + 2;
+    for (int i = 0; i < list[0]; ++i) {
+      const int* entry = interleaved_ + code[i] * size;
+      for (int k = 0; k < size; ++k) {
+        row[k] += entry[k];
+      }
+    }
+    code += list[0];
+    for (int i = 0; i < list[1]; ++i) {
+      const int* entry = interleaved_ + code[i] * size;
+      for (int k = 0; k < size; ++k) {
+        row[k] -= entry[k];
+      }
+    }
+  }
+}
@@ -0,0 +1,87 @@
+// SpectrumBatch scores several observed spectra against the same candidate
+// peptides in a single pass over their theoretical peaks.
+//
+// Consecutive spectra in the mass-sorted list share most of their candidate
+// peptides. Rather than running every peptide's program once per spectrum,
+// the caches of the member spectra (see spectrum_preprocess.h) are
+// interleaved so that the entries for one theoretical peak lie next to each
+// other for all members. Each peptide's portable program (see compiler.h) is
+// then read once, and every peak is added to the scores of all members
+// together.
+//
+// All members must use the same program, i.e. they must either all have
+// charge 1 or 2, or all have charge 3 and above (see Peptide::Prog()).
+//
+// Example usage:
+//   batch.Clear();
+//   batch.Add(&sc1, *sc1.spectrum, sc1.charge, ...);
+//   batch.Add(&sc2, *sc2.spectrum, sc2.charge, ...);
+//   ... load the peptides for all members into queue ...
+//   batch.Score(queue, charge, begin, end);
+//   int score = batch.GetScore(batch.Member(&sc2), position);
+
+#ifndef SPECTRUM_BATCH_H
+#define SPECTRUM_BATCH_H
+
+#include <vector>
+#include "spectrum_collection.h"
+#include "spectrum_preprocess.h"
+
+using namespace std;
+
+class ActivePeptideQueue;
+
+class SpectrumBatch {
+ public:
+  // config is passed on to the ObservedPeakSet of each member.
+  SpectrumBatch(int capacity, double bin_width, double bin_offset,
+                bool NL, bool FP, const SearchConfig* config = NULL);
+  ~SpectrumBatch();
+
+  void Clear();
+  int Size() const { return keys_.size(); }
+  bool Full() const { return Size() == capacity_; }
+
+  // Preprocess spectrum as the next member of the batch. key identifies the
+  // member for Member(). The counters are as for
+  // ObservedPeakSet::PreprocessSpectrum().
+  void Add(const SpectrumCollection::SpecCharge* key,
+           const Spectrum& spectrum, int charge,
+           long int* num_range_skipped,
+           long int* num_precursors_skipped,
+           long int* num_isotopes_skipped,
+           long int* num_retained);
+
+  // Index of the member added with key, or -1.
+  int Member(const SpectrumCollection::SpecCharge* key) const;
+
+  // Score all members against the peptides at file positions [begin, end)
+  // of queue (see ActivePeptideQueue::Position()).
+  void Score(const ActivePeptideQueue* queue, int charge,
+             long begin, long end);
+
+  bool Covers(long position) const {
+    return position >= begin_ && position < end_;
+  }
+  int GetScore(int member, long position) const {
+    return scores_[(position - begin_) * Size() + member];
+  }
+
+  // Cache of a single member, for scoring peptides not covered by Score().
+  const int* GetCache(int member) const { return observed_[member]->GetCache(); }
+
+ private:
+  int capacity_;
+  int cache_size_;
+  vector<ObservedPeakSet*> observed_;
+  vector<const SpectrumCollection::SpecCharge*> keys_;
+
+  // interleaved_[i * Size() + k] is entry i of the cache of member k.
+  int* interleaved_;
+
+  // scores_[(position - begin_) * Size() + k] is the score of member k.
+  vector<int> scores_;
+  long begin_, end_;
+};
+
+#endif // SPECTRUM_BATCH_H
@@ -180,7 +180,8 @@ vector<double> Spectrum::CreateEvidenceVector(
   long int* num_range_skipped,
   long int* num_precursors_skipped,
   long int* num_isotopes_skipped,
-  long int* num_retained
+  long int* num_retained,
+  const SearchConfig* config
 ) const {
   // TODO need to review these constants, decide which can be moved to parameter file
   const double maxIntensPerRegion = 50.0;
@@ -196,10 +197,11 @@ vector<double> Spectrum::CreateEvidenceVector(
   double maxIonIntens = 0.0;
 
   // Find max ion mass and max ion intensity
-  bool skipPreprocess = Params::GetBool("skip-preprocessing");
-  bool remove_precursor = !skipPreprocess && Params::GetBool("remove-precursor-peak");
-  double precursorMZExclude = Params::GetDouble("remove-precursor-tolerance");
-  double deisotope_threshold = Params::GetDouble("deisotope");
+  const SearchConfig& cfg = config ? *config : SearchConfig();
+  bool skipPreprocess = cfg.skip_preprocessing;
+  bool remove_precursor = !skipPreprocess && cfg.remove_precursor_peak;
+  double precursorMZExclude = cfg.remove_precursor_tolerance;
+  double deisotope_threshold = cfg.deisotope;
   set<int> peakSkip;
   for (int ion = 0; ion < numPeaks; ion++) {
     double ionMass = M_Z(ion);
@@ -295,8 +297,8 @@ vector<double> Spectrum::CreateEvidenceVector(
     intensObs[i] -= multiplier * (partial_sums[right] - partial_sums[left]);
   }
 
-  bool flankingPeaks = Params::GetBool("use-flanking-peaks");
-  bool nlPeaks = Params::GetBool("use-neutral-loss-peaks");
+  bool flankingPeaks = cfg.use_flanking_peaks;
+  bool nlPeaks = cfg.use_neutral_loss_peaks;
   int binFirst = MassConstants::mass2bin(30);
   int binLast = MassConstants::mass2bin(pepMassMonoMean - 47);
   vector<double> evidence(maxPrecurMass, 0);
@@ -377,11 +379,13 @@ vector<int> Spectrum::CreateEvidenceVectorDiscretized(
   long int* num_range_skipped,
   long int* num_precursors_skipped,
   long int* num_isotopes_skipped,
-  long int* num_retained
+  long int* num_retained,
+  const SearchConfig* config
 ) const {
   vector<double> evidence =
     CreateEvidenceVector(binWidth, binOffset, charge, pepMassMonoMean, maxPrecurMass,
-                         num_range_skipped, num_precursors_skipped, num_isotopes_skipped, num_retained);
+                         num_range_skipped, num_precursors_skipped, num_isotopes_skipped, num_retained,
+                         config);
   vector<int> discretized;
   discretized.reserve(evidence.size());
   for (vector<double>::const_iterator i = evidence.begin(); i != evidence.end(); i++) {
@@ -24,6 +24,7 @@
 #include <vector>
 #include "header.pb.h"
 #include "spectrum.pb.h"
+#include "search_config.h"
 
 using namespace std;
 
@@ -67,6 +68,8 @@ class Spectrum {
 
   bool Deisotope(int index, double deisotope_threshold) const;
 
+  // The preprocessing parameters are taken from config, or from Params if
+  // config is NULL.
   std::vector<double> CreateEvidenceVector(
     double binWidth,
     double binOffset,
@@ -76,7 +79,8 @@ class Spectrum {
     long int* num_range_skipped = NULL,
     long int* num_precursors_skipped = NULL,
     long int* num_isotopes_skipped = NULL,
-    long int* num_retained = NULL) const;
+    long int* num_retained = NULL,
+    const SearchConfig* config = NULL) const;
   std::vector<int> CreateEvidenceVectorDiscretized(
     double binWidth,
     double binOffset,
@@ -86,7 +90,8 @@ class Spectrum {
     long int* num_range_skipped = NULL,
     long int* num_precursors_skipped = NULL,
     long int* num_isotopes_skipped = NULL,
-    long int* num_retained = NULL) const;
+    long int* num_retained = NULL,
+    const SearchConfig* config = NULL) const;
 
   int MaxCharge() const;
   double MaxPeakInRange( double min_range, double max_range ) const;
@@ -109,6 +109,7 @@
 #include "theoretical_peak_pair.h"
 #include "max_mz.h"
 #include "mass_constants.h"
+#include "search_config.h"
 
 using namespace std;
 
@@ -117,22 +118,43 @@ class Spectrum;
 class ObservedPeakSet {
  public:
 
+  // The preprocessing parameters are taken from config, or from Params if
+  // config is NULL.
   ObservedPeakSet(double bin_width = MassConstants::bin_width_,
      double bin_offset = MassConstants::bin_width_,
-     bool NL = false, bool FP = false)
+     bool NL = false, bool FP = false,
+     const SearchConfig* config = NULL)
     : peaks_(new double[MaxBin::Global().BackgroundBinEnd()]),
-    cache_(new int[MaxBin::Global().CacheBinEnd()*NUM_PEAK_TYPES]) {
+    cache_(NULL),
+    dirty_end_(MaxBin::Global().CacheBinEnd()*NUM_PEAK_TYPES),
+    config_(config ? *config : SearchConfig()) {
 
     bin_width_  = bin_width;
     bin_offset_ = bin_offset;
     NL_ = NL; //NL means neutral loss
     FP_ = FP; //FP means flanking peaks
+    sparse_ = config_.xcorr_scoring == SearchConfig::XCORR_SPARSE;
+    if (!sparse_) {
+      cache_ = new int[MaxBin::Global().CacheBinEnd()*NUM_PEAK_TYPES];
+    }
   }
 
   ~ObservedPeakSet() { delete[] peaks_; delete[] cache_; }
 
+  // The dense cache, indexed by TheoreticalPeakPair::Code(). NULL if the
+  // peak set is sparse.
   const int* GetCache() const { return cache_; } //TODO 261: access restriction?
 
+  // With xcorr-scoring=sparse, only the nonzero cache entries are kept: the
+  // codes of SparseSize() entries in increasing order, and their values.
+  // Entries whose codes are missing are zero. For high-resolution bins this
+  // saves computing and clearing a cache the size of the whole m/z range for
+  // every spectrum. See TheoreticalPeakCompiler::RunSparse().
+  bool Sparse() const { return sparse_; }
+  int SparseSize() const { return sparse_codes_.size(); }
+  const int* SparseCodes() const { return sparse_codes_.empty() ? NULL : &sparse_codes_[0]; }
+  const int* SparseValues() const { return sparse_values_.empty() ? NULL : &sparse_values_[0]; }
+
   // On-the-fly compilation takes the place of this call.
   int DotProd(const TheoreticalPeakArr& theoretical);
 #ifdef DEBUG
@@ -218,8 +240,9 @@ class ObservedPeakSet {
     // In context of this class, peak_type feels like the primary selector.
     return cache_[TheoreticalPeakPair(index, peak_type).Code()];
   }
-  void MakeInteger();
+  void ComputeSimplePeaks(int index);
   void ComputeCache();
+  void ComputeSparseCache();
   void PreprocessSpectrum(const Spectrum& spectrum, double* intensArrayObs,
                           int* intensRegion, int maxPrecurMass, int charge);
 
@@ -228,11 +251,23 @@ class ObservedPeakSet {
 
   bool NL_;
   bool FP_;
+  bool sparse_;
   double bin_width_;
   double bin_offset_;
 
   MaxBin max_mz_;
   int cache_end_;
+  // Every entry of cache_ from dirty_end_ on is zero.
+  int dirty_end_;
+  // Partial sums used by the background subtraction, kept between spectra.
+  vector<double> background_sums_;
+
+  // Sparse cache (see Sparse()), and the integer peaks it is computed from.
+  vector<int> sparse_codes_;
+  vector<int> sparse_values_;
+  vector<int> sparse_peaks_;
+
+  SearchConfig config_;
 
   friend class ObservedPeakTester;
 };
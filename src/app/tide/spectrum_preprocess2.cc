@@ -36,24 +36,41 @@ DEFINE_int32(debug_charge, 0, "Charge to debug. 0 for all");
 // This computes that part of the XCORR function where an average value of the
 // peaks within a window surrounding each peak is subtracted from that peak.
 // This version is a linear-time implementation of the subtraction. Linearity is
-// accomplished by computing an array of partial sums.
-static void SubtractBackground(double* observed, int end) {
+// accomplished by computing an array of partial sums, kept in partial_sums
+// between calls.
+static void SubtractBackground(double* observed, int end,
+                               vector<double>* partial_sums) {
   // operation is as follows: new_observed = observed -
   // average_within_window but average is computed as if the array
   // extended infinitely: denominator is same throughout array, even
   // near edges (where fewer elements have been summed)
   static const double multiplier = 1.0 / (MAX_XCORR_OFFSET * 2);
 
+  if (partial_sums->size() < (size_t)end + 1) {
+    partial_sums->resize(end + 1);
+  }
+  double* sums = &(*partial_sums)[0];
   double total = 0;
-  vector<double> partial_sums(end+1);
   for (int i = 0; i < end; ++i)
-    partial_sums[i] = (total += observed[i]);
-  partial_sums[end] = total;
-
-  for (int i = 0; i < end; ++i) {
+    sums[i] = (total += observed[i]);
+  sums[end] = total;
+
+  // Away from the edges the window lies entirely within the array, and the
+  // loop has no bounds checks, so that it can be vectorized.
+  int first = min(end, MAX_XCORR_OFFSET + 1);
+  int last = max(first, end - MAX_XCORR_OFFSET);
+  for (int i = 0; i < first; ++i) {
+    int right_index = min(end, i + MAX_XCORR_OFFSET);
+    int left_index = max(0, i - MAX_XCORR_OFFSET - 1);
+    observed[i] -= multiplier * (sums[right_index] - sums[left_index] - observed[i]);
+  }
+  for (int i = first; i < last; ++i) {
+    observed[i] -= multiplier * (sums[i + MAX_XCORR_OFFSET] - sums[i - MAX_XCORR_OFFSET - 1] - observed[i]);
+  }
+  for (int i = last; i < end; ++i) {
     int right_index = min(end, i + MAX_XCORR_OFFSET);
     int left_index = max(0, i - MAX_XCORR_OFFSET - 1);
-    observed[i] -= multiplier * (partial_sums[right_index] - partial_sums[left_index] - observed[i]);
+    observed[i] -= multiplier * (sums[right_index] - sums[left_index] - observed[i]);
   }
 }
 
@@ -77,9 +94,10 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
   max_mz_.InitBin(min(experimental_mass_cut_off, max_peak_mz));
   cache_end_ = MaxBin::Global().CacheBinEnd() * NUM_PEAK_TYPES;
 
-  memset(peaks_, 0, sizeof(double) * MaxBin::Global().BackgroundBinEnd());
+  // Only bins below max_mz_.BackgroundBinEnd() are read from here on.
+  memset(peaks_, 0, sizeof(double) * max_mz_.BackgroundBinEnd());
 
-  if (Params::GetBool("skip-preprocessing")) {
+  if (config_.skip_preprocessing) {
     for (int i = 0; i < spectrum.Size(); ++i) {
       double peak_location = spectrum.M_Z(i);
       if (peak_location >= experimental_mass_cut_off) {
@@ -93,9 +111,9 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
       }
     }
   } else {
-    bool remove_precursor = Params::GetBool("remove-precursor-peak");
-    double precursor_tolerance = Params::GetDouble("remove-precursor-tolerance");
-    double deisotope_threshold = Params::GetDouble("deisotope");
+    bool remove_precursor = config_.remove_precursor_peak;
+    double precursor_tolerance = config_.remove_precursor_tolerance;
+    double deisotope_threshold = config_.deisotope;
     int max_charge = spectrum.MaxCharge();
 
     // Fill peaks
@@ -179,13 +197,16 @@ void ObservedPeakSet::PreprocessSpectrum(const Spectrum& spectrum, int charge,
     }
 #endif
   }
-  SubtractBackground(peaks_, max_mz_.BackgroundBinEnd());
+  SubtractBackground(peaks_, max_mz_.BackgroundBinEnd(), &background_sums_);
 
 #ifdef DEBUG
   if (debug)
     ShowPeaks();
 #endif
-  MakeInteger();
+  if (sparse_) {
+    ComputeSparseCache();
+    return;
+  }
   ComputeCache();
 #ifdef DEBUG
   if (debug)
@@ -199,41 +220,53 @@ inline int round_to_int(double x) {
   return int(x - 0.5);
 }
 
-void ObservedPeakSet::MakeInteger() {
+// Computes the integer peak and its multiples for a bin below
+// BackgroundBinEnd().
+inline void ObservedPeakSet::ComputeSimplePeaks(int index) {
   // essentially cheap fixed-point arithmetic for peak intensities
-  for(int i = 0; i < max_mz_.BackgroundBinEnd(); i++)
-    Peak(PeakMain, i) = round_to_int(peaks_[i]*50000);
+  int x = round_to_int(peaks_[index]*50000);
+  Peak(PeakMain, index) = x;
+  // Instead of computing 10 * x, 25 * x, and 50 * x, we compute 2 *
+  // x, 5 * x and 10 * x. This results in dot products that are 5
+  // times too small, but the adjustments can be made at the last
+  // moment e.g. when results are displayed. These smaller
+  // multiplications allow us to use addition operations instead of
+  // multiplications.
+  int y = x+x;
+  Peak(LossPeak, index) = y;
+  int z = y+y+x;
+  Peak(FlankingPeak, index) = z;
+  Peak(PrimaryPeak, index) = z+z;
 }
 
 // See .h file. Computes and stores all transformations of the observed peak
-// set.
+// set in a single pass over the bins.
 void ObservedPeakSet::ComputeCache() {
-  for (int i = 0; i < max_mz_.BackgroundBinEnd(); ++i) {
-    // Instead of computing 10 * x, 25 * x, and 50 * x, we compute 2 *
-    // x, 5 * x and 10 * x. This results in dot products that are 5
-    // times too small, but the adjustments can be made at the last
-    // moment e.g. when results are displayed. These smaller
-    // multiplications allow us to use addition operations instead of
-    // multiplications.
-    int x = Peak(PeakMain, i);
-    int y = x+x;
-    Peak(LossPeak, i) = y;
-    int z = y+y+x;
-    Peak(FlankingPeak, i) = z;
-    Peak(PrimaryPeak, i) = z+z;
-  }
+  const int background_end = max_mz_.BackgroundBinEnd();
+  const int cache_bin_end = max_mz_.CacheBinEnd();
 
-  for (int i = max_mz_.BackgroundBinEnd() * NUM_PEAK_TYPES; i < cache_end_; ++i) {
+  // Everything from dirty_end_ on is still zero from earlier spectra.
+  int zero_end = max(dirty_end_, cache_bin_end * NUM_PEAK_TYPES);
+  for (int i = background_end * NUM_PEAK_TYPES; i < zero_end; ++i) {
     cache_[i] = 0;
   }
+  dirty_end_ = cache_bin_end * NUM_PEAK_TYPES;
 
-  for (int i = 0; i < max_mz_.CacheBinEnd(); ++i) {
+  // The combined peaks of bin i look one bin ahead, so the simple peaks of
+  // bin i + 1 are computed first.
+  if (background_end > 0) {
+    ComputeSimplePeaks(0);
+  }
+  for (int i = 0; i < cache_bin_end; ++i) {
+    if (i + 1 < background_end) {
+      ComputeSimplePeaks(i + 1);
+    }
     int flanks = Peak(PrimaryPeak, i);
     if ( FP_ == true) {
         if (i > 0) {
           flanks += Peak(FlankingPeak, i-1);
         }
-        if (i < max_mz_.CacheBinEnd() - 1) {
+        if (i < cache_bin_end - 1) {
           flanks += Peak(FlankingPeak, i+1);
         }
     }
@@ -254,6 +287,82 @@ void ObservedPeakSet::ComputeCache() {
   }
 }
 
+// See .h file. Computes the same entries as ComputeCache(), but keeps only the
+// nonzero ones. A bin's entries can only be nonzero if there is a peak at the
+// bin, at a flanking bin, or at one of the neutral loss offsets below it.
+void ObservedPeakSet::ComputeSparseCache() {
+  const int background_end = max_mz_.BackgroundBinEnd();
+  const int cache_bin_end = max_mz_.CacheBinEnd();
+  sparse_codes_.clear();
+  sparse_values_.clear();
+
+  // essentially cheap fixed-point arithmetic for peak intensities
+  sparse_peaks_.assign(cache_bin_end + 1, 0);
+  int* x = &sparse_peaks_[0];
+  // Bins from last_peak + reach on are beyond reach of every peak.
+  int last_peak = 0;
+  for (int i = 0; i < background_end; ++i) {
+    if ((x[i] = round_to_int(peaks_[i]*50000)) != 0) {
+      last_peak = i + 1;
+    }
+  }
+  int reach = 1;
+  if (NL_) {
+    reach = max(reach, (int)max(MassConstants::BIN_NH3, MassConstants::BIN_H2O) + 1);
+  }
+  int end = min(cache_bin_end, last_peak + reach);
+
+  for (int i = 0; i < end; ++i) {
+    // Same terms, in the same order, as ComputeSimplePeaks() and
+    // ComputeCache().
+    int peak = x[i];
+    int flanks = 10 * peak;
+    if ( FP_ == true) {
+        if (i > 0) {
+          flanks += 5 * x[i-1];
+        }
+        if (i < cache_bin_end - 1) {
+          flanks += 5 * x[i+1];
+        }
+    }
+    int Y1 = flanks;
+    if ( NL_ == true) {
+        if (i > MassConstants::BIN_NH3) {
+          Y1 += 2 * x[(int)(i-MassConstants::BIN_NH3)];
+        }
+        if (i > MassConstants::BIN_H2O) {
+          Y1 += 2 * x[(int)(i-MassConstants::BIN_H2O)];
+        }
+    }
+    if (peak == 0 && flanks == 0 && Y1 == 0) {
+      continue;
+    }
+    int code = i * NUM_PEAK_TYPES;
+    if (peak != 0) {
+      sparse_codes_.push_back(code + PeakMain);
+      sparse_values_.push_back(peak);
+      sparse_codes_.push_back(code + LossPeak);
+      sparse_values_.push_back(2 * peak);
+      sparse_codes_.push_back(code + FlankingPeak);
+      sparse_values_.push_back(5 * peak);
+      sparse_codes_.push_back(code + PrimaryPeak);
+      sparse_values_.push_back(10 * peak);
+    }
+    if (Y1 != 0) {
+      sparse_codes_.push_back(code + PeakCombinedB1);
+      sparse_values_.push_back(Y1);
+      sparse_codes_.push_back(code + PeakCombinedY1);
+      sparse_values_.push_back(Y1);
+    }
+    if (flanks != 0) {
+      sparse_codes_.push_back(code + PeakCombinedB2);
+      sparse_values_.push_back(flanks);
+      sparse_codes_.push_back(code + PeakCombinedY2);
+      sparse_values_.push_back(flanks);
+    }
+  }
+}
+
 // This dot product is replaced by calls to on-the-fly compiled code.
 int ObservedPeakSet::DotProd(const TheoreticalPeakArr& theoretical) {
   int total = 0;
@@ -388,10 +497,10 @@ void ObservedPeakSet::CreateResidueEvidenceMatrix(
   const double maxIntensPerRegion = 50.0;
 
   // Determining max ion mass and max ion intensity
-  bool skipPreprocess = Params::GetBool("skip-preprocessing");
-  bool remove_precursor = !skipPreprocess && Params::GetBool("remove-precursor-peak");
-  double precursorMZExclude = Params::GetDouble("remove-precursor-tolerance");
-  double deisotope_threshold = Params::GetDouble("deisotope");
+  bool skipPreprocess = config_.skip_preprocessing;
+  bool remove_precursor = !skipPreprocess && config_.remove_precursor_peak;
+  double precursorMZExclude = config_.remove_precursor_tolerance;
+  double deisotope_threshold = config_.deisotope;
   double maxIonIntens = 0.0;
   double maxIonMass = 0.0;
   set<int> peakSkip;
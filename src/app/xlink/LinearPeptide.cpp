@@ -61,7 +61,6 @@ void LinearPeptide::addCandidates(
     vector<LinearPeptide>::iterator eiter = XLinkDatabase::getLinearEnd(is_decoy, siter, max_mass);
 
     while (siter != eiter && siter->getMass() <= max_mass) {
-      siter->incrementPointerCount();
       LinearPeptide& lpeptide = *siter;
       if (lpeptide.getMass() < min_mass || lpeptide.getMass() > max_mass) {
         carp(CARP_DEBUG,
@@ -71,7 +70,8 @@ void LinearPeptide::addCandidates(
         return;
       } else {
         //carp(CARP_INFO, "Add linear candidate");
-        candidates.add(&(*siter));
+        // Add a copy, so that the database's peptide is not changed
+        candidates.add(new LinearPeptide(*siter));
         ++siter;
       }
     }
@@ -54,7 +54,6 @@ void MonoLinkPeptide::addCandidates(
     vector<MonoLinkPeptide>::iterator eiter = XLinkDatabase::getMonoLinkEnd(is_decoy, siter, max_mass);
 
     while (siter != eiter && siter->getMass() <= max_mass) {
-      siter->incrementPointerCount();
       MonoLinkPeptide& lpeptide = *siter;
       if (lpeptide.getMass() < min_mass || lpeptide.getMass() > max_mass) {
         carp(CARP_DEBUG,
@@ -64,7 +63,8 @@ void MonoLinkPeptide::addCandidates(
         return;
       } else {
         //carp(CARP_INFO, "Add linear candidate");
-        candidates.add(&(*siter));
+        // Add a copy, so that the database's peptide is not changed
+        candidates.add(new MonoLinkPeptide(*siter));
         ++siter;
       }
     }
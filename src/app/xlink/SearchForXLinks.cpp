@@ -228,6 +228,8 @@ vector<string> SearchForXLinks::getOptions() const {
     "precursor-window-weibull",
     "precursor-window-type-weibull",
     "min-weibull-points",
+    "weibull-bin-width",
+    "write-weibull-comparison",
     "use-a-ions",
     "use-b-ions",
     "use-c-ions",
@@ -252,6 +254,7 @@ vector<string> SearchForXLinks::getOptions() const {
     "use-z-line",
     "top-match",
     "print-search-progress",
+    "num-threads",
     "output-dir",
     "overwrite",
     "parameter-file",
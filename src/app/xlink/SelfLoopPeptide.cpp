@@ -82,8 +82,8 @@ void SelfLoopPeptide::addCandidates(
     vector<SelfLoopPeptide>::iterator eiter = XLinkDatabase::getSelfLoopEnd(is_decoy);
 
     while (biter != eiter && biter->getMass(GlobalParams::getIsotopicMass()) <= max_mass) {
-      biter->incrementPointerCount();
-      candidates.add(&(*biter));
+      // Add a copy, so that the database's peptide is not changed
+      candidates.add(new SelfLoopPeptide(*biter));
       ++biter;
     }
   }
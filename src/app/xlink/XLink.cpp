@@ -150,16 +150,37 @@ void addAllocatedPeptide(
  * delete all peptides that are allocated
  */
 void deleteAllocatedPeptides() {
-  carp(CARP_DEBUG, "deleting %d peptides", allocated_peptides_.size());
+  deleteAllocatedPeptides(allocated_peptides_);
+}
+
+/**
+ * moves the allocated peptides to peptides, so that they can be deleted
+ * after later peptides have been allocated
+ */
+void takeAllocatedPeptides(
+  set<Crux::Peptide*>& peptides ///< peptides to add to -out
+  ) {
+
+  peptides.insert(allocated_peptides_.begin(), allocated_peptides_.end());
+  allocated_peptides_.clear();
+}
+
+/**
+ * delete the peptides, as taken by takeAllocatedPeptides
+ */
+void deleteAllocatedPeptides(
+  set<Crux::Peptide*>& peptides ///< peptides to delete
+  ) {
+  carp(CARP_DEBUG, "deleting %d peptides", peptides.size());
   for (set<Crux::Peptide*>::iterator iter =
-    allocated_peptides_.begin();
-    iter != allocated_peptides_.end();
+    peptides.begin();
+    iter != peptides.end();
     ++iter) {
   
   delete *iter;
 
   }
-  allocated_peptides_.clear();
+  peptides.clear();
 }
 
 
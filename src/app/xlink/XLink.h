@@ -12,6 +12,7 @@
 
 #include <vector>
 #include <string>
+#include <set>
 
 
 class XLinkMatch;
@@ -94,6 +95,21 @@ void addAllocatedPeptide(
  */
 void deleteAllocatedPeptides();
 
+/**
+ * moves the allocated peptides to peptides, so that they can be deleted
+ * after later peptides have been allocated
+ */
+void takeAllocatedPeptides(
+  std::set<Crux::Peptide*>& peptides ///< peptides to add to -out
+  );
+
+/**
+ * delete the peptides, as taken by takeAllocatedPeptides
+ */
+void deleteAllocatedPeptides(
+  std::set<Crux::Peptide*>& peptides ///< peptides to delete
+  );
+
 } // namespace XLink
 
 #endif
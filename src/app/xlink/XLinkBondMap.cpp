@@ -181,6 +181,73 @@ bool XLinkBondMap::canLink(
 
 }
 
+/**
+ * \returns whether the sites of the bond map fit in the bits of a site
+ * mask, so that getSiteMask and getPartnerMask can be used
+ */
+bool XLinkBondMap::canMaskSites() const {
+  // every site is a key, since init adds each bond both ways
+  return size() <= sizeof(unsigned int) * 8;
+}
+
+/**
+ * Sets mask to the bit of each site of the bond map that the peptide has
+ * at the sequence index
+ * \returns whether every site fit in the mask
+ */
+bool XLinkBondMap::getSiteMask(
+  Peptide* peptide, ///<peptide object pointer
+  int idx,            ///<sequence idx
+  unsigned int& mask  ///<the site mask -out
+  ) const {
+
+  mask = 0;
+  size_t bit_idx = 0;
+  for (XLinkBondMap::const_iterator iter = begin();
+    iter != end(); ++iter, bit_idx++) {
+    if (iter->first.hasSite(peptide, idx)) {
+      if (bit_idx >= sizeof(unsigned int) * 8) {
+        return false;
+      }
+      mask |= 1u << bit_idx;
+    }
+  }
+  return true;
+}
+
+/**
+ * Sets mask to the bit of each site of the bond map that the peptide can
+ * link to at the sequence index
+ * \returns whether every partner was found and fit in the mask
+ */
+bool XLinkBondMap::getPartnerMask(
+  Peptide* peptide, ///<peptide object pointer
+  int idx,            ///<sequence idx
+  unsigned int& mask  ///<the partner mask -out
+  ) const {
+
+  mask = 0;
+  for (XLinkBondMap::const_iterator iter1 = begin();
+    iter1 != end(); ++iter1) {
+    if (iter1->first.hasSite(peptide, idx)) {
+      for (set<XLinkSite>::const_iterator iter2 = iter1->second.begin();
+        iter2 != iter1->second.end();
+        ++iter2) {
+        XLinkBondMap::const_iterator partner = find(*iter2);
+        if (partner == end()) {
+          return false;
+        }
+        size_t bit_idx = distance(begin(), partner);
+        if (bit_idx >= sizeof(unsigned int) * 8) {
+          return false;
+        }
+        mask |= 1u << bit_idx;
+      }
+    }
+  }
+  return true;
+}
+
 /*                                                                                                                                                                                                                          
  * Local Variables:                                                                                                                                                                                                         
  * mode: c                                                                                                                                                                                                                  
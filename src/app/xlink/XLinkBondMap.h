@@ -100,6 +100,36 @@ class XLinkBondMap: public std::map<XLinkSite, std::set<XLinkSite> > {
     std::string& protein_sequence,
     int idx);
 
+  /**
+   * \returns whether the sites of the bond map fit in the bits of a site
+   * mask, so that getSiteMask and getPartnerMask can be used
+   */
+  bool canMaskSites() const;
+
+  /**
+   * Sets mask to the bit of each site of the bond map that the peptide
+   * has at the sequence index
+   * \returns whether every site fit in the mask
+   */
+  bool getSiteMask(
+    Crux::Peptide* peptide, ///<peptide object pointer
+    int idx,            ///<sequence idx
+    unsigned int& mask  ///<the site mask -out
+    ) const;
+
+  /**
+   * Sets mask to the bit of each site of the bond map that the peptide
+   * can link to at the sequence index. Two positions can link exactly
+   * when the partner mask of one and the site mask of the other share a
+   * bit.
+   * \returns whether every partner was found and fit in the mask;
+   * otherwise canLink must be used instead
+   */
+  bool getPartnerMask(
+    Crux::Peptide* peptide, ///<peptide object pointer
+    int idx,            ///<sequence idx
+    unsigned int& mask  ///<the partner mask -out
+    ) const;
 
 
 };
@@ -31,6 +31,9 @@ std::vector<XLinkablePeptide> XLinkDatabase::target_xlinkable_peptides2_;
 
 std::vector<XLinkablePeptide> XLinkDatabase::target_xlinkable_peptides_flatten_;
 std::vector<XLinkablePeptide> XLinkDatabase::decoy_xlinkable_peptides_flatten_;
+std::vector<std::vector<FLOAT_T> > XLinkDatabase::target_fragment_masses_flatten_;
+std::vector<std::vector<LinkSiteMask> > XLinkDatabase::target_link_site_masks_;
+std::vector<std::vector<LinkSiteMask> > XLinkDatabase::target_link_site_masks_flatten_;
 
 bool XLinkDatabase::addPeptideToDatabase(Crux::Peptide* peptide) {
   
@@ -98,6 +101,21 @@ bool XLinkDatabase::addPeptideToDatabase(Crux::Peptide* peptide) {
 }
 
 
+/**
+ * Computes the masses of the peptides that candidate generation reads, so
+ * that searches running in several threads do not compute and cache them
+ * in the shared peptides.
+ */
+template<class T>
+static void computeMasses(
+  vector<T>& peptides ///< peptides of the database
+  ) {
+  for (typename vector<T>::iterator iter = peptides.begin(); iter != peptides.end(); ++iter) {
+    iter->getMass(MONO);
+    iter->getMass(GlobalParams::getIsotopicMass());
+  }
+}
+
 void XLinkDatabase::initialize() {
   carp(CARP_INFO, "Initializing database");
   //Step one, load the database
@@ -212,8 +230,17 @@ void XLinkDatabase::initialize() {
     carp(CARP_INFO, "  The database contains %d cross-linkable peptides.", target_xlinkable_peptides_.size());
     sort(target_xlinkable_peptides_.begin(), target_xlinkable_peptides_.end(), compareXLinkablePeptideMass);
     flattenLinkablePeptides(target_xlinkable_peptides_, target_xlinkable_peptides_flatten_);
+    computeFragmentMasses(target_xlinkable_peptides_flatten_, target_fragment_masses_flatten_);
+    computeLinkSiteMasks(target_xlinkable_peptides_, target_link_site_masks_);
+    computeLinkSiteMasks(target_xlinkable_peptides_flatten_, target_link_site_masks_flatten_);
   }
 
+  computeMasses(target_linear_peptides_);
+  computeMasses(target_monolink_peptides_);
+  computeMasses(target_selfloop_peptides_);
+  computeMasses(target_xlinkable_peptides_);
+  computeMasses(target_xlinkable_peptides_flatten_);
+
   carp(CARP_INFO, "Done initializing database");
 }
 
@@ -226,6 +253,9 @@ void XLinkDatabase::finalize() {
   target_xlinkable_peptides_.clear();
   decoy_xlinkable_peptides_.clear();
   target_xlinkable_peptides_flatten_.clear();
+  target_fragment_masses_flatten_.clear();
+  target_link_site_masks_.clear();
+  target_link_site_masks_flatten_.clear();
   for (size_t idx1=0;idx1<target_peptides_.size();idx1++) {
     for (size_t idx2=0;idx2<target_peptides_[idx1].size();idx2++) {
       delete target_peptides_[idx1][idx2];
@@ -329,6 +359,44 @@ void XLinkDatabase::flattenLinkablePeptides(vector<XLinkablePeptide>& xpeptides,
   }
 }
 
+/**
+ * Computes the fragment masses of each peptide once, so that the top-n
+ * search scores the peptides without predicting IonSeries for them.
+ * xpeptides must not be resized or reordered afterwards.
+ */
+void XLinkDatabase::computeFragmentMasses(
+  vector<XLinkablePeptide>& xpeptides,
+  vector<vector<FLOAT_T> >& fragment_masses
+  ) {
+
+  fragment_masses.clear();
+  fragment_masses.resize(xpeptides.size());
+  for (size_t idx=0;idx < xpeptides.size();idx++) {
+    xpeptides[idx].computeFragmentMasses(fragment_masses[idx]);
+    xpeptides[idx].setFragmentMasses(&fragment_masses[idx]);
+  }
+}
+
+/**
+ * Computes the link site masks of each peptide once, so that pairs of
+ * peptides are checked without the bond map. Peptides whose masks cannot
+ * be computed are left to the bond map. xpeptides must not be resized or
+ * reordered afterwards.
+ */
+void XLinkDatabase::computeLinkSiteMasks(
+  vector<XLinkablePeptide>& xpeptides,
+  vector<vector<LinkSiteMask> >& link_site_masks
+  ) {
+
+  link_site_masks.clear();
+  link_site_masks.resize(xpeptides.size());
+  for (size_t idx=0;idx < xpeptides.size();idx++) {
+    if (xpeptides[idx].computeLinkSiteMasks(bondmap_, link_site_masks[idx])) {
+      xpeptides[idx].setLinkSiteMasks(&link_site_masks[idx]);
+    }
+  }
+}
+
 void XLinkDatabase::filterLinkablePeptides(
   vector<XLinkablePeptide>& xpeptides,
   vector<XLinkablePeptide>& filtered_xpeptides
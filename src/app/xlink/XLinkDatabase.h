@@ -40,6 +40,14 @@ class XLinkDatabase {
 
   static std::vector<XLinkablePeptide> decoy_xlinkable_peptides_flatten_;
 
+  static std::vector<std::vector<FLOAT_T> > target_fragment_masses_flatten_;
+    ///< fragment masses of target_xlinkable_peptides_flatten_, by index
+
+  static std::vector<std::vector<LinkSiteMask> > target_link_site_masks_;
+    ///< link site masks of target_xlinkable_peptides_, by index
+  static std::vector<std::vector<LinkSiteMask> > target_link_site_masks_flatten_;
+    ///< link site masks of target_xlinkable_peptides_flatten_, by index
+
   static void findLinearPeptides(
     vector<Crux::Peptide*>& peptides, 
     vector<LinearPeptide>& linears
@@ -59,6 +67,16 @@ class XLinkDatabase {
    std::vector<XLinkablePeptide>& flattened
    );
 
+  static void computeFragmentMasses(
+   std::vector<XLinkablePeptide>& xpeptides,
+   std::vector<std::vector<FLOAT_T> >& fragment_masses
+   );
+
+  static void computeLinkSiteMasks(
+   std::vector<XLinkablePeptide>& xpeptides,
+   std::vector<std::vector<LinkSiteMask> >& link_site_masks
+   );
+
   static void filterLinkablePeptides(
     std::vector<XLinkablePeptide>& xpeptides,
     std::vector<XLinkablePeptide>& filtered_xpeptides
@@ -1,7 +1,12 @@
 #include "XLinkIonSeriesCache.h"
 
+#include <boost/thread/recursive_mutex.hpp>
+
 using namespace std;
 
+// Guards the caches, which are filled on demand by the search threads.
+static boost::recursive_mutex cache_mutex;
+
 vector<vector<IonSeries*> > XLinkIonSeriesCache::target_xlinkable_ion_series_;
 
 vector<vector<IonSeries*> > XLinkIonSeriesCache::decoy_xlinkable_ion_series_;
@@ -13,6 +18,7 @@ IonSeries* XLinkIonSeriesCache::getXLinkablePeptideIonSeries(
   int charge
   ) {
 
+  boost::recursive_mutex::scoped_lock lock(cache_mutex);
   IonSeries* ans = NULL;
   int xpep_idx = xpep.getIndex();
 
@@ -102,6 +108,7 @@ IonConstraint* XLinkIonSeriesCache::getXCorrIonConstraint(
   int charge
   ) {
 
+  boost::recursive_mutex::scoped_lock lock(cache_mutex);
   int charge_idx = charge - 1;
 
   while(xcorr_ion_constraint_.size() <= charge_idx) {
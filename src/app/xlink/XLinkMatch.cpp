@@ -16,8 +16,102 @@
 #include "XLinkPeptide.h"
 #include "XLinkablePeptide.h"
 #include "io/OutputFiles.h"
+#include <boost/thread/tss.hpp>
 using namespace std;
 
+/**
+ * Each match is preceded by the arena it was allocated from, or NULL. The
+ * header is a multiple of the alignment new guarantees.
+ */
+static const size_t MATCH_HEADER_SIZE = 16;
+
+static void leaveArena(XLinkMatchArena*) {
+  // the arenas belong to the search, not to the thread
+}
+
+static boost::thread_specific_ptr<XLinkMatchArena> current_arena(leaveArena);
+
+XLinkMatchArena::XLinkMatchArena() : block_(0), used_(0), live_(0) {
+}
+
+XLinkMatchArena::~XLinkMatchArena() {
+  for (size_t idx = 0; idx < blocks_.size(); idx++) {
+    delete [] blocks_[idx];
+  }
+}
+
+XLinkMatchArena::Scope::Scope(XLinkMatchArena* arena) {
+  previous_ = current_arena.get();
+  current_arena.reset(arena);
+}
+
+XLinkMatchArena::Scope::~Scope() {
+  current_arena.reset(previous_);
+}
+
+XLinkMatchArena* XLinkMatchArena::current() {
+  return current_arena.get();
+}
+
+void* XLinkMatchArena::allocate(size_t size) {
+  size = (size + MATCH_HEADER_SIZE - 1) / MATCH_HEADER_SIZE * MATCH_HEADER_SIZE;
+  if (size > BLOCK_SIZE) {
+    return NULL;
+  }
+  if (block_ < blocks_.size() && used_ + size > BLOCK_SIZE) {
+    block_++;
+    used_ = 0;
+  }
+  if (block_ == blocks_.size()) {
+    blocks_.push_back(new char[BLOCK_SIZE]);
+  }
+  void* ptr = blocks_[block_] + used_;
+  used_ += size;
+  live_++;
+  return ptr;
+}
+
+void XLinkMatchArena::release() {
+  live_--;
+}
+
+bool XLinkMatchArena::reset() {
+  if (live_ != 0) {
+    carp(CARP_DEBUG, "%d xlink matches outlive their spectrum.", live_);
+    return false;
+  }
+  block_ = 0;
+  used_ = 0;
+  return true;
+}
+
+void* XLinkMatch::operator new(size_t size) {
+  XLinkMatchArena* arena = XLinkMatchArena::current();
+  char* ptr = NULL;
+  if (arena != NULL) {
+    ptr = (char*)arena->allocate(MATCH_HEADER_SIZE + size);
+  }
+  if (ptr == NULL) {
+    arena = NULL;
+    ptr = (char*)::operator new(MATCH_HEADER_SIZE + size);
+  }
+  *(XLinkMatchArena**)ptr = arena;
+  return ptr + MATCH_HEADER_SIZE;
+}
+
+void XLinkMatch::operator delete(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  char* block = (char*)ptr - MATCH_HEADER_SIZE;
+  XLinkMatchArena* arena = *(XLinkMatchArena**)block;
+  if (arena == NULL) {
+    ::operator delete(block);
+  } else {
+    arena->release();
+  }
+}
+
 /**
  * Constructor for XLinkMatch
  */
@@ -32,6 +126,19 @@ XLinkMatch::XLinkMatch() : Match() {
   is_decoy_ = false;
 }
 
+/**
+ * Copy constructor for XLinkMatch
+ */
+XLinkMatch::XLinkMatch(
+  const XLinkMatch& other ///< match to copy
+  ) : Match(other), CacheableMass(other) {
+  pointer_count_ = 1;
+  cached_sequence_ = other.cached_sequence_;
+  parent_ = NULL;
+  pvalue_ = other.pvalue_;
+  is_decoy_ = other.is_decoy_;
+}
+
 /**
  * Default destrcutor for XLinkMatch
  */
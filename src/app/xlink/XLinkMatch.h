@@ -14,6 +14,54 @@
 #include "model/Match.h"
 #include "util/CacheableMass.h"
 
+/**
+ * Memory for the matches of one spectrum-charge. While a thread has an
+ * arena in scope (see Scope), the XLinkMatch objects it creates are carved
+ * out of the arena's blocks rather than allocated one by one. They are still
+ * deleted through their pointer counts, which runs their destructors but
+ * leaves their memory in the arena, and once all of them have been deleted
+ * reset() makes the arena's blocks available again in one step.
+ */
+class XLinkMatchArena {
+ public:
+  XLinkMatchArena();
+  ~XLinkMatchArena();
+
+  /**
+   * Makes arena the one the calling thread allocates matches from, until
+   * the Scope is destroyed.
+   */
+  class Scope {
+   public:
+    explicit Scope(XLinkMatchArena* arena);
+    ~Scope();
+   private:
+    XLinkMatchArena* previous_;
+  };
+
+  /**
+   * \returns the arena the calling thread allocates matches from, or NULL
+   */
+  static XLinkMatchArena* current();
+
+  void* allocate(size_t size);
+  void release();
+
+  /**
+   * Reuses the blocks for new matches, if those allocated from them have
+   * all been deleted.
+   * \returns whether the arena was reset
+   */
+  bool reset();
+
+ protected:
+  static const size_t BLOCK_SIZE = 1 << 20;
+  std::vector<char*> blocks_;
+  size_t block_; ///< index of the block being allocated from
+  size_t used_; ///< bytes allocated from it
+  int live_; ///< matches allocated and not yet deleted
+};
+
 class XLinkMatch : public Crux::Match, public CacheableMass {
 
  protected:
@@ -37,11 +85,23 @@ class XLinkMatch : public Crux::Match, public CacheableMass {
    */
   XLinkMatch();
 
+  /**
+   * Copy constructor for XLinkMatch. The copy is not owned by any
+   * collection, and shares no cached ions or decoys with the original.
+   */
+  XLinkMatch(const XLinkMatch& other);
+
   /**
    * Default destructor for XLinkMatch
    */
   virtual ~XLinkMatch();
 
+  /**
+   * Allocates from the calling thread's XLinkMatchArena, if it has one.
+   */
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr);
+
   virtual XLINKMATCH_TYPE_T getCandidateType() = 0;
   virtual int getNumMissedCleavages() = 0;
   virtual bool isModified() = 0;
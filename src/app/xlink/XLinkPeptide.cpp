@@ -14,6 +14,7 @@
 #include "XLinkablePeptideIterator.h"
 #include "XLinkablePeptideIteratorTopN.h"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
@@ -181,6 +182,15 @@ bool XLinkPeptide::isInterIntra() {
 
 
 
+/**
+ * sets the minimum mass of a peptide in a crosslink product from the
+ * xlink database
+ */
+void XLinkPeptide::initializeMinMass() {
+  pmin_ = XLinkDatabase::getXLinkableBegin()->getMass(GlobalParams::getIsotopicMass());
+  pmin_set_ = true;
+}
+
 /***
  * adds crosslink candidates by iterating through all possible masses
  */
@@ -199,8 +209,7 @@ int XLinkPeptide::addCandidates(
   carp(CARP_DEBUG, "XLinkPeptide::addCandidates - max:%g", max_mass);
 
   if (!pmin_set_) {
-    pmin_ = XLinkDatabase::getXLinkableBegin()->getMass(GlobalParams::getIsotopicMass());
-    pmin_set_ = true;
+    initializeMinMass();
   }
   FLOAT_T peptide1_min_mass = pmin_;
   FLOAT_T peptide1_max_mass = max_mass-pmin_-linker_mass_;
@@ -218,6 +227,7 @@ int XLinkPeptide::addCandidates(
 					  decoy);
     while(xlp_iter.hasNext()) {
       xlinkable_peptides.push_back(xlp_iter.next());
+      xlinkable_peptides.back().setXCorr(0, xlp_iter.getXCorr());
     }
     sort(xlinkable_peptides.begin(), xlinkable_peptides.end(), compareXLinkablePeptideMass);
     carp(CARP_DEBUG, "get xcorr");
@@ -236,8 +246,25 @@ int XLinkPeptide::addXLinkPeptides(
   XLinkMatchCollection& candidates
   ) {
 
-  XLinkBondMap& bondmap = XLinkDatabase::getXLinkBondMap();
   int num_candidates = 0;
+  if (pep1.hasLinkSiteMasks() && pep2.hasLinkSiteMasks()) {
+    //check the precomputed masks and missed cleavages, so that only the
+    //legal candidates are allocated.
+    int max_missed = GlobalParams::getMissedCleavages();
+    for (unsigned int link1_idx=0;link1_idx < pep1.numLinkSites(); link1_idx++) {
+      int missed1 = pep1.getLinkMissedCleavages(link1_idx);
+      for (unsigned int link2_idx=0;link2_idx < pep2.numLinkSites();link2_idx++) {
+        if (pep1.canLink(pep2, link1_idx, link2_idx) &&
+            missed1 + pep2.getLinkMissedCleavages(link2_idx) <= max_missed) {
+          candidates.add(new XLinkPeptide(pep1, pep2, link1_idx, link2_idx));
+          num_candidates++;
+        }
+      }
+    }
+    return(num_candidates);
+  }
+
+  XLinkBondMap& bondmap = XLinkDatabase::getXLinkBondMap();
   //for every linkable site, generate the candidate if it is legal.
   for (unsigned int link1_idx=0;link1_idx < pep1.numLinkSites(); link1_idx++) {
     for (unsigned int link2_idx=0;link2_idx < pep2.numLinkSites();link2_idx++) {
@@ -281,6 +308,10 @@ int XLinkPeptide::addCandidates(
   
   bool done = false;
 
+  //linkable_peptides is sorted by mass, so the lightest partner in the
+  //window only moves down as pep1 gets heavier.
+  size_t min_idx2 = xpeptide_count;
+
   for (size_t pep_idx1=0;pep_idx1 < xpeptide_count-1;pep_idx1++) {
     XLinkablePeptide& pep1 = linkable_peptides.at(pep_idx1);
     carp(CARP_DEBUG, "pep_idx1:%d %d %f %s",
@@ -292,11 +323,16 @@ int XLinkPeptide::addCandidates(
     FLOAT_T pep1_mass = pep1.getMass(MONO);
     FLOAT_T pep2_min_mass = min_mass - pep1_mass - linker_mass_;
     FLOAT_T pep2_max_mass = max_mass - pep1_mass - linker_mass_;
-    int start_idx2 = pep_idx1+1;
+    size_t start_idx2 = pep_idx1+1;
       
     if (pep1_mass + linker_mass_ + linkable_peptides[start_idx2].getMass(MONO) > max_mass) {
       break;
     }
+    while (min_idx2 > start_idx2 &&
+           linkable_peptides[min_idx2-1].getMass(MONO) >= pep2_min_mass) {
+      min_idx2--;
+    }
+    start_idx2 = max(start_idx2, min_idx2);
     for (size_t pep_idx2=start_idx2;pep_idx2 < xpeptide_count;pep_idx2++) {
       
       XLinkablePeptide& pep2 = linkable_peptides[pep_idx2];
@@ -131,6 +131,13 @@ class XLinkPeptide : public XLinkMatch {
    */
   static FLOAT_T getLinkerMass();
 
+  /**
+   * sets the minimum mass of a peptide in a crosslink product from the
+   * xlink database. addCandidates calls it on first use; call it before
+   * generating candidates in several threads.
+   */
+  static void initializeMinMass();
+
   /**
    * adds crosslink candidates to the XLinkMatchCollection using
    * the passed in iterator for the 1st peptide
@@ -195,6 +195,13 @@ FLOAT_T XLinkScorer::scoreXLinkablePeptide(
   int link_idx,
   FLOAT_T mod_mass) {
 
+  if (xlpeptide.hasFragmentMasses()) {
+    // The ion series only goes up to the maximum charge of the constraint
+    // (charge_ - 1 and max-ion-charge), not up to charge_.
+    xlpeptide.predictIons(xcorr_ions_, ion_constraint_xcorr_->getMaxCharge(),
+                          link_idx, mod_mass);
+    return scorer_xcorr_->scoreXCorrIons(spectrum_, charge_, xcorr_ions_);
+  }
   xlpeptide.predictIons(ion_series_xcorr_, charge_, link_idx, mod_mass);
   FLOAT_T xcorr = scorer_xcorr_->scoreSpectrumVIonSeries(spectrum_, ion_series_xcorr_);
   return xcorr;
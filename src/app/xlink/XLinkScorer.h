@@ -8,6 +8,7 @@
 #ifndef XLINKSCORER_H_
 #define XLINKSCORER_H_
 #include "model/objects.h"
+#include "model/Scorer.h"
 #include "XLinkMatch.h"
 
 class XLinkScorer {
@@ -20,6 +21,7 @@ class XLinkScorer {
   XLinkMatch* candidate_; ///< current candidate
   int charge_; ///< current charege
   IonSeries* ion_series_xcorr_; ///< current ion series xcorr
+  std::vector<XCorrIon> xcorr_ions_; ///< current ions, from fragment masses
   IonSeries* ion_series_sp_; ///< current ion series sp
   bool compute_sp_; ///< calculate sp score
  
@@ -16,6 +16,7 @@
 #include "model/IonSeries.h"
 
 #include <iostream>
+#include <set>
 
 #include "XLink.h"
 
@@ -34,6 +35,8 @@ void XLinkablePeptide::init() {
   predict_ions_call_count_ = 0;
   index_ = -1;
   mod_seq_ = NULL;
+  link_site_masks_ = NULL;
+  fragment_masses_ = NULL;
 }
 
 /**
@@ -69,6 +72,8 @@ XLinkablePeptide::XLinkablePeptide(
   xcorr_link_idx_ = xlinkablepeptide.xcorr_link_idx_;
   xcorr_ = xlinkablepeptide.xcorr_;
   index_ = xlinkablepeptide.index_;
+  link_site_masks_ = xlinkablepeptide.link_site_masks_;
+  fragment_masses_ = xlinkablepeptide.fragment_masses_;
   for (size_t idx=0;idx<NUMBER_MASS_TYPES;idx++) {
     if (xlinkablepeptide.mass_calculated_[idx]) {
       mass_[idx] = xlinkablepeptide.mass_[idx];
@@ -89,6 +94,8 @@ XLinkablePeptide::XLinkablePeptide(
   xcorr_link_idx_ = xlinkablepeptide.xcorr_link_idx_;
   xcorr_ = xlinkablepeptide.xcorr_;
   index_ = xlinkablepeptide.index_;
+  link_site_masks_ = xlinkablepeptide.link_site_masks_;
+  fragment_masses_ = xlinkablepeptide.fragment_masses_;
     for (size_t idx=0;idx<NUMBER_MASS_TYPES;idx++) {
     if (xlinkablepeptide.mass_calculated_[idx]) {
       mass_[idx] = xlinkablepeptide.mass_[idx];
@@ -388,12 +395,14 @@ int XLinkablePeptide::addLinkSite(
   int seq_idx ///< the sequence index of the link site
   ) {
   link_sites_.push_back(seq_idx);
+  link_site_masks_ = NULL;
   return link_sites_.size()-1;
 }
 
 
 void XLinkablePeptide::clearSites() {
   link_sites_.clear();
+  link_site_masks_ = NULL;
 }
 
 
@@ -682,6 +691,148 @@ bool XLinkablePeptide::operator < (
 
 }
 
+/**
+ * Computes, for each link site, the bond map site and partner masks and
+ * the missed cleavages of the peptide when linked there.
+ */
+bool XLinkablePeptide::computeLinkSiteMasks(
+  XLinkBondMap& bondmap, ///< the bond map
+  vector<LinkSiteMask>& link_site_masks ///< the masks -out
+  ) {
+
+  link_site_masks.clear();
+  if (peptide_ == NULL || !bondmap.canMaskSites()) {
+    return false;
+  }
+  char* seq = peptide_->getSequencePointer();
+  for (size_t link_idx = 0; link_idx < link_sites_.size(); link_idx++) {
+    int seq_idx = link_sites_[link_idx];
+    LinkSiteMask mask;
+    if (!bondmap.getSiteMask(peptide_, seq_idx, mask.sites) ||
+        !bondmap.getPartnerMask(peptide_, seq_idx, mask.partners)) {
+      link_site_masks.clear();
+      return false;
+    }
+    // a link on K blocks its cleavage, as in XLinkPeptide::getNumMissedCleavages
+    set<int> skip;
+    if (seq[seq_idx] == 'K') {
+      skip.insert(seq_idx);
+    }
+    mask.missed_cleavages = peptide_->getMissedCleavageSites(skip);
+    link_site_masks.push_back(mask);
+  }
+  return true;
+}
+
+void XLinkablePeptide::setLinkSiteMasks(
+  const vector<LinkSiteMask>* link_site_masks ///< the masks
+  ) {
+  link_site_masks_ = link_site_masks;
+}
+
+bool XLinkablePeptide::hasLinkSiteMasks() const {
+  return link_site_masks_ != NULL;
+}
+
+/**
+ * Computes the masses that XCorr ions are predicted from: the summed
+ * residue masses of each prefix of the peptide, from the first residue
+ * to the whole peptide. The a, b and y ions follow from these.
+ */
+void XLinkablePeptide::computeFragmentMasses(
+  vector<FLOAT_T>& fragment_masses ///< the masses -out
+  ) {
+
+  const MODIFIED_AA_T* mod_seq = getModifiedSequencePtr();
+  int seq_len;
+  if (peptide_) {
+    seq_len = peptide_->getLength();
+  } else {
+    seq_len = strlen(sequence_);
+  }
+
+  // Summed as in IonSeries::createIonMassMatrix, without the length at
+  // index 0, so that the ions get identical masses.
+  fragment_masses.resize(seq_len);
+  fragment_masses[0] = get_mass_mod_amino_acid(mod_seq[0], MONO);
+  for (int idx = 1; idx < seq_len; ++idx) {
+    fragment_masses[idx] = fragment_masses[idx-1] +
+      get_mass_mod_amino_acid(mod_seq[idx], MONO);
+  }
+}
+
+void XLinkablePeptide::setFragmentMasses(
+  const vector<FLOAT_T>* fragment_masses ///< the masses
+  ) {
+  fragment_masses_ = fragment_masses;
+}
+
+bool XLinkablePeptide::hasFragmentMasses() const {
+  return fragment_masses_ != NULL;
+}
+
+/**
+ * Adds the ions of one fragment mass at charges 1 to max_charge, with
+ * the arithmetic of Ion::init and, for the ions that contain the link
+ * site, Ion::setMassZFromMass.
+ */
+static void addXCorrIons(
+  vector<XCorrIon>& ions, ///< the ions -out
+  ION_TYPE_T type, ///< type of the ions
+  FLOAT_T mass, ///< uncharged mass of the fragment
+  int max_charge, ///< maximum charge of the ions
+  bool linked, ///< does the fragment contain the link site?
+  FLOAT_T mod_mass ///< mass added to linked fragments
+  ) {
+
+  FLOAT_T h_mass = MASS_H_MONO;
+  XCorrIon ion;
+  ion.type = type;
+  for (int charge = 1; charge <= max_charge; charge++) {
+    ion.charge = charge;
+    ion.mass_z = (mass + (h_mass*(FLOAT_T)charge))/(FLOAT_T)charge;
+    if (linked) {
+      FLOAT_T unlinked_mass = (ion.mass_z - MASS_PROTON) * (FLOAT_T)charge;
+      FLOAT_T linked_mass = unlinked_mass + mod_mass;
+      ion.mass_z = (linked_mass + MASS_PROTON * (FLOAT_T)charge) / (FLOAT_T)charge;
+    }
+    ions.push_back(ion);
+  }
+}
+
+/**
+ * Predicts the same XCorr ions, in the same order, as predictIons with
+ * an IonSeries, from the fragment masses. Needs hasFragmentMasses().
+ */
+void XLinkablePeptide::predictIons(
+  vector<XCorrIon>& ions, ///< the ions -out
+  int charge, ///< maximum charge of the ions
+  int link_idx, ///< index of the link site
+  FLOAT_T mod_mass ///< mass added to the ions that contain the link site
+  ) {
+
+  // As in IonSeries::generateIonsNoModification, with mass_matrix[idx]
+  // at fragment_masses[idx - 1]
+  const vector<FLOAT_T>& fragment_masses = *fragment_masses_;
+  unsigned int link_pos = link_sites_.at(link_idx);
+  unsigned int seq_len = fragment_masses.size();
+
+  ions.clear();
+  for (unsigned int cleavage_idx = 1; cleavage_idx < seq_len; ++cleavage_idx) {
+    FLOAT_T b_mass = fragment_masses[cleavage_idx-1];
+    FLOAT_T a_mass = b_mass;
+    a_mass -= MASS_CO_MONO;
+    FLOAT_T y_mass = fragment_masses[seq_len-1] - fragment_masses[seq_len-cleavage_idx-1];
+    y_mass += MASS_H2O_MONO;
+
+    bool forward_linked = cleavage_idx > link_pos;
+    addXCorrIons(ions, A_ION, a_mass, charge, forward_linked, mod_mass);
+    addXCorrIons(ions, B_ION, b_mass, charge, forward_linked, mod_mass);
+    addXCorrIons(ions, Y_ION, y_mass, charge,
+                 cleavage_idx >= seq_len - link_pos, mod_mass);
+  }
+}
+
 void XLinkablePeptide::predictIons(
   IonSeries* ion_series,
   int charge,
@@ -8,12 +8,22 @@
 
 #include "model/objects.h"
 #include "model/Peptide.h"
+#include "model/Scorer.h"
 #include "util/CacheableMass.h"
 #include <vector>
 #include <string>
 
 #include "XLinkBondMap.h"
 
+/**
+ * What the bond map allows at one link site of an XLinkablePeptide
+ */
+struct LinkSiteMask {
+  unsigned int sites; ///< see XLinkBondMap::getSiteMask
+  unsigned int partners; ///< see XLinkBondMap::getPartnerMask
+  int missed_cleavages; ///< missed cleavages of the peptide when linked here
+};
+
 /**
  * \class XLinkablePeptide
  * \brief object for finding and defining the link sites on a peptide
@@ -30,6 +40,8 @@ class XLinkablePeptide : public CacheableMass {
   int index_;
 
   MODIFIED_AA_T* mod_seq_;
+  const std::vector<LinkSiteMask>* link_site_masks_; ///< by link site, see computeLinkSiteMasks, NULL if not computed; owned by the XLinkDatabase
+  const std::vector<FLOAT_T>* fragment_masses_; ///< see computeFragmentMasses, NULL if not computed; owned by the XLinkDatabase
 
   int predict_ions_call_count_;
   /**
@@ -228,6 +240,90 @@ class XLinkablePeptide : public CacheableMass {
     bool clear = true
     );
 
+  /**
+   * Computes the masses that XCorr ions are predicted from: the summed
+   * residue masses of each prefix of the peptide, from the first residue
+   * to the whole peptide. The a, b and y ions follow from these.
+   */
+  void computeFragmentMasses(
+    std::vector<FLOAT_T>& fragment_masses ///< the masses -out
+    );
+
+  /**
+   * Sets the masses computed by computeFragmentMasses, which must outlive
+   * this peptide and its copies.
+   */
+  void setFragmentMasses(
+    const std::vector<FLOAT_T>* fragment_masses ///< the masses
+    );
+
+  /**
+   * \returns whether the fragment masses have been set, so that ions can
+   * be predicted as XCorrIons
+   */
+  bool hasFragmentMasses() const;
+
+  /**
+   * Predicts the same XCorr ions, in the same order, as predictIons with
+   * an IonSeries, from the fragment masses. Needs hasFragmentMasses().
+   */
+  void predictIons(
+    std::vector<XCorrIon>& ions, ///< the ions -out
+    int charge, ///< maximum charge of the ions
+    int link_idx, ///< index of the link site
+    FLOAT_T mod_mass ///< mass added to the ions that contain the link site
+    );
+
+  /**
+   * Computes, for each link site, the bond map site and partner masks
+   * and the missed cleavages of the peptide when linked there, so that
+   * pairs of peptides can be checked without the bond map.
+   * \returns false if the bond map sites do not fit in a mask
+   */
+  bool computeLinkSiteMasks(
+    XLinkBondMap& bondmap, ///< the bond map
+    std::vector<LinkSiteMask>& link_site_masks ///< the masks -out
+    );
+
+  /**
+   * Sets the masks that canLink and getLinkMissedCleavages use, as
+   * computed by computeLinkSiteMasks. They are not copied, so they must
+   * outlive this peptide and its copies.
+   */
+  void setLinkSiteMasks(
+    const std::vector<LinkSiteMask>* link_site_masks ///< the masks
+    );
+
+  /**
+   * \returns whether link site masks have been set since the link sites
+   * last changed
+   */
+  bool hasLinkSiteMasks() const;
+
+  /**
+   * \returns whether this peptide can link to pep2 at the link sites, as
+   * XLinkBondMap::canLink would. Needs hasLinkSiteMasks() on both.
+   */
+  bool canLink(
+    const XLinkablePeptide& pep2, ///< the other peptide
+    int link1_idx, ///< index of the link site on this peptide
+    int link2_idx ///< index of the link site on pep2
+    ) const {
+    return ((*link_site_masks_)[link1_idx].partners &
+            (*pep2.link_site_masks_)[link2_idx].sites) != 0;
+  }
+
+  /**
+   * \returns the missed cleavages of the peptide when linked at the link
+   * site, as counted by XLinkPeptide::getNumMissedCleavages. Needs
+   * hasLinkSiteMasks().
+   */
+  int getLinkMissedCleavages(
+    int link_idx ///< index of the link site
+    ) const {
+    return (*link_site_masks_)[link_idx].missed_cleavages;
+  }
+
   FLOAT_T getXCorr() const;  
   void setXCorr( 
     size_t link_idx,
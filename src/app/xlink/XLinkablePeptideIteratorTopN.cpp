@@ -32,6 +32,7 @@ XLinkablePeptideIteratorTopN::XLinkablePeptideIteratorTopN(
   carp(CARP_DEBUG, "XLinkablePeptideIteratorTopN: start()");
 
   scored_xlp_.clear();
+  xcorr_ = 0;
 
   XLinkScorer scorer(spectrum, precursor_charge);
   top_n_ = GlobalParams::getXLinkTopN();
@@ -84,24 +85,31 @@ void XLinkablePeptideIteratorTopN::scorePeptides(
   while(biter != eiter) {
     XLinkablePeptide& pep1 = *biter;
     FLOAT_T delta_mass = precursor_mass - pep1.getMass(MONO);// - XLinkPeptide::getLinkerMass();
-    FLOAT_T xcorr = scorer.scoreXLinkablePeptide(pep1, 0, delta_mass);
-    pep1.setXCorr(0, xcorr);
-    //pep1.getXCorr();
-    scored_xlp_.push_back(&pep1);
+    ScoredXLinkablePeptide scored;
+    scored.xcorr = scorer.scoreXLinkablePeptide(pep1, 0, delta_mass);
+    scored.peptide = &pep1;
+    scored_xlp_.push_back(scored);
     biter++;
   }
   if (scored_xlp_.size() > 0) {
-    sort(scored_xlp_.begin(), scored_xlp_.end(), compareXLinkableXCorrPtr);
+    sort(scored_xlp_.begin(), scored_xlp_.end(), compareXCorr);
   }
  
   IF_CARP(CARP_DETAILED_DEBUG,
     for (size_t idx = 0;idx < min((size_t)top_n_,scored_xlp_.size());idx++) {
-      string seq = scored_xlp_[idx]->getModifiedSequenceString();
-      carp(CARP_INFO,"%d %g %s", idx, scored_xlp_[idx]->getXCorr(), seq.c_str());
+      string seq = scored_xlp_[idx].peptide->getModifiedSequenceString();
+      carp(CARP_INFO,"%d %g %s", idx, scored_xlp_[idx].xcorr, seq.c_str());
     }
   );
 }
 
+bool XLinkablePeptideIteratorTopN::compareXCorr(
+  const ScoredXLinkablePeptide& scored1,
+  const ScoredXLinkablePeptide& scored2
+  ) {
+  return scored1.xcorr > scored2.xcorr;
+}
+
 /**
  * Destructor
  */
@@ -141,7 +149,8 @@ XLinkablePeptide& XLinkablePeptideIteratorTopN::next() {
     carp(CARP_FATAL, "next called on empty iterator!");
   }
 
-  XLinkablePeptide& ans = *scored_xlp_[current_count_-1];
+  XLinkablePeptide& ans = *scored_xlp_[current_count_-1].peptide;
+  xcorr_ = scored_xlp_[current_count_-1].xcorr;
   //carp(CARP_INFO, "next peptide:%s %g", ans.getSequence(), ans.getXCorr());
   queueNextPeptide();
   //carp(CARP_INFO, "XLinkablePeptideIteratorTopN: returning reference");
@@ -153,12 +162,17 @@ XLinkablePeptide* XLinkablePeptideIteratorTopN::nextPtr() {
     carp(CARP_FATAL, "next called on empty iterator!");
   }
   
-  XLinkablePeptide* ans = scored_xlp_[current_count_-1];
+  XLinkablePeptide* ans = scored_xlp_[current_count_-1].peptide;
+  xcorr_ = scored_xlp_[current_count_-1].xcorr;
   queueNextPeptide();
   return ans;
   
 }
 
+FLOAT_T XLinkablePeptideIteratorTopN::getXCorr() const {
+  return xcorr_;
+}
+
 
 
 /*                                                                                                                                                                                                                          
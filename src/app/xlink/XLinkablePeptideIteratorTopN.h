@@ -20,8 +20,18 @@ class XLinkablePeptideIteratorTopN: public XLinkablePeptideIterator {
 
  protected:
 
+  /**
+   * A peptide of the database with its XCorr. The score is kept here
+   * rather than set in the peptide, which concurrent searches share.
+   */
+  struct ScoredXLinkablePeptide {
+    FLOAT_T xcorr;
+    XLinkablePeptide* peptide;
+  };
+
   //std::priority_queue<XLinkablePeptide, std::vector<XLinkablePeptide>, CompareXCorr> scored_xlp_;  
-  std::vector<XLinkablePeptide*> scored_xlp_; ///< sorted by highest XCorr score.
+  std::vector<ScoredXLinkablePeptide> scored_xlp_; ///< sorted by highest XCorr score.
+  FLOAT_T xcorr_; ///< XCorr of the peptide last returned
   int current_count_;
   int top_n_; ///<set by kojak-top-n
   bool has_next_; ///< is there a next candidate
@@ -32,6 +42,14 @@ class XLinkablePeptideIteratorTopN: public XLinkablePeptideIterator {
    */
   void queueNextPeptide(); 
   
+  /**
+   * orders peptides by decreasing XCorr, as compareXLinkableXCorrPtr does
+   */
+  static bool compareXCorr(
+    const ScoredXLinkablePeptide& scored1,
+    const ScoredXLinkablePeptide& scored2
+  );
+
   void scorePeptides(
     XLinkScorer& scorer,
     FLOAT_T precursor_mass,
@@ -70,6 +88,12 @@ class XLinkablePeptideIteratorTopN: public XLinkablePeptideIterator {
   
   XLinkablePeptide* nextPtr();
 
+  /**
+   *\returns the XCorr of the peptide last returned by next(), which is
+   * not set in the peptide itself
+   */
+  FLOAT_T getXCorr() const;
+
 };
 
 
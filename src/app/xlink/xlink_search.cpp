@@ -18,6 +18,7 @@
 #include "model/FilteredSpectrumChargeIterator.h"
 #include "io/OutputFiles.h"
 #include "io/SpectrumCollectionFactory.h"
+#include "util/GlobalParams.h"
 #include "util/Params.h"
 #include "XLinkDatabase.h"
 
@@ -29,9 +30,14 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <set>
 
 #include <ctime>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 
 
 using namespace std;
@@ -99,6 +105,539 @@ void writeTrainingCandidates(XLinkMatchCollection* training_candidates, int scan
 }
 
 
+/**
+ * A Weibull fit shared by the spectrum-charges of one charge and precursor
+ * mass bin (see weibull-bin-width). The first of them to be generated fits
+ * it from its training candidates; the others wait until it is fitted, and
+ * fit their own if it failed.
+ */
+struct XLinkWeibullFit {
+  Weibull weibull;
+  bool fitted; ///< guarded by XLinkSearchShared::weibull_mutex
+  bool ok; ///< whether the fit succeeded, set with fitted
+};
+
+/**
+ * A top target match, with its p-values from the shared and from its own
+ * Weibull fit, for search-for-xlinks.weibull-comparison.txt.
+ */
+struct XLinkWeibullComparison {
+  string sequence;
+  FLOAT_T xcorr;
+  FLOAT_T pvalue; ///< from the shared fit
+  FLOAT_T spectrum_pvalue; ///< from the spectrum-charge's own fit
+};
+
+/**
+ * A spectrum-charge to search, with its candidates and, once searched,
+ * the matches to write.
+ */
+struct XLinkSearchItem {
+  int index; ///< position of the spectrum-charge among those taken
+  Crux::Spectrum* spectrum;
+  SpectrumZState zstate;
+  int scan_num;
+  XLinkMatchCollection* target_candidates; ///< NULL if it has none
+  XLinkMatchCollection* decoy_candidates;
+  XLinkMatchCollection* target_train_candidates; ///< NULL without p-values
+  XLinkMatchCollection* train_candidates; ///< NULL without p-values
+  set<Crux::Peptide*> allocated_peptides; ///< peptides of the decoys
+  XLinkWeibullFit* shared_fit; ///< NULL unless fits are shared
+  bool fits_shared; ///< whether this item fits shared_fit
+  XLinkMatchArena* arena; ///< holds the matches of all the collections
+  vector<XLinkWeibullComparison> comparisons; ///< to write, if comparing fits
+};
+
+/**
+ * State shared by the threads searching a spectrum file.
+ *
+ * Each thread takes the next spectrum-charge under candidate_mutex and
+ * generates its candidates, including the xlink-top-n prefilter, in
+ * parallel with the others; generation only reads the xlink database.
+ * The decoy shuffles draw from the global random number generator, so
+ * they are done one spectrum-charge at a time, in spectrum order (see
+ * next_shuffle), which keeps the decoys of a given seed the same whatever
+ * the number of threads. Scoring then runs in parallel, and the searched
+ * spectrum-charges are written in the order they were taken.
+ */
+struct XLinkSearchShared {
+  // Set before the search
+  FilteredSpectrumChargeIterator* spectrum_iterator;
+  OutputFiles* output_files;
+  string ms2_file;
+  FLOAT_T num_spectra;
+  FLOAT_T min_pvalue;
+  int print_interval;
+  int top_match;
+  int min_weibull_points;
+  bool compute_pvalues;
+  bool concat;
+  bool write_weibull_points;
+  FLOAT_T weibull_bin_width; ///< 0 to fit every spectrum-charge separately
+  DelimitedFileWriter* comparison_writer; ///< NULL unless comparing fits
+
+  // Guarded by candidate_mutex
+  boost::mutex candidate_mutex;
+  int search_count;
+  vector<XLinkMatchArena*> free_arenas; ///< reset, for the next items
+
+  // Guarded by shuffle_mutex
+  boost::mutex shuffle_mutex;
+  boost::condition_variable shuffle_turn;
+  int next_shuffle; ///< index of the next item to shuffle
+  int skipped_no_candidates;
+
+  // Guarded by output_mutex
+  boost::mutex output_mutex;
+  map<int, XLinkSearchItem*> searched; ///< waiting for earlier items
+  int next_output; ///< index of the next item to write
+
+  // Guarded by weibull_mutex; added to in shuffle order
+  boost::mutex weibull_mutex;
+  boost::condition_variable weibull_fitted;
+  map<pair<int, int>, XLinkWeibullFit*> weibull_fits; ///< by charge and mass bin
+};
+
+/**
+ * Finds the shared Weibull fit of a spectrum-charge, adding it if this is
+ * the first spectrum-charge of its charge and mass bin.
+ * \returns the fit, and whether it was added
+ */
+static XLinkWeibullFit* findWeibullFit(
+  XLinkSearchShared& shared, ///< state of the search
+  SpectrumZState& zstate, ///< charge and mass of the spectrum-charge
+  bool& added ///< whether the fit was added -out
+  ) {
+
+  pair<int, int> key(zstate.getCharge(),
+    (int)floor(zstate.getNeutralMass() / shared.weibull_bin_width));
+  boost::mutex::scoped_lock lock(shared.weibull_mutex);
+  map<pair<int, int>, XLinkWeibullFit*>::iterator found = shared.weibull_fits.find(key);
+  added = found == shared.weibull_fits.end();
+  if (!added) {
+    return found->second;
+  }
+  XLinkWeibullFit* fit = new XLinkWeibullFit();
+  fit->fitted = false;
+  fit->ok = false;
+  shared.weibull_fits[key] = fit;
+  return fit;
+}
+
+/**
+ * Waits until a shared Weibull fit is fitted.
+ * \returns whether the fit succeeded
+ */
+static bool waitWeibullFit(
+  XLinkSearchShared& shared, ///< state of the search
+  XLinkWeibullFit* fit ///< the shared fit
+  ) {
+
+  boost::mutex::scoped_lock lock(shared.weibull_mutex);
+  while (!fit->fitted) {
+    shared.weibull_fitted.wait(lock);
+  }
+  return fit->ok;
+}
+
+/**
+ * Takes the next spectrum-charge to search.
+ * \returns the spectrum-charge, or NULL if there are no more
+ */
+static XLinkSearchItem* nextSearchItem(
+  XLinkSearchShared& shared ///< state of the search
+  ) {
+
+  boost::mutex::scoped_lock lock(shared.candidate_mutex);
+  FilteredSpectrumChargeIterator* spectrum_iterator = shared.spectrum_iterator;
+
+  if (!spectrum_iterator->hasNext()) {
+    return NULL;
+  }
+
+  XLinkSearchItem* item = new XLinkSearchItem();
+  item->spectrum = spectrum_iterator->next(item->zstate);
+  item->scan_num = item->spectrum->getFirstScan();
+
+  if (shared.print_interval > 0 && shared.search_count > 0 &&
+      shared.search_count % shared.print_interval == 0) {
+    carp(CARP_INFO, 
+         "%d spectrum-charge combinations searched, %.0f%% complete",
+         shared.search_count + spectrum_iterator->numSkipped(),
+         (shared.search_count + spectrum_iterator->numSkipped()) / shared.num_spectra * 100);
+  }
+  item->index = shared.search_count++;
+
+  item->target_candidates = NULL;
+  item->decoy_candidates = NULL;
+  item->target_train_candidates = NULL;
+  item->train_candidates = NULL;
+  item->shared_fit = NULL;
+  item->fits_shared = false;
+  if (shared.free_arenas.empty()) {
+    item->arena = new XLinkMatchArena();
+  } else {
+    item->arena = shared.free_arenas.back();
+    shared.free_arenas.pop_back();
+  }
+  return item;
+}
+
+/**
+ * Deletes a written spectrum-charge, whose collections have been deleted,
+ * and gives its arena to the next spectrum-charges.
+ */
+static void deleteSearchItem(
+  XLinkSearchShared& shared, ///< state of the search
+  XLinkSearchItem* item ///< spectrum-charge to delete
+  ) {
+
+  // An arena whose matches have not all been deleted is left as it is,
+  // as their memory would be without it.
+  if (item->arena->reset()) {
+    boost::mutex::scoped_lock lock(shared.candidate_mutex);
+    shared.free_arenas.push_back(item->arena);
+  }
+  delete item;
+}
+
+/**
+ * Generates the Weibull training candidates of a spectrum-charge, except
+ * for the shuffled decoys added by shuffleCandidates.
+ */
+static void generateTrainCandidates(
+  XLinkSearchItem* item ///< spectrum-charge to train
+  ) {
+
+  item->target_train_candidates =
+    new XLinkMatchCollection(item->spectrum, item->zstate, false, true);
+  item->train_candidates =
+    new XLinkMatchCollection(item->spectrum, item->zstate, true, true);
+
+  XLinkMatchCollection* target_train_candidates = item->target_train_candidates;
+  XLinkMatchCollection* train_candidates = item->train_candidates;
+  for (size_t idx=0;idx < target_train_candidates->getMatchTotal();idx++) {
+    train_candidates->add(target_train_candidates->at(idx), true);
+  }
+}
+
+/**
+ * Generates the target candidates of a spectrum-charge and, if it trains
+ * a Weibull fit of its own, its training candidates. This only reads the
+ * xlink database, so the threads run it in parallel.
+ */
+static void generateCandidates(
+  XLinkSearchShared& shared, ///< state of the search
+  XLinkSearchItem* item ///< spectrum-charge to generate candidates for
+  ) {
+
+  XLinkMatchCollection* candidates =
+    new XLinkMatchCollection(item->spectrum, item->zstate, false, false);
+
+  if (candidates->getMatchTotal() < 0) {
+    carp(CARP_ERROR, "Scan %d has %d candidates.", item->scan_num, 
+         candidates->getMatchTotal());
+  } else if (candidates->getMatchTotal() == 0) {
+    carp(CARP_DETAILED_INFO, "Skipping scan %d charge %d mass %lg", 
+         item->scan_num, 
+         item->zstate.getCharge(),
+         item->zstate.getNeutralMass()
+         );
+    delete candidates;
+    return;
+  }
+
+  carp(CARP_DETAILED_INFO, "Scan=%d charge=%d mass=%lg candidates=%d", 
+       item->scan_num, 
+       item->zstate.getCharge(), 
+       item->zstate.getNeutralMass(), 
+       candidates->getMatchTotal());   
+  item->target_candidates = candidates;
+
+  // With shared fits, whether this spectrum-charge trains is only known in
+  // shuffle order
+  if (shared.compute_pvalues &&
+      (shared.weibull_bin_width <= 0 || shared.comparison_writer != NULL)) {
+    generateTrainCandidates(item);
+  }
+}
+
+/**
+ * Shuffles the decoys of a spectrum-charge, once those of every earlier
+ * spectrum-charge have been shuffled.
+ */
+static void shuffleCandidates(
+  XLinkSearchShared& shared, ///< state of the search
+  XLinkSearchItem* item ///< spectrum-charge to shuffle decoys for
+  ) {
+
+  boost::mutex::scoped_lock lock(shared.shuffle_mutex);
+  while (shared.next_shuffle != item->index) {
+    shared.shuffle_turn.wait(lock);
+  }
+
+  if (item->target_candidates == NULL) {
+    shared.skipped_no_candidates++;
+  } else {
+    carp(CARP_DEBUG, "Getting decoy candidates.");
+    item->decoy_candidates = new XLinkMatchCollection();
+    item->target_candidates->shuffle(*item->decoy_candidates);
+
+    if (shared.compute_pvalues && shared.weibull_bin_width > 0) {
+      item->shared_fit = findWeibullFit(shared, item->zstate, item->fits_shared);
+      // Only the spectrum-charge that makes the fit trains here. The others
+      // of its mass bin wait for the fit in searchItem, once they have
+      // released shuffle_mutex.
+      if (item->train_candidates == NULL && item->fits_shared) {
+        generateTrainCandidates(item);
+      }
+    }
+    if (item->train_candidates != NULL) {
+      XLinkMatchCollection* target_train_candidates = item->target_train_candidates;
+      XLinkMatchCollection* train_candidates = item->train_candidates;
+      while(train_candidates->getMatchTotal() < shared.min_weibull_points) {
+        target_train_candidates->shuffle(*train_candidates);
+      }
+    }
+
+    XLink::takeAllocatedPeptides(item->allocated_peptides);
+  }
+
+  shared.next_shuffle++;
+  shared.shuffle_turn.notify_all();
+}
+
+/**
+ * Scores, computes the p-values of and ranks the candidates of a
+ * spectrum-charge.
+ */
+static void searchItem(
+  XLinkSearchShared& shared, ///< state of the search
+  XLinkSearchItem* item ///< spectrum-charge to search
+  ) {
+
+  Crux::Spectrum* spectrum = item->spectrum;
+  XLinkMatchCollection* target_candidates = item->target_candidates;
+  XLinkMatchCollection* decoy_candidates = item->decoy_candidates;
+
+  // Score targets.
+  target_candidates->scoreSpectrum(spectrum);
+
+  // Score decoys.
+  carp(CARP_DEBUG, "Scoring decoys.");
+  decoy_candidates->scoreSpectrum(spectrum);
+      
+  if (shared.compute_pvalues) {
+    //class for estimating pvalues.
+    Weibull spectrum_weibull;
+    XLinkWeibullFit* shared_fit = item->shared_fit;
+    bool shared_fit_ok = false;
+    bool train_on_decoys = false;
+    if (shared_fit != NULL && !item->fits_shared) {
+      shared_fit_ok = waitWeibullFit(shared, shared_fit);
+      // Whether this spectrum-charge needs training candidates of its own is
+      // only known now, after its shuffle turn, so rather than drawing more
+      // shuffles it trains on its targets and the decoys shuffled for it.
+      if (!shared_fit_ok && item->train_candidates == NULL) {
+        generateTrainCandidates(item);
+        for (size_t idx = 0;idx < decoy_candidates->getMatchTotal();idx++) {
+          item->train_candidates->add(decoy_candidates->at(idx), true);
+        }
+        train_on_decoys = true;
+      }
+    }
+    XLinkMatchCollection *target_train_candidates = item->target_train_candidates;
+    XLinkMatchCollection *train_candidates = item->train_candidates;
+    // the fit from this spectrum-charge's own training candidates, if any
+    Weibull* train_weibull = NULL;
+    bool write_weibull_points = false;
+    if (train_candidates != NULL) {
+      train_weibull = item->fits_shared ? &shared_fit->weibull : &spectrum_weibull;
+      train_candidates->scoreSpectrum(spectrum);
+      for (int idx = 0;idx < train_candidates->getMatchTotal();idx++) {
+        const string& sequence = (*train_candidates)[idx]->getSequenceStringConst();
+        FLOAT_T score = (*train_candidates)[idx]->getScore(XCORR);
+        train_weibull->addPoint(sequence, score);
+      }
+      write_weibull_points = !train_weibull->fit();
+    }
+
+    Weibull* weibull = train_weibull;
+    if (shared_fit != NULL) {
+      if (item->fits_shared) {
+        if (write_weibull_points) {
+          carp(CARP_WARNING, "The shared Weibull fit of charge %d at %lg Da failed, "
+               "so the other spectra of its mass bin are fitted separately.",
+               item->zstate.getCharge(), item->zstate.getNeutralMass());
+        }
+        boost::mutex::scoped_lock lock(shared.weibull_mutex);
+        shared_fit->ok = !write_weibull_points;
+        shared_fit->fitted = true;
+        shared.weibull_fitted.notify_all();
+      } else if (shared_fit_ok) {
+        weibull = &shared_fit->weibull;
+      }
+    }
+	
+    target_candidates->sort(XCORR);
+	
+	
+    // Calculate pvalues.
+    int nprint = min(shared.top_match,target_candidates->getMatchTotal());
+    carp(CARP_DEBUG, "Calculating %d target p-values.", nprint);
+    for (int idx=0;idx < nprint;idx++) {
+      FLOAT_T score = (*target_candidates)[idx]->getScore(XCORR);
+      (*target_candidates)[idx]->setPValue(weibull->getPValue(score));
+      if (shared.comparison_writer != NULL && shared_fit != NULL) {
+        XLinkWeibullComparison comparison;
+        comparison.sequence = (*target_candidates)[idx]->getSequenceString();
+        comparison.xcorr = score;
+        comparison.pvalue = (*target_candidates)[idx]->getPValue();
+        comparison.spectrum_pvalue = train_weibull->getPValue(score);
+        item->comparisons.push_back(comparison);
+      }
+    }
+	
+    nprint = min(shared.top_match, (int)decoy_candidates->getMatchTotal());
+    carp(CARP_DEBUG, "Calculating %d decoy p-values.", nprint);
+    decoy_candidates->sort(XCORR);
+    for (int idx=0;idx < nprint;idx++) {
+      FLOAT_T score = (*decoy_candidates)[idx]->getScore(XCORR);
+      (*decoy_candidates)[idx]->setPValue(weibull->getPValue(score));
+      FLOAT_T wpvalue = weibull->getWeibullPValue(score);
+      FLOAT_T bpvalue = bonferroni_correction(wpvalue, decoy_candidates->getMatchTotal()) * 2.0;
+      if ((wpvalue == 0) || (wpvalue != wpvalue) || (bpvalue  < shared.min_pvalue)) {
+        //If we have a bad fit, 0 or too low pvalue, print out the points.
+        write_weibull_points = true;
+      }
+        
+    }
+      
+      
+    if (train_candidates != NULL) {
+      if (write_weibull_points || shared.write_weibull_points) {
+        writeTrainingCandidates(train_candidates, item->scan_num, *train_weibull);
+      }
+      carp(CARP_DEBUG, "Delete train candidates.");
+      delete train_candidates;
+      carp(CARP_DEBUG, "Delete target train candidates.");
+      delete target_train_candidates;
+      item->train_candidates = NULL;
+      item->target_train_candidates = NULL;
+      if (train_on_decoys) {
+        for (size_t idx = 0;idx < decoy_candidates->getMatchTotal();idx++) {
+          decoy_candidates->at(idx)->setParent(decoy_candidates);
+        }
+      }
+    }
+	
+  } // if (compute_p_values)
+      
+  if (shared.concat) {
+    for (size_t idx=0;idx < decoy_candidates->getMatchTotal();idx++) {
+      target_candidates->add(decoy_candidates->at(idx), true);
+    }
+  } else {
+    if (decoy_candidates->getScoredType(SP) == true) {
+      decoy_candidates->populateMatchRank(SP);
+    }
+    decoy_candidates->populateMatchRank(XCORR);
+    decoy_candidates->sort(XCORR);
+  }
+      
+  carp(CARP_DEBUG, "Ranking.");
+      
+  if (target_candidates->getScoredType(SP) == true) {
+    target_candidates->populateMatchRank(SP);
+  }
+  target_candidates->populateMatchRank(XCORR);
+  target_candidates->sort(XCORR);
+}
+
+/**
+ * Queues a searched spectrum-charge for output, and writes and deletes
+ * those that are next in order.
+ */
+static void writeSearchItems(
+  XLinkSearchShared& shared, ///< state of the search
+  XLinkSearchItem* searched_item ///< spectrum-charge that has been searched
+  ) {
+
+  boost::mutex::scoped_lock lock(shared.output_mutex);
+  shared.searched[searched_item->index] = searched_item;
+
+  map<int, XLinkSearchItem*>::iterator next;
+  while ((next = shared.searched.find(shared.next_output)) != shared.searched.end()) {
+    XLinkSearchItem* item = next->second;
+    shared.searched.erase(next);
+    shared.next_output++;
+    if (item->target_candidates == NULL) {
+      deleteSearchItem(shared, item);
+      continue;
+    }
+
+    //print out
+    item->target_candidates->setFilePath(shared.ms2_file);
+    item->decoy_candidates->setFilePath(shared.ms2_file);
+    vector<MatchCollection*> decoy_vec;
+    if (!shared.concat) {
+      decoy_vec.push_back(item->decoy_candidates);
+    }
+
+    DelimitedFileWriter* comparison_writer = shared.comparison_writer;
+    for (size_t idx = 0; idx < item->comparisons.size(); idx++) {
+      const XLinkWeibullComparison& comparison = item->comparisons[idx];
+      comparison_writer->setColumnCurrentRow(0, item->scan_num);
+      comparison_writer->setColumnCurrentRow(1, item->zstate.getCharge());
+      comparison_writer->setColumnCurrentRow(2, item->zstate.getNeutralMass());
+      comparison_writer->setColumnCurrentRow(3, comparison.sequence);
+      comparison_writer->setColumnCurrentRow(4, comparison.xcorr);
+      comparison_writer->setColumnCurrentRow(5, comparison.pvalue);
+      comparison_writer->setColumnCurrentRow(6, comparison.spectrum_pvalue);
+      comparison_writer->writeRow();
+    }
+
+    carp(CARP_DEBUG, "Writing results.");
+    shared.output_files->writeMatches(
+      (MatchCollection*)item->target_candidates, 
+      decoy_vec,
+      XCORR,
+      item->spectrum);
+
+    /* Clean up */
+    carp(CARP_DEBUG, "Deleting decoy candidates.");
+    delete item->decoy_candidates;
+    carp(CARP_DEBUG, "Deleting target candidates.");
+    delete item->target_candidates;
+    XLink::deleteAllocatedPeptides(item->allocated_peptides);
+    
+    carp(CARP_DEBUG, "Done with spectrum %d.", item->scan_num);
+    carp(CARP_DEBUG, "=====================================");
+    deleteSearchItem(shared, item);
+  }
+}
+
+/**
+ * Searches spectrum-charges until there are none left.
+ */
+static void searchThread(
+  XLinkSearchShared* shared ///< state of the search
+  ) {
+
+  XLinkSearchItem* item;
+  while ((item = nextSearchItem(*shared)) != NULL) {
+    {
+      XLinkMatchArena::Scope scope(item->arena);
+      generateCandidates(*shared, item);
+      shuffleCandidates(*shared, item);
+      if (item->target_candidates != NULL) {
+        searchItem(*shared, item);
+      }
+    }
+    writeSearchItems(*shared, item);
+  }
+}
+
 /**
  * main method for SearchForXLinks that implements the refactored code
  */
@@ -133,19 +672,46 @@ int SearchForXLinks::xlinkSearchMain() {
     XLinkDatabase::print();
   }
 
-  SpectrumZState zstate;
+  int num_threads = Params::GetInt("num-threads");
+  if (num_threads < 1) {
+    num_threads = max(1, (int)boost::thread::hardware_concurrency());
+  }
+  carp(CARP_INFO, "Number of Threads: %d", num_threads);
+  // Initialize the lazily computed ion masses before the threads use them.
+  Ion::initializeModificationMasses(GlobalParams::getFragmentMass());
+  if (GlobalParams::getXLinkIncludeInter() ||
+      GlobalParams::getXLinkIncludeIntra() ||
+      GlobalParams::getXLinkIncludeInterIntra()) {
+    XLinkPeptide::initializeMinMass();
+  }
 
   /* Prepare output files */
   carp(CARP_DETAILED_INFO, "Preparing output files.");
   OutputFiles output_files(this);
   output_files.writeHeaders(num_proteins);
 
+  FLOAT_T weibull_bin_width = Params::GetDouble("weibull-bin-width");
+  DelimitedFileWriter* comparison_writer = NULL;
+  if (compute_pvalues && weibull_bin_width > 0 &&
+      Params::GetBool("write-weibull-comparison")) {
+    string comparison_file = output_directory + "/" +
+      "search-for-xlinks.weibull-comparison.txt";
+    comparison_writer = new DelimitedFileWriter(comparison_file.c_str());
+    comparison_writer->setColumnName("scan", 0);
+    comparison_writer->setColumnName("charge", 1);
+    comparison_writer->setColumnName("spectrum neutral mass", 2);
+    comparison_writer->setColumnName("sequence", 3);
+    comparison_writer->setColumnName("xcorr score", 4);
+    comparison_writer->setColumnName("p-value", 5);
+    comparison_writer->setColumnName("spectrum p-value", 6);
+    comparison_writer->writeHeader();
+  }
+
   for (vector<string>::iterator ms2_file_iter = ms2_files.begin();
        ms2_file_iter != ms2_files.end(); ++ms2_file_iter) { 
     string ms2_file = *ms2_file_iter;
     
     carp(CARP_INFO, "Loading spectra %s.", ms2_file.c_str());
-    Crux::Spectrum* spectrum = NULL;
     Crux::SpectrumCollection* spectra =
       SpectrumCollectionFactory::create(ms2_file);
     spectra->parse();
@@ -153,189 +719,49 @@ int SearchForXLinks::xlinkSearchMain() {
     FilteredSpectrumChargeIterator* spectrum_iterator =
       new FilteredSpectrumChargeIterator(spectra);
 
-
-    // main loop over spectra in ms2 file
-    int scan_num = 0;
-    int skipped_no_candidates = 0;
-    int search_count = 0;
     FLOAT_T num_spectra = (FLOAT_T)spectra->getNumSpectra();
-    FLOAT_T min_pvalue = 1.0 / num_spectra;
-    //class for estimating pvalues.
-    Weibull weibull;
+
+    XLinkSearchShared shared;
+    shared.spectrum_iterator = spectrum_iterator;
+    shared.output_files = &output_files;
+    shared.ms2_file = ms2_file;
+    shared.num_spectra = num_spectra;
+    shared.min_pvalue = 1.0 / num_spectra;
+    shared.print_interval = Params::GetInt("print-search-progress");
+    shared.top_match = top_match;
+    shared.min_weibull_points = min_weibull_points;
+    shared.compute_pvalues = compute_pvalues;
+    shared.concat = Params::GetBool("concat");
+    shared.write_weibull_points = Params::GetBool("write-weibull-points");
+    shared.weibull_bin_width = weibull_bin_width;
+    shared.comparison_writer = comparison_writer;
+    shared.search_count = 0;
+    shared.next_shuffle = 0;
+    shared.skipped_no_candidates = 0;
+    shared.next_output = 0;
   
-    // for every observed spectrum 
+    // main loop over spectra in ms2 file
     carp(CARP_INFO, "Beginning search.");
-    int print_interval = Params::GetInt("print-search-progress");
-
-    while (spectrum_iterator->hasNext()) {
-
-      spectrum = spectrum_iterator->next(zstate);
-      scan_num = spectrum->getFirstScan();
-      
-      if (print_interval > 0 && search_count > 0 && search_count % print_interval == 0) {
-	carp(CARP_INFO, 
-	     "%d spectrum-charge combinations searched, %.0f%% complete",
-	     search_count + spectrum_iterator->numSkipped(),
-	     (search_count + spectrum_iterator->numSkipped()) / num_spectra * 100);
-      }
-      search_count++;
-
-      FLOAT_T precursor_mz = spectrum->getPrecursorMz();
-
-      XLinkMatchCollection* target_candidates =
-	new XLinkMatchCollection(
-				 spectrum,
-				 zstate,
-				 false,
-				 false
-				 );
-
-      if (target_candidates->getMatchTotal() < 0) {
-	carp(CARP_ERROR, "Scan %d has %d candidates.", scan_num, 
-	     target_candidates->getMatchTotal());
-      } else if (target_candidates->getMatchTotal() == 0) {
-	skipped_no_candidates++;
-	carp(CARP_DETAILED_INFO, "Skipping scan %d charge %d mass %lg", 
-	     scan_num, 
-	     zstate.getCharge(),
-	     zstate.getNeutralMass()
-	     );
-	delete target_candidates;
-	//XLink::deleteAllocatedPeptides();
-	continue;
-      }
+    boost::thread_group threadgroup;
+    for (int thread_idx = 1; thread_idx < num_threads; thread_idx++) {
+      threadgroup.create_thread(boost::bind(searchThread, &shared));
+    }
+    searchThread(&shared);
+    threadgroup.join_all();
 
-      carp(CARP_DETAILED_INFO, "Scan=%d charge=%d mass=%lg candidates=%d", 
-	   scan_num, 
-	   zstate.getCharge(), 
-	   zstate.getNeutralMass(), 
-	   target_candidates->getMatchTotal());   
-
-      // Score targets.
-      target_candidates->scoreSpectrum(spectrum);
-
-      // Score decoys.
-      carp(CARP_DEBUG, "Getting decoy candidates.");
-      XLinkMatchCollection* decoy_candidates = new XLinkMatchCollection();
-      target_candidates->shuffle(*decoy_candidates);
-      carp(CARP_DEBUG, "Scoring decoys.");
-      decoy_candidates->scoreSpectrum(spectrum);
-      
-      if (compute_pvalues) {
-	weibull.reset();
-	XLinkMatchCollection *target_train_candidates =
-	  new XLinkMatchCollection(
-				   spectrum,
-				   zstate,
-				   false,
-				   true);
-	XLinkMatchCollection *train_candidates =
-	  new XLinkMatchCollection(
-				   spectrum,
-				   zstate,
-				   true,
-				   true
-				   );
-      
-	for (size_t idx=0;idx < target_train_candidates->getMatchTotal();idx++) {
-	  train_candidates->add(target_train_candidates->at(idx), true);
-	}
-	while(train_candidates->getMatchTotal() < min_weibull_points) {
-	  target_train_candidates->shuffle(*train_candidates);
-	}
-	train_candidates->scoreSpectrum(spectrum);
-	for (int idx = 0;idx < train_candidates->getMatchTotal();idx++) {
-	  const string& sequence = (*train_candidates)[idx]->getSequenceStringConst();
-	  FLOAT_T score = (*train_candidates)[idx]->getScore(XCORR);
-	  weibull.addPoint(sequence, score);
-	}
-	bool write_weibull_points = !weibull.fit();
-	
-	target_candidates->sort(XCORR);
-	
-	
-	// Calculate pvalues.
-	int nprint = min(top_match,target_candidates->getMatchTotal());
-	carp(CARP_DEBUG, "Calculating %d target p-values.", nprint);
-	for (int idx=0;idx < nprint;idx++) {
-	  FLOAT_T score = (*target_candidates)[idx]->getScore(XCORR);
-	  (*target_candidates)[idx]->setPValue(weibull.getPValue(score));
-	}
-	
-	nprint = min(top_match, (int)decoy_candidates->getMatchTotal());
-	carp(CARP_DEBUG, "Calculating %d decoy p-values.", nprint);
-	decoy_candidates->sort(XCORR);
-	for (int idx=0;idx < nprint;idx++) {
-	  FLOAT_T score = (*decoy_candidates)[idx]->getScore(XCORR);
-	  (*decoy_candidates)[idx]->setPValue(weibull.getPValue(score));
-	  FLOAT_T wpvalue = weibull.getWeibullPValue(score);
-	  FLOAT_T bpvalue = bonferroni_correction(wpvalue, decoy_candidates->getMatchTotal()) * 2.0;
-	  if ((wpvalue == 0) || (wpvalue != wpvalue) || (bpvalue  < min_pvalue)) {
-	    //If we have a bad fit, 0 or too low pvalue, print out the points.
-	    write_weibull_points = true;
-	  }
-        
-	}
-      
-      
-	if (write_weibull_points || Params::GetBool("write-weibull-points")) {
-	  writeTrainingCandidates(train_candidates, scan_num, weibull);
-	}
-	carp(CARP_DEBUG, "Delete train candidates.");
-	delete train_candidates;
-	carp(CARP_DEBUG, "Delete target train candidates.");
-	delete target_train_candidates;
-	
-      } // if (compute_p_values)
-      
-      //print out
-      target_candidates->setFilePath(ms2_file);
-      decoy_candidates->setFilePath(ms2_file);
-      vector<MatchCollection*> decoy_vec;
-    
-      if (Params::GetBool("concat")) {
-	for (size_t idx=0;idx < decoy_candidates->getMatchTotal();idx++) {
-	  target_candidates->add(decoy_candidates->at(idx), true);
-	}
-      } else {
-	
-	decoy_vec.push_back(decoy_candidates);
+    if (!shared.weibull_fits.empty()) {
+      carp(CARP_INFO, "Fit %d shared Weibull distributions.",
+           shared.weibull_fits.size());
+    }
+    for (map<pair<int, int>, XLinkWeibullFit*>::iterator iter = shared.weibull_fits.begin();
+         iter != shared.weibull_fits.end(); ++iter) {
+      delete iter->second;
+    }
+    for (size_t idx = 0; idx < shared.free_arenas.size(); idx++) {
+      delete shared.free_arenas[idx];
+    }
 
-	if (decoy_candidates->getScoredType(SP) == true) {
-	  decoy_candidates->populateMatchRank(SP);
-	}
-	decoy_candidates->populateMatchRank(XCORR);
-	decoy_candidates->sort(XCORR);
-      }
-      
-      carp(CARP_DEBUG, "Ranking.");
-      
-      if (target_candidates->getScoredType(SP) == true) {
-	target_candidates->populateMatchRank(SP);
-      }
-      target_candidates->populateMatchRank(XCORR);
-      target_candidates->sort(XCORR);
-      
-    
-      carp(CARP_DEBUG, "Writing results.");
-      output_files.writeMatches(
-				(MatchCollection*)target_candidates, 
-				decoy_vec,
-				XCORR,
-				spectrum);
-
-      /* Clean up */
-      carp(CARP_DEBUG, "Deleting decoy candidates.");
-      delete decoy_candidates;
-      carp(CARP_DEBUG, "Deleting target candidates.");
-      delete target_candidates;
-      XLink::deleteAllocatedPeptides();
-    
-      //free_spectrum(spectrum);
-      
-      carp(CARP_DEBUG, "Done with spectrum %d.", scan_num);
-      carp(CARP_DEBUG, "=====================================");
-    } // get next spectrum
+    int skipped_no_candidates = shared.skipped_no_candidates;
 
     carp(CARP_INFO, "Skipped %d (%g%%) spectra with 0 candidates.", 
 	 skipped_no_candidates, skipped_no_candidates / num_spectra * 100);
@@ -353,6 +779,7 @@ int SearchForXLinks::xlinkSearchMain() {
     delete spectra;
     XLink::deleteAllocatedPeptides();
   }
+  delete comparison_writer;
   for(int mod_idx = 0; mod_idx < num_peptide_mods; mod_idx++) {
     free_peptide_mod(peptide_mods[mod_idx]);
   }
@@ -22,6 +22,7 @@
 #endif
 
 #include <stack>
+#include <boost/thread/tss.hpp>
 
 using namespace Crux;
 using namespace std;
@@ -74,7 +75,20 @@ class IonCache {
 };
 
 
-IonCache ion_cache_;
+/**
+ * Freed ions are recycled within a thread; an ion freed by another thread
+ * just joins that thread's cache.
+ */
+static boost::thread_specific_ptr<IonCache> ion_caches;
+
+static IonCache& ion_cache() {
+  IonCache* cache = ion_caches.get();
+  if (cache == NULL) {
+    cache = new IonCache();
+    ion_caches.reset(cache);
+  }
+  return *cache;
+}
 
 
 // At one point I need to reverse the endianness for pfile_create to work
@@ -302,12 +316,12 @@ void Ion::freeIon(
   ion->pointer_count_--;
 
   if (ion->pointer_count_ <= 0) {
-    ion_cache_.checkin(ion);//delete ion;
+    ion_cache().checkin(ion);//delete ion;
   }
 }
 
 Ion* Ion::newIon() {
-  Ion* ion = ion_cache_.checkout();
+  Ion* ion = ion_cache().checkout();
   ion->init();
   return(ion);
 }
@@ -968,12 +968,6 @@ FLOAT_T Scorer::scoreIntensityIonSeries(
   FLOAT_T ans = 0.0;
   
   Ion* ion = NULL;
-  int intensity_array_idx = 0;
-  int ion_charge = 0;
-  ION_TYPE_T ion_type;
-  FLOAT_T ion_mass_z = 0;
-  FLOAT_T bin_width = bin_width_;
-  FLOAT_T bin_offset = bin_offset_;
   int max_bin = getMaxBin();
   FLOAT_T B_Y_sum = 0.0;
   FLOAT_T FLANK_sum = 0.0;
@@ -989,58 +983,117 @@ FLOAT_T Scorer::scoreIntensityIonSeries(
     
     ion = *ion_iterator;
     
-    ion_mass_z = ion->getMassZ();
-    intensity_array_idx 
-      = INTEGERIZE(ion_mass_z, bin_width, bin_offset);
-
-    // skip ions that are located beyond max mz limit
-    if(intensity_array_idx >= max_bin){
-      continue;
+    if (!addIonIntensities(ion->getType(), ion->getCharge(), ion->getMassZ(),
+                           max_bin, B_Y_sum, FLANK_sum, LOSS_sum)) {
+      // ERROR!, only should create B, Y, A type ions for xcorr theoreical 
+      carp(CARP_ERROR, "only should create B, Y, A type ions for xcorr theoretical spectrum");
+      return 0;
     }
-    ion_type = ion->getType();
-
-    // is it B, Y ion?
-    if(ion_type == B_ION || 
-       ion_type == Y_ION){
-
-      //      if (!ion->isModified()){
-      // Add peaks of intensity 50.0 for B, Y type ions. 
-      // In addition, add peaks of intensity of 25.0 to +/- 1 m/z flanking each B, Y ion if requested.
-      // Skip ions that are located beyond max mz limit
-      B_Y_sum += observed_[intensity_array_idx];
-      if (use_flanks_) {
-        FLANK_sum += observed_[intensity_array_idx-1];
-        if ((intensity_array_idx + 1) < max_bin) {
-          FLANK_sum += observed_[intensity_array_idx+1];
-	      }
-      }
-        
-      // add neutral loss of water and NH3
-      ion_charge = ion->getCharge();
-      if(ion_type == B_ION){
-        int h2o_array_idx = 
-          INTEGERIZE((ion_mass_z - (MASS_H2O_MONO/ion_charge)),
-                       bin_width, bin_offset);  
-        LOSS_sum += observed_[h2o_array_idx];
+  }
+
+  ans = B_Y_sum * B_Y_HEIGHT + FLANK_sum * FLANK_HEIGHT + LOSS_sum * LOSS_HEIGHT;
+  return ans / 10000.0;
+}
+
+/**
+ * Adds the observed intensities at the peaks of one ion to the XCorr
+ * sums of b/y, flanking and neutral loss peaks.
+ * \returns false if the ion is of a type that XCorr does not score
+ */
+bool Scorer::addIonIntensities(
+  ION_TYPE_T ion_type, ///< type of the ion -in
+  int ion_charge, ///< charge of the ion -in
+  FLOAT_T ion_mass_z, ///< m/z of the ion -in
+  int max_bin, ///< bins of the observed array -in
+  FLOAT_T& B_Y_sum, ///< sum of b/y ion peaks -in/out
+  FLOAT_T& FLANK_sum, ///< sum of flanking peaks -in/out
+  FLOAT_T& LOSS_sum ///< sum of neutral loss and a ion peaks -in/out
+  ) {
+
+  FLOAT_T bin_width = bin_width_;
+  FLOAT_T bin_offset = bin_offset_;
+  int intensity_array_idx 
+    = INTEGERIZE(ion_mass_z, bin_width, bin_offset);
+
+  // skip ions that are located beyond max mz limit
+  if(intensity_array_idx >= max_bin){
+    return true;
+  }
+
+  // is it B, Y ion?
+  if(ion_type == B_ION || 
+     ion_type == Y_ION){
+
+    //      if (!ion->isModified()){
+    // Add peaks of intensity 50.0 for B, Y type ions. 
+    // In addition, add peaks of intensity of 25.0 to +/- 1 m/z flanking each B, Y ion if requested.
+    // Skip ions that are located beyond max mz limit
+    B_Y_sum += observed_[intensity_array_idx];
+    if (use_flanks_) {
+      FLANK_sum += observed_[intensity_array_idx-1];
+      if ((intensity_array_idx + 1) < max_bin) {
+        FLANK_sum += observed_[intensity_array_idx+1];
       }
+    }
+      
+    // add neutral loss of water and NH3
+    if(ion_type == B_ION){
+      int h2o_array_idx = 
+        INTEGERIZE((ion_mass_z - (MASS_H2O_MONO/ion_charge)),
+                     bin_width, bin_offset);  
+      LOSS_sum += observed_[h2o_array_idx];
+    }
+
+    int nh3_array_idx 
+      = INTEGERIZE((ion_mass_z -  (MASS_NH3_MONO/ion_charge)),
+                     bin_width, bin_offset);
+    LOSS_sum += observed_[nh3_array_idx];
+
+  }// is it A ion?
+  else if(ion_type == A_ION){
+    // Add peaks of intensity 10.0 for A type ions.
+    LOSS_sum += observed_[intensity_array_idx];
+  }
+  else{
+    return false;
+  }
+  return true;
+}
 
-      int nh3_array_idx 
-        = INTEGERIZE((ion_mass_z -  (MASS_NH3_MONO/ion_charge)),
-                       bin_width, bin_offset);
-      LOSS_sum += observed_[nh3_array_idx];
+/**
+ * Computes the XCorr of a spectrum vs. ions that are not held in an
+ * IonSeries. Gives the same score as scoreSpectrumVIonSeries does for an
+ * IonSeries of charge charge with the same ions in the same order.
+ */
+FLOAT_T Scorer::scoreXCorrIons(
+  Spectrum* spectrum, ///< the spectrum to score -in
+  int charge, ///< the charge to preprocess the spectrum for -in
+  const vector<XCorrIon>& ions ///< the ions to score -in
+  ) {
 
-    }// is it A ion?
-    else if(ion_type == A_ION){
-      // Add peaks of intensity 10.0 for A type ions.
-      LOSS_sum += observed_[intensity_array_idx];
+  // preprocess the observed spectrum in scorer
+  if(!initialized_){
+    if(!createIntensityArrayXcorr(spectrum, charge)){
+      carp(CARP_FATAL, "failed to produce XCORR");
     }
-    else{// ERROR!, only should create B, Y, A type ions for xcorr theoreical 
+  }
+
+  int max_bin = getMaxBin();
+  FLOAT_T B_Y_sum = 0.0;
+  FLOAT_T FLANK_sum = 0.0;
+  FLOAT_T LOSS_sum = 0.0;
+
+  for (vector<XCorrIon>::const_iterator ion = ions.begin();
+       ion != ions.end();
+       ++ion) {
+    if (!addIonIntensities(ion->type, ion->charge, ion->mass_z,
+                           max_bin, B_Y_sum, FLANK_sum, LOSS_sum)) {
       carp(CARP_ERROR, "only should create B, Y, A type ions for xcorr theoretical spectrum");
       return 0;
     }
   }
 
-  ans = B_Y_sum * B_Y_HEIGHT + FLANK_sum * FLANK_HEIGHT + LOSS_sum * LOSS_HEIGHT;
+  FLOAT_T ans = B_Y_sum * B_Y_HEIGHT + FLANK_sum * FLANK_HEIGHT + LOSS_sum * LOSS_HEIGHT;
   return ans / 10000.0;
 }
 
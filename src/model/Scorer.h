@@ -32,6 +32,17 @@
 #define INTEGERIZE(VALUE,BIN_SIZE,BIN_OFFSET) \
   ((int)( ( ( VALUE / BIN_SIZE ) + 1.0 ) - BIN_OFFSET ) )
 
+/**
+ * \struct XCorrIon
+ * \brief A fragment ion as scored for XCorr, for scoring ions that are not
+ * held in an IonSeries (see Scorer::scoreXCorrIons).
+ */
+struct XCorrIon {
+  ION_TYPE_T type; ///< A_ION, B_ION or Y_ION
+  int charge; ///< charge of the ion
+  FLOAT_T mass_z; ///< m/z of the ion
+};
+
 class Scorer {
 
  protected:
@@ -163,6 +174,21 @@ class Scorer {
     IonSeries* ion_series
   );
 
+  /**
+   * Adds the observed intensities at the peaks of one ion to the XCorr
+   * sums of b/y, flanking and neutral loss peaks.
+   * \returns false if the ion is of a type that XCorr does not score
+   */
+  bool addIonIntensities(
+    ION_TYPE_T ion_type, ///< type of the ion -in
+    int ion_charge, ///< charge of the ion -in
+    FLOAT_T ion_mass_z, ///< m/z of the ion -in
+    int max_bin, ///< bins of the observed array -in
+    FLOAT_T& B_Y_sum, ///< sum of b/y ion peaks -in/out
+    FLOAT_T& FLANK_sum, ///< sum of flanking peaks -in/out
+    FLOAT_T& LOSS_sum ///< sum of neutral loss and a ion peaks -in/out
+  );
+
   /*****************************************************
    * General purpose functions
    * 
@@ -209,6 +235,17 @@ class Scorer {
     IonSeries* ion_series ///< the ion series to score against the spectrum -in
   );
 
+  /**
+   * Computes the XCorr of a spectrum vs. ions that are not held in an
+   * IonSeries. Gives the same score as scoreSpectrumVIonSeries does for an
+   * IonSeries of charge charge with the same ions in the same order.
+   */
+  FLOAT_T scoreXCorrIons(
+    Crux::Spectrum* spectrum, ///< the spectrum to score -in
+    int charge, ///< the charge to preprocess the spectrum for -in
+    const std::vector<XCorrIon>& ions ///< the ions to score -in
+  );
+
   /**
    * Frees the single_ion_constraints array
    */
@@ -89,3 +89,7 @@ void FileUtils::Copy(const std::string& orig, const std::string& dest) {
   }
 }
 
+string FileUtils::UniquePath(const string& model) {
+  return boost::filesystem::unique_path(model).string();
+}
+
@@ -20,6 +20,8 @@ class FileUtils {
   static std::string Stem(const std::string& path);
   static std::string Extension(const std::string& path);
   static void Copy(const std::string& orig, const std::string& dest);
+  // Replaces each '%' in model with a random hex digit.
+  static std::string UniquePath(const std::string& model);
  private:
   FileUtils();
   ~FileUtils();
@@ -293,6 +293,15 @@ Params::Params() : finalized_(false) {
     "then a second file will be created containing the decoy peptides. Decoys that also "
     "appear in the target database are marked with an asterisk in a third column.",
     "Available for tide-index.", true);
+  InitBoolParam("peptide-table", false,
+    "Also write the peptides to a fixed-layout table in the index, which tide-search "
+    "memory-maps in place of reading the peptide records. The table lets tide-search go "
+    "directly to the candidate peptides of each spectrum.",
+    "Available for tide-index.", true);
+  InitBoolParam("fragment-index", false,
+    "Also write an index from fragment ion m/z to peptides, which tide-search uses to "
+    "preselect candidates when fragment-index-top-n is set.",
+    "Available for tide-index.", true);
   InitIntParam("modsoutputter-threshold", 1000, 0, BILLION,
     "Maximum number of temporary files that would be opened by ModsOutputter "
     "before switching to ModsOutputterAlt.",
@@ -401,6 +410,13 @@ Params::Params() : finalized_(false) {
     "The name of the directory where temporary files will be created. If this "
     "parameter is blank, then the system temporary directory will be used",
     "Available for tide-index.", true);
+  InitIntParam("memory-limit", 0, 0, BILLION,
+    "Approximate amount of memory, in megabytes, used to hold the generated peptides "
+    "while they are sorted by mass. Whenever this limit is reached, the peptides are "
+    "written as a sorted run to temp-dir, and the runs are merged once all peptides "
+    "have been generated. The same limit applies to the fragment index lists written "
+    "with fragment-index, which are spilled to temp-dir in blocks. 0 means no limit.",
+    "Available for tide-index.", true);
   // coder options regarding decoys
   InitIntParam("num-decoy-files", 1, 0, 10,
     "Replaces number-decoy-set.  Determined by decoy-location"
@@ -801,6 +817,36 @@ Params::Params() : finalized_(false) {
     "the current working directory, not the Crux output directory (as specified by "
     "--output-dir). This option is not valid if multiple input spectrum files are given.",
     "Available for tide-search", true);
+  InitStringParam("spectrum-cache-dir", "",
+    "Directory in which to keep the binarized fragmentation spectra converted from "
+    "each input spectrum file, so that later runs on the same file reuse them instead "
+    "of converting again. Each cached file is named after a hash of the input file's "
+    "contents and of the parameters that affect conversion, so changed inputs are "
+    "converted anew. The directory may be shared by concurrent runs and is created if "
+    "it does not exist. Unlike store-spectra, this option may be used with multiple "
+    "input spectrum files.",
+    "Available for tide-search", true);
+  InitBoolParam("deterministic-output", false,
+    "Write the tab-delimited results of a multithreaded search in the same order "
+    "as a single-threaded search would, rather than in the order in which the threads "
+    "finish. The results of each thread are held in a temporary file in the output "
+    "directory until the search is done.",
+    "Available for tide-search.", true);
+  InitBoolParam("search-stats", false,
+    "Record how long each stage of the search takes (spectrum preprocessing, "
+    "updating the window of candidate peptides, compiling peptides, scoring, "
+    "p-values, Sp and reporting) in each thread, together with the sizes of the "
+    "candidate window, memory page reuse and time spent waiting on locks, and write "
+    "them to the file tide-search.stats.json in the output directory.",
+    "Available for tide-search.", true);
+  InitBoolParam("pipeline-spectra", false,
+    "When searching multiple spectrum files, convert and read each file in the "
+    "background while the previous one is being searched, rather than converting all "
+    "of them before the first search begins. The results are unchanged, but the "
+    "spectra of two files are held in memory at once. Has no effect when only one "
+    "spectrum file is given, because there is no later file to prepare during the "
+    "search.",
+    "Available for tide-search with more than one spectrum file", true);
   InitBoolParam("exact-p-value", false,
     "Enable the calculation of exact p-values for the XCorr score[[html: as described in "
     "<a href=\"http://www.ncbi.nlm.nih.gov/pubmed/24895379\">this article</a>]]. Calculation "
@@ -882,6 +928,26 @@ Params::Params() : finalized_(false) {
     "'residue-evidence' is designed to score high-resolution MS2 spectra; and 'both' calculates "
     "both scores. The latter requires that exact-p-value=T.",
     "Available for tide-search.", true);
+  InitStringParam("xcorr-scoring", "auto", "auto|compiled|portable|sparse",
+    "How XCorr scores are computed when exact-p-value=F. 'compiled' generates x86 machine code "
+    "for each candidate peptide; 'portable' scores from a plain list of peak positions and "
+    "works on any processor; 'sparse' is like 'portable', but keeps only the nonzero bins of "
+    "each processed spectrum, which saves time and memory when mz-bin-width is small. 'auto' "
+    "uses 'sparse' if mz-bin-width is at most 0.1 and 'compiled' otherwise. All give identical "
+    "scores.",
+    "Available for tide-search.", true);
+  InitIntParam("spectrum-batch-size", 1, 1, 64,
+    "Number of consecutive spectra that are scored together in one pass over the theoretical "
+    "peaks of their candidate peptides. Values greater than 1 require xcorr-scoring=portable "
+    "and do not change the results.",
+    "Available for tide-search.", true);
+  InitIntParam("fragment-index-top-n", 0, 0, BILLION,
+    "If greater than 0, only this many of the candidate peptides of each spectrum are scored "
+    "with XCorr: those that share the most fragment peaks with the spectrum. This makes "
+    "searches with wide precursor windows, such as open modification searches, much faster, "
+    "but the best-scoring peptide may be missed. Requires an index built with "
+    "fragment-index=T and does not apply to exact-p-value or peptide-centric searches.",
+    "Available for tide-search.", true);
   InitDoubleParam("fragment-tolerance", .02, 0, 2,
     "Mass tolerance (in Da) for scoring pairs of peaks when creating the residue evidence matrix. "
     "This parameter only makes sense when score-function is 'residue-evidence' or 'both'.",
@@ -899,7 +965,9 @@ Params::Params() : finalized_(false) {
                   "Available for tide-search", true);
   InitIntParam("num-threads", 0, 0, 64,
                "0=poll CPU to set num threads; else specify num threads directly.",
-               "Available for tide-search tab-delimited files only.", true);
+               "Available for tide-index, for tide-search tab-delimited files only, and for "
+               "search-for-xlinks. For search-for-xlinks, this option is only available when "
+               "use-old-xlink=F.", true);
   /*
    * Comet parameters
    */
@@ -1537,6 +1605,18 @@ Params::Params() : finalized_(false) {
     "Keep shuffling and collecting XCorr scores until the minimum number of points for "
     "weibull fitting (using targets and decoys) is achieved.",
     "Available for crux search-for-xlinks", true);
+  InitDoubleParam("weibull-bin-width", 0, 0, 1e6,
+    "Share one Weibull fit among the spectra of the same charge whose precursor masses "
+    "fall in the same bin of this width (in Da). The fit is made from the training "
+    "candidates of the first such spectrum, and the others are searched without training "
+    "candidates. If that fit fails, the others are fitted separately, each from its "
+    "target training candidates and its decoys. 0 fits every spectrum-charge separately.",
+    "Available for crux search-for-xlinks when compute-p-values=T.", true);
+  InitBoolParam("write-weibull-comparison", false,
+    "When weibull-bin-width is set, fit every spectrum-charge separately as well, and "
+    "write the p-values of its top-match targets from both fits to "
+    "search-for-xlinks.weibull-comparison.txt.",
+    "Available for crux search-for-xlinks when compute-p-values=T.", true);
   InitArgParam("link sites",
     "Specification of the the two sets of amino acids that the cross-linker can "
     "connect. These are specified as two comma-separated sets of amino acids, "
@@ -1991,7 +2071,12 @@ void Params::Categorize() {
   items.insert("spectrum-min-mz");
   items.insert("use-flanking-peaks");
   items.insert("use-neutral-loss-peaks");
+  items.insert("weibull-bin-width");
+  items.insert("write-weibull-comparison");
   items.insert("score-function");
+  items.insert("xcorr-scoring");
+  items.insert("spectrum-batch-size");
+  items.insert("fragment-index-top-n");
   items.insert("fragment-tolerance");
   items.insert("evidence-granularity");
   AddCategory("Search parameters", items);
@@ -2196,6 +2281,8 @@ void Params::Categorize() {
   items.insert("overwrite");
   items.insert("parameter-file");
   items.insert("peptide-list");
+  items.insert("fragment-index");
+  items.insert("peptide-table");
   items.insert("pepxml-output");
   items.insert("pin-output");
   items.insert("pout-output");
@@ -2204,12 +2291,17 @@ void Params::Categorize() {
   items.insert("print_expect_score");
   items.insert("sample_enzyme_number");
   items.insert("show_fragment_ions");
+  items.insert("deterministic-output");
+  items.insert("search-stats");
+  items.insert("pipeline-spectra");
+  items.insert("spectrum-cache-dir");
   items.insert("spectrum-format");
   items.insert("spectrum-parser");
   items.insert("sqt-output");
   items.insert("store-index");
   items.insert("store-spectra");
   items.insert("temp-dir");
+  items.insert("memory-limit");
   items.insert("top-match");
   items.insert("txt-output");
   items.insert("use-z-line");
@@ -26,6 +26,7 @@
 #include "Params.h"
 #include <stack>
 #include <iostream>
+#include <boost/thread/tss.hpp>
 
 using namespace std;
 
@@ -83,14 +84,27 @@ class MODIFIED_AA_T_Cache {
   
 };
 
-MODIFIED_AA_T_Cache modified_aa_cache; ///< The cache of modified sequences
+/**
+ * Modified sequences are recycled within a thread; a sequence freed by
+ * another thread just joins that thread's cache.
+ */
+static boost::thread_specific_ptr<MODIFIED_AA_T_Cache> modified_aa_caches;
+
+static MODIFIED_AA_T_Cache& modified_aa_cache() {
+  MODIFIED_AA_T_Cache* cache = modified_aa_caches.get();
+  if (cache == NULL) {
+    cache = new MODIFIED_AA_T_Cache();
+    modified_aa_caches.reset(cache);
+  }
+  return *cache;
+}
 
 /**
  * \return a new modification sequence array. Can be off of already allocated
  * arrays
  */
 MODIFIED_AA_T* newModSeq() {
-  MODIFIED_AA_T* ans = modified_aa_cache.checkout();
+  MODIFIED_AA_T* ans = modified_aa_cache().checkout();
   return(ans);
 }
 
@@ -100,7 +114,7 @@ MODIFIED_AA_T* newModSeq() {
 void freeModSeq(
   MODIFIED_AA_T* &seq  ///< sequence to release
   ) {
-  modified_aa_cache.checkin(seq);
+  modified_aa_cache().checkin(seq);
   seq=NULL;
 }
 
@@ -0,0 +1,226 @@
+#include <cppunit/config/SourcePrefix.h>
+#include "TestObservedPeakSet.h"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "app/tide/spectrum_collection.h"
+#include "app/tide/spectrum_preprocess.h"
+#include "app/tide/max_mz.h"
+
+using namespace std;
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestObservedPeakSet );
+
+// Declared a friend by ObservedPeakSet.
+class ObservedPeakTester {
+ public:
+  static const int* Cache(const ObservedPeakSet& observed) {
+    return observed.cache_;
+  }
+};
+
+static const double MONO_H2O = 18.010564684;
+static const double MONO_NH3 = 17.026549101;
+
+void TestObservedPeakSet::setUp(){
+  saved_bin_width_ = MassConstants::bin_width_;
+  saved_bin_offset_ = MassConstants::bin_offset_;
+  saved_bin_h2o_ = MassConstants::BIN_H2O;
+  saved_bin_nh3_ = MassConstants::BIN_NH3;
+}
+
+void TestObservedPeakSet::tearDown(){
+  MassConstants::bin_width_ = saved_bin_width_;
+  MassConstants::bin_offset_ = saved_bin_offset_;
+  MassConstants::BIN_H2O = saved_bin_h2o_;
+  MassConstants::BIN_NH3 = saved_bin_nh3_;
+}
+
+static int roundToInt(double x) {
+  if (x >= 0)
+    return int(x + 0.5);
+  return int(x - 0.5);
+}
+
+void TestObservedPeakSet::referenceCache(const Spectrum& spectrum, int charge,
+                                         const SearchConfig& config,
+                                         bool NL, bool FP, vector<int>* cache) {
+  double precursor_mz = spectrum.PrecursorMZ();
+  double experimental_mass_cut_off = (precursor_mz-MASS_PROTON)*charge+MASS_PROTON + 50;
+  double max_peak_mz = spectrum.M_Z(spectrum.Size()-1);
+
+  MaxBin max_mz;
+  max_mz.InitBin(min(experimental_mass_cut_off, max_peak_mz));
+  vector<double> peaks(MaxBin::Global().BackgroundBinEnd(), 0);
+  cache->assign(MaxBin::Global().CacheBinEnd() * NUM_PEAK_TYPES, 0);
+
+  int largest_mz = 0;
+  double highest_intensity = 0;
+  for (int i = spectrum.Size() - 1; i >= 0; --i) {
+    double peak_location = spectrum.M_Z(i);
+    if (peak_location >= experimental_mass_cut_off) {
+      continue;
+    }
+    if (config.remove_precursor_peak &&
+        fabs(peak_location - precursor_mz) <= config.remove_precursor_tolerance) {
+      continue;
+    }
+    int mz = MassConstants::mass2bin(peak_location);
+    double intensity = spectrum.Intensity(i);
+    if ((mz > largest_mz) && (intensity > 0)) {
+      largest_mz = mz;
+    }
+    intensity = sqrt(intensity);
+    if (intensity > highest_intensity) {
+      highest_intensity = intensity;
+    }
+    if (intensity > peaks[mz]) {
+      peaks[mz] = intensity;
+    }
+  }
+
+  double intensity_cutoff = highest_intensity * 0.05;
+  int region_size = largest_mz / NUM_SPECTRUM_REGIONS + 1;
+  for (int i = 0; i < NUM_SPECTRUM_REGIONS; ++i) {
+    highest_intensity = 0;
+    for (int j = 0; j < region_size; ++j) {
+      int index = i * region_size + j;
+      if (peaks[index] <= intensity_cutoff) {
+        peaks[index] = 0;
+      }
+      if (peaks[index] > highest_intensity) {
+        highest_intensity = peaks[index];
+      }
+    }
+    if (highest_intensity == 0) {
+      continue;
+    }
+    double normalizer = 50.0 / highest_intensity;
+    for (int j = 0; j < region_size; ++j) {
+      peaks[i * region_size + j] *= normalizer;
+    }
+  }
+
+  // Background subtraction, with the partial sums allocated for the call
+  int end = max_mz.BackgroundBinEnd();
+  double multiplier = 1.0 / (MAX_XCORR_OFFSET * 2);
+  double total = 0;
+  vector<double> partial_sums(end+1);
+  for (int i = 0; i < end; ++i)
+    partial_sums[i] = (total += peaks[i]);
+  partial_sums[end] = total;
+  for (int i = 0; i < end; ++i) {
+    int right_index = min(end, i + MAX_XCORR_OFFSET);
+    int left_index = max(0, i - MAX_XCORR_OFFSET - 1);
+    peaks[i] -= multiplier * (partial_sums[right_index] - partial_sums[left_index] - peaks[i]);
+  }
+
+  // Integer and multiplied peaks, then the combined peaks
+  vector<int>& c = *cache;
+  for (int i = 0; i < end; i++) {
+    int x = roundToInt(peaks[i]*50000);
+    c[i * NUM_PEAK_TYPES + PeakMain] = x;
+    c[i * NUM_PEAK_TYPES + LossPeak] = x+x;
+    c[i * NUM_PEAK_TYPES + FlankingPeak] = 5*x;
+    c[i * NUM_PEAK_TYPES + PrimaryPeak] = 10*x;
+  }
+  for (int i = 0; i < max_mz.CacheBinEnd(); ++i) {
+    int flanks = c[i * NUM_PEAK_TYPES + PrimaryPeak];
+    if (FP) {
+      if (i > 0) {
+        flanks += c[(i-1) * NUM_PEAK_TYPES + FlankingPeak];
+      }
+      if (i < max_mz.CacheBinEnd() - 1) {
+        flanks += c[(i+1) * NUM_PEAK_TYPES + FlankingPeak];
+      }
+    }
+    int Y1 = flanks;
+    if (NL) {
+      if (i > MassConstants::BIN_NH3) {
+        Y1 += c[(i-(int)MassConstants::BIN_NH3) * NUM_PEAK_TYPES + LossPeak];
+      }
+      if (i > MassConstants::BIN_H2O) {
+        Y1 += c[(i-(int)MassConstants::BIN_H2O) * NUM_PEAK_TYPES + LossPeak];
+      }
+    }
+    c[i * NUM_PEAK_TYPES + PeakCombinedY1] = Y1;
+    c[i * NUM_PEAK_TYPES + PeakCombinedB1] = Y1;
+    c[i * NUM_PEAK_TYPES + PeakCombinedY2] = flanks;
+    c[i * NUM_PEAK_TYPES + PeakCombinedB2] = flanks;
+  }
+}
+
+void TestObservedPeakSet::checkBinWidth(double bin_width, double bin_offset) {
+  MassConstants::bin_width_ = bin_width;
+  MassConstants::bin_offset_ = bin_offset;
+  MassConstants::BIN_H2O = MassConstants::mass2bin(MONO_H2O, 1);
+  MassConstants::BIN_NH3 = MassConstants::mass2bin(MONO_NH3, 1);
+
+  // Long and short spectra in turn, so that each spectrum leaves cache
+  // entries beyond the end of the next one.
+  srand(7);
+  const double max_mzs[] = { 1800, 400, 1200, 250, 1990, 700 };
+  const int num_spectra = sizeof(max_mzs) / sizeof(max_mzs[0]);
+  vector<Spectrum*> spectra;
+  vector<int> charges;
+  for (int i = 0; i < num_spectra; ++i) {
+    int charge = 2 + i % 2;
+    double precursor_mz = max_mzs[i] * 0.8 / (charge - 1);
+    Spectrum* spectrum = new Spectrum(i + 1, precursor_mz);
+    spectrum->AddChargeState(charge);
+    vector< pair<double, double> > peaks;
+    double mz = 100;
+    while (mz < max_mzs[i]) {
+      peaks.push_back(make_pair(mz, (double)(1 + rand() % 10000)));
+      mz += 0.01 + (rand() % 300) / 100.0;
+    }
+    // A tall peak at the precursor, for remove-precursor
+    peaks.push_back(make_pair(precursor_mz, 50000.0));
+    sort(peaks.begin(), peaks.end());
+    for (size_t j = 0; j < peaks.size(); ++j) {
+      spectrum->AddPeak(peaks[j].first, peaks[j].second);
+    }
+    spectra.push_back(spectrum);
+    charges.push_back(charge);
+  }
+  MaxBin::SetGlobalMax(2000);
+
+  SearchConfig config;
+  config.skip_preprocessing = false;
+  config.deisotope = 0;
+  config.xcorr_scoring = SearchConfig::XCORR_PORTABLE;
+  config.remove_precursor_tolerance = 1.5;
+  int entries = MaxBin::Global().CacheBinEnd() * NUM_PEAK_TYPES;
+
+  for (int flags = 0; flags < 8; ++flags) {
+    bool NL = (flags & 1) != 0;
+    bool FP = (flags & 2) != 0;
+    config.remove_precursor_peak = (flags & 4) != 0;
+    ObservedPeakSet observed(bin_width, bin_offset, NL, FP, &config);
+    for (int i = 0; i < num_spectra; ++i) {
+      observed.PreprocessSpectrum(*spectra[i], charges[i]);
+      vector<int> expected;
+      referenceCache(*spectra[i], charges[i], config, NL, FP, &expected);
+      const int* cache = ObservedPeakTester::Cache(observed);
+      for (int code = 0; code < entries; ++code) {
+        // The 'b' charge 2 types are not computed.
+        if (code % NUM_PEAK_TYPES > PeakCombinedY2) {
+          continue;
+        }
+        CPPUNIT_ASSERT_EQUAL(expected[code], cache[code]);
+      }
+    }
+  }
+
+  for (int i = 0; i < num_spectra; ++i) {
+    delete spectra[i];
+  }
+}
+
+void TestObservedPeakSet::unitBins(){
+  checkBinWidth(1.0005079, 0.40);
+}
+
+void TestObservedPeakSet::narrowBins(){
+  checkBinWidth(0.02, 0.0);
+}
@@ -0,0 +1,47 @@
+#ifndef CPP_UNIT_TESTOBSERVEDPEAKSET_H
+#define CPP_UNIT_TESTOBSERVEDPEAKSET_H
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+
+class Spectrum;
+struct SearchConfig;
+
+/**
+ * Checks the cache that ObservedPeakSet::PreprocessSpectrum computes against
+ * the straightforward version it replaced, which cleared and recomputed the
+ * whole cache for every spectrum.
+ */
+class TestObservedPeakSet : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( TestObservedPeakSet );
+  CPPUNIT_TEST( unitBins );
+  CPPUNIT_TEST( narrowBins );
+  CPPUNIT_TEST_SUITE_END();
+
+ public:
+  void setUp();
+  void tearDown();
+
+ protected:
+  void unitBins();
+  void narrowBins();
+
+  // Preprocesses a series of spectra of varying length with one peak set,
+  // for each combination of flanking peaks, neutral losses and
+  // remove-precursor, and compares every cache entry with the reference.
+  void checkBinWidth(double bin_width, double bin_offset);
+
+  // The cache as computed before ComputeCache() and SubtractBackground()
+  // were reworked.
+  static void referenceCache(const Spectrum& spectrum, int charge,
+                             const SearchConfig& config, bool NL, bool FP,
+                             std::vector<int>* cache);
+
+  double saved_bin_width_;
+  double saved_bin_offset_;
+  double saved_bin_h2o_;
+  double saved_bin_nh3_;
+};
+
+#endif //CPP_UNIT_TESTOBSERVEDPEAKSET_H
@@ -0,0 +1,88 @@
+#include <cppunit/config/SourcePrefix.h>
+#include "TestXLinkablePeptide.h"
+#include <stdlib.h>
+#include <vector>
+#include "app/xlink/XLinkablePeptide.h"
+#include "app/xlink/XLinkScorer.h"
+#include "model/Peptide.h"
+#include "util/GlobalParams.h"
+
+using namespace std;
+using namespace Crux;
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TestXLinkablePeptide );
+
+// DSS cross-link and dead-end (hydrolyzed) masses
+static const FLOAT_T LINK_MASS = 138.0680796;
+static const FLOAT_T DEAD_END_MASS = 156.0786442;
+
+static const char* PEPTIDE1 = "GDKAELMTSKWPR";
+static const char* PEPTIDE2 = "VLSEKFQGHK";
+
+void TestXLinkablePeptide::setUp(){
+  GlobalParams::set();
+
+  // Peaks all over the m/z range of the ions, so that many of them score
+  vector<int> charges;
+  charges.push_back(3);
+  spectrum_ = new Spectrum(1, 1, 900.0, charges, "");
+  srand(11);
+  for (int i = 0; i < 600; i++) {
+    FLOAT_T mz = 100.0 + (FLOAT_T)rand() / RAND_MAX * 2500.0;
+    spectrum_->addPeak((FLOAT_T)(1 + rand() % 1000), mz);
+  }
+  spectrum_->sortPeaks(_PEAK_LOCATION);
+}
+
+void TestXLinkablePeptide::tearDown(){
+  delete spectrum_;
+}
+
+void TestXLinkablePeptide::checkXCorr(const string& sequence, FLOAT_T mod_mass){
+  Peptide peptide(sequence);
+  vector<int> link_sites;
+  for (size_t idx = 0; idx < sequence.length(); idx++) {
+    if (sequence[idx] == 'K') {
+      link_sites.push_back(idx);
+    }
+  }
+  XLinkablePeptide xlpeptide(&peptide, link_sites);
+  vector<FLOAT_T> fragment_masses;
+  xlpeptide.computeFragmentMasses(fragment_masses);
+  CPPUNIT_ASSERT_EQUAL(sequence.length(), fragment_masses.size());
+
+  for (int charge = 1; charge <= 3; charge++) {
+    XLinkScorer scorer(spectrum_, charge);
+    for (size_t link_idx = 0; link_idx < link_sites.size(); link_idx++) {
+      xlpeptide.setFragmentMasses(NULL);
+      FLOAT_T ion_series_xcorr =
+        scorer.scoreXLinkablePeptide(xlpeptide, link_idx, mod_mass);
+      xlpeptide.setFragmentMasses(&fragment_masses);
+      FLOAT_T fragment_xcorr =
+        scorer.scoreXLinkablePeptide(xlpeptide, link_idx, mod_mass);
+      CPPUNIT_ASSERT(ion_series_xcorr != 0);
+      CPPUNIT_ASSERT_EQUAL(ion_series_xcorr, fragment_xcorr);
+    }
+  }
+}
+
+void TestXLinkablePeptide::linearXCorr(){
+  checkXCorr(PEPTIDE1, 0);
+  checkXCorr(PEPTIDE2, 0);
+}
+
+void TestXLinkablePeptide::deadEndXCorr(){
+  checkXCorr(PEPTIDE1, DEAD_END_MASS);
+  checkXCorr(PEPTIDE2, DEAD_END_MASS);
+}
+
+void TestXLinkablePeptide::crossLinkedXCorr(){
+  // Each peptide is scored with its partner and the linker on the link site,
+  // as XLinkScorer::scoreCandidate scores the halves of an XLinkPeptide.
+  Peptide peptide1(PEPTIDE1);
+  Peptide peptide2(PEPTIDE2);
+  FLOAT_T mass1 = peptide1.calcModifiedMass(MONO);
+  FLOAT_T mass2 = peptide2.calcModifiedMass(MONO);
+  checkXCorr(PEPTIDE1, mass2 + LINK_MASS);
+  checkXCorr(PEPTIDE2, mass1 + LINK_MASS);
+}
@@ -0,0 +1,38 @@
+#ifndef CPP_UNIT_TESTXLINKABLEPEPTIDE_H
+#define CPP_UNIT_TESTXLINKABLEPEPTIDE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include "model/Spectrum.h"
+
+/**
+ * Checks that XCorr scored from the fragment masses of an XLinkablePeptide
+ * (computeFragmentMasses and Scorer::scoreXCorrIons) is the XCorr scored
+ * from its IonSeries, for linear, dead-end and cross-linked peptides.
+ */
+class TestXLinkablePeptide : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( TestXLinkablePeptide );
+  CPPUNIT_TEST( linearXCorr );
+  CPPUNIT_TEST( deadEndXCorr );
+  CPPUNIT_TEST( crossLinkedXCorr );
+  CPPUNIT_TEST_SUITE_END();
+
+ protected:
+  Crux::Spectrum* spectrum_;
+
+ public:
+  void setUp();
+  void tearDown();
+
+ protected:
+  void linearXCorr();
+  void deadEndXCorr();
+  void crossLinkedXCorr();
+
+  // Scores sequence linked at each of its lysines, with mod_mass added to
+  // the ions that contain the link, by both paths at charges 1 to 3.
+  void checkXCorr(const std::string& sequence, FLOAT_T mod_mass);
+};
+
+#endif //CPP_UNIT_TESTXLINKABLEPEPTIDE_H
@@ -15,10 +15,47 @@ Examples:
   |test_name        |args                            |spectra  |fasta         |sites  |mass  |actual_output     |expected_output        |
   |xlink-db         |--parameter-file params/xlink.db|xlink.ms2|xlink.db.fasta|K:K    |222   |xlink_peptides.txt|xlink_peptides.txt     |
   |search-for-xlinks|--parameter-file params/xlink   |xlink.ms2|xlink.fasta   |E,D:K|-18.01|search-for-xlinks.target.txt|search-xlink.target.txt|
+  |search-for-xlinks-threads|--parameter-file params/xlink --num-threads 4|xlink.ms2|xlink.fasta   |E,D:K|-18.01|search-for-xlinks.target.txt|search-xlink.target.txt|
+  # search-for-xlinks.new.txt predates the file column.
   #|search-for-xlinks-new|--parameter-file params/xlink-new|xlink.ms2|xlink.fasta   |E,D:K|-18.01|search-for-xlinks.txt|search-for-xlinks.new.txt|
   |search-for-xlinks-cz-ions|--parameter-file params/xlink-cz|xlink.ms2|xlink.fasta   |E,D:K|-18.01|search-for-xlinks.target.txt|search-for-xlinks.cz.txt|
   #|search-for-xlinks-ribo|--parameter-file params/xlink-ribo|good3.mgf|good3.fasta|K,nterm:K,nterm|136.100049|search-for-xlinks.txt|search-for-xlinks.ribo.txt|
 
+Scenario Outline: User runs search-for-xlinks with one thread and with several
+  Given the path to Crux is ../../src/crux
+  And I want to run a test named <test_name>
+  And I pass the arguments <args> --num-threads 1 --output-dir <first_dir> <spectra> <fasta> <sites> <mass>
+  When I run search-for-xlinks as an intermediate step
+  Then the return value should be 0
+  And I pass the arguments <args> --num-threads 4 <spectra> <fasta> <sites> <mass>
+  When I run search-for-xlinks
+  Then the return value should be 0
+  And crux-output/<actual_output> should match <first_dir>/<actual_output>
+
+Examples:
+  |test_name                           |args                                                                          |spectra  |fasta      |sites|mass  |actual_output        |first_dir                          |
+  |search-for-xlinks-new-threads       |--parameter-file params/xlink-new                                             |xlink.ms2|xlink.fasta|E,D:K|-18.01|search-for-xlinks.txt|xlink-new-1thread-output           |
+  |search-for-xlinks-new-weibull-shared|--parameter-file params/xlink-new --compute-p-values T --weibull-bin-width 100|xlink.ms2|xlink.fasta|E,D:K|-18.01|search-for-xlinks.txt|xlink-weibull-shared-1thread-output|
+  |search-for-xlinks-new-weibull-failed|--parameter-file params/xlink-new --compute-p-values T --weibull-bin-width 100 --min-weibull-points 1 --precursor-window-weibull 0.5|xlink.ms2|xlink.fasta|E,D:K|-18.01|search-for-xlinks.txt|xlink-weibull-failed-1thread-output|
+
+# Sites that no peptide has do not change the results, but more than 32
+# sites do not fit in the link site masks, so the search falls back to
+# the bond map.
+Scenario Outline: User runs search-for-xlinks with a bond map too large for site masks
+  Given the path to Crux is ../../src/crux
+  And I want to run a test named <test_name>
+  And I pass the arguments <args> --output-dir <first_dir> <spectra> <fasta> <sites> <mass>
+  When I run search-for-xlinks as an intermediate step
+  Then the return value should be 0
+  And I pass the arguments <args> <spectra> <fasta> <many_sites> <mass>
+  When I run search-for-xlinks
+  Then the return value should be 0
+  And crux-output/<actual_output> should match <first_dir>/<actual_output>
+
+Examples:
+  |test_name                       |args                             |spectra  |fasta      |sites|many_sites|mass  |actual_output        |first_dir                |
+  |search-for-xlinks-new-many-sites|--parameter-file params/xlink-new|xlink.ms2|xlink.fasta|E,D:K|E,D,a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q,r,s,t,u,v,w,x,y,z,0,1,2,3,4,5,6,7,8,9:K|-18.01|search-for-xlinks.txt|xlink-new-few-sites-output|
+
 # The search-for-xlinks-ribo test consists of three cross-linked spectra 
 # with validated peptides from a ribosomal data set, provided by Jeff Howbert.
 # For details, see the 29 June 2016 and 7 July 2016 entries here:
@@ -42,3 +42,11 @@ Then /^(.*) should contain the same lines as (.*)$/ do | actual, expected |
   expect(@tester.cmpUnordered(expected, actual)).to be true
 end
 
+
+Then /^(.*) should contain a line matching \/(.*)\/$/ do | actual, pattern |
+  expect(@tester.anyLineMatches(actual, pattern)).to be true
+end
+
+Then /^(.*) should not contain a line matching \/(.*)\/$/ do | actual, pattern |
+  expect(@tester.anyLineMatches(actual, pattern)).to be false
+end
@@ -142,6 +142,18 @@ class CruxTester
     return same
   end
 
+  # Check whether any line of a file matches a pattern
+  def anyLineMatches(filename, pattern)
+    unless File.readable?(filename)
+      raise("cannot read file '" + filename + "'")
+    end
+    regexp = Regexp.new(pattern)
+    File.foreach(filename) do | line |
+      return true if regexp.match(line) != nil
+    end
+    return false
+  end
+
   def writeObserved(actual_content, expected_filename, same, write_observed)
     if write_observed == 1
       observed = expected_filename + ".observed"
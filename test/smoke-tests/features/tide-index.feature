@@ -21,4 +21,10 @@ Examples:
   |tide-mods      |--mods-spec 2M+15.9949,2STY+79.9663 --max-mods 2                            |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-index-mods1.target.txt|tide-index.peptides.decoy.txt|tide-index-mods1.decoy.txt|
   |tide-mods-alt  |--mods-spec 2M+15.9949,2STY+79.9663 --max-mods 2 --modsoutputter-threshold 1|small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-index-mods1.target.txt|tide-index.peptides.decoy.txt|tide-index-mods1.decoy.txt|
   |tide-multidecoy|--num-decoys-per-target 5                                                   |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-default.target.txt    |tide-index.peptides.decoy.txt|tide-index-multi.decoy.txt|
+  |tide-memlimit  |--memory-limit 1                                                            |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-default.target.txt    |tide-index.peptides.decoy.txt|tide-default.decoy.txt    |
+  |tide-memlimit-reverse|--memory-limit 1 --decoy-format PROTEIN-REVERSE                             |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-reverse.target.txt    |tide-index.peptides.decoy.txt|tide-reverse.decoy.txt    |
+  |tide-memlimit-mods|--memory-limit 1 --mods-spec 2M+15.9949,2STY+79.9663 --max-mods 2           |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-index-mods1.target.txt|tide-index.peptides.decoy.txt|tide-index-mods1.decoy.txt|
+  |tide-4thread   |--num-threads 4                                                             |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-default.target.txt    |tide-index.peptides.decoy.txt|tide-default.decoy.txt    |
+  |tide-4thread-reverse|--num-threads 4 --decoy-format PROTEIN-REVERSE                              |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-reverse.target.txt    |tide-index.peptides.decoy.txt|tide-reverse.decoy.txt    |
+  |tide-4thread-dups|--num-threads 4 --allow-dups T                                              |small-yeast.fasta|tide_test_index|tide-index.peptides.target.txt|tide-dups.target.txt       |tide-index.peptides.decoy.txt|tide-dups.decoy.txt       |
 
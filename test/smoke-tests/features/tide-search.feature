@@ -33,6 +33,15 @@ Examples:
   |tide-misscleave|--missed-cleavages 2                                         |                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-misscleave.txt|
   |tide-reverse   |--decoy-format peptide-reverse                               |                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-reverse.txt   |
   |tide-multidecoy|--num-decoys-per-target 5                                    |                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.decoy.txt |tide-5decoys.txt   |
+  |tide-table     |--peptide-table T                                            |                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-table-mods|--peptide-table T --mods-spec C+57.02146,2M+15.9949,1STY+79.966331|                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-mods1.txt     |
+  |tide-table-7thread|--peptide-table T                                            |--num-threads 7                                         |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-table-mzwin|--peptide-table T                                            |--precursor-window 5 --precursor-window-type mz         |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-mzwin.txt     |
+  |tide-fragidx  |--fragment-index T                                           |                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-fragidx-topn|--fragment-index T                                         |--fragment-index-top-n 1000000                          |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-index-4thread|--num-threads 4                                              |                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-partial-memlimit|--digestion partial-digest --memory-limit 1                |                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-partial.txt   |
+  |tide-index-4thread-mods|--num-threads 4 --mods-spec C+57.02146,2M+15.9949,1STY+79.966331|                                                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-mods1.txt     |
 
   # Tests that vary tide-search options
   |tide-masswin   |                                                             |--precursor-window 5 --precursor-window-type mass       |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-masswin.txt   |
@@ -50,6 +59,21 @@ Examples:
   |tide-exact-pval|                                                             |--exact-p-value T                                       |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-exact-pval.txt|
   |tide-1thread   |                                                             |--num-threads 1                                         |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
   |tide-7thread   |                                                             |--num-threads 7                                         |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-portable  |                                                             |--xcorr-scoring portable                               |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-portable-7thread|                                                       |--xcorr-scoring portable --num-threads 7                |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-portable-useflank|                                                      |--xcorr-scoring portable --use-flanking-peaks T         |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-useflank.txt  |
+  |tide-batch    |                                                             |--xcorr-scoring portable --spectrum-batch-size 8       |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-batch-7thread|                                                             |--xcorr-scoring portable --spectrum-batch-size 8 --num-threads 7|small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-batch-mzwin|                                                             |--xcorr-scoring portable --spectrum-batch-size 8 --precursor-window 5 --precursor-window-type mz|small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-mzwin.txt     |
+  |tide-batch-isoerr|                                                             |--xcorr-scoring portable --spectrum-batch-size 8 --isotope-error 1,2,3|small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-isoerr.txt    |
+  |tide-sparse   |                                                             |--xcorr-scoring sparse                                 |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-sparse-useflank|                                                        |--xcorr-scoring sparse --use-flanking-peaks T          |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-useflank.txt  |
+  |tide-sparse-usenl|                                                           |--xcorr-scoring sparse --use-neutral-loss-peaks T      |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-usenl.txt     |
+  |tide-mzbins-compiled|                                                        |--xcorr-scoring compiled --mz-bin-width 0.02 --mz-bin-offset 0.34|small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-mzbins.txt    |
+  |tide-cache    |                                                             |--spectrum-cache-dir tide_spectrum_cache               |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-cache-reuse|                                                             |--spectrum-cache-dir tide_spectrum_cache --num-threads 7|small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-deterministic|                                                         |--deterministic-output T --num-threads 7              |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-default.txt   |
+  |tide-deterministic-concat|                                                  |--deterministic-output T --num-threads 7 --concat T    |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.txt       |tide-concat.txt    |
   |tide-exact-pval-1thread|                                                     |--exact-p-value T --num-threads 1                       |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-exact-pval.txt|
   |tide-exact-pval-7thread|                                                     |--exact-p-value T --num-threads 7                       |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-exact-pval.txt|
   |tide-concat    |                                                             |--concat T                                              |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.txt       |tide-concat.txt    |
@@ -61,3 +85,43 @@ Examples:
   |tide-resEv-pval-7thread|                                                     |--score-function residue-evidence --exact-p-value T --num-threads 7 --use-neutral-loss-peaks F |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-resEv.txt   |
   |tide-deiso     |                                                             |--deisotope 10                                          |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-deiso.txt     |
   |tide-deiso-pval|                                                             |--deisotope 10 --exact-p-value t                        |small-yeast.fasta|tide_test_index|demo.ms2|tide-search.target.txt|tide-deiso-pval.txt|
+
+Scenario Outline: User runs tide-search twice with settings that must agree
+  Given the path to Crux is ../../src/crux
+  And I want to run a test named <test_name>
+  And I pass the arguments --overwrite T --seed 7 <index_args> <fasta> <index>
+  When I run tide-index as an intermediate step
+  Then the return value should be 0
+  And I pass the arguments --overwrite T --file-column F --output-dir <first_dir> <first_args> <spectra> <index>
+  When I run tide-search as an intermediate step
+  Then the return value should be 0
+  And I pass the arguments --overwrite T --file-column F <second_args> <spectra> <index>
+  When I run tide-search
+  Then the return value should be 0
+  And crux-output/tide-search.target.txt should contain the same lines as <first_dir>/tide-search.target.txt
+
+Examples:
+  |test_name            |index_args        |first_args                                        |second_args                                                               |fasta            |index          |spectra |first_dir             |
+  |tide-fragidx-top3    |--fragment-index T|--fragment-index-top-n 3 --num-threads 1          |--fragment-index-top-n 3 --num-threads 7                                  |small-yeast.fasta|tide_test_index|demo.ms2|tide-fragidx-top3-1thread|
+  |tide-fragidx-top3-sparse|--fragment-index T|--fragment-index-top-n 3 --num-threads 1       |--fragment-index-top-n 3 --xcorr-scoring sparse                            |small-yeast.fasta|tide_test_index|demo.ms2|tide-fragidx-top3-1thread|
+  |tide-pipeline        |                  |--spectrum-cache-dir tide_spectrum_cache          |--spectrum-cache-dir tide_spectrum_cache --pipeline-spectra T             |small-yeast.fasta|tide_test_index|demo.ms2 demo.ms2|tide-pipeline-serial|
+
+Scenario Outline: User reruns tide-search with a spectrum cache
+  Given the path to Crux is ../../src/crux
+  And I want to run a test named <test_name>
+  And I pass the arguments --overwrite T --seed 7 <fasta> <index>
+  When I run tide-index as an intermediate step
+  Then the return value should be 0
+  And I pass the arguments --overwrite T --file-column F <search_args> <spectra> <index>
+  When I run tide-search as an intermediate step
+  Then the return value should be 0
+  And I pass the arguments --overwrite T --file-column F <search_args> <spectra> <index>
+  When I run tide-search
+  Then the return value should be 0
+  And crux-output/tide-search.log.txt should contain a line matching /Using cached spectrumrecords/
+  And crux-output/tide-search.log.txt should not contain a line matching /Converting .* to spectrumrecords/
+  And crux-output/tide-search.target.txt should contain the same lines as good_results/<expected_output>
+
+Examples:
+  |test_name      |search_args                                             |fasta            |index          |spectra |expected_output    |
+  |tide-cache-hit |--spectrum-cache-dir tide_spectrum_cache_hit            |small-yeast.fasta|tide_test_index|demo.ms2|tide-default.txt   |
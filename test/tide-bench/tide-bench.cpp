@@ -0,0 +1,696 @@
+/**
+ * \file tide-bench.cpp
+ * \brief Benchmark of the tide-search hot paths on synthetic data.
+ *
+ * tide-bench writes a FASTA file of random proteins and an MS2 file of
+ * spectra simulated from their tryptic peptides, both from a fixed seed,
+ * indexes the proteins with tide-index, and then runs the stages of
+ * tide-search over the spectra, timing each one separately:
+ *
+ *   preprocess  ObservedPeakSet::PreprocessSpectrum
+ *   window      ActivePeptideQueue::SetActiveRange
+ *   score       TideSearchApplication::collectScoresCompiled (or the
+ *               portable or sparse scorer, as xcorr-scoring selects)
+ *   pvalue      TideSearchApplication::calcScoreCount
+ *   report      TideMatchSet::report
+ *
+ * For each stage it prints the number of calls, the items processed
+ * (spectra, candidate peptides or PSMs), the time taken, the throughput and
+ * the number of heap allocations per call, and writes the same table to
+ * tide-bench.txt in the output directory. Nothing is downloaded, so the
+ * benchmark can run offline in CI. Timings are comparable only between
+ * builds run on the same machine; allocation counts are comparable anywhere.
+ *
+ * With --arena 0 the temporaries of each spectrum-charge are allocated the
+ * way they were before tide-search kept them in a per-thread arena: the
+ * match arrays on the heap and the precursor window vectors afresh, so the
+ * allocation counts of the two can be compared.
+ *
+ * Usage:
+ *   tide-bench [--proteins <n>] [--spectra <n>] [--repeat <n>] [--arena 0|1]
+ *              [options]
+ *
+ * where the options are the tide-search options listed by getOptions().
+ * The default workload is 2000 proteins and 2000 spectra, searched 3 times.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <iomanip>
+#include <new>
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include "app/TideSearchApplication.h"
+#include "app/TideIndexApplication.h"
+#include "app/TideResultWriter.h"
+#include "app/tide/records_to_vector-inl.h"
+#include "app/tide/fifo_alloc.h"
+#include "app/tide/mass_constants.h"
+#include "app/tide/score_count_matrix.h"
+#include "io/carp.h"
+#include "io/SpectrumRecordWriter.h"
+#include "model/Modification.h"
+#include "parameter.h"
+#include "util/crux-utils.h"
+#include "util/FileUtils.h"
+#include "util/Params.h"
+#include "util/StringUtils.h"
+
+using namespace std;
+
+/* Every heap allocation made by the process is counted, so that a stage's
+ * allocations are the change in the count across it.
+ */
+static long numAllocations = 0;
+
+#if __cplusplus >= 201103L
+#define BENCH_THROW_BAD_ALLOC
+#define BENCH_NOTHROW noexcept
+#else
+#define BENCH_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define BENCH_NOTHROW throw()
+#endif
+
+void* operator new(size_t size) BENCH_THROW_BAD_ALLOC {
+  ++numAllocations;
+  void* p = malloc(size > 0 ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) BENCH_THROW_BAD_ALLOC {
+  return operator new(size);
+}
+
+void operator delete(void* p) BENCH_NOTHROW {
+  free(p);
+}
+
+void operator delete[](void* p) BENCH_NOTHROW {
+  free(p);
+}
+
+/* Page size of the arena for the temporary arrays of one spectrum-charge,
+ * as in TideSearchApplication.
+ */
+static const size_t SPECTRUM_ARENA_PAGE_SIZE = 1 << 20;
+
+static const double PROTON = 1.00727646688;
+static const double WATER = 18.010565;
+
+/* A 64-bit linear congruential generator, so that the synthetic data are the
+ * same on every platform for a given seed.
+ */
+class BenchRandom {
+ public:
+  explicit BenchRandom(uint64_t seed) : state_(seed) {}
+
+  // Uniform in [0, n)
+  int Next(int n) {
+    state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (int)((state_ >> 33) % (uint64_t)n);
+  }
+
+  // Uniform in [0, 1)
+  double NextDouble() {
+    return Next(1 << 30) / (double)(1 << 30);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+/* Cumulative cost of one stage of the search.
+ */
+struct BenchStage {
+  const char* name;
+  const char* item; // what items counts
+  long calls;
+  long items;
+  long allocations;
+  double seconds;
+  explicit BenchStage(const char* name_, const char* item_)
+    : name(name_), item(item_), calls(0), items(0), allocations(0), seconds(0.0) {}
+};
+
+/* Charges the time and allocations from its construction to its destruction
+ * to a stage, as one call.
+ */
+class BenchTimer {
+ public:
+  explicit BenchTimer(BenchStage* stage)
+    : stage_(stage), allocations_(numAllocations),
+      start_(boost::chrono::steady_clock::now()) {}
+  ~BenchTimer() {
+    boost::chrono::duration<double> elapsed =
+      boost::chrono::steady_clock::now() - start_;
+    stage_->seconds += elapsed.count();
+    stage_->allocations += numAllocations - allocations_;
+    ++stage_->calls;
+  }
+
+ private:
+  BenchStage* stage_;
+  long allocations_;
+  boost::chrono::steady_clock::time_point start_;
+};
+
+class TideBench : public TideSearchApplication {
+ public:
+  TideBench(int num_proteins, int num_spectra, int repeat, bool use_arena)
+    : num_proteins_(num_proteins), num_spectra_(num_spectra), repeat_(repeat),
+      use_arena_(use_arena) {}
+
+  virtual int main(int argc, char** argv);
+  virtual string getName() const { return "tide-bench"; }
+  virtual string getDescription() const {
+    return "Benchmark the stages of tide-search on synthetic data.";
+  }
+  virtual vector<string> getArgs() const { return vector<string>(); }
+  virtual vector<string> getOptions() const;
+  virtual bool needsOutputDirectory() const { return true; }
+  virtual bool hidden() const { return true; }
+  virtual void processParams();
+
+ private:
+  void writeProteins(BenchRandom* random, vector<string>* proteins) const;
+  void writeSpectra(BenchRandom* random, const vector<string>& proteins) const;
+  void searchOnce(const string& index, SpectrumCollection* spectra,
+                  const ProteinVec& proteins,
+                  const vector<const pb::AuxLocation*>& locations,
+                  int decoys_per_target, ofstream* target_file,
+                  ofstream* decoy_file, vector<BenchStage>* stages);
+  void countScoresOnce(SpectrumCollection* spectra, int nAA, double* aaFreqN,
+                       double* aaFreqI, double* aaFreqC, int* aaMass,
+                       BenchStage* stage);
+  void writeReport(const vector<BenchStage>& stages, ostream* out) const;
+
+  int num_proteins_;
+  int num_spectra_;
+  int repeat_;
+  bool use_arena_;
+  string index_;
+  string spectra_file_;
+};
+
+enum { STAGE_PREPROCESS, STAGE_WINDOW, STAGE_SCORE, STAGE_PVALUE, STAGE_REPORT };
+
+vector<string> TideBench::getOptions() const {
+  string arr[] = {
+    "compute-sp",
+    "max-precursor-charge",
+    "mz-bin-offset",
+    "mz-bin-width",
+    "output-dir",
+    "overwrite",
+    "parameter-file",
+    "precursor-window",
+    "precursor-window-type",
+    "seed",
+    "top-match",
+    "use-flanking-peaks",
+    "use-neutral-loss-peaks",
+    "verbosity",
+    "xcorr-scoring"
+  };
+  return vector<string>(arr, arr + sizeof(arr) / sizeof(string));
+}
+
+/**
+ * Generates the synthetic data and indexes it, as tide-search indexes a
+ * FASTA file given in place of an index.
+ */
+void TideBench::processParams() {
+  Params::Set("no-analytics", true);
+  Params::Set("overwrite", true);
+
+  string seed = Params::GetString("seed");
+  BenchRandom random(seed == "time" ? (uint64_t)time(NULL) :
+                     (uint64_t)StringUtils::FromString<unsigned>(seed));
+  vector<string> proteins;
+  writeProteins(&random, &proteins);
+  writeSpectra(&random, proteins);
+
+  index_ = make_file_path("tide-bench.index");
+  TideIndexApplication indexApp;
+  // processParams() is protected in TideIndexApplication, public in the base
+  static_cast<CruxApplication&>(indexApp).processParams();
+  if (indexApp.main(make_file_path("tide-bench.fasta"), index_) != 0) {
+    carp(CARP_FATAL, "tide-index failed.");
+  }
+  spectra_file_ = make_file_path("tide-bench.spectrumrecords");
+  if (!SpectrumRecordWriter::convert(make_file_path("tide-bench.ms2"), spectra_file_)) {
+    carp(CARP_FATAL, "Error converting tide-bench.ms2 to spectrumrecords format");
+  }
+}
+
+/**
+ * Writes num_proteins_ random proteins of 100 to 800 residues, with roughly
+ * natural amino acid frequencies.
+ */
+void TideBench::writeProteins(BenchRandom* random, vector<string>* proteins) const {
+  const char* freqs[] = {
+    "AAAAAAAAA", "C", "DDDDD", "EEEEEEE", "FFFF", "GGGGGGG", "HH", "IIIIII",
+    "KKKKKK", "LLLLLLLLL", "MM", "NNNN", "PPPPP", "QQQQ", "RRRRR", "SSSSSSS",
+    "TTTTT", "VVVVVVV", "W", "YYY"
+  };
+  string residues;
+  for (size_t i = 0; i < sizeof(freqs) / sizeof(freqs[0]); i++) {
+    residues += freqs[i];
+  }
+
+  ofstream* file = FileUtils::GetWriteStream(make_file_path("tide-bench.fasta"), true);
+  if (file == NULL) {
+    carp(CARP_FATAL, "Could not open tide-bench.fasta for writing");
+  }
+  for (int i = 0; i < num_proteins_; i++) {
+    int length = 100 + random->Next(701);
+    string protein(length, 'A');
+    for (int j = 0; j < length; j++) {
+      protein[j] = residues[random->Next(residues.length())];
+    }
+    *file << ">bench_" << i << endl;
+    for (int j = 0; j < length; j += 60) {
+      *file << protein.substr(j, 60) << endl;
+    }
+    proteins->push_back(protein);
+  }
+  delete file;
+}
+
+/**
+ * Writes num_spectra_ spectra, each of a random tryptic peptide of the
+ * proteins at charge 2 or 3: most of its singly charged b and y ions plus
+ * random noise peaks.
+ */
+void TideBench::writeSpectra(BenchRandom* random, const vector<string>& proteins) const {
+  double mass_table[256];
+  fill(mass_table, mass_table + 256, 0.0);
+  const char aa[] = "ACDEFGHIKLMNPQRSTVWY";
+  const double aa_mass[] = {
+    71.03711, 103.00919 + 57.02146, 115.02694, 129.04259, 147.06841,
+    57.02146, 137.05891, 113.08406, 128.09496, 113.08406, 131.04049,
+    114.04293, 97.05276, 128.05858, 156.10111, 87.03203, 101.04768,
+    99.06841, 186.07931, 163.06333
+  };
+  for (int i = 0; i < 20; i++) {
+    mass_table[(unsigned char)aa[i]] = aa_mass[i];
+  }
+
+  ofstream* file = FileUtils::GetWriteStream(make_file_path("tide-bench.ms2"), true);
+  if (file == NULL) {
+    carp(CARP_FATAL, "Could not open tide-bench.ms2 for writing");
+  }
+  *file << "H\tExtractor\ttide-bench" << endl;
+  *file << fixed;
+  vector<pair<double, double> > peaks;
+  for (int scan = 1; scan <= num_spectra_; ) {
+    // Cut the protein after K or R, and take a peptide of 7 to 30 residues.
+    const string& protein = proteins[random->Next(proteins.size())];
+    vector<size_t> sites(1, 0);
+    for (size_t i = 0; i + 1 < protein.length(); i++) {
+      if ((protein[i] == 'K' || protein[i] == 'R') && protein[i + 1] != 'P') {
+        sites.push_back(i + 1);
+      }
+    }
+    sites.push_back(protein.length());
+    size_t site = random->Next(sites.size() - 1);
+    size_t begin = sites[site];
+    size_t end = sites[site + 1];
+    if (end - begin < 7 || end - begin > 30) {
+      continue;
+    }
+    string peptide = protein.substr(begin, end - begin);
+
+    double mass = WATER;
+    for (size_t i = 0; i < peptide.length(); i++) {
+      mass += mass_table[(unsigned char)peptide[i]];
+    }
+    int charge = 2 + random->Next(2);
+
+    peaks.clear();
+    double prefix = 0.0;
+    for (size_t i = 0; i + 1 < peptide.length(); i++) {
+      prefix += mass_table[(unsigned char)peptide[i]];
+      if (random->NextDouble() < 0.8) {
+        peaks.push_back(make_pair(prefix + PROTON, 1000.0 + 9000.0 * random->NextDouble()));
+      }
+      if (random->NextDouble() < 0.8) {
+        peaks.push_back(make_pair(mass - prefix + PROTON, 1000.0 + 9000.0 * random->NextDouble()));
+      }
+    }
+    for (int i = 0; i < 60; i++) {
+      peaks.push_back(make_pair(100.0 + (mass - 50.0) * random->NextDouble(),
+                                100.0 + 1900.0 * random->NextDouble()));
+    }
+    sort(peaks.begin(), peaks.end());
+
+    *file << "S\t" << scan << '\t' << scan << '\t' << setprecision(5)
+          << (mass + charge * PROTON) / charge << endl
+          << "Z\t" << charge << '\t' << mass + PROTON << endl;
+    for (size_t i = 0; i < peaks.size(); i++) {
+      *file << setprecision(4) << peaks[i].first << ' '
+            << setprecision(1) << peaks[i].second << endl;
+    }
+    scan++;
+  }
+  delete file;
+}
+
+int TideBench::main(int argc, char** argv) {
+  bin_width_ = Params::GetDouble("mz-bin-width");
+  bin_offset_ = Params::GetDouble("mz-bin-offset");
+
+  ProteinVec proteins;
+  pb::Header protein_header;
+  string proteins_file = FileUtils::Join(index_, "protix");
+  if (!ReadRecordsToVector<pb::Protein, const pb::Protein>(&proteins,
+      proteins_file, &protein_header)) {
+    carp(CARP_FATAL, "Error reading index (%s)", proteins_file.c_str());
+  }
+  vector<const pb::AuxLocation*> locations;
+  string auxlocs_file = FileUtils::Join(index_, "auxlocs");
+  if (!ReadRecordsToVector<pb::AuxLocation>(&locations, auxlocs_file)) {
+    carp(CARP_FATAL, "Error reading index (%s)", auxlocs_file.c_str());
+  }
+
+  string peptides_file = FileUtils::Join(index_, "pepix");
+  pb::Header peptides_header;
+  HeadedRecordReader peptide_reader(peptides_file, &peptides_header);
+  if (peptides_header.file_type() != pb::Header::PEPTIDES ||
+      !peptides_header.has_peptides_header()) {
+    carp(CARP_FATAL, "Error reading index (%s)", peptides_file.c_str());
+  }
+  const pb::Header::PeptidesHeader& pepHeader = peptides_header.peptides_header();
+  int decoysPerTarget = pepHeader.has_decoys_per_target() ? pepHeader.decoys_per_target() : 0;
+  HAS_DECOYS = (DECOY_TYPE_T)pepHeader.decoys() != NO_DECOYS;
+  MassConstants::Init(&pepHeader.mods(), &pepHeader.nterm_mods(),
+                      &pepHeader.cterm_mods(), bin_width_, bin_offset_);
+  ModificationDefinition::ClearAll();
+  TideMatchSet::initModMap(pepHeader.mods(), ANY);
+  TideMatchSet::initModMap(pepHeader.nterm_mods(), PEPTIDE_N);
+  TideMatchSet::initModMap(pepHeader.cterm_mods(), PEPTIDE_C);
+  TideMatchSet::CleavageType = Params::GetString("enzyme") + '-' + Params::GetString("digestion");
+
+  // Amino acid frequencies for the exact p-value stage
+  double* aaFreqN = NULL;
+  double* aaFreqI = NULL;
+  double* aaFreqC = NULL;
+  int* aaMass = NULL;
+  int nAA = 0;
+  bool count_scores = Params::IsDefault("mz-bin-width");
+  if (count_scores) {
+    ActivePeptideQueue queue(peptide_reader.Reader(), proteins);
+    nAA = queue.CountAAFrequency(bin_width_, bin_offset_, &aaFreqN, &aaFreqI, &aaFreqC, &aaMass);
+  } else {
+    carp(CARP_INFO, "Skipping the pvalue stage, which requires the default mz-bin-width.");
+  }
+
+  SpectrumCollection* spectra = loadSpectra(spectra_file_);
+  carp(CARP_INFO, "Read %d spectra.", spectra->Size());
+
+  ofstream* target_file = create_stream_in_path(
+    make_file_path("tide-bench.target.txt").c_str(), NULL, true);
+  ofstream* decoy_file = HAS_DECOYS ? create_stream_in_path(
+    make_file_path("tide-bench.decoy.txt").c_str(), NULL, true) : NULL;
+  bool compute_sp = Params::GetBool("compute-sp");
+  TideMatchSet::writeHeaders(target_file, false, decoysPerTarget > 1, compute_sp);
+  TideMatchSet::writeHeaders(decoy_file, true, decoysPerTarget > 1, compute_sp);
+
+  vector<BenchStage> stages;
+  stages.push_back(BenchStage("preprocess", "spectra"));
+  stages.push_back(BenchStage("window", "candidates"));
+  stages.push_back(BenchStage("score", "candidates"));
+  stages.push_back(BenchStage("pvalue", "spectra"));
+  stages.push_back(BenchStage("report", "spectra"));
+  for (int i = 0; i < repeat_; i++) {
+    carp(CARP_INFO, "Search %d of %d.", i + 1, repeat_);
+    searchOnce(index_, spectra, proteins, locations, decoysPerTarget,
+               target_file, decoy_file, &stages);
+    if (count_scores) {
+      countScoresOnce(spectra, nAA, aaFreqN, aaFreqI, aaFreqC, aaMass,
+                      &stages[STAGE_PVALUE]);
+    }
+  }
+
+  writeReport(stages, &cout);
+  ofstream* report = FileUtils::GetWriteStream(make_file_path("tide-bench.txt"), true);
+  if (report != NULL) {
+    writeReport(stages, report);
+    delete report;
+  }
+
+  delete target_file;
+  delete decoy_file;
+  delete spectra;
+  delete[] aaFreqN;
+  delete[] aaFreqI;
+  delete[] aaFreqC;
+  delete[] aaMass;
+  for (ProteinVec::iterator i = proteins.begin(); i != proteins.end(); ++i) {
+    delete *i;
+  }
+  return 0;
+}
+
+/**
+ * Searches every spectrum-charge once, as a single search thread would in
+ * the XCorr search without p-values.
+ */
+void TideBench::searchOnce(
+  const string& index,
+  SpectrumCollection* spectra,
+  const ProteinVec& proteins,
+  const vector<const pb::AuxLocation*>& locations,
+  int decoys_per_target,
+  ofstream* target_file,
+  ofstream* decoy_file,
+  vector<BenchStage>* stages
+) {
+  SearchConfig config;
+  double highest_mz = spectra->FindHighestMZ();
+  MaxBin::SetGlobalMax(highest_mz);
+  int top_matches = Params::GetInt("top-match");
+  bool compute_sp = Params::GetBool("compute-sp");
+  int max_charge = Params::GetInt("max-precursor-charge");
+  double precursor_window = Params::GetDouble("precursor-window");
+  WINDOW_TYPE_T window_type = string_to_window_type(Params::GetString("precursor-window-type"));
+  vector<int> negative_isotope_errors = getNegativeIsotopeErrors();
+
+  pb::Header peptides_header;
+  HeadedRecordReader peptide_reader(FileUtils::Join(index, "pepix"), &peptides_header);
+  ActivePeptideQueue queue(peptide_reader.Reader(), proteins);
+  queue.SetBinSize(bin_width_, bin_offset_);
+  queue.SetOutputs(NULL, &locations, top_matches, compute_sp, target_file, decoy_file,
+                   highest_mz, &config);
+  boost::mutex lock;
+  TideResultWriter writer(target_file, decoy_file, &lock, "");
+  SpScorer* sp_scorer = compute_sp ? new SpScorer(proteins, highest_mz) : NULL;
+
+  ObservedPeakSet observed(bin_width_, bin_offset_, config.use_neutral_loss_peaks,
+                           config.use_flanking_peaks, &config);
+  FifoAllocator arena(SPECTRUM_ARENA_PAGE_SIZE);
+  FifoAllocator* arrays = use_arena_ ? &arena : NULL;
+  vector<double> min_mass;
+  vector<double> max_mass;
+  vector<bool> candidates;
+  long num_range_skipped = 0;
+  long num_precursors_skipped = 0;
+  long num_isotopes_skipped = 0;
+  long num_retained = 0;
+
+  const vector<SpectrumCollection::SpecCharge>* spec_charges = spectra->SpecCharges();
+  for (size_t i = 0; i < spec_charges->size(); i++) {
+    const SpectrumCollection::SpecCharge& sc = (*spec_charges)[i];
+    const Spectrum* spectrum = sc.spectrum;
+    int charge = sc.charge;
+    arena.ReleaseAll();
+    {
+      BenchTimer timer(&(*stages)[STAGE_PREPROCESS]);
+      observed.PreprocessSpectrum(*spectrum, charge, &num_range_skipped,
+                                  &num_precursors_skipped, &num_isotopes_skipped,
+                                  &num_retained);
+    }
+    (*stages)[STAGE_PREPROCESS].items++;
+
+    int num_candidates;
+    {
+      BenchTimer timer(&(*stages)[STAGE_WINDOW]);
+      if (use_arena_) {
+        min_mass.clear();
+        max_mass.clear();
+        candidates.clear();
+      } else {
+        vector<double>().swap(min_mass);
+        vector<double>().swap(max_mass);
+        vector<bool>().swap(candidates);
+      }
+      double min_range, max_range;
+      computeWindow(sc, window_type, precursor_window, max_charge,
+                    &negative_isotope_errors, &min_mass, &max_mass,
+                    &min_range, &max_range);
+      num_candidates = queue.SetActiveRange(&min_mass, &max_mass, min_range,
+                                            max_range, &candidates);
+    }
+    (*stages)[STAGE_WINDOW].items += num_candidates;
+    if (num_candidates == 0) {
+      continue;
+    }
+
+    int queue_size = candidates.size();
+    TideMatchSet::Arr2 match_arr2;
+    {
+      BenchTimer timer(&(*stages)[STAGE_SCORE]);
+      match_arr2.Init(arrays, queue_size);
+      if (config.xcorr_scoring == SearchConfig::XCORR_SPARSE) {
+        collectScoresSparse(&queue, observed, &match_arr2, queue_size, charge);
+      } else if (config.xcorr_scoring == SearchConfig::XCORR_PORTABLE) {
+        collectScoresPortable(&queue, observed, &match_arr2, queue_size, charge);
+      } else {
+        collectScoresCompiled(&queue, spectrum, observed, &match_arr2, queue_size, charge);
+      }
+    }
+    (*stages)[STAGE_SCORE].items += num_candidates;
+
+    {
+      BenchTimer timer(&(*stages)[STAGE_REPORT]);
+      TideMatchSet::Arr match_arr;
+      match_arr.Init(arrays, num_candidates);
+      for (TideMatchSet::Arr2::iterator it = match_arr2.begin(); it != match_arr2.end(); ++it) {
+        if (candidates[queue_size - it->second]) {
+          TideMatchSet::Scores score;
+          score.xcorr_score = (double)(it->first / XCORR_SCALING);
+          score.rank = it->second;
+          match_arr.push_back(score);
+        }
+      }
+      TideMatchSet matches(&match_arr, highest_mz, &config);
+      matches.exact_pval_search_ = false;
+      matches.cur_score_function_ = XCORR_SCORE;
+      matches.sp_scorer_ = sp_scorer;
+      matches.report(&writer, top_matches, decoys_per_target, spectra_file_,
+                     spectrum, charge, &queue, proteins, locations, compute_sp, true);
+      writer.EndSpectrum(i);
+    }
+    (*stages)[STAGE_REPORT].items++;
+  }
+  writer.Flush();
+  delete sp_scorer;
+}
+
+/**
+ * Computes the XCorr score counts for every spectrum-charge once, at the mass
+ * bin of its precursor, as the exact p-value search does for each mass bin
+ * of its candidates.
+ */
+void TideBench::countScoresOnce(
+  SpectrumCollection* spectra,
+  int nAA,
+  double* aaFreqN,
+  double* aaFreqI,
+  double* aaFreqC,
+  int* aaMass,
+  BenchStage* stage
+) {
+  const vector<SpectrumCollection::SpecCharge>* spec_charges = spectra->SpecCharges();
+  if (spec_charges->empty()) {
+    return;
+  }
+  SearchConfig config;
+  MaxBin::SetGlobalMax(spec_charges->back().neutral_mass);
+  int maxPrecurMassBin = floor(MaxBin::Global().CacheBinEnd() + 50.0);
+  ScoreCountMatrix scoreCountMatrix;
+  vector<double> pValueScoreObs;
+
+  for (size_t i = 0; i < spec_charges->size(); i++) {
+    const SpectrumCollection::SpecCharge& sc = (*spec_charges)[i];
+    int pepMaInt = MassConstants::mass2bin(sc.neutral_mass);
+    double pepMassMonoMean = (pepMaInt - 0.5 + bin_offset_) * bin_width_;
+    vector<int> evidenceObs = sc.spectrum->CreateEvidenceVectorDiscretized(
+      bin_width_, bin_offset_, sc.charge, pepMassMonoMean, maxPrecurMassBin,
+      NULL, NULL, NULL, NULL, &config);
+
+    int maxEvidence = *max_element(evidenceObs.begin(), evidenceObs.end());
+    int minEvidence = *min_element(evidenceObs.begin(), evidenceObs.end());
+    int maxNResidue = (int)floor((double)pepMaInt / (double)aaMass[0]);
+    vector<int> sortEvidenceObs(evidenceObs);
+    sort(sortEvidenceObs.begin(), sortEvidenceObs.end(), greater<int>());
+    int maxScore = 0;
+    int minScore = 0;
+    for (int j = 0; j < maxNResidue; j++) {
+      maxScore += sortEvidenceObs[j];
+    }
+    for (int j = maxPrecurMassBin - maxNResidue; j < maxPrecurMassBin; j++) {
+      minScore += sortEvidenceObs[j];
+    }
+    int nRowDynProg = (maxEvidence + 1) - minScore + 1 + maxScore - minEvidence;
+    pValueScoreObs.resize(nRowDynProg);
+
+    BenchTimer timer(stage);
+    calcScoreCount(maxPrecurMassBin, &evidenceObs[0], pepMaInt, maxEvidence,
+                   minEvidence, maxScore, minScore, nAA, aaFreqN, aaFreqI,
+                   aaFreqC, aaMass, &pValueScoreObs[0], &scoreCountMatrix);
+    stage->items++;
+  }
+}
+
+void TideBench::writeReport(const vector<BenchStage>& stages, ostream* out) const {
+  *out << "stage\tcalls\titems\titem\tseconds\titems/s\tallocations/call" << endl;
+  for (vector<BenchStage>::const_iterator i = stages.begin(); i != stages.end(); ++i) {
+    *out << i->name << '\t' << i->calls << '\t' << i->items << '\t' << i->item << '\t'
+         << fixed << setprecision(4) << i->seconds << '\t'
+         << setprecision(0) << (i->seconds > 0 ? i->items / i->seconds : 0.0) << '\t'
+         << setprecision(2) << (i->calls > 0 ? (double)i->allocations / i->calls : 0.0)
+         << endl;
+  }
+}
+
+/**
+ * Removes "--<name> <value>" from the command line, returning the value as an
+ * integer of at least min_value, or default_value if the option is not given.
+ */
+static int takeOption(int* argc, char** argv, const string& name, int default_value,
+                      int min_value = 1) {
+  for (int i = 1; i + 1 < *argc; i++) {
+    if (argv[i] == "--" + name) {
+      int value = atoi(argv[i + 1]);
+      if (value < min_value) {
+        carp(CARP_FATAL, "--%s must be an integer of at least %d.", name.c_str(), min_value);
+      }
+      for (int j = i + 2; j < *argc; j++) {
+        argv[j - 2] = argv[j];
+      }
+      *argc -= 2;
+      return value;
+    }
+  }
+  return default_value;
+}
+
+int main(int argc, char** argv) {
+  try {
+    int num_proteins = takeOption(&argc, argv, "proteins", 2000);
+    int num_spectra = takeOption(&argc, argv, "spectra", 2000);
+    int repeat = takeOption(&argc, argv, "repeat", 3);
+    bool use_arena = takeOption(&argc, argv, "arena", 1, 0) != 0;
+    TideBench bench(num_proteins, num_spectra, repeat, use_arena);
+    // Arguments as CruxApplicationList passes them, starting at the command
+    // name and with the program name before it.
+    vector<char*> args(argv, argv + argc);
+    args.insert(args.begin() + 1, argv[0]);
+    args.push_back(NULL);
+    bench.initialize(argc, &args[1]);
+    int ret = bench.main(argc, &args[1]);
+    google::protobuf::ShutdownProtobufLibrary();
+    return ret;
+  } catch (const std::exception& e) {
+    carp(CARP_FATAL, "An exception occurred: %s", e.what());
+  } catch (...) {
+    carp(CARP_FATAL, "An unknown exception occurred.");
+  }
+}